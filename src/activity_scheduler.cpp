@@ -0,0 +1,112 @@
+#include "activity_scheduler.h"
+
+#include "hash.h"
+
+ActivityScheduler::ActivityScheduler(const ActivitySchedulerConfig& config)
+    : config_(config) {
+  if (!(config_.min_interval > 0)) {
+    config_.min_interval = 1;
+  }
+  if (config_.max_interval < config_.min_interval) {
+    config_.max_interval = config_.min_interval;
+  }
+}
+
+void ActivityScheduler::Resize(size_t count, double now) {
+  const size_t old = displays_.size();
+  displays_.resize(count);
+  for (size_t i = old; i < count; ++i) {
+    displays_[i].interval = config_.min_interval;
+    displays_[i].next_capture = now;
+  }
+}
+
+bool ActivityScheduler::CaptureDue(size_t display, double now) const {
+  return display < displays_.size() &&
+         now >= displays_[display].next_capture;
+}
+
+void ActivityScheduler::Shrink(Display* display) const {
+  const double interval = display->interval * config_.shrink;
+  display->interval =
+      interval > config_.min_interval ? interval : config_.min_interval;
+}
+
+bool ActivityScheduler::Probe(size_t display, uint64_t probe_hash) {
+  if (display >= displays_.size()) {
+    return false;
+  }
+  Display& d = displays_[display];
+  const bool changed = d.probed && probe_hash != d.probe_hash;
+  d.probed = true;
+  d.probe_hash = probe_hash;
+  if (!changed) {
+    return false;
+  }
+  // Обоснование: выборка пикселей грубая — одно изменение сокращает
+  // интервал вдвое, а не сразу до минимума; продолжающаяся активность
+  // за несколько проб доводит его до минимума.
+  d.active = true;
+  Shrink(&d);
+  if (d.captured && d.last_capture + d.interval < d.next_capture) {
+    d.next_capture = d.last_capture + d.interval;
+  }
+  return true;
+}
+
+void ActivityScheduler::Captured(size_t display, double now, bool changed) {
+  if (display >= displays_.size()) {
+    return;
+  }
+  Display& d = displays_[display];
+  // Активность, уже учтенная пробой, интервал второй раз не сокращает.
+  if (changed && !d.active) {
+    Shrink(&d);
+  } else if (!changed && !d.active) {
+    const double interval = d.interval * config_.grow;
+    d.interval =
+        interval < config_.max_interval ? interval : config_.max_interval;
+  }
+  d.active = false;
+  d.captured = true;
+  d.last_capture = now;
+  d.next_capture = now + d.interval;
+}
+
+double ActivityScheduler::Interval(size_t display) const {
+  return display < displays_.size() ? displays_[display].interval : 0;
+}
+
+double ActivityScheduler::NextCapture(size_t display) const {
+  return display < displays_.size() ? displays_[display].next_capture : 0;
+}
+
+double ActivityScheduler::NextDue(double now) const {
+  if (displays_.empty()) {
+    return now;
+  }
+  double due = displays_[0].next_capture;
+  for (const Display& d : displays_) {
+    due = d.next_capture < due ? d.next_capture : due;
+  }
+  return due;
+}
+
+uint64_t SparseProbeHash(const ImageBuffer& frame, uint32_t columns,
+                         uint32_t rows) {
+  uint64_t hash = Hash64(&frame.width, sizeof(frame.width),
+                         static_cast<uint64_t>(frame.height));
+  if (frame.width == 0 || frame.height == 0 || columns == 0 || rows == 0) {
+    return hash;
+  }
+  const size_t bpp = BytesPerPixel(frame.pixel_format);
+  for (uint32_t r = 0; r < rows; ++r) {
+    const uint64_t y = (2ull * r + 1) * frame.height / (2ull * rows);
+    const uint8_t* row = frame.pixels.data() + y * frame.stride;
+    for (uint32_t c = 0; c < columns; ++c) {
+      const uint64_t x = (2ull * c + 1) * frame.width / (2ull * columns);
+      hash = Hash64(row + x * bpp, bpp, hash);
+    }
+  }
+  return hash;
+}
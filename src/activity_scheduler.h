@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image_buffer.h"
+
+// Per-display capture intervals between a minimum and a maximum
+// (--adaptive-interval). Between captures every display is probed cheaply
+// (a hash of a sparse pixel sample). Activity — a changed probe or a
+// captured frame that differs from the previous one — shortens the
+// interval of that display; a capture with no activity since the previous
+// capture lengthens it. Times are seconds on any monotonic clock.
+
+struct ActivitySchedulerConfig {
+  double min_interval = 1;
+  double max_interval = 60;
+  // Interval multipliers after activity (< 1) and after an idle capture
+  // (> 1).
+  double shrink = 0.5;
+  double grow = 1.5;
+};
+
+class ActivityScheduler {
+ public:
+  explicit ActivityScheduler(const ActivitySchedulerConfig& config);
+
+  // Tracks displays 0..count-1: new ones start at the minimum interval and
+  // are due at now, kept ones keep their state.
+  void Resize(size_t count, double now);
+  size_t Displays() const { return displays_.size(); }
+
+  bool CaptureDue(size_t display, double now) const;
+  // Latest probe of display. Output: true when probe_hash differs from
+  // the previous probe; the interval then shrinks and the next capture
+  // moves up accordingly (never closer than the minimum interval to the
+  // last capture).
+  bool Probe(size_t display, uint64_t probe_hash);
+  // A capture of display finished at now; changed: the frame differs from
+  // the previous capture.
+  void Captured(size_t display, double now, bool changed);
+
+  double Interval(size_t display) const;
+  double NextCapture(size_t display) const;
+  // Earliest NextCapture of all displays (now when there are none).
+  double NextDue(double now) const;
+
+ private:
+  struct Display {
+    double interval = 0;
+    double last_capture = 0;
+    double next_capture = 0;
+    bool captured = false;
+    bool probed = false;
+    uint64_t probe_hash = 0;
+    // A probe changed since the last capture.
+    bool active = false;
+  };
+
+  void Shrink(Display* display) const;
+
+  ActivitySchedulerConfig config_;
+  std::vector<Display> displays_;
+};
+
+// Hash of a columns x rows grid of pixels sampled at the cell centers of
+// frame (a probe between captures; grid cells larger than a change can
+// miss it).
+uint64_t SparseProbeHash(const ImageBuffer& frame, uint32_t columns,
+                         uint32_t rows);
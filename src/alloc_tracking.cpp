@@ -0,0 +1,135 @@
+#include "alloc_tracking.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace {
+
+struct RegionSlot {
+  std::atomic<const char*> name{nullptr};
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+std::array<RegionSlot, kMaxAllocRegions> g_regions;
+std::atomic<uint32_t> g_region_count{0};
+std::mutex g_region_mutex;
+
+// Обоснование: только тривиальные thread_local — operator new вызывается
+// и до инициализации потока, динамическая инициализация здесь недопустима.
+thread_local AllocRegion t_alloc_region = kNoAllocRegion;
+
+#if defined(P2_ALLOC_TRACKING)
+std::atomic<uint64_t> g_process_allocations{0};
+std::atomic<uint64_t> g_process_bytes{0};
+thread_local uint64_t t_thread_allocations = 0;
+thread_local uint64_t t_thread_bytes = 0;
+
+void CountAllocation(std::size_t size) {
+  g_process_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_process_bytes.fetch_add(size, std::memory_order_relaxed);
+  ++t_thread_allocations;
+  t_thread_bytes += size;
+  if (t_alloc_region < kMaxAllocRegions) {
+    RegionSlot& slot = g_regions[t_alloc_region];
+    slot.allocations.fetch_add(1, std::memory_order_relaxed);
+    slot.bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+}
+
+void* Allocate(std::size_t size) {
+  CountAllocation(size);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+#endif
+
+}  // namespace
+
+#if defined(P2_ALLOC_TRACKING)
+// nothrow-варианты стандартной библиотеки вызывают эти operator new.
+void* operator new(std::size_t size) { return Allocate(size); }
+void* operator new[](std::size_t size) { return Allocate(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+#endif
+
+AllocCounts operator-(const AllocCounts& a, const AllocCounts& b) {
+  AllocCounts out;
+  out.allocations = a.allocations - b.allocations;
+  out.bytes = a.bytes - b.bytes;
+  return out;
+}
+
+AllocCounts ProcessAllocCounts() {
+  AllocCounts counts;
+#if defined(P2_ALLOC_TRACKING)
+  counts.allocations = g_process_allocations.load(std::memory_order_relaxed);
+  counts.bytes = g_process_bytes.load(std::memory_order_relaxed);
+#endif
+  return counts;
+}
+
+AllocCounts ThreadAllocCounts() {
+  AllocCounts counts;
+#if defined(P2_ALLOC_TRACKING)
+  counts.allocations = t_thread_allocations;
+  counts.bytes = t_thread_bytes;
+#endif
+  return counts;
+}
+
+AllocRegion RegisterAllocRegion(const char* name) {
+  std::lock_guard<std::mutex> lock(g_region_mutex);
+  const uint32_t count = g_region_count.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (std::strcmp(g_regions[i].name.load(std::memory_order_relaxed),
+                    name) == 0) {
+      return i;
+    }
+  }
+  if (count == kMaxAllocRegions) {
+    return kNoAllocRegion;
+  }
+  g_regions[count].name.store(name, std::memory_order_relaxed);
+  g_region_count.store(count + 1, std::memory_order_release);
+  return count;
+}
+
+AllocCounts AllocRegionCounts(AllocRegion region) {
+  AllocCounts counts;
+  if (region < g_region_count.load(std::memory_order_acquire)) {
+    counts.allocations =
+        g_regions[region].allocations.load(std::memory_order_relaxed);
+    counts.bytes = g_regions[region].bytes.load(std::memory_order_relaxed);
+  }
+  return counts;
+}
+
+std::vector<AllocRegionTotals> AllocRegionReport() {
+  const uint32_t count = g_region_count.load(std::memory_order_acquire);
+  std::vector<AllocRegionTotals> report;
+  report.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    AllocRegionTotals totals;
+    totals.name = g_regions[i].name.load(std::memory_order_relaxed);
+    totals.counts = AllocRegionCounts(i);
+    report.push_back(std::move(totals));
+  }
+  return report;
+}
+
+AllocScope::AllocScope(AllocRegion region) : previous_(t_alloc_region) {
+  t_alloc_region = region;
+}
+
+AllocScope::~AllocScope() { t_alloc_region = previous_; }
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Heap allocation accounting, compiled in with the P2_ALLOC_TRACKING CMake
+// option. p2_core then replaces the global operator new/delete, and every
+// allocation is counted for the process, for the calling thread and for
+// the innermost AllocScope of that thread (exclusive, as with PerfScope).
+// Bytes are the requested sizes; frees are not subtracted. Over-aligned
+// new and malloc are not counted. Without the option the counters stay
+// zero and a scope costs one thread-local store.
+
+#if defined(P2_ALLOC_TRACKING)
+constexpr bool kAllocTrackingEnabled = true;
+#else
+constexpr bool kAllocTrackingEnabled = false;
+#endif
+
+struct AllocCounts {
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+};
+
+// a - b per field (for deltas around a piece of work).
+AllocCounts operator-(const AllocCounts& a, const AllocCounts& b);
+
+AllocCounts ProcessAllocCounts();
+AllocCounts ThreadAllocCounts();
+
+using AllocRegion = uint32_t;
+constexpr AllocRegion kNoAllocRegion = static_cast<AllocRegion>(-1);
+constexpr size_t kMaxAllocRegions = 32;
+
+// Region of name, created on first use; name must outlive the process (a
+// literal). Output: kNoAllocRegion when kMaxAllocRegions are taken.
+AllocRegion RegisterAllocRegion(const char* name);
+// Totals of region since the start of the process.
+AllocCounts AllocRegionCounts(AllocRegion region);
+
+struct AllocRegionTotals {
+  std::string name;
+  AllocCounts counts;
+};
+// All registered regions in registration order.
+std::vector<AllocRegionTotals> AllocRegionReport();
+
+// Attributes the allocations of the current thread to region while alive.
+class AllocScope {
+ public:
+  explicit AllocScope(AllocRegion region);
+  ~AllocScope();
+  AllocScope(const AllocScope&) = delete;
+  AllocScope& operator=(const AllocScope&) = delete;
+
+ private:
+  AllocRegion previous_;
+};
@@ -1,8 +1,11 @@
 #include "capture_dxgi.h"
 
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
+#include <dxgi1_5.h>
+
 using Microsoft::WRL::ComPtr;
 
 namespace {
@@ -16,6 +19,48 @@ struct FrameGuard {
   }
 };
 
+// Обоснование: DuplicateOutput1 отдает HDR/10-бит поверхности без
+// конвертации на стороне DWM; приведение к 8 бит делают ядра pixel_convert.
+HRESULT DuplicateOutputNativeFormat(const DxgiAdapterContext& adapter,
+                                    const DxgiOutputInfo& output,
+                                    ComPtr<IDXGIOutputDuplication>* out) {
+  ComPtr<IDXGIOutput5> output5;
+  if (SUCCEEDED(output.output.As(&output5))) {
+    const DXGI_FORMAT formats[] = {DXGI_FORMAT_B8G8R8A8_UNORM,
+                                   DXGI_FORMAT_R10G10B10A2_UNORM,
+                                   DXGI_FORMAT_R16G16B16A16_FLOAT};
+    HRESULT hr = output5->DuplicateOutput1(
+        adapter.device.Get(), 0, ARRAYSIZE(formats), formats,
+        out->ReleaseAndGetAddressOf());
+    if (SUCCEEDED(hr)) {
+      return hr;
+    }
+  }
+  return output.output->DuplicateOutput(adapter.device.Get(),
+                                        out->ReleaseAndGetAddressOf());
+}
+
+bool PixelFormatFromDxgi(DXGI_FORMAT format, PixelFormat* out) {
+  switch (format) {
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+      *out = PixelFormat::kBgra8;
+      return true;
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+      *out = PixelFormat::kRgba8;
+      return true;
+    case DXGI_FORMAT_R10G10B10A2_UNORM:
+      *out = PixelFormat::kR10G10B10A2;
+      return true;
+    case DXGI_FORMAT_R16G16B16A16_FLOAT:
+      *out = PixelFormat::kRgba16F;
+      return true;
+    default:
+      return false;
+  }
+}
+
 }  // namespace
 
 bool InitializeDxgiContext(DxgiContext* ctx, std::wstring* error,
@@ -115,22 +160,22 @@ bool InitializeDxgiContext(DxgiContext* ctx, std::wstring* error,
   return true;
 }
 
-bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
-                       const DxgiOutputInfo& output, ImageBuffer* out,
-                       std::wstring* error, HRESULT* hr_out) {
-  if (!out) {
-    if (error) {
-      *error = L"Не передан буфер для захвата.";
-    }
-    if (hr_out) {
-      *hr_out = E_INVALIDARG;
-    }
-    return false;
+DxgiStripSource::~DxgiStripSource() {
+  if (mapped_.pData) {
+    context_->Unmap(staging_.Get(), 0);
+  }
+}
+
+bool DxgiStripSource::Open(const DxgiAdapterContext& adapter,
+                           const DxgiOutputInfo& output, std::wstring* error,
+                           HRESULT* hr_out) {
+  if (mapped_.pData) {
+    context_->Unmap(staging_.Get(), 0);
+    mapped_ = {};
   }
 
   ComPtr<IDXGIOutputDuplication> duplication;
-  HRESULT hr =
-      output.output->DuplicateOutput(adapter.device.Get(), &duplication);
+  HRESULT hr = DuplicateOutputNativeFormat(adapter, output, &duplication);
   if (FAILED(hr)) {
     if (error) {
       *error = L"Не удалось создать дубликатор Desktop Duplication.";
@@ -183,6 +228,18 @@ bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
     return false;
   }
 
+  PixelFormat pixel_format = PixelFormat::kBgra8;
+  if (!PixelFormatFromDxgi(desc.Format, &pixel_format)) {
+    if (error) {
+      *error = L"Неподдерживаемый формат кадра DXGI: " +
+               std::to_wstring(static_cast<int>(desc.Format));
+    }
+    if (hr_out) {
+      *hr_out = DXGI_ERROR_UNSUPPORTED;
+    }
+    return false;
+  }
+
   // Обоснование: CPU может читать только staging-ресурс, поэтому нужна копия.
   D3D11_TEXTURE2D_DESC staging_desc = desc;
   staging_desc.Usage = D3D11_USAGE_STAGING;
@@ -204,6 +261,9 @@ bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
 
   adapter.context->CopyResource(staging.Get(), texture.Get());
 
+  // Обоснование: кадр дубликатора освобождается сразу после копии, а
+  // строки читаются прямо из отображения staging без копии в память
+  // процесса.
   D3D11_MAPPED_SUBRESOURCE mapped = {};
   hr = adapter.context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped);
   if (FAILED(hr)) {
@@ -216,26 +276,74 @@ bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
     return false;
   }
 
-  const uint32_t width = desc.Width;
-  const uint32_t height = desc.Height;
-  const uint32_t stride = width * 4;
+  context_ = adapter.context;
+  staging_ = staging;
+  mapped_ = mapped;
+  width_ = desc.Width;
+  height_ = desc.Height;
+  format_ = pixel_format;
+  if (hr_out) {
+    *hr_out = S_OK;
+  }
+  return true;
+}
+
+bool DxgiStripSource::ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                               std::wstring* error) {
+  if (!rows || !mapped_.pData || count == 0 || count > kMaxStripRows ||
+      y >= height_ || count > height_ - y) {
+    if (error) {
+      *error = L"Запрошены строки за пределами кадра.";
+    }
+    return false;
+  }
+  rows->data = static_cast<const uint8_t*>(mapped_.pData) +
+               static_cast<size_t>(y) * mapped_.RowPitch;
+  rows->stride = mapped_.RowPitch;
+  return true;
+}
+
+bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
+                       const DxgiOutputInfo& output, ImageBuffer* out,
+                       std::wstring* error, HRESULT* hr_out) {
+  if (!out) {
+    if (error) {
+      *error = L"Не передан буфер для захвата.";
+    }
+    if (hr_out) {
+      *hr_out = E_INVALIDARG;
+    }
+    return false;
+  }
+
+  DxgiStripSource source;
+  if (!source.Open(adapter, output, error, hr_out)) {
+    return false;
+  }
+
+  const uint32_t width = source.Width();
+  const uint32_t height = source.Height();
+  const uint32_t stride = width * BytesPerPixel(source.Format());
   out->width = width;
   out->height = height;
   out->stride = stride;
-  out->pixel_format = GUID_WICPixelFormat32bppBGRA;
+  out->pixel_format = source.Format();
   out->pixels.resize(static_cast<size_t>(stride) * height);
 
-  const uint8_t* src = reinterpret_cast<const uint8_t*>(mapped.pData);
   uint8_t* dst = out->pixels.data();
-  for (uint32_t y = 0; y < height; ++y) {
-    std::memcpy(dst + static_cast<size_t>(y) * stride,
-                src + static_cast<size_t>(y) * mapped.RowPitch, stride);
-  }
-
-  adapter.context->Unmap(staging.Get(), 0);
-
-  if (hr_out) {
-    *hr_out = S_OK;
+  for (uint32_t y = 0; y < height; y += kMaxStripRows) {
+    const uint32_t count = std::min(kMaxStripRows, height - y);
+    PixelRows rows;
+    if (!source.ReadRows(y, count, &rows, error)) {
+      if (hr_out) {
+        *hr_out = E_FAIL;
+      }
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      std::memcpy(dst + static_cast<size_t>(y + i) * stride,
+                  rows.data + i * rows.stride, stride);
+    }
   }
   return true;
 }
@@ -7,7 +7,8 @@
 #include <dxgi1_2.h>
 #include <wrl/client.h>
 
-#include "encode_wic.h"
+#include "image_buffer.h"
+#include "strip_source.h"
 
 // Description of a DXGI output.
 struct DxgiOutputInfo {
@@ -34,6 +35,36 @@ bool InitializeDxgiContext(DxgiContext* ctx, std::wstring* error,
                            HRESULT* hr);
 
 // Captures one output via Desktop Duplication.
+// Output: frame in the desktop's native format (BGRA8, R10G10B10A2 or FP16).
 bool CaptureDxgiOutput(const DxgiAdapterContext& adapter,
                        const DxgiOutputInfo& output, ImageBuffer* out,
                        std::wstring* error, HRESULT* hr);
+
+// Captures one output and exposes it as strips read in place from the
+// mapped staging texture: no frame copy in process memory. The duplication
+// frame is released in Open; the mapping lives until destruction or the
+// next Open.
+class DxgiStripSource : public StripSource {
+ public:
+  DxgiStripSource() = default;
+  ~DxgiStripSource() override;
+  DxgiStripSource(const DxgiStripSource&) = delete;
+  DxgiStripSource& operator=(const DxgiStripSource&) = delete;
+
+  bool Open(const DxgiAdapterContext& adapter, const DxgiOutputInfo& output,
+            std::wstring* error, HRESULT* hr);
+
+  uint32_t Width() const override { return width_; }
+  uint32_t Height() const override { return height_; }
+  PixelFormat Format() const override { return format_; }
+  bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                std::wstring* error) override;
+
+ private:
+  Microsoft::WRL::ComPtr<ID3D11DeviceContext> context_;
+  Microsoft::WRL::ComPtr<ID3D11Texture2D> staging_;
+  D3D11_MAPPED_SUBRESOURCE mapped_ = {};
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  PixelFormat format_ = PixelFormat::kBgra8;
+};
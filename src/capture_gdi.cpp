@@ -2,17 +2,22 @@
 
 #include <cstring>
 
-bool CaptureRectGdi(const RECT& rect, ImageBuffer* out,
-                    std::wstring* error) {
+namespace {
+
+// Копирует прямоугольник экрана в DIB width x height: BitBlt при том же
+// размере, иначе StretchBlt с выборкой пикселей (COLORONCOLOR) — без
+// усреднения, поэтому уменьшение стоит столько же, сколько чтение точек.
+bool BlitRect(const RECT& rect, int width, int height, ImageBuffer* out,
+              std::wstring* error) {
   if (!out) {
     if (error) {
       *error = L"Не передан буфер для захвата.";
     }
     return false;
   }
-  const int width = rect.right - rect.left;
-  const int height = rect.bottom - rect.top;
-  if (width <= 0 || height <= 0) {
+  const int rect_width = rect.right - rect.left;
+  const int rect_height = rect.bottom - rect.top;
+  if (width <= 0 || height <= 0 || rect_width <= 0 || rect_height <= 0) {
     if (error) {
       *error = L"Некорректный размер прямоугольника захвата.";
     }
@@ -61,9 +66,16 @@ bool CaptureRectGdi(const RECT& rect, ImageBuffer* out,
   }
 
   HGDIOBJ old = SelectObject(mem_dc, dib);
-  BOOL blt_ok =
-      BitBlt(mem_dc, 0, 0, width, height, screen_dc, rect.left, rect.top,
-             SRCCOPY | CAPTUREBLT);
+  BOOL blt_ok = FALSE;
+  if (width == rect_width && height == rect_height) {
+    blt_ok = BitBlt(mem_dc, 0, 0, width, height, screen_dc, rect.left,
+                    rect.top, SRCCOPY | CAPTUREBLT);
+  } else {
+    SetStretchBltMode(mem_dc, COLORONCOLOR);
+    blt_ok = StretchBlt(mem_dc, 0, 0, width, height, screen_dc, rect.left,
+                        rect.top, rect_width, rect_height,
+                        SRCCOPY | CAPTUREBLT);
+  }
 
   bool success = false;
   if (!blt_ok) {
@@ -77,7 +89,7 @@ bool CaptureRectGdi(const RECT& rect, ImageBuffer* out,
     out->width = static_cast<uint32_t>(width);
     out->height = static_cast<uint32_t>(height);
     out->stride = static_cast<uint32_t>(stride);
-    out->pixel_format = GUID_WICPixelFormat32bppBGRA;
+    out->pixel_format = PixelFormat::kBgra8;
     out->pixels.resize(stride * static_cast<size_t>(height));
     std::memcpy(out->pixels.data(), bits, out->pixels.size());
     success = true;
@@ -90,7 +102,126 @@ bool CaptureRectGdi(const RECT& rect, ImageBuffer* out,
   return success;
 }
 
+}  // namespace
+
+bool CaptureRectGdi(const RECT& rect, ImageBuffer* out,
+                    std::wstring* error) {
+  return BlitRect(rect, rect.right - rect.left, rect.bottom - rect.top, out,
+                  error);
+}
+
+bool ProbeRectGdi(const RECT& rect, uint32_t width, uint32_t height,
+                  ImageBuffer* out, std::wstring* error) {
+  return BlitRect(rect, static_cast<int>(width), static_cast<int>(height),
+                  out, error);
+}
+
 bool CaptureMonitorGdi(const DisplayInfo& display, ImageBuffer* out,
                        std::wstring* error) {
   return CaptureRectGdi(display.rect, out, error);
 }
+
+GdiStripSource::~GdiStripSource() { Close(); }
+
+void GdiStripSource::Close() {
+  if (mem_dc_) {
+    SelectObject(mem_dc_, old_bitmap_);
+    DeleteDC(mem_dc_);
+  }
+  if (dib_) {
+    DeleteObject(dib_);
+  }
+  if (screen_dc_) {
+    ReleaseDC(nullptr, screen_dc_);
+  }
+  screen_dc_ = nullptr;
+  mem_dc_ = nullptr;
+  dib_ = nullptr;
+  old_bitmap_ = nullptr;
+  bits_ = nullptr;
+  width_ = 0;
+  height_ = 0;
+}
+
+bool GdiStripSource::Open(const RECT& rect, std::wstring* error) {
+  Close();
+  const int width = rect.right - rect.left;
+  const int height = rect.bottom - rect.top;
+  if (width <= 0 || height <= 0) {
+    if (error) {
+      *error = L"Некорректный размер прямоугольника захвата.";
+    }
+    return false;
+  }
+  screen_dc_ = GetDC(nullptr);
+  if (!screen_dc_) {
+    if (error) {
+      *error = L"Не удалось получить DC экрана.";
+    }
+    return false;
+  }
+  mem_dc_ = CreateCompatibleDC(screen_dc_);
+  if (!mem_dc_) {
+    DWORD last_error = GetLastError();
+    Close();
+    if (error) {
+      *error = L"Не удалось создать совместимый DC.";
+    }
+    SetLastError(last_error);
+    return false;
+  }
+
+  // Обоснование: DIB высотой в одну полосу переиспользуется для всех
+  // полос кадра вместо DIB на весь экран.
+  BITMAPINFO bmi = {};
+  bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  bmi.bmiHeader.biWidth = width;
+  bmi.bmiHeader.biHeight = -static_cast<int>(kMaxStripRows);
+  bmi.bmiHeader.biPlanes = 1;
+  bmi.bmiHeader.biBitCount = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+
+  void* bits = nullptr;
+  dib_ = CreateDIBSection(screen_dc_, &bmi, DIB_RGB_COLORS, &bits, nullptr,
+                          0);
+  if (!dib_ || !bits) {
+    DWORD last_error = GetLastError();
+    Close();
+    if (error) {
+      *error = L"Не удалось создать DIB секцию.";
+    }
+    SetLastError(last_error);
+    return false;
+  }
+  old_bitmap_ = SelectObject(mem_dc_, dib_);
+  bits_ = static_cast<uint8_t*>(bits);
+  rect_ = rect;
+  width_ = static_cast<uint32_t>(width);
+  height_ = static_cast<uint32_t>(height);
+  return true;
+}
+
+bool GdiStripSource::ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                              std::wstring* error) {
+  if (!rows || !bits_ || count == 0 || count > kMaxStripRows ||
+      y >= height_ || count > height_ - y) {
+    if (error) {
+      *error = L"Запрошены строки за пределами кадра.";
+    }
+    return false;
+  }
+  if (!BitBlt(mem_dc_, 0, 0, static_cast<int>(width_),
+              static_cast<int>(count), screen_dc_, rect_.left,
+              rect_.top + static_cast<int>(y), SRCCOPY | CAPTUREBLT)) {
+    DWORD last_error = GetLastError();
+    if (error) {
+      *error = L"Не удалось выполнить BitBlt.";
+    }
+    SetLastError(last_error);
+    return false;
+  }
+  GdiFlush();
+  rows->data = bits_;
+  rows->stride = static_cast<size_t>(width_) * 4;
+  return true;
+}
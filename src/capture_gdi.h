@@ -3,7 +3,8 @@
 #include <string>
 
 #include "display_enum.h"
-#include "encode_wic.h"
+#include "image_buffer.h"
+#include "strip_source.h"
 
 // Captures a monitor via GDI BitBlt.
 bool CaptureMonitorGdi(const DisplayInfo& display, ImageBuffer* out,
@@ -11,3 +12,40 @@ bool CaptureMonitorGdi(const DisplayInfo& display, ImageBuffer* out,
 
 // Captures a screen rect via GDI BitBlt.
 bool CaptureRectGdi(const RECT& rect, ImageBuffer* out, std::wstring* error);
+
+// Samples a screen rect into a width x height BGRA image (StretchBlt, one
+// source pixel per output pixel, no averaging): a cheap activity probe.
+bool ProbeRectGdi(const RECT& rect, uint32_t width, uint32_t height,
+                  ImageBuffer* out, std::wstring* error);
+
+// Reads a screen rect strip by strip through a DIB of kMaxStripRows rows
+// (one BitBlt per strip), so the frame is never held whole. Strips are
+// taken moments apart: fast-changing content may tear between them.
+class GdiStripSource : public StripSource {
+ public:
+  GdiStripSource() = default;
+  ~GdiStripSource() override;
+  GdiStripSource(const GdiStripSource&) = delete;
+  GdiStripSource& operator=(const GdiStripSource&) = delete;
+
+  // Output: false + error (GetLastError preserved) on GDI failure.
+  bool Open(const RECT& rect, std::wstring* error);
+
+  uint32_t Width() const override { return width_; }
+  uint32_t Height() const override { return height_; }
+  PixelFormat Format() const override { return PixelFormat::kBgra8; }
+  bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                std::wstring* error) override;
+
+ private:
+  void Close();
+
+  RECT rect_ = {};
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  HDC screen_dc_ = nullptr;
+  HDC mem_dc_ = nullptr;
+  HBITMAP dib_ = nullptr;
+  HGDIOBJ old_bitmap_ = nullptr;
+  uint8_t* bits_ = nullptr;
+};
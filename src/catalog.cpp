@@ -0,0 +1,449 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+
+#include "file_io.h"
+#include "hash.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint8_t kCatalogMagic[4] = {'P', '2', 'C', 'T'};
+constexpr uint64_t kCatalogVersion = 1;
+constexpr size_t kHeaderFixedSize = 16;
+// Флаг заголовка: время шло назад (перевод часов), поиск линейный.
+constexpr uint32_t kCatalogUnsorted = 1;
+constexpr uint8_t kEntryBlack = 1;
+// Строк в полосе оценки изменений.
+constexpr uint32_t kChangeBandRows = 16;
+
+void PutLe(uint8_t* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+uint64_t GetLe(const uint8_t* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Имена хранятся в UTF-16LE (на Linux — только символы BMP).
+void PutName(const std::wstring& name, std::vector<uint8_t>* out) {
+  for (wchar_t ch : name) {
+    out->push_back(static_cast<uint8_t>(ch & 0xFF));
+    out->push_back(static_cast<uint8_t>((ch >> 8) & 0xFF));
+  }
+}
+
+std::wstring GetName(const uint8_t* in, size_t units) {
+  std::wstring name(units, L'\0');
+  for (size_t i = 0; i < units; ++i) {
+    name[i] = static_cast<wchar_t>(GetLe(in + i * 2, 2));
+  }
+  return name;
+}
+
+std::vector<uint8_t> EncodeHeader(const ArchiveIdentity& identity) {
+  std::vector<uint8_t> header(kHeaderFixedSize, 0);
+  PutName(identity.computer, &header);
+  PutName(identity.user, &header);
+  std::memcpy(header.data(), kCatalogMagic, 4);
+  PutLe(header.data() + 4, kCatalogVersion, 2);
+  PutLe(header.data() + 6, header.size(), 2);
+  PutLe(header.data() + 12, identity.computer.size(), 2);
+  PutLe(header.data() + 14, identity.user.size(), 2);
+  return header;
+}
+
+// Разбирает заголовок в начале data; размер заголовка — начало записей.
+bool DecodeHeader(const uint8_t* data, size_t size, ArchiveIdentity* identity,
+                  uint32_t* flags, size_t* header_size) {
+  if (size < kHeaderFixedSize || std::memcmp(data, kCatalogMagic, 4) != 0 ||
+      GetLe(data + 4, 2) != kCatalogVersion) {
+    return false;
+  }
+  const size_t total = static_cast<size_t>(GetLe(data + 6, 2));
+  const size_t computer_units = static_cast<size_t>(GetLe(data + 12, 2));
+  const size_t user_units = static_cast<size_t>(GetLe(data + 14, 2));
+  if (total != kHeaderFixedSize + 2 * (computer_units + user_units) ||
+      total > size) {
+    return false;
+  }
+  identity->computer = GetName(data + kHeaderFixedSize, computer_units);
+  identity->user =
+      GetName(data + kHeaderFixedSize + computer_units * 2, user_units);
+  identity->display_index = 0;
+  *flags = static_cast<uint32_t>(GetLe(data + 8, 4));
+  *header_size = total;
+  return true;
+}
+
+void EncodeEntry(const CatalogEntry& entry, uint8_t* out) {
+  std::memset(out, 0, kCatalogEntrySize);
+  PutLe(out, static_cast<uint64_t>(entry.timestamp), 8);
+  PutLe(out + 8, entry.size, 4);
+  PutLe(out + 12, entry.change, 2);
+  out[14] = entry.codec == OutputCodec::kLossless ? 1 : 0;
+  out[15] = static_cast<uint8_t>(entry.storage);
+  out[16] = static_cast<uint8_t>(entry.display_index);
+  out[17] = entry.black ? kEntryBlack : 0;
+  PutLe(out + 18, static_cast<uint64_t>(entry.display_count), 2);
+  PutLe(out + 20, static_cast<uint64_t>(entry.video_part), 2);
+}
+
+CatalogEntry DecodeEntry(const uint8_t* in) {
+  CatalogEntry entry;
+  entry.timestamp = static_cast<int64_t>(GetLe(in, 8));
+  entry.size = static_cast<uint32_t>(GetLe(in + 8, 4));
+  entry.change = static_cast<uint16_t>(GetLe(in + 12, 2));
+  entry.codec = in[14] == 1 ? OutputCodec::kLossless : OutputCodec::kJpeg;
+  entry.storage = in[15] <= static_cast<uint8_t>(CatalogStorage::kStore)
+                      ? static_cast<CatalogStorage>(in[15])
+                      : CatalogStorage::kFile;
+  entry.display_index = in[16];
+  entry.black = (in[17] & kEntryBlack) != 0;
+  entry.display_count = static_cast<int>(GetLe(in + 18, 2));
+  entry.video_part = static_cast<int>(GetLe(in + 20, 2));
+  return entry;
+}
+
+// Номер месяца (год * 12 + месяц - 1) для отбора файлов по диапазону.
+int64_t MonthKey(int64_t timestamp) {
+  const DateTimeParts dt = ArchiveDateTime(timestamp);
+  return static_cast<int64_t>(dt.year) * 12 + dt.month - 1;
+}
+
+// Месяц из имени YYYY-MM.p2cat. Output: false для других файлов.
+bool ParseCatalogFileName(const std::wstring& name, int64_t* month_key) {
+  int year = 0;
+  int month = 0;
+  wchar_t tail[8] = {};
+  if (name.size() != 13 ||
+      std::swscanf(name.c_str(), L"%4d-%2d.%5ls", &year, &month, tail) !=
+          3 ||
+      std::wcscmp(tail, L"p2cat") != 0 || month < 1 || month > 12) {
+    return false;
+  }
+  *month_key = static_cast<int64_t>(year) * 12 + month - 1;
+  return true;
+}
+
+bool Matches(const CatalogEntry& entry, const CatalogQuery& query) {
+  if (entry.timestamp < query.from || entry.timestamp > query.to) {
+    return false;
+  }
+  if (query.display_index >= 0 && entry.display_index != query.display_index) {
+    return false;
+  }
+  if (query.skip_black && entry.black) {
+    return false;
+  }
+  return entry.change == kCatalogChangeUnknown ||
+         entry.change >= query.min_change;
+}
+
+}  // namespace
+
+std::wstring CatalogFileName(int64_t timestamp) {
+  const DateTimeParts dt = ArchiveDateTime(timestamp);
+  wchar_t name[32] = {};
+  std::swprintf(name, 32, L"%04d-%02d.p2cat", dt.year, dt.month);
+  return name;
+}
+
+uint16_t ChangeTracker::Update(const ImageBuffer& frame) {
+  const uint32_t bands = (frame.height + kChangeBandRows - 1) / kChangeBandRows;
+  const size_t row_bytes =
+      static_cast<size_t>(frame.width) * BytesPerPixel(frame.pixel_format);
+  const bool comparable = frame.width == width_ && frame.height == height_ &&
+                          bands_.size() == bands && bands > 0;
+  width_ = frame.width;
+  height_ = frame.height;
+  bands_.resize(bands);
+  uint32_t changed = 0;
+  // Обоснование: хэш полосы вместо попиксельного сравнения — не нужно
+  // держать копию прошлого кадра, а проход по памяти один.
+  for (uint32_t band = 0; band < bands; ++band) {
+    const uint32_t end = std::min(frame.height, (band + 1) * kChangeBandRows);
+    uint64_t hash = band;
+    for (uint32_t y = band * kChangeBandRows; y < end; ++y) {
+      hash = Hash64(frame.pixels.data() + static_cast<size_t>(y) * frame.stride,
+                    row_bytes, hash);
+    }
+    if (bands_[band] != hash) {
+      ++changed;
+    }
+    bands_[band] = hash;
+  }
+  if (!comparable) {
+    return kCatalogChangeUnknown;
+  }
+  return static_cast<uint16_t>((changed * 1000ull + bands - 1) / bands);
+}
+
+bool CatalogWriter::Open(const std::wstring& catalog_dir,
+                         const ArchiveIdentity& identity,
+                         std::wstring* error) {
+  Close();
+  std::error_code ec;
+  fs::create_directories(fs::path(catalog_dir), ec);
+  if (!fs::is_directory(fs::path(catalog_dir), ec)) {
+    if (error) {
+      *error = L"Не удалось создать папку каталога: " + catalog_dir;
+    }
+    return false;
+  }
+  dir_ = catalog_dir;
+  identity_ = identity;
+  identity_.display_index = 0;
+  return true;
+}
+
+void CatalogWriter::Close() {
+  if (file_.is_open()) {
+    file_.close();
+  }
+  file_.clear();
+  dir_.clear();
+  path_.clear();
+  entries_ = 0;
+}
+
+bool CatalogWriter::OpenMonth(const std::wstring& path, std::wstring* error) {
+  if (file_.is_open()) {
+    file_.close();
+  }
+  file_.clear();
+  path_.clear();
+  entries_ = 0;
+  last_timestamp_ = INT64_MIN;
+  flags_ = 0;
+
+  const fs::path file(path);
+  std::error_code ec;
+  const uintmax_t existing = fs::file_size(file, ec);
+  size_t header_size = 0;
+  if (ec || existing == 0) {
+    const std::vector<uint8_t> header = EncodeHeader(identity_);
+    if (!WriteFileBytes(path, header, error)) {
+      return false;
+    }
+    header_size = header.size();
+  } else {
+    std::vector<uint8_t> bytes;
+    if (!ReadFileBytes(path, &bytes, error)) {
+      return false;
+    }
+    ArchiveIdentity stored;
+    if (!DecodeHeader(bytes.data(), bytes.size(), &stored, &flags_,
+                      &header_size)) {
+      if (error) {
+        *error = L"Файл не является каталогом кадров: " + path;
+      }
+      return false;
+    }
+    if (stored.computer != identity_.computer ||
+        stored.user != identity_.user) {
+      if (error) {
+        *error = L"Каталог принадлежит другому компьютеру: " + path;
+      }
+      return false;
+    }
+    // Недописанная запись (сбой посреди записи) отрезается.
+    entries_ = (bytes.size() - header_size) / kCatalogEntrySize;
+    const uint64_t end = header_size + entries_ * kCatalogEntrySize;
+    if (end < bytes.size()) {
+      fs::resize_file(file, end, ec);
+      if (ec) {
+        if (error) {
+          *error = L"Не удалось отрезать поврежденный хвост каталога: " + path;
+        }
+        return false;
+      }
+    }
+    if (entries_ > 0) {
+      last_timestamp_ = static_cast<int64_t>(
+          GetLe(bytes.data() + end - kCatalogEntrySize, 8));
+    }
+  }
+  file_.open(file, std::ios::in | std::ios::out | std::ios::binary);
+  if (!file_.is_open()) {
+    if (error) {
+      *error = L"Не удалось открыть каталог для записи: " + path;
+    }
+    return false;
+  }
+  path_ = path;
+  return true;
+}
+
+bool CatalogWriter::Append(const CatalogEntry& entry, std::wstring* error) {
+  if (!IsOpen()) {
+    if (error) {
+      *error = L"Каталог не открыт.";
+    }
+    return false;
+  }
+  // Обоснование: путь собирается только при смене месяца — в цикле
+  // захвата запись в каталог не выделяет память.
+  const DateTimeParts dt = ArchiveDateTime(entry.timestamp);
+  const int month = dt.year * 12 + dt.month;
+  if (path_.empty() || month != month_) {
+    const std::wstring path =
+        (fs::path(dir_) / CatalogFileName(entry.timestamp)).wstring();
+    if (!OpenMonth(path, error)) {
+      return false;
+    }
+    month_ = month;
+  }
+  uint8_t bytes[kCatalogEntrySize];
+  EncodeEntry(entry, bytes);
+  file_.seekp(0, std::ios::end);
+  file_.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+  if (entry.timestamp < last_timestamp_ &&
+      (flags_ & kCatalogUnsorted) == 0) {
+    flags_ |= kCatalogUnsorted;
+    uint8_t flags[4];
+    PutLe(flags, flags_, 4);
+    file_.seekp(8);
+    file_.write(reinterpret_cast<const char*>(flags), sizeof(flags));
+  }
+  last_timestamp_ = entry.timestamp;
+  file_.flush();
+  if (!file_) {
+    file_.clear();
+    if (error) {
+      *error = L"Не удалось записать каталог: " + path_;
+    }
+    return false;
+  }
+  ++entries_;
+  return true;
+}
+
+bool CatalogView::Open(const std::wstring& path, std::wstring* error) {
+  count_ = 0;
+  sorted_ = true;
+  if (!file_.Open(path, error)) {
+    return false;
+  }
+  uint32_t flags = 0;
+  if (!DecodeHeader(file_.Data(), file_.Size(), &identity_, &flags,
+                    &entries_offset_)) {
+    file_.Close();
+    if (error) {
+      *error = L"Файл не является каталогом кадров: " + path;
+    }
+    return false;
+  }
+  count_ = (file_.Size() - entries_offset_) / kCatalogEntrySize;
+  sorted_ = (flags & kCatalogUnsorted) == 0;
+  return true;
+}
+
+CatalogEntry CatalogView::Entry(size_t i) const {
+  return DecodeEntry(file_.Data() + entries_offset_ + i * kCatalogEntrySize);
+}
+
+size_t CatalogView::LowerBound(int64_t timestamp) const {
+  const uint8_t* entries = file_.Data() + entries_offset_;
+  auto timestamp_at = [&](size_t i) {
+    return static_cast<int64_t>(GetLe(entries + i * kCatalogEntrySize, 8));
+  };
+  if (!sorted_) {
+    for (size_t i = 0; i < count_; ++i) {
+      if (timestamp_at(i) >= timestamp) {
+        return i;
+      }
+    }
+    return count_;
+  }
+  size_t low = 0;
+  size_t high = count_;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    if (timestamp_at(mid) < timestamp) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+bool QueryCatalog(const std::wstring& catalog_dir, const CatalogQuery& query,
+                  std::vector<CatalogEntry>* out, ArchiveIdentity* identity,
+                  CatalogQueryStats* stats, std::wstring* error) {
+  out->clear();
+  const int64_t first_month =
+      query.from == INT64_MIN ? INT64_MIN : MonthKey(query.from);
+  const int64_t last_month =
+      query.to == INT64_MAX ? INT64_MAX : MonthKey(query.to);
+  std::vector<std::wstring> files;
+  std::error_code ec;
+  for (const fs::directory_entry& item :
+       fs::directory_iterator(fs::path(catalog_dir), ec)) {
+    int64_t month = 0;
+    const std::wstring name = item.path().filename().wstring();
+    if (item.is_regular_file() && ParseCatalogFileName(name, &month) &&
+        month >= first_month && month <= last_month) {
+      files.push_back(item.path().wstring());
+    }
+  }
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось прочитать папку каталога: " + catalog_dir;
+    }
+    return false;
+  }
+  std::sort(files.begin(), files.end());
+
+  CatalogQueryStats local;
+  for (const std::wstring& path : files) {
+    CatalogView view;
+    if (!view.Open(path, error)) {
+      if (stats) {
+        *stats = local;
+      }
+      return false;
+    }
+    ++local.files;
+    if (identity) {
+      *identity = view.Identity();
+    }
+    // Обоснование: в упорядоченном файле начало диапазона находится
+    // бинарным поиском по отображению, а перебор останавливается на первой
+    // записи после to — запрос за минуту года читает несколько страниц.
+    const bool sorted = view.Sorted();
+    for (size_t i = sorted ? view.LowerBound(query.from) : 0;
+         i < view.Size(); ++i) {
+      const CatalogEntry entry = view.Entry(i);
+      ++local.scanned;
+      if (sorted && entry.timestamp > query.to) {
+        break;
+      }
+      if (!Matches(entry, query)) {
+        continue;
+      }
+      out->push_back(entry);
+      if (query.limit > 0 && out->size() >= query.limit) {
+        if (stats) {
+          *stats = local;
+        }
+        return true;
+      }
+    }
+  }
+  if (stats) {
+    *stats = local;
+  }
+  return true;
+}
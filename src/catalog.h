@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "codec_select.h"
+#include "frame_archive.h"
+#include "image_buffer.h"
+#include "mapped_file.h"
+
+// Capture catalog: one fixed 24-byte entry per saved frame in monthly files
+// <PC_USER>/catalog/YYYY-MM.p2cat, so time, display and activity queries
+// over months of capture read a few memory-mapped files instead of listing
+// day folders.
+//
+// File:   header "P2CT" (version, header size, flags, source computer/user),
+//         then entries (timestamp, size, change, codec, storage, display,
+//         flags, display count, video part) in append order.
+// The frame location is not stored: it follows from the source, timestamp,
+// display and storage the same way the capture names it. All integers
+// little-endian; timestamps as in ArchiveTimestamp.
+
+constexpr size_t kCatalogEntrySize = 24;
+// Change score of a frame without a previous one to compare against.
+constexpr uint16_t kCatalogChangeUnknown = 0xFFFF;
+
+// Where the frame bytes were written.
+enum class CatalogStorage : uint8_t {
+  kFile = 0,
+  kArchive = 1,
+  kVideo = 2,
+  kStore = 3,
+};
+
+struct CatalogEntry {
+  int64_t timestamp = 0;
+  // Encoded bytes written for the frame (0 for a repeat in the store).
+  uint32_t size = 0;
+  // Share of changed rows against the previous frame of the display,
+  // per-mille, or kCatalogChangeUnknown.
+  uint16_t change = kCatalogChangeUnknown;
+  OutputCodec codec = OutputCodec::kJpeg;
+  CatalogStorage storage = CatalogStorage::kFile;
+  int display_index = 0;
+  int display_count = 1;
+  bool black = false;
+  // Part of the daily video stream (kVideo).
+  int video_part = 0;
+};
+
+// Catalog file of the month of timestamp: YYYY-MM.p2cat.
+std::wstring CatalogFileName(int64_t timestamp);
+
+// Per-display change score: 64-bit hashes of 16-row bands against the
+// previous frame. Costs one pass over the frame.
+class ChangeTracker {
+ public:
+  // Output: per-mille of changed bands; kCatalogChangeUnknown for the first
+  // frame and after a size change.
+  uint16_t Update(const ImageBuffer& frame);
+  void Reset() { bands_.clear(); }
+
+ private:
+  std::vector<uint64_t> bands_;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+};
+
+// Appends entries to the month file of each timestamp. Opening an existing
+// file keeps whole entries and truncates a torn tail.
+class CatalogWriter {
+ public:
+  // Output: false + error when catalog_dir cannot be created.
+  bool Open(const std::wstring& catalog_dir, const ArchiveIdentity& identity,
+            std::wstring* error);
+  void Close();
+  bool IsOpen() const { return !dir_.empty(); }
+  // Entries in the current month file.
+  uint64_t Entries() const { return entries_; }
+
+  // Switches the month file when needed; sets the unsorted flag of the file
+  // when time goes backwards. Output: false + error on I/O failure or a file
+  // of another source.
+  bool Append(const CatalogEntry& entry, std::wstring* error);
+
+ private:
+  bool OpenMonth(const std::wstring& path, std::wstring* error);
+
+  std::wstring dir_;
+  ArchiveIdentity identity_;
+  std::wstring path_;
+  // year * 12 + month of path_.
+  int month_ = 0;
+  std::fstream file_;
+  uint64_t entries_ = 0;
+  int64_t last_timestamp_ = INT64_MIN;
+  uint32_t flags_ = 0;
+};
+
+// Memory-mapped month file: entries decoded on access, lookup by time.
+class CatalogView {
+ public:
+  // Output: false + error when the file is missing or not a catalog.
+  bool Open(const std::wstring& path, std::wstring* error);
+  const ArchiveIdentity& Identity() const { return identity_; }
+  size_t Size() const { return count_; }
+  CatalogEntry Entry(size_t i) const;
+  // False when timestamps went backwards (clock change): LowerBound then
+  // scans linearly.
+  bool Sorted() const { return sorted_; }
+  // Index of the first entry with timestamp >= timestamp (Size() if none).
+  size_t LowerBound(int64_t timestamp) const;
+
+ private:
+  MappedFile file_;
+  ArchiveIdentity identity_;
+  size_t entries_offset_ = 0;
+  size_t count_ = 0;
+  bool sorted_ = true;
+};
+
+struct CatalogQuery {
+  // Inclusive time range.
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+  // -1: all displays.
+  int display_index = -1;
+  // Frames with at least this change (per-mille); unknown change passes.
+  uint16_t min_change = 0;
+  bool skip_black = false;
+  // 0: no limit.
+  size_t limit = 0;
+};
+
+struct CatalogQueryStats {
+  uint64_t files = 0;
+  // Entries decoded (range lookup skips the rest).
+  uint64_t scanned = 0;
+};
+
+// Entries of catalog_dir matching query, month files in name order; only
+// files whose month overlaps the range are opened. identity receives the
+// source of the last file read. Output: false + error when the folder
+// cannot be listed or a file is not a catalog.
+bool QueryCatalog(const std::wstring& catalog_dir, const CatalogQuery& query,
+                  std::vector<CatalogEntry>* out, ArchiveIdentity* identity,
+                  CatalogQueryStats* stats, std::wstring* error);
@@ -0,0 +1,67 @@
+#include "codec_select.h"
+
+#include <algorithm>
+
+#include "qoi_codec.h"
+
+namespace {
+
+// Оценка по одной полосе из группы: не чаще 1/8 кадра (~1/8 работы
+// кодеров), но не меньше 16 полос по 16 строк.
+constexpr uint32_t kMaxSampleStep = 8;
+constexpr uint32_t kMinSampledBands = 16;
+constexpr uint32_t kBandRows = 16;
+
+}  // namespace
+
+bool ParseOutputCodec(const std::wstring& value, OutputCodec* out) {
+  if (!out) {
+    return false;
+  }
+  if (value == L"jpeg") {
+    *out = OutputCodec::kJpeg;
+  } else if (value == L"lossless") {
+    *out = OutputCodec::kLossless;
+  } else if (value == L"auto") {
+    *out = OutputCodec::kAuto;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const wchar_t* OutputCodecName(OutputCodec codec) {
+  switch (codec) {
+    case OutputCodec::kLossless:
+      return L"lossless";
+    case OutputCodec::kAuto:
+      return L"auto";
+    case OutputCodec::kJpeg:
+    default:
+      return L"jpeg";
+  }
+}
+
+const wchar_t* OutputCodecExtension(OutputCodec codec) {
+  return codec == OutputCodec::kLossless ? L".qoi" : L".jpg";
+}
+
+CodecChoice ChooseCodec(const ImageBuffer& image, ColorMode color_mode,
+                        float quality, JpegWorkspace* workspace) {
+  CodecChoice choice;
+  // Обоснование: оба размера оцениваются одними и теми же полосами кадра
+  // точным кодированием (JPEG — до счетчика битов, без записи), а не
+  // косвенной мерой вроде энтропии градиентов: для текста и заливок
+  // соотношение кодеков по такой мере предсказывается плохо.
+  // Объем JPEG сосредоточен на редких горизонтальных границах (окна,
+  // панели), поэтому малым кадрам нужна более плотная выборка.
+  const uint32_t step = std::clamp<uint32_t>(
+      image.height / (kBandRows * kMinSampledBands), 1, kMaxSampleStep);
+  choice.jpeg_bytes = EstimateJpegSizeSampled(
+      image, color_mode, QualityToIjg(quality), step, workspace);
+  choice.lossless_bytes = EstimateQoiSize(image, step);
+  choice.codec = choice.lossless_bytes < choice.jpeg_bytes
+                     ? OutputCodec::kLossless
+                     : OutputCodec::kJpeg;
+  return choice;
+}
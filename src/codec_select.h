@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image_buffer.h"
+#include "jpeg_encoder.h"
+
+// Codec of saved frames.
+enum class OutputCodec {
+  kJpeg,      // Baseline JPEG (WIC or native encoder).
+  kLossless,  // QOI lossless (text and flat UI stay legible, often smaller).
+  kAuto,      // Per frame: the codec with the smaller estimated file.
+};
+
+// Parses "jpeg" / "lossless" / "auto". Output: false if unknown.
+bool ParseOutputCodec(const std::wstring& value, OutputCodec* out);
+// Returns codec name for logs and reports.
+const wchar_t* OutputCodecName(OutputCodec codec);
+// Returns file extension with the dot of a resolved codec (".jpg", ".qoi").
+const wchar_t* OutputCodecExtension(OutputCodec codec);
+
+// Sampled estimates behind a per-frame choice.
+struct CodecChoice {
+  OutputCodec codec = OutputCodec::kJpeg;
+  size_t jpeg_bytes = 0;
+  size_t lossless_bytes = 0;
+};
+
+// Estimates JPEG (native encoder at quality 0.01..1.0 and color_mode) and
+// lossless sizes from sampled bands of rows (1/8 of a 1080p+ frame, at least
+// 16 bands) and picks the smaller file.
+CodecChoice ChooseCodec(const ImageBuffer& image, ColorMode color_mode,
+                        float quality, JpegWorkspace* workspace = nullptr);
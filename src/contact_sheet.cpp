@@ -0,0 +1,331 @@
+#include "contact_sheet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cwchar>
+#include <filesystem>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "file_io.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "qoi_codec.h"
+#include "resample.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Промежуток между плитками и фон листа.
+constexpr uint32_t kTileGap = 2;
+constexpr uint8_t kBackground = 32;
+// Предел стороны кадра JPEG.
+constexpr uint32_t kMaxSheetSide = 65535;
+
+struct FrameFile {
+  fs::path path;
+  int hour = 0;
+  int display = 0;
+  ImageBuffer tile;
+  bool ok = false;
+  bool from_encoder = false;
+};
+
+// Обрабатывает элементы 0..count-1 на нескольких потоках; элементы
+// раздаются по одному — время кадров разное (JPEG, QOI, готовый эскиз).
+template <typename Fn>
+void RunWorkers(size_t count, int threads, Fn&& fn) {
+  size_t workers_count = threads > 0 ? static_cast<size_t>(threads)
+                                     : std::thread::hardware_concurrency();
+  workers_count = std::max<size_t>(1, std::min(workers_count, count));
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(workers_count - 1);
+  for (size_t i = 1; i < workers_count; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+bool ParseDigits(const std::wstring& text, size_t pos, size_t count,
+                 int* out) {
+  int value = 0;
+  for (size_t i = pos; i < pos + count; ++i) {
+    if (text[i] < L'0' || text[i] > L'9') {
+      return false;
+    }
+    value = value * 10 + (text[i] - L'0');
+  }
+  *out = value;
+  return true;
+}
+
+// Копирует tile в sheet с позиции (x, y).
+void Blit(const ImageBuffer& tile, uint32_t x, uint32_t y,
+          ImageBuffer* sheet) {
+  for (uint32_t row = 0; row < tile.height; ++row) {
+    std::copy_n(tile.pixels.data() + static_cast<size_t>(row) * tile.stride,
+                static_cast<size_t>(tile.width) * 4,
+                sheet->pixels.data() +
+                    static_cast<size_t>(y + row) * sheet->stride +
+                    static_cast<size_t>(x) * 4);
+  }
+}
+
+std::wstring SheetName(int hour, int display, bool multiple_displays) {
+  wchar_t name[64] = {};
+  if (multiple_displays) {
+    std::swprintf(name, 64, L"sheet_%02d_Display%02d.jpg", hour,
+                  display + 1);
+  } else {
+    std::swprintf(name, 64, L"sheet_%02d.jpg", hour);
+  }
+  return name;
+}
+
+// Лист одной группы кадров (час, дисплей): плитки по строкам слева направо.
+bool BuildSheet(const std::vector<const FrameFile*>& frames,
+                const ContactSheetOptions& options, const fs::path& path,
+                std::wstring* error) {
+  const uint32_t tile_width = frames.front()->tile.width;
+  const uint32_t tile_height = frames.front()->tile.height;
+  uint32_t columns = std::max<uint32_t>(1, options.columns);
+  columns = std::min<uint32_t>(columns, static_cast<uint32_t>(frames.size()));
+  // Обоснование: лист не выше предела JPEG — при частом захвате столбцов
+  // становится больше.
+  auto rows_for = [&](uint32_t cols) {
+    return static_cast<uint32_t>((frames.size() + cols - 1) / cols);
+  };
+  while (rows_for(columns) * (tile_height + kTileGap) + kTileGap >
+             kMaxSheetSide &&
+         (columns * 2) * (tile_width + kTileGap) + kTileGap <= kMaxSheetSide) {
+    columns *= 2;
+  }
+  const uint32_t rows = rows_for(columns);
+  ImageBuffer sheet;
+  sheet.width = columns * (tile_width + kTileGap) + kTileGap;
+  sheet.height = std::min(rows * (tile_height + kTileGap) + kTileGap,
+                          kMaxSheetSide);
+  sheet.stride = sheet.width * 4;
+  sheet.pixel_format = PixelFormat::kBgra8;
+  sheet.pixels.assign(static_cast<size_t>(sheet.stride) * sheet.height,
+                      kBackground);
+  ImageBuffer resized;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    const uint32_t x =
+        kTileGap + static_cast<uint32_t>(i % columns) * (tile_width + kTileGap);
+    const uint32_t y = kTileGap + static_cast<uint32_t>(i / columns) *
+                                      (tile_height + kTileGap);
+    if (y + tile_height > sheet.height) {
+      break;
+    }
+    // Кадр другого размера (смена разрешения за час) подгоняется к плитке.
+    const ImageBuffer* tile = &frames[i]->tile;
+    if (tile->width != tile_width || tile->height != tile_height) {
+      if (!ResampleImage(*tile, tile_width, tile_height,
+                         ResampleFilter::kAuto, 1, &resized, error)) {
+        return false;
+      }
+      tile = &resized;
+    }
+    Blit(*tile, x, y, &sheet);
+  }
+  JpegEncodeOptions encode_options;
+  encode_options.quality = options.jpeg_quality;
+  std::vector<uint8_t> jpeg;
+  return EncodeJpeg(sheet, encode_options, &jpeg, error) &&
+         WriteFileBytes(path.wstring(), jpeg, error);
+}
+
+}  // namespace
+
+std::wstring ThumbnailPathForFrame(const std::wstring& frame_path) {
+  const fs::path path(frame_path);
+  fs::path thumbnail = path.parent_path() / kThumbnailDirName / path.stem();
+  thumbnail += L".jpg";
+  return thumbnail.wstring();
+}
+
+bool ParseFrameFileName(const std::wstring& name, int* hour,
+                        int* display_index) {
+  const size_t dot = name.find_last_of(L'.');
+  std::wstring base = dot == std::wstring::npos ? name : name.substr(0, dot);
+  int display = 0;
+  // Суффикс дисплея "_DisplayNN" есть только при нескольких дисплеях.
+  const std::wstring suffix = L"_Display";
+  if (base.size() > suffix.size() + 2 &&
+      base.compare(base.size() - suffix.size() - 2, suffix.size(), suffix) ==
+          0) {
+    if (!ParseDigits(base, base.size() - 2, 2, &display) || display < 1) {
+      return false;
+    }
+    --display;
+    base.resize(base.size() - suffix.size() - 2);
+  }
+  // ..._YYYY-MM-DD_HH-MM-SS
+  constexpr size_t kStampLength = 20;
+  if (base.size() <= kStampLength) {
+    return false;
+  }
+  const size_t stamp = base.size() - kStampLength;
+  int parts[6] = {};
+  const size_t offsets[6] = {1, 6, 9, 12, 15, 18};
+  const size_t lengths[6] = {4, 2, 2, 2, 2, 2};
+  for (int i = 0; i < 6; ++i) {
+    if (!ParseDigits(base, stamp + offsets[i], lengths[i], &parts[i])) {
+      return false;
+    }
+  }
+  if (base[stamp] != L'_' || base[stamp + 5] != L'-' ||
+      base[stamp + 8] != L'-' || base[stamp + 11] != L'_' ||
+      base[stamp + 14] != L'-' || base[stamp + 17] != L'-' || parts[3] > 23) {
+    return false;
+  }
+  *hour = parts[3];
+  *display_index = display;
+  return true;
+}
+
+bool LoadFrameThumbnail(const std::wstring& frame_path, ImageBuffer* out,
+                        bool* from_encoder, std::wstring* error) {
+  std::vector<uint8_t> data;
+  const std::wstring thumbnail_path = ThumbnailPathForFrame(frame_path);
+  std::error_code ec;
+  if (fs::is_regular_file(thumbnail_path, ec) &&
+      ReadFileBytes(thumbnail_path, &data, nullptr) &&
+      DecodeJpeg(data, out, nullptr)) {
+    *from_encoder = true;
+    return true;
+  }
+  *from_encoder = false;
+  if (!ReadFileBytes(frame_path, &data, error)) {
+    return false;
+  }
+  if (fs::path(frame_path).extension() != L".qoi") {
+    return DecodeJpegDc(data, out, error);
+  }
+  ImageBuffer frame;
+  return DecodeQoi(data, &frame, error) &&
+         ResampleImage(frame, (frame.width + 7) / 8, (frame.height + 7) / 8,
+                       ResampleFilter::kAuto, 1, out, error);
+}
+
+std::wstring FormatContactSheetStats(const ContactSheetStats& stats) {
+  return L"кадров: " + std::to_wstring(stats.frames) +
+         L", готовых эскизов: " + std::to_wstring(stats.encoder_thumbnails) +
+         L", ошибок: " + std::to_wstring(stats.failed) + L", листов: " +
+         std::to_wstring(stats.sheets);
+}
+
+bool BuildDayContactSheets(const std::wstring& day_dir,
+                           const std::wstring& out_dir,
+                           const ContactSheetOptions& options,
+                           ContactSheetStats* stats, std::wstring* error) {
+  std::vector<FrameFile> files;
+  std::error_code ec;
+  for (const fs::directory_entry& entry :
+       fs::directory_iterator(fs::path(day_dir), ec)) {
+    const std::wstring extension = entry.path().extension().wstring();
+    FrameFile file;
+    if (entry.is_regular_file() &&
+        (extension == L".jpg" || extension == L".qoi") &&
+        ParseFrameFileName(entry.path().filename().wstring(), &file.hour,
+                           &file.display)) {
+      file.path = entry.path();
+      files.push_back(std::move(file));
+    }
+  }
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось прочитать папку дня: " + day_dir;
+    }
+    return false;
+  }
+  std::sort(files.begin(), files.end(),
+            [](const FrameFile& a, const FrameFile& b) {
+              return a.path.filename() < b.path.filename();
+            });
+  fs::create_directories(fs::path(out_dir), ec);
+
+  // Эскизы всех кадров дня параллельно; плитка — эскиз, уменьшенный до
+  // ширины плитки (ресемплер в одном потоке: потоки заняты кадрами).
+  RunWorkers(files.size(), options.threads, [&](size_t i) {
+    FrameFile& file = files[i];
+    ImageBuffer thumbnail;
+    if (!LoadFrameThumbnail(file.path.wstring(), &thumbnail,
+                            &file.from_encoder, nullptr)) {
+      return;
+    }
+    const uint32_t width = std::clamp<uint32_t>(options.tile_width, 1,
+                                                thumbnail.width);
+    const uint32_t height = std::max<uint32_t>(
+        1, static_cast<uint32_t>(std::lround(
+               static_cast<double>(thumbnail.height) * width /
+               thumbnail.width)));
+    if (width == thumbnail.width) {
+      file.tile = std::move(thumbnail);
+      file.ok = true;
+    } else {
+      file.ok = ResampleImage(thumbnail, width, height, ResampleFilter::kAuto,
+                              1, &file.tile, nullptr);
+    }
+  });
+
+  std::map<std::pair<int, int>, std::vector<const FrameFile*>> groups;
+  ContactSheetStats local;
+  int max_display = 0;
+  for (const FrameFile& file : files) {
+    ++local.frames;
+    if (!file.ok) {
+      ++local.failed;
+      continue;
+    }
+    if (file.from_encoder) {
+      ++local.encoder_thumbnails;
+    }
+    max_display = std::max(max_display, file.display);
+    groups[{file.hour, file.display}].push_back(&file);
+  }
+  std::vector<std::pair<std::pair<int, int>,
+                        const std::vector<const FrameFile*>*>>
+      sheets;
+  for (const auto& [key, frames] : groups) {
+    sheets.emplace_back(key, &frames);
+  }
+  std::vector<std::wstring> errors(sheets.size());
+  std::vector<char> written(sheets.size(), 0);
+  RunWorkers(sheets.size(), options.threads, [&](size_t i) {
+    const auto& [key, frames] = sheets[i];
+    const fs::path path =
+        fs::path(out_dir) / SheetName(key.first, key.second, max_display > 0);
+    written[i] = BuildSheet(*frames, options, path, &errors[i]) ? 1 : 0;
+  });
+  for (size_t i = 0; i < sheets.size(); ++i) {
+    if (!written[i]) {
+      if (error) {
+        *error = errors[i];
+      }
+      if (stats) {
+        *stats = local;
+      }
+      return false;
+    }
+    ++local.sheets;
+  }
+  if (stats) {
+    *stats = local;
+  }
+  return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "image_buffer.h"
+
+// Day review sheets: 1/8-scale thumbnails of the frame files of a day folder
+// (PC_USER_YYYY-MM-DD_HH-MM-SS[_DisplayNN].jpg|.qoi) tiled into one JPEG
+// per hour and display. A JPEG thumbnail costs only the entropy decoding of
+// the DC values; frames saved with --thumbnails carry a ready one in the
+// t subfolder of the day.
+
+// Subfolder of a day folder with encode-time thumbnails.
+inline constexpr wchar_t kThumbnailDirName[] = L"t";
+
+// Encode-time thumbnail of frame_path: <day>/t/<file name without
+// extension>.jpg.
+std::wstring ThumbnailPathForFrame(const std::wstring& frame_path);
+
+// Parses hour and display (from 0) of a frame file name.
+// Output: false for other names.
+bool ParseFrameFileName(const std::wstring& name, int* hour,
+                        int* display_index);
+
+// 1/8-scale BGRA8 thumbnail of a saved frame: the encode-time thumbnail when
+// present (from_encoder), else the DC values of a JPEG or a decoded and
+// reduced QOI frame. Output: false + error on an unreadable frame.
+bool LoadFrameThumbnail(const std::wstring& frame_path, ImageBuffer* out,
+                        bool* from_encoder, std::wstring* error);
+
+struct ContactSheetOptions {
+  // Tile width in pixels (at most the thumbnail width); the height keeps
+  // the aspect ratio of the first frame of the sheet.
+  uint32_t tile_width = 240;
+  uint32_t columns = 10;
+  // JPEG quality of the sheets (same scale as WIC).
+  float jpeg_quality = 0.75f;
+  // Worker threads (0: hardware concurrency).
+  int threads = 0;
+};
+
+struct ContactSheetStats {
+  uint64_t frames = 0;
+  uint64_t failed = 0;
+  // Frames with an encode-time thumbnail (no decoding of the frame).
+  uint64_t encoder_thumbnails = 0;
+  uint64_t sheets = 0;
+};
+
+std::wstring FormatContactSheetStats(const ContactSheetStats& stats);
+
+// Writes sheet_HH[_DisplayNN].jpg into out_dir for every hour and display
+// of the frame files in day_dir, tiles in time order. Thumbnails and sheets
+// are built on options.threads workers. Output: false + error when day_dir
+// cannot be listed or a sheet cannot be written; unreadable frames are
+// skipped and counted in stats.
+bool BuildDayContactSheets(const std::wstring& day_dir,
+                           const std::wstring& out_dir,
+                           const ContactSheetOptions& options,
+                           ContactSheetStats* stats, std::wstring* error);
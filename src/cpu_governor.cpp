@@ -0,0 +1,213 @@
+#include "cpu_governor.h"
+
+#include <cwchar>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <chrono>
+#include <ctime>
+#endif
+
+namespace {
+
+// Обоснование: удвоение ожидания запаса ограничено — после долгой
+// перегрузки регулятор все же пробует вернуть качество (при интервале
+// 10 с раз в ~10 минут).
+constexpr int kMaxUpWaitCycles = 64;
+
+}  // namespace
+
+const wchar_t kDefaultGovernorLevels[] =
+    L"quality,gray,scale:0.5,skip,interval:2";
+
+bool ParseGovernorLevels(const std::wstring& text,
+                         std::vector<GovernorLevel>* out,
+                         std::wstring* error) {
+  auto fail = [&](const std::wstring& step) {
+    if (error) {
+      *error = L"Некорректная ступень регулятора: " + step;
+    }
+    return false;
+  };
+  std::vector<GovernorLevel> levels;
+  GovernorLevel level;
+  std::wstringstream steps(text);
+  std::wstring item;
+  while (std::getline(steps, item, L',')) {
+    const size_t colon = item.find(L':');
+    const std::wstring name = item.substr(0, colon);
+    const std::wstring value =
+        colon == std::wstring::npos ? L"" : item.substr(colon + 1);
+    wchar_t* end = nullptr;
+    if (name == L"quality" && colon == std::wstring::npos) {
+      level.fixed_quality = true;
+    } else if (name == L"gray" && colon == std::wstring::npos) {
+      level.grayscale = true;
+    } else if (name == L"skip" && colon == std::wstring::npos) {
+      level.skip_unchanged = true;
+    } else if (name == L"scale") {
+      const float scale = std::wcstof(value.c_str(), &end);
+      if (value.empty() || *end != L'\0' || !(scale > 0.0f) ||
+          scale >= 1.0f) {
+        return fail(item);
+      }
+      level.scale *= scale;
+    } else if (name == L"interval") {
+      const long factor = std::wcstol(value.c_str(), &end, 10);
+      if (value.empty() || *end != L'\0' || factor < 2 || factor > 60) {
+        return fail(item);
+      }
+      level.interval_factor *= static_cast<int>(factor);
+    } else {
+      return fail(item);
+    }
+    levels.push_back(level);
+  }
+  if (levels.empty()) {
+    return fail(text);
+  }
+  if (out) {
+    *out = levels;
+  }
+  return true;
+}
+
+std::wstring FormatGovernorLevel(const GovernorLevel& level) {
+  std::wstring text;
+  auto add = [&](const std::wstring& part) {
+    text += (text.empty() ? L"" : L" + ") + part;
+  };
+  if (level.fixed_quality) {
+    add(L"quality");
+  }
+  if (level.grayscale) {
+    add(L"gray");
+  }
+  if (level.scale < 1.0f) {
+    wchar_t scale[16] = {};
+    std::swprintf(scale, 16, L"scale %.2f", level.scale);
+    add(scale);
+  }
+  if (level.skip_unchanged) {
+    add(L"skip");
+  }
+  if (level.interval_factor > 1) {
+    add(L"interval x" + std::to_wstring(level.interval_factor));
+  }
+  return text.empty() ? L"full" : text;
+}
+
+bool ProcessCpuMeter::Sample(CpuSample* out) {
+  if (!out) {
+    return false;
+  }
+#if defined(_WIN32)
+  FILETIME creation = {};
+  FILETIME exit = {};
+  FILETIME kernel = {};
+  FILETIME user = {};
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel,
+                       &user)) {
+    return false;
+  }
+  auto seconds = [](const FILETIME& time) {
+    ULARGE_INTEGER value = {};
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    return static_cast<double>(value.QuadPart) * 1e-7;
+  };
+  LARGE_INTEGER counter = {};
+  LARGE_INTEGER frequency = {};
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  out->cpu_seconds = seconds(kernel) + seconds(user);
+  out->wall_seconds = static_cast<double>(counter.QuadPart) /
+                      static_cast<double>(frequency.QuadPart);
+  return true;
+#else
+  timespec cpu = {};
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) != 0) {
+    return false;
+  }
+  out->cpu_seconds = static_cast<double>(cpu.tv_sec) + cpu.tv_nsec * 1e-9;
+  out->wall_seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+  return true;
+#endif
+}
+
+CpuGovernor::CpuGovernor(const CpuGovernorConfig& config, CpuMeter* meter)
+    : config_(config), meter_(meter), up_wait_(config.up_cycles) {
+  if (config_.processors == 0) {
+    config_.processors = 1;
+  }
+}
+
+void CpuGovernor::Start() {
+  started_ = meter_ && meter_->Sample(&last_);
+}
+
+const GovernorLevel& CpuGovernor::Current() const {
+  return level_ == 0 ? full_ : config_.levels[level_ - 1];
+}
+
+bool CpuGovernor::EndCycle(GovernorTransition* transition) {
+  CpuSample now;
+  if (!started_ || !meter_->Sample(&now)) {
+    return false;
+  }
+  const double wall = now.wall_seconds - last_.wall_seconds;
+  const double cpu = now.cpu_seconds - last_.cpu_seconds;
+  if (!(wall > 0.0)) {
+    return false;
+  }
+  last_ = now;
+  usage_percent_ = cpu / (wall * config_.processors) * 100.0;
+  ++cycles_at_level_;
+  // Повышение удержалось дольше окна понижения — ожидание снова обычное.
+  if (probing_ && cycles_at_level_ > config_.down_cycles) {
+    probing_ = false;
+    up_wait_ = config_.up_cycles;
+  }
+
+  // Обоснование: между порогами (ниже бюджета, но без запаса up_share)
+  // уровень держится — иначе шаг вверх сразу вернул бы перегрузку.
+  if (usage_percent_ > config_.budget_percent) {
+    ++over_;
+    under_ = 0;
+  } else if (usage_percent_ < config_.budget_percent * config_.up_share) {
+    ++under_;
+    over_ = 0;
+  } else {
+    over_ = 0;
+    under_ = 0;
+  }
+
+  const int from = level_;
+  if (over_ >= config_.down_cycles && level_ < Levels()) {
+    ++level_;
+    if (probing_) {
+      up_wait_ = up_wait_ * 2 < kMaxUpWaitCycles ? up_wait_ * 2
+                                                 : kMaxUpWaitCycles;
+    }
+    probing_ = false;
+  } else if (under_ >= up_wait_ && level_ > 0) {
+    --level_;
+    probing_ = true;
+  }
+  if (level_ == from) {
+    return false;
+  }
+  over_ = 0;
+  under_ = 0;
+  cycles_at_level_ = 0;
+  if (transition) {
+    transition->from_level = from;
+    transition->to_level = level_;
+    transition->usage_percent = usage_percent_;
+  }
+  return true;
+}
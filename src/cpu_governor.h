@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// CPU budget governor (--cpu-budget-percent): measures the CPU time of the
+// process per capture cycle and steps through degradation levels while the
+// share stays over budget, back up when headroom returns. Levels are
+// cumulative; level 0 is the configuration as given.
+
+struct GovernorLevel {
+  // Rate control and optimized Huffman tables off, codec auto -> jpeg: one
+  // encode pass at the minimum quality.
+  bool fixed_quality = false;
+  bool grayscale = false;
+  // Extra linear scale on top of --scale (1: none).
+  float scale = 1.0f;
+  // Displays whose frame did not change since the previous cycle are not
+  // encoded.
+  bool skip_unchanged = false;
+  // Capture interval multiplier.
+  int interval_factor = 1;
+};
+
+// Default ladder: "quality,gray,scale:0.5,skip,interval:2".
+extern const wchar_t kDefaultGovernorLevels[];
+
+// Parses "STEP[,...]", STEP = quality | gray | scale:F | skip | interval:N;
+// every step adds a level with that change on top of the previous level.
+// Output: false + error on an unknown step, F outside (0, 1) or N outside
+// 2..60.
+bool ParseGovernorLevels(const std::wstring& text,
+                         std::vector<GovernorLevel>* out,
+                         std::wstring* error);
+// "quality + gray + scale 0.50 + skip + interval x2"; "full" for level 0.
+std::wstring FormatGovernorLevel(const GovernorLevel& level);
+
+struct CpuSample {
+  // CPU time of all threads of the process.
+  double cpu_seconds = 0;
+  // Monotonic wall clock.
+  double wall_seconds = 0;
+};
+
+// Source of CPU samples; tests substitute a synthetic clock and meter.
+class CpuMeter {
+ public:
+  virtual ~CpuMeter() = default;
+  // Output: false when the platform does not report CPU time.
+  virtual bool Sample(CpuSample* out) = 0;
+};
+
+// GetProcessTimes on Windows, CLOCK_PROCESS_CPUTIME_ID elsewhere.
+class ProcessCpuMeter : public CpuMeter {
+ public:
+  bool Sample(CpuSample* out) override;
+};
+
+struct CpuGovernorConfig {
+  // Share of all logical processors, percent (Task Manager scale).
+  double budget_percent = 0;
+  unsigned processors = 1;
+  // Levels 1..N.
+  std::vector<GovernorLevel> levels;
+  // Cycles in a row over budget before stepping down.
+  int down_cycles = 2;
+  // Cycles in a row under budget * up_share before stepping up.
+  int up_cycles = 5;
+  double up_share = 0.6;
+};
+
+struct GovernorTransition {
+  int from_level = 0;
+  int to_level = 0;
+  // Share of the cycle that triggered the transition, percent.
+  double usage_percent = 0;
+};
+
+class CpuGovernor {
+ public:
+  // meter must outlive the governor.
+  CpuGovernor(const CpuGovernorConfig& config, CpuMeter* meter);
+
+  // Takes the first sample; the first EndCycle measures from here.
+  void Start();
+  // Measures the share since the previous call (work and the sleep after
+  // it) and changes the level by at most one step. Output: true +
+  // transition when the level changed.
+  bool EndCycle(GovernorTransition* transition);
+
+  int Level() const { return level_; }
+  int Levels() const { return static_cast<int>(config_.levels.size()); }
+  // Settings of the current level.
+  const GovernorLevel& Current() const;
+  // Share of the last measured cycle, percent (-1 before the first one).
+  double UsagePercent() const { return usage_percent_; }
+
+ private:
+  CpuGovernorConfig config_;
+  CpuMeter* meter_;
+  GovernorLevel full_;
+  CpuSample last_;
+  bool started_ = false;
+  int level_ = 0;
+  double usage_percent_ = -1;
+  int over_ = 0;
+  int under_ = 0;
+  // Cycles of headroom required before the next step up; doubles when a
+  // step up has to be undone right away.
+  int up_wait_ = 0;
+  bool probing_ = false;
+  int cycles_at_level_ = 0;
+};
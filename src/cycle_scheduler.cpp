@@ -0,0 +1,195 @@
+#include "cycle_scheduler.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <ctime>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+#if defined(_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+SystemCycleClock::SystemCycleClock() {
+#if defined(_WIN32)
+  LARGE_INTEGER frequency = {};
+  QueryPerformanceFrequency(&frequency);
+  frequency_ = frequency.QuadPart;
+  // Обоснование: обычный таймер ожидания срабатывает с шагом системного
+  // тика (до 15.6 мс); таймер высокого разрешения — без timeBeginPeriod
+  // для всей системы.
+  timer_ = CreateWaitableTimerExW(nullptr, nullptr,
+                                  CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                  TIMER_ALL_ACCESS);
+  if (!timer_) {
+    timer_ = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+  }
+#elif defined(__linux__)
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif
+}
+
+SystemCycleClock::~SystemCycleClock() {
+#if defined(_WIN32)
+  if (timer_) {
+    CloseHandle(timer_);
+  }
+#elif defined(__linux__)
+  if (timer_fd_ >= 0) {
+    close(timer_fd_);
+  }
+#endif
+}
+
+int64_t SystemCycleClock::Now() {
+#if defined(_WIN32)
+  LARGE_INTEGER counter = {};
+  QueryPerformanceCounter(&counter);
+  // Деление по частям: counter * 1e9 переполнил бы int64 через ~10 суток
+  // работы при частоте 10 МГц.
+  return counter.QuadPart / frequency_ * 1000000000 +
+         counter.QuadPart % frequency_ * 1000000000 / frequency_;
+#elif defined(__linux__)
+  timespec now = {};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+void SystemCycleClock::SleepUntil(int64_t deadline) {
+#if defined(_WIN32)
+  // Таймер ожидания берет абсолютное время по системным часам, которые
+  // переводятся; срок по QPC пересчитывается в относительный на каждом
+  // круге, пока QPC не дойдет до него.
+  for (int64_t left = deadline - Now(); left > 0; left = deadline - Now()) {
+    if (!timer_) {
+      Sleep(static_cast<DWORD>(left / 1000000 + 1));
+      continue;
+    }
+    LARGE_INTEGER due = {};
+    due.QuadPart = -(left / 100 > 0 ? left / 100 : 1);
+    if (!SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE)) {
+      Sleep(static_cast<DWORD>(left / 1000000 + 1));
+      continue;
+    }
+    WaitForSingleObject(timer_, INFINITE);
+  }
+#elif defined(__linux__)
+  if (deadline <= Now()) {
+    return;
+  }
+  itimerspec spec = {};
+  spec.it_value.tv_sec = static_cast<time_t>(deadline / 1000000000);
+  spec.it_value.tv_nsec = static_cast<long>(deadline % 1000000000);
+  if (timer_fd_ < 0 ||
+      timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+    const timespec until = spec.it_value;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until,
+                           nullptr) == EINTR) {
+    }
+    return;
+  }
+  uint64_t expirations = 0;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) < 0 &&
+         errno == EINTR) {
+  }
+#else
+  std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::nanoseconds(deadline))));
+#endif
+}
+
+bool ParseOverrunPolicy(const std::wstring& value, OverrunPolicy* out) {
+  if (!out) {
+    return false;
+  }
+  if (value == L"skip") {
+    *out = OverrunPolicy::kSkip;
+  } else if (value == L"catch-up") {
+    *out = OverrunPolicy::kCatchUp;
+  } else if (value == L"coalesce") {
+    *out = OverrunPolicy::kCoalesce;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const wchar_t* OverrunPolicyName(OverrunPolicy policy) {
+  switch (policy) {
+    case OverrunPolicy::kSkip:
+      return L"skip";
+    case OverrunPolicy::kCatchUp:
+      return L"catch-up";
+    case OverrunPolicy::kCoalesce:
+      return L"coalesce";
+  }
+  return L"?";
+}
+
+CycleScheduler::CycleScheduler(CycleClock* clock, int64_t period_ns,
+                               OverrunPolicy policy)
+    : clock_(clock), period_(period_ns > 0 ? period_ns : 1),
+      policy_(policy) {}
+
+CycleTick CycleScheduler::Wait() {
+  CycleTick tick;
+  tick.index = stats_.cycles;
+  const int64_t now = clock_->Now();
+  if (!started_) {
+    started_ = true;
+    next_ = now;
+  }
+  int64_t deadline = next_;
+  if (stats_.cycles > 0 && now > deadline) {
+    tick.overrun = true;
+    // Сроки сетки после deadline, которые тоже уже прошли.
+    const int64_t passed = (now - deadline) / period_;
+    switch (policy_) {
+      case OverrunPolicy::kSkip:
+        deadline += (passed + 1) * period_;
+        tick.missed = static_cast<uint64_t>(passed + 1);
+        break;
+      case OverrunPolicy::kCatchUp:
+        break;
+      case OverrunPolicy::kCoalesce:
+        deadline += passed * period_;
+        tick.missed = static_cast<uint64_t>(passed);
+        break;
+    }
+  }
+  clock_->SleepUntil(deadline);
+  tick.deadline = deadline;
+  tick.start = clock_->Now();
+  tick.lateness = tick.start > deadline ? tick.start - deadline : 0;
+  deadline_ = deadline;
+  next_ = deadline + period_;
+
+  ++stats_.cycles;
+  stats_.overruns += tick.overrun ? 1 : 0;
+  stats_.missed += tick.missed;
+  stats_.last_lateness = tick.lateness;
+  stats_.max_lateness =
+      tick.lateness > stats_.max_lateness ? tick.lateness : stats_.max_lateness;
+  stats_.total_lateness += tick.lateness;
+  return tick;
+}
+
+void CycleScheduler::SetPeriod(int64_t period_ns) {
+  period_ = period_ns > 0 ? period_ns : 1;
+  if (started_) {
+    next_ = deadline_ + period_;
+  }
+}
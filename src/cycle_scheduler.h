@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Capture cycle scheduler: cycle k is due at start + k * period (absolute
+// deadlines, so wake-up jitter and cycle length never shift later
+// cycles). A cycle that runs past the next deadline is an overrun; the
+// policy decides what happens to the deadlines it missed. Lateness (start
+// of a cycle minus its deadline) is measured for every cycle.
+
+// Monotonic clock with absolute sleeps; tests substitute a synthetic one.
+class CycleClock {
+ public:
+  virtual ~CycleClock() = default;
+  // Nanoseconds since an arbitrary epoch.
+  virtual int64_t Now() = 0;
+  // Returns once Now() >= deadline (at once when it already is).
+  virtual void SleepUntil(int64_t deadline) = 0;
+};
+
+// CLOCK_MONOTONIC + timerfd with TFD_TIMER_ABSTIME on Linux, QPC + a
+// high-resolution waitable timer on Windows (Windows 10 1803+; a regular
+// waitable timer before), steady_clock elsewhere.
+class SystemCycleClock : public CycleClock {
+ public:
+  SystemCycleClock();
+  ~SystemCycleClock() override;
+  SystemCycleClock(const SystemCycleClock&) = delete;
+  SystemCycleClock& operator=(const SystemCycleClock&) = delete;
+
+  int64_t Now() override;
+  void SleepUntil(int64_t deadline) override;
+
+ private:
+#if defined(_WIN32)
+  void* timer_ = nullptr;
+  int64_t frequency_ = 1;
+#elif defined(__linux__)
+  int timer_fd_ = -1;
+#endif
+};
+
+enum class OverrunPolicy {
+  // Missed deadlines are dropped; the next cycle waits for the next
+  // deadline on the grid.
+  kSkip,
+  // Every missed deadline gets its cycle, back to back, until the
+  // schedule is caught up.
+  kCatchUp,
+  // One cycle at once for all missed deadlines, then back on the grid.
+  kCoalesce,
+};
+
+// Parses "skip" / "catch-up" / "coalesce". Output: false if unknown.
+bool ParseOverrunPolicy(const std::wstring& value, OverrunPolicy* out);
+const wchar_t* OverrunPolicyName(OverrunPolicy policy);
+
+struct CycleTick {
+  // Cycle number from 0.
+  uint64_t index = 0;
+  // Deadline the cycle runs for and its actual start, clock ns.
+  int64_t deadline = 0;
+  int64_t start = 0;
+  // start - deadline, >= 0.
+  int64_t lateness = 0;
+  // The previous cycle ran past this deadline.
+  bool overrun = false;
+  // Deadlines passed without a cycle of their own before this one
+  // (dropped by kSkip, folded into this cycle by kCoalesce).
+  uint64_t missed = 0;
+};
+
+struct CycleStats {
+  uint64_t cycles = 0;
+  uint64_t overruns = 0;
+  uint64_t missed = 0;
+  int64_t last_lateness = 0;
+  int64_t max_lateness = 0;
+  int64_t total_lateness = 0;
+};
+
+class CycleScheduler {
+ public:
+  // clock must outlive the scheduler; period_ns > 0.
+  CycleScheduler(CycleClock* clock, int64_t period_ns, OverrunPolicy policy);
+
+  // Blocks until the next cycle is due under the policy (the first call
+  // returns at once and anchors the grid).
+  CycleTick Wait();
+  // New period from the deadline of the current cycle on (the grid is
+  // re-anchored there).
+  void SetPeriod(int64_t period_ns);
+
+  int64_t Period() const { return period_; }
+  OverrunPolicy Policy() const { return policy_; }
+  const CycleStats& Stats() const { return stats_; }
+
+ private:
+  CycleClock* clock_;
+  int64_t period_;
+  OverrunPolicy policy_;
+  bool started_ = false;
+  // Deadline of the current cycle and of the next one.
+  int64_t deadline_ = 0;
+  int64_t next_ = 0;
+  CycleStats stats_;
+};
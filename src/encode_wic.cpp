@@ -4,6 +4,8 @@
 
 #include <wrl/client.h>
 
+#include "pixel_convert.h"
+
 using Microsoft::WRL::ComPtr;
 
 namespace {
@@ -18,10 +20,37 @@ float ClampQuality(float quality) {
   return quality;
 }
 
+// Returns WIC pixel format for layouts WIC reads directly.
+bool WicPixelFormatFor(PixelFormat format, GUID* out) {
+  switch (format) {
+    case PixelFormat::kBgra8:
+      *out = GUID_WICPixelFormat32bppBGRA;
+      return true;
+    case PixelFormat::kRgba8:
+      *out = GUID_WICPixelFormat32bppRGBA;
+      return true;
+    default:
+      return false;
+  }
+}
+
+WICJpegYCrCbSubsamplingOption WicSubsamplingFor(ColorMode mode) {
+  switch (mode) {
+    case ColorMode::k422:
+      return WICJpegYCrCbSubsampling422;
+    case ColorMode::k444:
+      return WICJpegYCrCbSubsampling444;
+    case ColorMode::k420:
+    default:
+      return WICJpegYCrCbSubsampling420;
+  }
+}
+
 }  // namespace
 
 bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
-              std::wstring* error, HRESULT* hr_out) {
+              ColorMode color_mode, std::wstring* error, HRESULT* hr_out,
+              WicJpegContext* context) {
   if (image.width == 0 || image.height == 0 || image.stride == 0 ||
       image.pixels.empty()) {
     if (error) {
@@ -34,19 +63,59 @@ bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
   }
 
   quality = ClampQuality(quality);
+  WicJpegContext local;
+  if (!context) {
+    context = &local;
+  }
 
-  ComPtr<IWICImagingFactory> factory;
-  HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr,
-                                CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
-  if (FAILED(hr)) {
-    if (error) {
-      *error = L"Не удалось создать WIC фабрику.";
+  // Обоснование: 10-бит и FP16 WIC конвертирует медленно и без тонмаппинга,
+  // поэтому сначала приводим их к BGRA8 векторизованными ядрами.
+  const ImageBuffer* source = &image;
+  ImageBuffer& converted = context->converted;
+  GUID source_format = {};
+  if (color_mode == ColorMode::kGray) {
+    // Обоснование: яркость считаем своим SIMD-ядром, WIC получает готовый
+    // 8bpp Gray и пишет однокомпонентный JPEG без конвертации цветности.
+    converted.width = image.width;
+    converted.height = image.height;
+    converted.stride = image.width;
+    if (!ConvertToGray8(image, &converted.pixels, error)) {
+      if (hr_out) {
+        *hr_out = E_INVALIDARG;
+      }
+      return false;
     }
-    if (hr_out) {
-      *hr_out = hr;
+    source = &converted;
+    source_format = GUID_WICPixelFormat8bppGray;
+  } else if (!WicPixelFormatFor(image.pixel_format, &source_format)) {
+    if (!ConvertToBgra8(image, &converted, DefaultToneMapLut(), error)) {
+      if (hr_out) {
+        *hr_out = E_INVALIDARG;
+      }
+      return false;
+    }
+    source = &converted;
+    source_format = GUID_WICPixelFormat32bppBGRA;
+  }
+
+  // Обоснование: создание фабрики — самый дорогой шаг WIC (загрузка
+  // кодеков через COM), с контекстом дисплея она создается один раз.
+  HRESULT hr = S_OK;
+  if (!context->factory) {
+    hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr,
+                          CLSCTX_INPROC_SERVER,
+                          IID_PPV_ARGS(&context->factory));
+    if (FAILED(hr)) {
+      if (error) {
+        *error = L"Не удалось создать WIC фабрику.";
+      }
+      if (hr_out) {
+        *hr_out = hr;
+      }
+      return false;
     }
-    return false;
   }
+  IWICImagingFactory* factory = context->factory.Get();
 
   ComPtr<IWICStream> stream;
   hr = factory->CreateStream(&stream);
@@ -107,12 +176,17 @@ bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
     return false;
   }
 
-  PROPBAG2 option = {};
-  option.pstrName = const_cast<wchar_t*>(L"ImageQuality");
-  VARIANT var = {};
-  var.vt = VT_R4;
-  var.fltVal = quality;
-  hr = props->Write(1, &option, &var);
+  PROPBAG2 options[2] = {};
+  options[0].pstrName = const_cast<wchar_t*>(L"ImageQuality");
+  options[1].pstrName = const_cast<wchar_t*>(L"JpegYCrCbSubsampling");
+  VARIANT vars[2] = {};
+  vars[0].vt = VT_R4;
+  vars[0].fltVal = quality;
+  vars[1].vt = VT_UI1;
+  vars[1].bVal = static_cast<BYTE>(WicSubsamplingFor(color_mode));
+  // Для gray субдискретизация не применяется: пишем только качество.
+  const ULONG option_count = color_mode == ColorMode::kGray ? 1 : 2;
+  hr = props->Write(option_count, options, vars);
   if (FAILED(hr)) {
     if (error) {
       *error = L"Не удалось задать качество JPEG.";
@@ -134,7 +208,9 @@ bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
     return false;
   }
 
-  GUID target_format = GUID_WICPixelFormat24bppBGR;
+  GUID target_format = color_mode == ColorMode::kGray
+                           ? GUID_WICPixelFormat8bppGray
+                           : GUID_WICPixelFormat24bppBGR;
   hr = frame->SetPixelFormat(&target_format);
   if (FAILED(hr)) {
     if (error) {
@@ -148,9 +224,9 @@ bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
 
   ComPtr<IWICBitmap> bitmap;
   hr = factory->CreateBitmapFromMemory(
-      image.width, image.height, image.pixel_format, image.stride,
-      static_cast<UINT>(image.pixels.size()),
-      const_cast<BYTE*>(image.pixels.data()), &bitmap);
+      source->width, source->height, source_format, source->stride,
+      static_cast<UINT>(source->pixels.size()),
+      const_cast<BYTE*>(source->pixels.data()), &bitmap);
   if (FAILED(hr)) {
     if (error) {
       *error = L"Не удалось создать WIC bitmap из буфера.";
@@ -161,7 +237,7 @@ bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
     return false;
   }
 
-  if (target_format != image.pixel_format) {
+  if (target_format != source_format) {
     ComPtr<IWICFormatConverter> converter;
     hr = factory->CreateFormatConverter(&converter);
     if (FAILED(hr)) {
@@ -1,21 +1,26 @@
 #pragma once
 
-#include <cstdint>
 #include <string>
-#include <vector>
 
 #include <wincodec.h>
+#include <wrl/client.h>
 
-// Image buffer in memory (BGRA by default).
-struct ImageBuffer {
-  uint32_t width = 0;
-  uint32_t height = 0;
-  uint32_t stride = 0;
-  GUID pixel_format = GUID_WICPixelFormat32bppBGRA;
-  std::vector<uint8_t> pixels;
+#include "image_buffer.h"
+#include "jpeg_encoder.h"
+
+// WIC state of one display reused between frames: the imaging factory and
+// the gray/tone-mapping buffer. Encoder and frame objects are bound to one
+// output stream and are still created per file.
+struct WicJpegContext {
+  Microsoft::WRL::ComPtr<IWICImagingFactory> factory;
+  ImageBuffer converted;
 };
 
 // Saves buffer to JPEG via WIC.
-// Input: quality in 0.01..1.0. Output: true on success, else error/hr.
+// Input: quality in 0.01..1.0, any PixelFormat (10-bit/FP16 are tone-mapped
+// to 8-bit first), color mode (gray = single-channel JPEG), optional context
+// (nullptr = factory and buffers created for this call only).
+// Output: true on success, else error/hr.
 bool SaveJpeg(const ImageBuffer& image, const std::wstring& path, float quality,
-              std::wstring* error, HRESULT* hr);
+              ColorMode color_mode, std::wstring* error, HRESULT* hr,
+              WicJpegContext* context = nullptr);
@@ -0,0 +1,301 @@
+#include <Windows.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cwchar>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "codec_select.h"
+#include "contact_sheet.h"
+#include "file_io.h"
+#include "frame_archive.h"
+#include "frame_store.h"
+#include "path_utils.h"
+#include "time_utils.h"
+
+// p2_extract: restores the per-file layout (root/PC_USER/YYYY-MM/DD/*.jpg)
+// from a daily frame archive written with --archive or from a day reference
+// log of the frame store written with --dedup; builds the hourly contact
+// sheets of a day folder.
+
+namespace {
+
+struct ExtractOptions {
+  std::wstring pack_path;
+  std::wstring refs_path;
+  std::wstring sheets_dir;
+  std::wstring out_dir;
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+};
+
+void PrintUsage() {
+  std::wcerr << L"Использование: p2_extract --pack <файл.p2pack> --out <путь>\n"
+             << L"       p2_extract --refs <файл.p2refs> [--out <путь>]\n"
+             << L"       p2_extract --sheets <папка дня> [--out <путь>]\n"
+             << L"                  [--from YYYY-MM-DD_HH-MM-SS] "
+                L"[--to YYYY-MM-DD_HH-MM-SS]\n";
+  std::wcerr << L"Индекс берется рядом с архивом (.p2idx); границы --from/--to "
+                L"включительно.\n";
+  std::wcerr << L"--refs печатает статистику дедупликации дня; с --out "
+                L"восстанавливает файлы из хранилища.\n";
+  std::wcerr << L"--sheets строит листы эскизов по часам и дисплеям "
+                L"(по умолчанию в подпапку sheets папки дня).\n";
+}
+
+// Разбирает время в формате имен файлов: YYYY-MM-DD_HH-MM-SS.
+bool ParseTimestampArg(const std::wstring& value, int64_t* out) {
+  DateTimeParts dt;
+  wchar_t tail = 0;
+  if (swscanf_s(value.c_str(), L"%4d-%2d-%2d_%2d-%2d-%2d%c", &dt.year,
+                &dt.month, &dt.day, &dt.hour, &dt.minute, &dt.second, &tail,
+                1u) != 6 ||
+      dt.month < 1 || dt.month > 12 || dt.day < 1 || dt.day > 31 ||
+      dt.hour > 23 || dt.minute > 59 || dt.second > 59) {
+    return false;
+  }
+  *out = ArchiveTimestamp(dt);
+  return true;
+}
+
+bool ParseArgs(int argc, wchar_t* argv[], ExtractOptions* options,
+               std::wstring* error) {
+  for (int i = 1; i < argc; ++i) {
+    const std::wstring arg = argv[i];
+    if (arg == L"--help" || arg == L"-h" || arg == L"/?") {
+      return false;
+    }
+    if (i + 1 >= argc) {
+      *error = L"Не указан аргумент после " + arg + L".";
+      return false;
+    }
+    const std::wstring value = argv[++i];
+    if (arg == L"--pack") {
+      options->pack_path = value;
+    } else if (arg == L"--refs") {
+      options->refs_path = value;
+    } else if (arg == L"--sheets") {
+      options->sheets_dir = value;
+    } else if (arg == L"--out") {
+      options->out_dir = value;
+    } else if (arg == L"--from") {
+      if (!ParseTimestampArg(value, &options->from)) {
+        *error = L"Некорректное значение --from.";
+        return false;
+      }
+    } else if (arg == L"--to") {
+      if (!ParseTimestampArg(value, &options->to)) {
+        *error = L"Некорректное значение --to.";
+        return false;
+      }
+    } else {
+      *error = L"Неизвестный аргумент: " + arg;
+      return false;
+    }
+  }
+  if (!options->sheets_dir.empty()) {
+    if (!options->pack_path.empty() || !options->refs_path.empty()) {
+      *error = L"--sheets несовместим с --pack и --refs.";
+      return false;
+    }
+    return true;
+  }
+  if (!options->refs_path.empty()) {
+    if (!options->pack_path.empty()) {
+      *error = L"--refs несовместим с --pack.";
+      return false;
+    }
+    return true;
+  }
+  if (options->pack_path.empty() || options->out_dir.empty()) {
+    *error = L"Нужны --pack и --out (или --refs).";
+    return false;
+  }
+  return true;
+}
+
+std::wstring IndexPathForPack(const std::wstring& pack_path) {
+  const size_t dot = pack_path.find_last_of(L'.');
+  const size_t slash = pack_path.find_last_of(L"\\/");
+  if (dot == std::wstring::npos ||
+      (slash != std::wstring::npos && dot < slash)) {
+    return pack_path + L".p2idx";
+  }
+  return pack_path.substr(0, dot) + L".p2idx";
+}
+
+// Журнал лежит в <хранилище>/refs: хранилище — папка над ним.
+std::wstring StoreDirForRefs(const std::wstring& refs_path) {
+  const size_t slash = refs_path.find_last_of(L"\\/");
+  const std::wstring refs_dir =
+      slash == std::wstring::npos ? L"." : refs_path.substr(0, slash);
+  const size_t parent = refs_dir.find_last_of(L"\\/");
+  return parent == std::wstring::npos ? L"." : refs_dir.substr(0, parent);
+}
+
+// Папка дня кадра в выходном дереве; создается при смене даты.
+bool EnsureDayDir(const std::wstring& out_dir, const std::wstring& pc_user,
+                  const DateTimeParts& dt, std::wstring* day_key,
+                  std::wstring* day_dir, std::wstring* error) {
+  if (FormatDate(dt) == *day_key) {
+    return true;
+  }
+  OutputPaths paths;
+  std::vector<std::wstring> created;
+  if (!BuildOutputPaths(out_dir, pc_user, dt, &paths, error) ||
+      !EnsureDirectories(paths, &created, error)) {
+    return false;
+  }
+  *day_dir = paths.day_dir;
+  *day_key = FormatDate(dt);
+  return true;
+}
+
+// Режим --refs: статистика дня и восстановление файлов из объектов.
+int ExtractReferences(const ExtractOptions& options) {
+  std::wstring error;
+  ArchiveIdentity identity;
+  std::vector<StoreReference> references;
+  if (!ReadStoreReferences(options.refs_path, &identity, &references,
+                           &error)) {
+    std::wcerr << error << L"\n";
+    return 2;
+  }
+  std::wcout << FormatDedupStats(ComputeDedupStats(references)) << L"\n";
+  if (options.out_dir.empty()) {
+    return 0;
+  }
+  const std::wstring store_dir = StoreDirForRefs(options.refs_path);
+  const std::wstring pc_user = identity.computer + L"_" + identity.user;
+  std::vector<uint8_t> data;
+  std::wstring day_dir;
+  std::wstring day_key;
+  size_t extracted = 0;
+  size_t failed = 0;
+  for (const StoreReference& reference : references) {
+    if (reference.timestamp < options.from ||
+        reference.timestamp > options.to) {
+      continue;
+    }
+    const DateTimeParts dt = ArchiveDateTime(reference.timestamp);
+    if (!EnsureDayDir(options.out_dir, pc_user, dt, &day_key, &day_dir,
+                      &error)) {
+      std::wcerr << error << L"\n";
+      return 2;
+    }
+    const std::wstring path = JoinPath(
+        day_dir, BuildFileName(identity.computer, identity.user, dt,
+                               reference.display_index,
+                               reference.display_count,
+                               OutputCodecExtension(reference.codec)));
+    if (!ReadFileBytes(StoreObjectPath(store_dir, reference.key,
+                                       reference.codec),
+                       &data, &error) ||
+        !WriteFileBytes(path, data, &error)) {
+      std::wcerr << error << L"\n";
+      ++failed;
+      continue;
+    }
+    ++extracted;
+  }
+  std::wcout << L"Извлечено кадров: " << extracted << L", ошибок: " << failed
+             << L"\n";
+  return failed > 0 ? 2 : 0;
+}
+
+// Режим --sheets: листы эскизов дня по часам и дисплеям.
+int BuildSheets(const ExtractOptions& options) {
+  const std::wstring out_dir = options.out_dir.empty()
+                                   ? JoinPath(options.sheets_dir, L"sheets")
+                                   : options.out_dir;
+  const auto start = std::chrono::steady_clock::now();
+  ContactSheetStats stats;
+  std::wstring error;
+  const bool ok = BuildDayContactSheets(options.sheets_dir, out_dir,
+                                        ContactSheetOptions{}, &stats, &error);
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  std::wcout << FormatContactSheetStats(stats) << L", мс: " << ms << L"\n";
+  if (!ok) {
+    std::wcerr << error << L"\n";
+    return 2;
+  }
+  std::wcout << L"Листы: " << out_dir << L"\n";
+  return stats.failed > 0 ? 2 : 0;
+}
+
+}  // namespace
+
+int wmain(int argc, wchar_t* argv[]) {
+  ExtractOptions options;
+  std::wstring error;
+  if (!ParseArgs(argc, argv, &options, &error)) {
+    if (!error.empty()) {
+      std::wcerr << error << L"\n";
+    }
+    PrintUsage();
+    return 1;
+  }
+  if (!options.sheets_dir.empty()) {
+    return BuildSheets(options);
+  }
+  if (!options.refs_path.empty()) {
+    return ExtractReferences(options);
+  }
+
+  ArchiveIndexView index;
+  FrameArchiveReader reader;
+  if (!index.Open(IndexPathForPack(options.pack_path), &error) ||
+      !reader.Open(options.pack_path, &error)) {
+    std::wcerr << error << L"\n";
+    return 2;
+  }
+  const ArchiveIdentity& identity = reader.Identity();
+  const std::wstring pc_user = identity.computer + L"_" + identity.user;
+
+  // Обоснование: при упорядоченном индексе начало диапазона находится
+  // бинарным поиском по отображению, а перебор останавливается на первой
+  // записи после --to.
+  const bool sorted = index.Sorted();
+  size_t first = sorted ? index.LowerBound(options.from) : 0;
+  std::vector<uint8_t> data;
+  std::wstring day_dir;
+  std::wstring day_key;
+  size_t extracted = 0;
+  size_t failed = 0;
+  for (size_t i = first; i < index.Size(); ++i) {
+    const ArchiveEntry entry = index.Entry(i);
+    if (entry.timestamp > options.to) {
+      if (sorted) {
+        break;
+      }
+      continue;
+    }
+    if (entry.timestamp < options.from) {
+      continue;
+    }
+    const DateTimeParts dt = ArchiveDateTime(entry.timestamp);
+    if (!EnsureDayDir(options.out_dir, pc_user, dt, &day_key, &day_dir,
+                      &error)) {
+      std::wcerr << error << L"\n";
+      return 2;
+    }
+    const std::wstring path = JoinPath(
+        day_dir, BuildFileName(identity.computer, identity.user, dt,
+                               entry.display_index, entry.display_count,
+                               OutputCodecExtension(entry.codec)));
+    if (!reader.Read(entry, &data, &error) ||
+        !WriteFileBytes(path, data, &error)) {
+      std::wcerr << error << L"\n";
+      ++failed;
+      continue;
+    }
+    ++extracted;
+  }
+  std::wcout << L"Извлечено кадров: " << extracted << L", ошибок: " << failed
+             << L"\n";
+  return failed > 0 ? 2 : 0;
+}
@@ -0,0 +1,93 @@
+#include "file_io.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "perf_counters.h"
+
+bool WriteFileBytes(const std::wstring& path, const std::vector<uint8_t>& bytes,
+                    std::wstring* error) {
+  const PerfScope perf_scope(PerfStage::kWrite);
+  // Обоснование: дескриптор ОС вместо std::ofstream — файл пишется одним
+  // вызовом без буфера потока и без выделений памяти на кадр (на Linux
+  // остается только перевод пути в байты).
+#if defined(_WIN32)
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  const bool opened = file != INVALID_HANDLE_VALUE;
+#else
+  const std::filesystem::path native(path);
+  const int file =
+      open(native.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  const bool opened = file >= 0;
+#endif
+  if (!opened) {
+    if (error) {
+      *error = L"Не удалось открыть файл для записи: " + path;
+    }
+    return false;
+  }
+  bool written = true;
+  size_t offset = 0;
+  while (written && offset < bytes.size()) {
+    const size_t chunk = std::min<size_t>(bytes.size() - offset, 1u << 30);
+#if defined(_WIN32)
+    DWORD done = 0;
+    written = WriteFile(file, bytes.data() + offset, static_cast<DWORD>(chunk),
+                        &done, nullptr) != 0 &&
+              done > 0;
+#else
+    const ssize_t done = write(file, bytes.data() + offset, chunk);
+    written = done > 0;
+#endif
+    offset += written ? static_cast<size_t>(done) : 0;
+  }
+#if defined(_WIN32)
+  written = CloseHandle(file) != 0 && written;
+#else
+  written = close(file) == 0 && written;
+#endif
+  if (!written) {
+    if (error) {
+      *error = L"Не удалось записать файл: " + path;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ReadFileBytes(const std::wstring& path, std::vector<uint8_t>* out,
+                   std::wstring* error) {
+  if (!out) {
+    return false;
+  }
+  std::ifstream file(std::filesystem::path(path), std::ios::binary);
+  if (!file) {
+    if (error) {
+      *error = L"Не удалось открыть файл: " + path;
+    }
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  const std::streamoff size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  out->resize(size > 0 ? static_cast<size_t>(size) : 0);
+  file.read(reinterpret_cast<char*>(out->data()),
+            static_cast<std::streamsize>(out->size()));
+  if (!file) {
+    if (error) {
+      *error = L"Не удалось прочитать файл: " + path;
+    }
+    return false;
+  }
+  return true;
+}
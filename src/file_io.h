@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes bytes to file (truncates existing). Output: false + error on failure.
+bool WriteFileBytes(const std::wstring& path, const std::vector<uint8_t>& bytes,
+                    std::wstring* error);
+
+// Reads whole file into out. Output: false + error on failure.
+bool ReadFileBytes(const std::wstring& path, std::vector<uint8_t>* out,
+                   std::wstring* error);
@@ -0,0 +1,531 @@
+#include "frame_archive.h"
+
+#include <cstring>
+#include <filesystem>
+
+#include "file_io.h"
+#include "hash.h"
+
+namespace {
+
+constexpr uint8_t kPackMagic[4] = {'P', '2', 'P', 'K'};
+constexpr uint8_t kRecordMagic[4] = {'P', '2', 'F', 'R'};
+constexpr uint8_t kIndexMagic[4] = {'P', '2', 'I', 'X'};
+constexpr uint64_t kArchiveVersion = 1;
+constexpr size_t kPackHeaderFixedSize = 16;
+// Флаг заголовка индекса: время шло назад (перевод часов), поиск линейный.
+constexpr uint32_t kIndexUnsorted = 1;
+
+void PutLe(uint8_t* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+uint64_t GetLe(const uint8_t* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+uint8_t CodecByte(OutputCodec codec) {
+  return codec == OutputCodec::kLossless ? 1 : 0;
+}
+
+bool CodecFromByte(uint8_t value, OutputCodec* out) {
+  if (value > 1) {
+    return false;
+  }
+  *out = value == 1 ? OutputCodec::kLossless : OutputCodec::kJpeg;
+  return true;
+}
+
+// Имена хранятся в UTF-16LE (на Linux — только символы BMP).
+void PutName(const std::wstring& name, std::vector<uint8_t>* out) {
+  for (wchar_t ch : name) {
+    out->push_back(static_cast<uint8_t>(ch & 0xFF));
+    out->push_back(static_cast<uint8_t>((ch >> 8) & 0xFF));
+  }
+}
+
+std::wstring GetName(const uint8_t* in, size_t units) {
+  std::wstring name(units, L'\0');
+  for (size_t i = 0; i < units; ++i) {
+    name[i] = static_cast<wchar_t>(GetLe(in + i * 2, 2));
+  }
+  return name;
+}
+
+std::vector<uint8_t> EncodePackHeader(const ArchiveIdentity& identity) {
+  std::vector<uint8_t> header(kPackHeaderFixedSize, 0);
+  PutName(identity.computer, &header);
+  PutName(identity.user, &header);
+  std::memcpy(header.data(), kPackMagic, 4);
+  PutLe(header.data() + 4, kArchiveVersion, 2);
+  PutLe(header.data() + 6, header.size(), 2);
+  PutLe(header.data() + 8, static_cast<uint64_t>(identity.display_index), 2);
+  PutLe(header.data() + 10, identity.computer.size(), 2);
+  PutLe(header.data() + 12, identity.user.size(), 2);
+  return header;
+}
+
+bool ReadPackHeader(std::istream& in, ArchiveIdentity* identity,
+                    uint64_t* header_size) {
+  uint8_t fixed[kPackHeaderFixedSize];
+  in.seekg(0);
+  if (!in.read(reinterpret_cast<char*>(fixed), sizeof(fixed)) ||
+      std::memcmp(fixed, kPackMagic, 4) != 0 ||
+      GetLe(fixed + 4, 2) != kArchiveVersion) {
+    return false;
+  }
+  const size_t size = static_cast<size_t>(GetLe(fixed + 6, 2));
+  const size_t computer_units = static_cast<size_t>(GetLe(fixed + 10, 2));
+  const size_t user_units = static_cast<size_t>(GetLe(fixed + 12, 2));
+  if (size != kPackHeaderFixedSize + 2 * (computer_units + user_units)) {
+    return false;
+  }
+  std::vector<uint8_t> names(size - kPackHeaderFixedSize);
+  if (!in.read(reinterpret_cast<char*>(names.data()),
+               static_cast<std::streamsize>(names.size()))) {
+    return false;
+  }
+  identity->display_index = static_cast<int>(GetLe(fixed + 8, 2));
+  identity->computer = GetName(names.data(), computer_units);
+  identity->user = GetName(names.data() + computer_units * 2, user_units);
+  *header_size = size;
+  return true;
+}
+
+void EncodeRecordHeader(const ArchiveEntry& entry, uint8_t* out) {
+  std::memset(out, 0, kArchiveRecordHeaderSize);
+  std::memcpy(out, kRecordMagic, 4);
+  out[4] = CodecByte(entry.codec);
+  out[5] = static_cast<uint8_t>(entry.display_index);
+  PutLe(out + 6, static_cast<uint64_t>(entry.display_count), 2);
+  PutLe(out + 8, entry.length, 4);
+  PutLe(out + 16, static_cast<uint64_t>(entry.timestamp), 8);
+  PutLe(out + 24, entry.hash, 8);
+}
+
+bool DecodeRecordHeader(const uint8_t* in, ArchiveEntry* entry) {
+  if (std::memcmp(in, kRecordMagic, 4) != 0 ||
+      !CodecFromByte(in[4], &entry->codec)) {
+    return false;
+  }
+  entry->display_index = in[5];
+  entry->display_count = static_cast<int>(GetLe(in + 6, 2));
+  entry->length = static_cast<uint32_t>(GetLe(in + 8, 4));
+  entry->timestamp = static_cast<int64_t>(GetLe(in + 16, 8));
+  entry->hash = GetLe(in + 24, 8);
+  return true;
+}
+
+void EncodeIndexEntry(const ArchiveEntry& entry, uint8_t* out) {
+  PutLe(out, static_cast<uint64_t>(entry.timestamp), 8);
+  PutLe(out + 8, entry.offset, 8);
+  PutLe(out + 16, entry.length, 4);
+  out[20] = CodecByte(entry.codec);
+  out[21] = static_cast<uint8_t>(entry.display_index);
+  PutLe(out + 22, static_cast<uint64_t>(entry.display_count), 2);
+  PutLe(out + 24, entry.hash, 8);
+}
+
+ArchiveEntry DecodeIndexEntry(const uint8_t* in) {
+  ArchiveEntry entry;
+  entry.timestamp = static_cast<int64_t>(GetLe(in, 8));
+  entry.offset = GetLe(in + 8, 8);
+  entry.length = static_cast<uint32_t>(GetLe(in + 16, 4));
+  CodecFromByte(in[20], &entry.codec);
+  entry.display_index = in[21];
+  entry.display_count = static_cast<int>(GetLe(in + 22, 2));
+  entry.hash = GetLe(in + 24, 8);
+  return entry;
+}
+
+bool IsIndexHeader(const uint8_t* data, size_t size) {
+  return size >= kArchiveIndexHeaderSize &&
+         std::memcmp(data, kIndexMagic, 4) == 0 &&
+         GetLe(data + 4, 2) == kArchiveVersion &&
+         GetLe(data + 6, 2) == kArchiveIndexEntrySize;
+}
+
+std::vector<uint8_t> IndexHeader(uint32_t flags) {
+  std::vector<uint8_t> header(kArchiveIndexHeaderSize, 0);
+  std::memcpy(header.data(), kIndexMagic, 4);
+  PutLe(header.data() + 4, kArchiveVersion, 2);
+  PutLe(header.data() + 6, kArchiveIndexEntrySize, 2);
+  PutLe(header.data() + 8, flags, 4);
+  return header;
+}
+
+// Дни от 1970-01-01 по пролептическому григорианскому календарю
+// (алгоритм days_from_civil Г. Хиннанта).
+int64_t DaysFromCivil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2 ? 1 : 0;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t yoe = year - era * 400;
+  const int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+}  // namespace
+
+int64_t ArchiveTimestamp(const DateTimeParts& dt) {
+  return DaysFromCivil(dt.year, dt.month, dt.day) * 86400 + dt.hour * 3600 +
+         dt.minute * 60 + dt.second;
+}
+
+DateTimeParts ArchiveDateTime(int64_t timestamp) {
+  int64_t days = timestamp / 86400;
+  int64_t seconds = timestamp % 86400;
+  if (seconds < 0) {
+    seconds += 86400;
+    --days;
+  }
+  // civil_from_days, обратное к DaysFromCivil.
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t doe = days - era * 146097;
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const int64_t mp = (5 * doy + 2) / 153;
+  DateTimeParts dt;
+  dt.day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+  dt.month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+  dt.year = static_cast<int>(yoe + era * 400 + (dt.month <= 2 ? 1 : 0));
+  dt.hour = static_cast<int>(seconds / 3600);
+  dt.minute = static_cast<int>(seconds / 60 % 60);
+  dt.second = static_cast<int>(seconds % 60);
+  return dt;
+}
+
+bool FrameArchiveWriter::Open(const std::wstring& pack_path,
+                              const std::wstring& index_path,
+                              const ArchiveIdentity& identity,
+                              std::wstring* error) {
+  namespace fs = std::filesystem;
+  Close();
+  pack_path_ = pack_path;
+  identity_ = identity;
+  frames_ = 0;
+  last_timestamp_ = INT64_MIN;
+  index_flags_ = 0;
+  recovered_frames_ = 0;
+  truncated_bytes_ = 0;
+
+  const fs::path pack_file(pack_path);
+  const fs::path index_file(index_path);
+  std::error_code ec;
+  const uintmax_t existing = fs::file_size(pack_file, ec);
+  uint64_t header_size = 0;
+  if (ec || existing == 0) {
+    // Новый архив: заголовок пакета и пустой индекс.
+    const std::vector<uint8_t> header = EncodePackHeader(identity);
+    if (!WriteFileBytes(pack_path, header, error) ||
+        !WriteFileBytes(index_path, IndexHeader(0), error)) {
+      return false;
+    }
+    header_size = header.size();
+  } else {
+    std::ifstream in(pack_file, std::ios::binary);
+    ArchiveIdentity stored;
+    if (!ReadPackHeader(in, &stored, &header_size)) {
+      if (error) {
+        *error = L"Файл не является архивом кадров: " + pack_path;
+      }
+      return false;
+    }
+    if (stored.computer != identity.computer || stored.user != identity.user ||
+        stored.display_index != identity.display_index) {
+      if (error) {
+        *error = L"Архив принадлежит другому компьютеру или дисплею: " +
+                 pack_path;
+      }
+      return false;
+    }
+  }
+  const uint64_t pack_size = fs::file_size(pack_file, ec);
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось получить размер архива: " + pack_path;
+    }
+    return false;
+  }
+
+  // Записи индекса сохраняются, пока идут подряд и целиком лежат в пакете.
+  std::vector<uint8_t> index_bytes;
+  std::wstring index_error;
+  const bool index_read =
+      fs::exists(index_file, ec) &&
+      ReadFileBytes(index_path, &index_bytes, &index_error);
+  const bool index_valid =
+      index_read && IsIndexHeader(index_bytes.data(), index_bytes.size());
+  uint64_t end = header_size;
+  uint64_t kept = 0;
+  if (index_valid) {
+    index_flags_ = static_cast<uint32_t>(GetLe(index_bytes.data() + 8, 4));
+    const size_t entries = (index_bytes.size() - kArchiveIndexHeaderSize) /
+                           kArchiveIndexEntrySize;
+    for (size_t i = 0; i < entries; ++i) {
+      const ArchiveEntry entry =
+          DecodeIndexEntry(index_bytes.data() + kArchiveIndexHeaderSize +
+                           i * kArchiveIndexEntrySize);
+      if (entry.offset != end ||
+          end + kArchiveRecordHeaderSize + entry.length > pack_size) {
+        break;
+      }
+      if (entry.timestamp < last_timestamp_) {
+        index_flags_ |= kIndexUnsorted;
+      }
+      last_timestamp_ = entry.timestamp;
+      end += kArchiveRecordHeaderSize + entry.length;
+      ++kept;
+    }
+  }
+
+  // Целые записи после индексированных (сбой между записью кадра и
+  // индекса) индексируются заново; недописанный хвост отрезается.
+  std::vector<ArchiveEntry> recovered;
+  {
+    std::ifstream in(pack_file, std::ios::binary);
+    std::vector<uint8_t> payload;
+    uint8_t header[kArchiveRecordHeaderSize];
+    while (in && end + kArchiveRecordHeaderSize <= pack_size) {
+      ArchiveEntry entry;
+      in.seekg(static_cast<std::streamoff>(end));
+      if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+          !DecodeRecordHeader(header, &entry) ||
+          end + kArchiveRecordHeaderSize + entry.length > pack_size) {
+        break;
+      }
+      payload.resize(entry.length);
+      if (!in.read(reinterpret_cast<char*>(payload.data()),
+                   static_cast<std::streamsize>(payload.size())) ||
+          Hash64(payload.data(), payload.size()) != entry.hash) {
+        break;
+      }
+      entry.offset = end;
+      recovered.push_back(entry);
+      end += kArchiveRecordHeaderSize + entry.length;
+    }
+  }
+  if (pack_size > end) {
+    fs::resize_file(pack_file, end, ec);
+    if (ec) {
+      if (error) {
+        *error = L"Не удалось отрезать поврежденный хвост архива: " +
+                 pack_path;
+      }
+      return false;
+    }
+    truncated_bytes_ = pack_size - end;
+  }
+  if (!index_valid) {
+    if (!WriteFileBytes(index_path, IndexHeader(index_flags_), error)) {
+      return false;
+    }
+  } else {
+    fs::resize_file(index_file,
+                    kArchiveIndexHeaderSize + kept * kArchiveIndexEntrySize,
+                    ec);
+    if (ec) {
+      if (error) {
+        *error = L"Не удалось восстановить индекс архива: " + index_path;
+      }
+      return false;
+    }
+  }
+
+  pack_.open(pack_file, std::ios::in | std::ios::out | std::ios::binary);
+  index_.open(index_file, std::ios::in | std::ios::out | std::ios::binary);
+  if (!pack_.is_open() || !index_.is_open()) {
+    Close();
+    if (error) {
+      *error = L"Не удалось открыть архив для записи: " + pack_path;
+    }
+    return false;
+  }
+  pack_size_ = end;
+  frames_ = kept;
+  for (const ArchiveEntry& entry : recovered) {
+    if (!WriteIndexEntry(entry, error)) {
+      Close();
+      return false;
+    }
+    ++frames_;
+  }
+  recovered_frames_ = recovered.size();
+  return true;
+}
+
+void FrameArchiveWriter::Close() {
+  if (pack_.is_open()) {
+    pack_.close();
+  }
+  if (index_.is_open()) {
+    index_.close();
+  }
+  pack_.clear();
+  index_.clear();
+}
+
+bool FrameArchiveWriter::WriteIndexEntry(const ArchiveEntry& entry,
+                                         std::wstring* error) {
+  uint8_t bytes[kArchiveIndexEntrySize];
+  EncodeIndexEntry(entry, bytes);
+  index_.seekp(0, std::ios::end);
+  index_.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+  if (entry.timestamp < last_timestamp_ &&
+      (index_flags_ & kIndexUnsorted) == 0) {
+    index_flags_ |= kIndexUnsorted;
+    uint8_t flags[4];
+    PutLe(flags, index_flags_, 4);
+    index_.seekp(8);
+    index_.write(reinterpret_cast<const char*>(flags), sizeof(flags));
+  }
+  last_timestamp_ = entry.timestamp;
+  index_.flush();
+  if (!index_) {
+    index_.clear();
+    if (error) {
+      *error = L"Не удалось записать индекс архива: " + pack_path_;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool FrameArchiveWriter::Append(int64_t timestamp, OutputCodec codec,
+                                int display_count,
+                                const std::vector<uint8_t>& data,
+                                std::wstring* error) {
+  if (!IsOpen() || data.size() > UINT32_MAX) {
+    if (error) {
+      *error = L"Архив не открыт или кадр слишком велик.";
+    }
+    return false;
+  }
+  ArchiveEntry entry;
+  entry.timestamp = timestamp;
+  entry.offset = pack_size_;
+  entry.length = static_cast<uint32_t>(data.size());
+  entry.codec = codec;
+  entry.display_index = identity_.display_index;
+  entry.display_count = display_count;
+  entry.hash = Hash64(data.data(), data.size());
+  uint8_t header[kArchiveRecordHeaderSize];
+  EncodeRecordHeader(entry, header);
+  // Обоснование: запись всегда с конца целых записей — хвост неудачной
+  // попытки перезаписывается следующим кадром или отрезается при Open.
+  pack_.seekp(static_cast<std::streamoff>(pack_size_));
+  pack_.write(reinterpret_cast<const char*>(header), sizeof(header));
+  pack_.write(reinterpret_cast<const char*>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+  pack_.flush();
+  if (!pack_) {
+    pack_.clear();
+    if (error) {
+      *error = L"Не удалось записать кадр в архив: " + pack_path_;
+    }
+    return false;
+  }
+  pack_size_ += kArchiveRecordHeaderSize + data.size();
+  if (!WriteIndexEntry(entry, error)) {
+    return false;
+  }
+  ++frames_;
+  return true;
+}
+
+bool ArchiveIndexView::Open(const std::wstring& index_path,
+                            std::wstring* error) {
+  count_ = 0;
+  sorted_ = true;
+  if (!file_.Open(index_path, error)) {
+    return false;
+  }
+  if (!IsIndexHeader(file_.Data(), file_.Size())) {
+    file_.Close();
+    if (error) {
+      *error = L"Файл не является индексом архива: " + index_path;
+    }
+    return false;
+  }
+  count_ = (file_.Size() - kArchiveIndexHeaderSize) / kArchiveIndexEntrySize;
+  sorted_ = (GetLe(file_.Data() + 8, 4) & kIndexUnsorted) == 0;
+  return true;
+}
+
+ArchiveEntry ArchiveIndexView::Entry(size_t i) const {
+  return DecodeIndexEntry(file_.Data() + kArchiveIndexHeaderSize +
+                          i * kArchiveIndexEntrySize);
+}
+
+size_t ArchiveIndexView::LowerBound(int64_t timestamp) const {
+  const uint8_t* entries = file_.Data() + kArchiveIndexHeaderSize;
+  auto at = [&](size_t i) {
+    return static_cast<int64_t>(GetLe(entries + i * kArchiveIndexEntrySize, 8));
+  };
+  if (!sorted_) {
+    for (size_t i = 0; i < count_; ++i) {
+      if (at(i) >= timestamp) {
+        return i;
+      }
+    }
+    return count_;
+  }
+  size_t low = 0;
+  size_t high = count_;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    if (at(mid) < timestamp) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+bool FrameArchiveReader::Open(const std::wstring& pack_path,
+                              std::wstring* error) {
+  pack_.close();
+  pack_.clear();
+  pack_.open(std::filesystem::path(pack_path), std::ios::binary);
+  uint64_t header_size = 0;
+  if (!pack_ || !ReadPackHeader(pack_, &identity_, &header_size)) {
+    if (error) {
+      *error = L"Файл не является архивом кадров: " + pack_path;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool FrameArchiveReader::Read(const ArchiveEntry& entry,
+                              std::vector<uint8_t>* out,
+                              std::wstring* error) {
+  uint8_t header[kArchiveRecordHeaderSize];
+  ArchiveEntry stored;
+  pack_.clear();
+  pack_.seekg(static_cast<std::streamoff>(entry.offset));
+  bool ok = out &&
+            pack_.read(reinterpret_cast<char*>(header), sizeof(header)) &&
+            DecodeRecordHeader(header, &stored) &&
+            stored.length == entry.length &&
+            stored.timestamp == entry.timestamp && stored.hash == entry.hash;
+  if (ok) {
+    out->resize(entry.length);
+    ok = pack_.read(reinterpret_cast<char*>(out->data()),
+                    static_cast<std::streamsize>(out->size())) &&
+         Hash64(out->data(), out->size()) == entry.hash;
+  }
+  if (!ok && error) {
+    *error = L"Запись архива повреждена (смещение " +
+             std::to_wstring(entry.offset) + L").";
+  }
+  return ok;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "codec_select.h"
+#include "mapped_file.h"
+#include "time_utils.h"
+
+// Daily append-only frame archive of one display: a pack file of encoded
+// frames and a companion index of fixed 32-byte entries.
+//
+// Pack:   header "P2PK" (source computer/user, display), then records of a
+//         fixed 32-byte header "P2FR" (codec, display, length, timestamp,
+//         hash) followed by the encoded file bytes.
+// Index:  16-byte header "P2IX", then entries (timestamp, pack offset,
+//         length, codec, display, hash) in append order; memory-mapped by
+//         readers for O(log n) lookup by time.
+// All integers little-endian. Timestamps are local civil time in seconds
+// (see ArchiveTimestamp), the clock of folder and file names.
+
+constexpr size_t kArchiveRecordHeaderSize = 32;
+constexpr size_t kArchiveIndexHeaderSize = 16;
+constexpr size_t kArchiveIndexEntrySize = 32;
+
+// Source of an archive; written once into the pack header.
+struct ArchiveIdentity {
+  std::wstring computer;
+  std::wstring user;
+  int display_index = 0;
+};
+
+struct ArchiveEntry {
+  int64_t timestamp = 0;
+  // Offset of the record header in the pack.
+  uint64_t offset = 0;
+  uint32_t length = 0;
+  OutputCodec codec = OutputCodec::kJpeg;
+  int display_index = 0;
+  // Displays in the capture cycle (file name suffix on extraction).
+  int display_count = 1;
+  uint64_t hash = 0;
+};
+
+// Local date/time <-> archive timestamp (seconds since 1970-01-01 00:00 of
+// the same civil clock, no time zone).
+int64_t ArchiveTimestamp(const DateTimeParts& dt);
+DateTimeParts ArchiveDateTime(int64_t timestamp);
+
+// Appends frames to a pack/index pair. Open on existing files recovers from
+// a crash: index entries past the pack end and a torn index tail are
+// dropped, complete unindexed records (hash verified) are re-indexed and a
+// torn pack tail is truncated.
+class FrameArchiveWriter {
+ public:
+  // Output: false + error on I/O failure or an archive of another source.
+  bool Open(const std::wstring& pack_path, const std::wstring& index_path,
+            const ArchiveIdentity& identity, std::wstring* error);
+  void Close();
+  bool IsOpen() const { return pack_.is_open(); }
+  const std::wstring& PackPath() const { return pack_path_; }
+  uint64_t Frames() const { return frames_; }
+  // Records re-indexed or bytes truncated by the last Open.
+  uint64_t RecoveredFrames() const { return recovered_frames_; }
+  uint64_t TruncatedBytes() const { return truncated_bytes_; }
+
+  // Appends one encoded file. The pack record is flushed before its index
+  // entry, so a crash never leaves an entry without data.
+  bool Append(int64_t timestamp, OutputCodec codec, int display_count,
+              const std::vector<uint8_t>& data, std::wstring* error);
+
+ private:
+  bool WriteIndexEntry(const ArchiveEntry& entry, std::wstring* error);
+
+  std::fstream pack_;
+  std::fstream index_;
+  std::wstring pack_path_;
+  ArchiveIdentity identity_;
+  uint64_t pack_size_ = 0;
+  uint64_t frames_ = 0;
+  int64_t last_timestamp_ = INT64_MIN;
+  uint32_t index_flags_ = 0;
+  uint64_t recovered_frames_ = 0;
+  uint64_t truncated_bytes_ = 0;
+};
+
+// Memory-mapped index: entries decoded on access, lookup by time.
+class ArchiveIndexView {
+ public:
+  // Output: false + error when the file is missing or not an index.
+  bool Open(const std::wstring& index_path, std::wstring* error);
+  size_t Size() const { return count_; }
+  ArchiveEntry Entry(size_t i) const;
+  // False when timestamps went backwards (clock change): LowerBound then
+  // scans linearly.
+  bool Sorted() const { return sorted_; }
+  // Index of the first entry with timestamp >= timestamp (Size() if none);
+  // binary search over the mapping when Sorted().
+  size_t LowerBound(int64_t timestamp) const;
+
+ private:
+  MappedFile file_;
+  size_t count_ = 0;
+  bool sorted_ = true;
+};
+
+// Reads frames of a pack by index entry.
+class FrameArchiveReader {
+ public:
+  bool Open(const std::wstring& pack_path, std::wstring* error);
+  const ArchiveIdentity& Identity() const { return identity_; }
+  // Output: out replaced with the file bytes; false + error when the record
+  // header does not match the entry or the hash differs.
+  bool Read(const ArchiveEntry& entry, std::vector<uint8_t>* out,
+            std::wstring* error);
+
+ private:
+  std::ifstream pack_;
+  ArchiveIdentity identity_;
+};
@@ -0,0 +1,498 @@
+#include "frame_ring.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint32_t kMagic = 0x47523250;  // "P2RG"
+constexpr uint16_t kVersion = 1;
+// Заголовки выровнены по строке кэша: счетчики разных дисплеев и слотов не
+// делят строку между ядрами.
+constexpr size_t kLine = 64;
+constexpr size_t kMaxNameLength = 200;
+constexpr int kReadAttempts = 4;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "общая память требует атомарных операций без блокировок");
+
+struct RingHeader {
+  // Пишется последним: читатель не увидит кольцо до конца разметки.
+  std::atomic<uint32_t> magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t displays;
+  uint32_t depth;
+  uint64_t slot_bytes;
+  std::atomic<uint32_t> closed;
+};
+
+struct DisplayHeader {
+  // Номер последнего опубликованного кадра, 0 — кадров еще нет.
+  std::atomic<uint64_t> latest;
+};
+
+struct SlotHeader {
+  // Нечетное значение — запись кадра в слот идет.
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> frame_number;
+  std::atomic<int64_t> timestamp;
+  std::atomic<uint32_t> width;
+  std::atomic<uint32_t> height;
+  std::atomic<uint32_t> stride;
+  std::atomic<uint32_t> pixel_format;
+};
+
+static_assert(sizeof(RingHeader) <= kLine && sizeof(SlotHeader) <= kLine,
+              "заголовок не помещается в строку кэша");
+
+size_t SlotStride(size_t slot_bytes) {
+  return kLine + (slot_bytes + kLine - 1) / kLine * kLine;
+}
+
+size_t RingSize(uint32_t displays, size_t slot_bytes) {
+  return kLine + displays * kLine +
+         static_cast<size_t>(displays) * kFrameRingDepth *
+             SlotStride(slot_bytes);
+}
+
+RingHeader* Header(const uint8_t* base) {
+  return reinterpret_cast<RingHeader*>(const_cast<uint8_t*>(base));
+}
+
+DisplayHeader* Display(const uint8_t* base, uint32_t display) {
+  return reinterpret_cast<DisplayHeader*>(
+      const_cast<uint8_t*>(base) + kLine + display * kLine);
+}
+
+SlotHeader* Slot(const uint8_t* base, uint32_t displays, size_t slot_bytes,
+                 uint32_t display, uint64_t frame_number) {
+  const size_t index = static_cast<size_t>(display) * kFrameRingDepth +
+                       static_cast<size_t>((frame_number - 1) %
+                                           kFrameRingDepth);
+  return reinterpret_cast<SlotHeader*>(const_cast<uint8_t*>(base) + kLine +
+                                       displays * kLine +
+                                       index * SlotStride(slot_bytes));
+}
+
+const uint8_t* SlotPixels(const SlotHeader* slot) {
+  return reinterpret_cast<const uint8_t*>(slot) + kLine;
+}
+
+// Кольцо с той же разметкой (перезапуск писателя при открытых читателях).
+bool SameLayout(const uint8_t* base, uint32_t displays, size_t slot_bytes) {
+  const RingHeader* header = Header(base);
+  return header->magic.load(std::memory_order_acquire) == kMagic &&
+         header->version == kVersion && header->displays == displays &&
+         header->depth == kFrameRingDepth && header->slot_bytes == slot_bytes;
+}
+
+void InitRing(uint8_t* base, uint32_t displays, size_t slot_bytes) {
+  RingHeader* header = new (base) RingHeader();
+  header->version = kVersion;
+  header->header_size = static_cast<uint16_t>(kLine);
+  header->displays = displays;
+  header->depth = kFrameRingDepth;
+  header->slot_bytes = slot_bytes;
+  header->closed.store(0, std::memory_order_relaxed);
+  for (uint32_t display = 0; display < displays; ++display) {
+    new (Display(base, display)) DisplayHeader();
+    Display(base, display)->latest.store(0, std::memory_order_relaxed);
+    for (uint64_t number = 1; number <= kFrameRingDepth; ++number) {
+      SlotHeader* slot = new (Slot(base, displays, slot_bytes, display,
+                                   number)) SlotHeader();
+      slot->sequence.store(0, std::memory_order_relaxed);
+    }
+  }
+  header->magic.store(kMagic, std::memory_order_release);
+}
+
+// Писатель, упавший посреди записи, оставил нечетную последовательность:
+// слот помечается целым, на него еще не указывает latest.
+void ReuseRing(uint8_t* base, uint32_t displays, size_t slot_bytes) {
+  for (uint32_t display = 0; display < displays; ++display) {
+    for (uint64_t number = 1; number <= kFrameRingDepth; ++number) {
+      SlotHeader* slot = Slot(base, displays, slot_bytes, display, number);
+      const uint64_t sequence =
+          slot->sequence.load(std::memory_order_relaxed);
+      if (sequence & 1) {
+        slot->sequence.store(sequence + 1, std::memory_order_release);
+      }
+    }
+  }
+  Header(base)->closed.store(0, std::memory_order_release);
+}
+
+// Имя кольца: латиница, цифры, '_', '-', '.'; одинаково допустимо для shm
+// и для имен объектов Windows.
+bool CheckName(const std::wstring& name, std::string* narrow,
+               std::wstring* error) {
+  bool valid = !name.empty() && name.size() <= kMaxNameLength;
+  for (wchar_t ch : name) {
+    valid = valid && ((ch >= L'a' && ch <= L'z') ||
+                      (ch >= L'A' && ch <= L'Z') ||
+                      (ch >= L'0' && ch <= L'9') || ch == L'_' ||
+                      ch == L'-' || ch == L'.');
+  }
+  if (!valid) {
+    if (error) {
+      *error = L"Некорректное имя кольца кадров: " + name;
+    }
+    return false;
+  }
+  narrow->assign(name.begin(), name.end());
+  return true;
+}
+
+}  // namespace
+
+FrameRingWriter::~FrameRingWriter() { Close(); }
+
+bool FrameRingWriter::Create(const std::wstring& name, uint32_t displays,
+                             size_t slot_bytes, std::wstring* error) {
+  Close();
+  std::string narrow;
+  if (!CheckName(name, &narrow, error)) {
+    return false;
+  }
+  if (displays == 0 || slot_bytes == 0) {
+    if (error) {
+      *error = L"Пустое кольцо кадров: " + name;
+    }
+    return false;
+  }
+  const size_t size = RingSize(displays, slot_bytes);
+  bool reuse = false;
+#if defined(_WIN32)
+  // Обоснование: Local\ — пространство имен сеанса; дескриптор безопасности
+  // по умолчанию открывает кадры только владельцу, SYSTEM и администраторам.
+  const std::wstring native = L"Local\\" + name;
+  HANDLE mapping = CreateFileMappingW(
+      INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+      static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+      static_cast<DWORD>(size & 0xFFFFFFFFu), native.c_str());
+  const bool existed = mapping && GetLastError() == ERROR_ALREADY_EXISTS;
+  void* view =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size)
+              : nullptr;
+  if (!view) {
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (error) {
+      *error = L"Не удалось создать общую память кадров: " + native;
+    }
+    return false;
+  }
+  // Объект жив, пока его держит хоть один читатель: пересоздать его с
+  // другой разметкой нельзя.
+  if (existed && !SameLayout(static_cast<uint8_t*>(view), displays,
+                             slot_bytes)) {
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    if (error) {
+      *error = L"Кольцо кадров с другой разметкой уже открыто: " + native;
+    }
+    return false;
+  }
+  reuse = existed;
+  mapping_ = mapping;
+#else
+  const std::string native = "/" + narrow;
+  // Обоснование: 0600 — кадры экрана читает только тот же пользователь.
+  int fd = shm_open(native.c_str(), O_RDWR | O_CREAT, 0600);
+  struct stat info = {};
+  if (fd >= 0 && fstat(fd, &info) == 0 &&
+      static_cast<size_t>(info.st_size) == size) {
+    void* existing =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (existing != MAP_FAILED) {
+      reuse = SameLayout(static_cast<uint8_t*>(existing), displays,
+                         slot_bytes);
+      munmap(existing, size);
+    }
+  }
+  // Объект другой разметки не усекается (читатели получили бы SIGBUS), а
+  // заменяется новым под тем же именем.
+  if (fd >= 0 && !reuse && info.st_size != 0) {
+    close(fd);
+    shm_unlink(native.c_str());
+    fd = shm_open(native.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  }
+  void* view = MAP_FAILED;
+  if (fd >= 0 && (reuse || ftruncate(fd, static_cast<off_t>(size)) == 0)) {
+    view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (view == MAP_FAILED) {
+    if (error) {
+      *error = L"Не удалось создать общую память кадров: " + name;
+    }
+    return false;
+  }
+  posix_name_ = native;
+#endif
+  base_ = static_cast<uint8_t*>(view);
+  size_ = size;
+  slot_bytes_ = slot_bytes;
+  displays_ = displays;
+  if (reuse) {
+    ReuseRing(base_, displays, slot_bytes);
+  } else {
+    InitRing(base_, displays, slot_bytes);
+  }
+  return true;
+}
+
+void FrameRingWriter::Close() {
+  if (base_) {
+    Header(base_)->closed.store(1, std::memory_order_release);
+#if defined(_WIN32)
+    UnmapViewOfFile(base_);
+#else
+    munmap(base_, size_);
+    shm_unlink(posix_name_.c_str());
+#endif
+  }
+#if defined(_WIN32)
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  mapping_ = nullptr;
+#endif
+  base_ = nullptr;
+  size_ = 0;
+  slot_bytes_ = 0;
+  displays_ = 0;
+  posix_name_.clear();
+}
+
+bool FrameRingWriter::Publish(uint32_t display, const ImageBuffer& frame,
+                              int64_t timestamp, std::wstring* error) {
+  const size_t row_bytes =
+      static_cast<size_t>(frame.width) * BytesPerPixel(frame.pixel_format);
+  const size_t bytes = row_bytes * frame.height;
+  if (!base_ || display >= displays_ || bytes > slot_bytes_ ||
+      frame.pixels.size() <
+          (frame.height ? static_cast<size_t>(frame.stride) *
+                                  (frame.height - 1) +
+                              row_bytes
+                        : 0)) {
+    if (error) {
+      *error = L"Кадр не помещается в кольцо кадров: дисплей " +
+               std::to_wstring(display + 1) + L", байт: " +
+               std::to_wstring(bytes);
+    }
+    return false;
+  }
+  DisplayHeader* header = Display(base_, display);
+  // latest меняет только этот поток: чтение без синхронизации.
+  const uint64_t number = header->latest.load(std::memory_order_relaxed) + 1;
+  SlotHeader* slot = Slot(base_, displays_, slot_bytes_, display, number);
+  const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  // Обоснование: барьер после нечетной последовательности — читатель,
+  // увидевший хоть один новый байт, увидит и нечетное значение.
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->frame_number.store(number, std::memory_order_relaxed);
+  slot->timestamp.store(timestamp, std::memory_order_relaxed);
+  slot->width.store(frame.width, std::memory_order_relaxed);
+  slot->height.store(frame.height, std::memory_order_relaxed);
+  slot->stride.store(static_cast<uint32_t>(row_bytes),
+                     std::memory_order_relaxed);
+  slot->pixel_format.store(static_cast<uint32_t>(frame.pixel_format),
+                           std::memory_order_relaxed);
+  uint8_t* pixels = reinterpret_cast<uint8_t*>(slot) + kLine;
+  if (row_bytes == frame.stride) {
+    std::memcpy(pixels, frame.pixels.data(), bytes);
+  } else {
+    for (uint32_t y = 0; y < frame.height; ++y) {
+      std::memcpy(pixels + y * row_bytes,
+                  frame.pixels.data() + static_cast<size_t>(y) * frame.stride,
+                  row_bytes);
+    }
+  }
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header->latest.store(number, std::memory_order_release);
+  return true;
+}
+
+FrameRingReader::~FrameRingReader() { Close(); }
+
+bool FrameRingReader::Open(const std::wstring& name, std::wstring* error) {
+  Close();
+  std::string narrow;
+  if (!CheckName(name, &narrow, error)) {
+    return false;
+  }
+#if defined(_WIN32)
+  const std::wstring native = L"Local\\" + name;
+  HANDLE mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, native.c_str());
+  void* view =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  MEMORY_BASIC_INFORMATION region = {};
+  if (!view || !VirtualQuery(view, &region, sizeof(region))) {
+    if (view) {
+      UnmapViewOfFile(view);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    if (error) {
+      *error = L"Кольцо кадров не найдено: " + native;
+    }
+    return false;
+  }
+  mapping_ = mapping;
+  const size_t size = region.RegionSize;
+#else
+  const std::string native = "/" + narrow;
+  const int fd = shm_open(native.c_str(), O_RDONLY, 0);
+  struct stat info = {};
+  void* view = MAP_FAILED;
+  if (fd >= 0 && fstat(fd, &info) == 0 &&
+      static_cast<size_t>(info.st_size) >= kLine) {
+    view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (view == MAP_FAILED) {
+    if (error) {
+      *error = L"Кольцо кадров не найдено: " + name;
+    }
+    return false;
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+#endif
+  base_ = static_cast<const uint8_t*>(view);
+  size_ = size;
+  const RingHeader* header = Header(base_);
+  if (header->magic.load(std::memory_order_acquire) != kMagic ||
+      header->version != kVersion || header->depth != kFrameRingDepth ||
+      header->displays == 0 || header->slot_bytes == 0 ||
+      RingSize(header->displays, header->slot_bytes) > size) {
+    Close();
+    if (error) {
+      *error = L"Неизвестная разметка кольца кадров: " + name;
+    }
+    return false;
+  }
+  displays_ = header->displays;
+  slot_bytes_ = static_cast<size_t>(header->slot_bytes);
+  return true;
+}
+
+void FrameRingReader::Close() {
+#if defined(_WIN32)
+  if (base_) {
+    UnmapViewOfFile(base_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  mapping_ = nullptr;
+#else
+  if (base_) {
+    munmap(const_cast<uint8_t*>(base_), size_);
+  }
+#endif
+  base_ = nullptr;
+  size_ = 0;
+  slot_bytes_ = 0;
+  displays_ = 0;
+}
+
+bool FrameRingReader::Closed() const {
+  return !base_ || Header(base_)->closed.load(std::memory_order_acquire);
+}
+
+bool FrameRingReader::Latest(uint32_t display, FrameRingView* view) const {
+  if (!base_ || display >= displays_) {
+    return false;
+  }
+  const DisplayHeader* header = Display(base_, display);
+  for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+    const uint64_t number = header->latest.load(std::memory_order_acquire);
+    if (number == 0) {
+      return false;
+    }
+    const SlotHeader* slot =
+        Slot(base_, displays_, slot_bytes_, display, number);
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    FrameRingView result;
+    result.display = display;
+    result.frame_number = slot->frame_number.load(std::memory_order_relaxed);
+    result.timestamp = slot->timestamp.load(std::memory_order_relaxed);
+    result.width = slot->width.load(std::memory_order_relaxed);
+    result.height = slot->height.load(std::memory_order_relaxed);
+    result.stride = slot->stride.load(std::memory_order_relaxed);
+    const uint32_t format =
+        slot->pixel_format.load(std::memory_order_relaxed);
+    result.pixels = SlotPixels(slot);
+    result.sequence = sequence;
+    if (!Validate(result)) {
+      continue;
+    }
+    // Целый слот с чужими размерами — поврежденная память, не гонка.
+    if (format > static_cast<uint32_t>(PixelFormat::kRgba16F) ||
+        static_cast<uint64_t>(result.stride) * result.height > slot_bytes_) {
+      return false;
+    }
+    result.pixel_format = static_cast<PixelFormat>(format);
+    *view = result;
+    return true;
+  }
+  return false;
+}
+
+bool FrameRingReader::Validate(const FrameRingView& view) const {
+  if (!base_ || view.display >= displays_ || view.frame_number == 0) {
+    return false;
+  }
+  // Обоснование: барьер до повторного чтения — все чтения пикселей
+  // упорядочены перед проверкой последовательности.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const SlotHeader* slot = Slot(base_, displays_, slot_bytes_, view.display,
+                                view.frame_number);
+  return slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
+
+bool FrameRingReader::CopyLatest(uint32_t display, ImageBuffer* out,
+                                 FrameRingView* info) {
+  for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+    FrameRingView view;
+    if (!Latest(display, &view)) {
+      return false;
+    }
+    out->width = view.width;
+    out->height = view.height;
+    out->stride = view.stride;
+    out->pixel_format = view.pixel_format;
+    out->pixels.resize(static_cast<size_t>(view.stride) * view.height);
+    std::memcpy(out->pixels.data(), view.pixels, out->pixels.size());
+    if (Validate(view)) {
+      if (info) {
+        *info = view;
+      }
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image_buffer.h"
+
+// Named shared-memory ring of the latest raw frame per display, for local
+// consumers (live preview, DLP scanner) that would otherwise capture the
+// screen again. POSIX shm (/name) on Linux, a pagefile-backed file mapping
+// (Local\name) on Windows.
+//
+// Every display has kFrameRingDepth slots, written in turn. A slot is a
+// seqlock: the writer makes its sequence odd, copies the frame and makes it
+// even again. Readers never block the writer and never copy: they get a
+// pointer into the mapping and check afterwards (Validate) that the slot
+// was not rewritten while they read it. A slot is reused only after
+// kFrameRingDepth - 1 newer frames of its display, i.e. a reader has about
+// that many capture intervals to process a frame.
+//
+// The reader side (FrameRingReader) is the p2_frame_ring library and needs
+// nothing else from p2.
+
+constexpr uint32_t kFrameRingDepth = 3;
+
+// Writing process: one per name. Publish is called from one thread per
+// display (different displays may publish concurrently).
+class FrameRingWriter {
+ public:
+  FrameRingWriter() = default;
+  ~FrameRingWriter();
+  FrameRingWriter(const FrameRingWriter&) = delete;
+  FrameRingWriter& operator=(const FrameRingWriter&) = delete;
+
+  // A ring of the same name and layout left by a previous writer is reused
+  // (frame numbers continue); one with another layout is replaced on Linux
+  // and is an error on Windows while readers hold it. slot_bytes: the
+  // largest frame (tightly packed rows).
+  // Output: false + error when the memory cannot be created or mapped.
+  bool Create(const std::wstring& name, uint32_t displays, size_t slot_bytes,
+              std::wstring* error);
+  // Marks the ring closed for readers and removes the name (on Windows the
+  // name lives while readers hold it).
+  void Close();
+
+  // Copies frame into the next slot of display; timestamp is stored for
+  // readers (seconds, ArchiveTimestamp in p2). Output: false + error when
+  // the frame is larger than the slot or display is out of range.
+  bool Publish(uint32_t display, const ImageBuffer& frame, int64_t timestamp,
+               std::wstring* error);
+
+  bool IsOpen() const { return base_ != nullptr; }
+  size_t SlotBytes() const { return slot_bytes_; }
+
+ private:
+  uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+  size_t slot_bytes_ = 0;
+  uint32_t displays_ = 0;
+  std::string posix_name_;
+#if defined(_WIN32)
+  void* mapping_ = nullptr;
+#endif
+};
+
+// Frame inside the mapping; pixels stay readable until the reader closes,
+// but are only consistent while Validate(view) holds.
+struct FrameRingView {
+  uint32_t display = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // Row pitch in the mapping (width * bytes per pixel).
+  uint32_t stride = 0;
+  PixelFormat pixel_format = PixelFormat::kBgra8;
+  int64_t timestamp = 0;
+  // Per display, from 1; a new frame has a greater number.
+  uint64_t frame_number = 0;
+  const uint8_t* pixels = nullptr;
+  // Seqlock value the view was taken under.
+  uint64_t sequence = 0;
+};
+
+class FrameRingReader {
+ public:
+  FrameRingReader() = default;
+  ~FrameRingReader();
+  FrameRingReader(const FrameRingReader&) = delete;
+  FrameRingReader& operator=(const FrameRingReader&) = delete;
+
+  // Output: false + error when no ring of that name exists or its layout is
+  // not recognized.
+  bool Open(const std::wstring& name, std::wstring* error);
+  void Close();
+
+  uint32_t Displays() const { return displays_; }
+  // The writer has stopped; reopen to follow a restarted writer.
+  bool Closed() const;
+
+  // Latest published frame of display without copying; false when there is
+  // none yet. Check Validate after reading the pixels.
+  bool Latest(uint32_t display, FrameRingView* view) const;
+  // True while the slot of view has not been rewritten since Latest.
+  bool Validate(const FrameRingView& view) const;
+  // Latest + copy + Validate, retried a few times; false when no frame or
+  // the writer kept overtaking the copy.
+  bool CopyLatest(uint32_t display, ImageBuffer* out, FrameRingView* info);
+
+ private:
+  const uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+  size_t slot_bytes_ = 0;
+  uint32_t displays_ = 0;
+#if defined(_WIN32)
+  void* mapping_ = nullptr;
+#endif
+};
@@ -0,0 +1,521 @@
+#include "frame_store.h"
+
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+
+#include "file_io.h"
+#include "hash.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint8_t kRefsMagic[4] = {'P', '2', 'R', 'F'};
+constexpr uint64_t kRefsVersion = 1;
+constexpr size_t kRefsHeaderFixedSize = 16;
+constexpr size_t kReferenceSize = 40;
+constexpr uint8_t kFlagNewObject = 1;
+
+void PutLe(uint8_t* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+uint64_t GetLe(const uint8_t* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Имена хранятся в UTF-16LE, как в заголовке архива кадров.
+std::vector<uint8_t> EncodeRefsHeader(const ArchiveIdentity& identity) {
+  std::vector<uint8_t> header(kRefsHeaderFixedSize, 0);
+  for (const std::wstring* name : {&identity.computer, &identity.user}) {
+    for (wchar_t ch : *name) {
+      header.push_back(static_cast<uint8_t>(ch & 0xFF));
+      header.push_back(static_cast<uint8_t>((ch >> 8) & 0xFF));
+    }
+  }
+  std::memcpy(header.data(), kRefsMagic, 4);
+  PutLe(header.data() + 4, kRefsVersion, 2);
+  PutLe(header.data() + 6, header.size(), 2);
+  PutLe(header.data() + 8, identity.computer.size(), 2);
+  PutLe(header.data() + 10, identity.user.size(), 2);
+  return header;
+}
+
+// Output: размер заголовка, 0 — не журнал ссылок.
+size_t DecodeRefsHeader(const std::vector<uint8_t>& bytes,
+                        ArchiveIdentity* identity) {
+  if (bytes.size() < kRefsHeaderFixedSize ||
+      std::memcmp(bytes.data(), kRefsMagic, 4) != 0 ||
+      GetLe(bytes.data() + 4, 2) != kRefsVersion) {
+    return 0;
+  }
+  const size_t size = static_cast<size_t>(GetLe(bytes.data() + 6, 2));
+  const size_t computer = static_cast<size_t>(GetLe(bytes.data() + 8, 2));
+  const size_t user = static_cast<size_t>(GetLe(bytes.data() + 10, 2));
+  if (size != kRefsHeaderFixedSize + 2 * (computer + user) ||
+      size > bytes.size()) {
+    return 0;
+  }
+  if (identity) {
+    auto name = [&](size_t offset, size_t units) {
+      std::wstring value(units, L'\0');
+      for (size_t i = 0; i < units; ++i) {
+        value[i] =
+            static_cast<wchar_t>(GetLe(bytes.data() + offset + i * 2, 2));
+      }
+      return value;
+    };
+    identity->computer = name(kRefsHeaderFixedSize, computer);
+    identity->user = name(kRefsHeaderFixedSize + computer * 2, user);
+    identity->display_index = 0;
+  }
+  return size;
+}
+
+void EncodeReference(const StoreReference& reference, uint8_t* out) {
+  std::memset(out, 0, kReferenceSize);
+  PutLe(out, static_cast<uint64_t>(reference.timestamp), 8);
+  PutLe(out + 8, reference.key.low, 8);
+  PutLe(out + 16, reference.key.high, 8);
+  PutLe(out + 24, reference.length, 4);
+  out[28] = reference.codec == OutputCodec::kLossless ? 1 : 0;
+  out[29] = static_cast<uint8_t>(reference.display_index);
+  PutLe(out + 30, static_cast<uint64_t>(reference.display_count), 2);
+  out[32] = reference.new_object ? kFlagNewObject : 0;
+}
+
+StoreReference DecodeReference(const uint8_t* in) {
+  StoreReference reference;
+  reference.timestamp = static_cast<int64_t>(GetLe(in, 8));
+  reference.key.low = GetLe(in + 8, 8);
+  reference.key.high = GetLe(in + 16, 8);
+  reference.length = static_cast<uint32_t>(GetLe(in + 24, 4));
+  reference.codec = in[28] == 1 ? OutputCodec::kLossless : OutputCodec::kJpeg;
+  reference.display_index = in[29];
+  reference.display_count = static_cast<int>(GetLe(in + 30, 2));
+  reference.new_object = (in[32] & kFlagNewObject) != 0;
+  return reference;
+}
+
+bool ParseHex64(const std::wstring& text, uint64_t* out) {
+  uint64_t value = 0;
+  for (wchar_t ch : text) {
+    int digit = 0;
+    if (ch >= L'0' && ch <= L'9') {
+      digit = ch - L'0';
+    } else if (ch >= L'a' && ch <= L'f') {
+      digit = ch - L'a' + 10;
+    } else {
+      return false;
+    }
+    value = (value << 4) | static_cast<uint64_t>(digit);
+  }
+  *out = value;
+  return true;
+}
+
+// Ключ из имени объекта (32 hex-цифры); false — чужой или временный файл.
+bool KeyFromObjectName(const fs::path& file, FrameKey* key) {
+  const std::wstring stem = file.stem().wstring();
+  const std::wstring extension = file.extension().wstring();
+  return stem.size() == 32 &&
+         (extension == L".jpg" || extension == L".qoi") &&
+         ParseHex64(stem.substr(0, 16), &key->high) &&
+         ParseHex64(stem.substr(16), &key->low);
+}
+
+// Output: ссылки целых записей; возвращает размер заголовка (0 — не журнал).
+size_t ParseReferences(const std::vector<uint8_t>& bytes,
+                       ArchiveIdentity* identity,
+                       std::vector<StoreReference>* out) {
+  const size_t header = DecodeRefsHeader(bytes, identity);
+  out->clear();
+  if (header == 0) {
+    return 0;
+  }
+  for (size_t offset = header; offset + kReferenceSize <= bytes.size();
+       offset += kReferenceSize) {
+    out->push_back(DecodeReference(bytes.data() + offset));
+  }
+  return header;
+}
+
+}  // namespace
+
+FrameKey FrameContentKey(const ImageBuffer& frame) {
+  // Обоснование: размеры и формат входят в затравку — одинаковые байты
+  // другой геометрии не совпадают по ключу.
+  const uint64_t shape[4] = {frame.width, frame.height, frame.stride,
+                             static_cast<uint64_t>(frame.pixel_format)};
+  const Hash128Value hash = Hash128(frame.pixels.data(), frame.pixels.size(),
+                                    Hash64(shape, sizeof(shape)));
+  FrameKey key;
+  key.low = hash.low;
+  key.high = hash.high;
+  return key;
+}
+
+std::wstring FrameKeyHex(const FrameKey& key) {
+  wchar_t text[33] = {};
+  swprintf(text, 33, L"%016llx%016llx",
+           static_cast<unsigned long long>(key.high),
+           static_cast<unsigned long long>(key.low));
+  return text;
+}
+
+bool ReadStoreReferences(const std::wstring& path, ArchiveIdentity* identity,
+                         std::vector<StoreReference>* out,
+                         std::wstring* error) {
+  std::vector<uint8_t> bytes;
+  if (!ReadFileBytes(path, &bytes, error)) {
+    return false;
+  }
+  if (ParseReferences(bytes, identity, out) == 0) {
+    if (error) {
+      *error = L"Файл не является журналом ссылок хранилища: " + path;
+    }
+    return false;
+  }
+  return true;
+}
+
+DedupStats ComputeDedupStats(const std::vector<StoreReference>& references) {
+  DedupStats stats;
+  std::unordered_set<FrameKey, FrameKeyHash> keys;
+  for (const StoreReference& reference : references) {
+    ++stats.references;
+    stats.logical_bytes += reference.length;
+    if (reference.new_object) {
+      ++stats.new_objects;
+      stats.stored_bytes += reference.length;
+    }
+    keys.insert(reference.key);
+  }
+  stats.unique_frames = keys.size();
+  return stats;
+}
+
+std::wstring FormatDedupStats(const DedupStats& stats) {
+  const double ratio =
+      stats.unique_frames > 0
+          ? static_cast<double>(stats.references) / stats.unique_frames
+          : 0.0;
+  wchar_t ratio_text[32] = {};
+  swprintf(ratio_text, 32, L"%.2f", ratio);
+  return L"ссылок: " + std::to_wstring(stats.references) +
+         L", уникальных кадров: " + std::to_wstring(stats.unique_frames) +
+         L", коэффициент: " + ratio_text + L", записано байт: " +
+         std::to_wstring(stats.stored_bytes) + L" из " +
+         std::to_wstring(stats.logical_bytes);
+}
+
+bool FrameStore::Open(const std::wstring& store_dir,
+                      const ArchiveIdentity& identity, std::wstring* error) {
+  open_ = false;
+  store_dir_ = store_dir;
+  identity_ = identity;
+  objects_.clear();
+  object_bytes_ = 0;
+  day_path_.clear();
+  day_log_.close();
+  day_log_.clear();
+  day_stats_ = DedupStats{};
+  day_keys_.clear();
+
+  const fs::path root(store_dir);
+  std::error_code ec;
+  fs::create_directories(root / "objects", ec);
+  fs::create_directories(root / "refs", ec);
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось создать папку хранилища: " + store_dir;
+    }
+    return false;
+  }
+  // Счетчики ссылок — по всем журналам дней.
+  std::vector<StoreReference> references;
+  for (const fs::directory_entry& entry :
+       fs::directory_iterator(root / "refs", ec)) {
+    if (entry.path().extension() != L".p2refs") {
+      continue;
+    }
+    if (!ReadStoreReferences(entry.path().wstring(), nullptr, &references,
+                             error)) {
+      return false;
+    }
+    for (const StoreReference& reference : references) {
+      Object& object = objects_[reference.key];
+      if (object.references++ == 0) {
+        object.length = reference.length;
+        object.codec = reference.codec;
+        object_bytes_ += reference.length;
+      }
+    }
+  }
+  // Объекты без ссылок (сбой между записью объекта и ссылки) и временные
+  // файлы удаляются; объекты из журналов без файла забываются.
+  std::unordered_set<FrameKey, FrameKeyHash> present;
+  std::vector<fs::path> stale;
+  for (const fs::directory_entry& entry :
+       fs::recursive_directory_iterator(root / "objects", ec)) {
+    if (!entry.is_regular_file(ec)) {
+      continue;
+    }
+    FrameKey key;
+    if (KeyFromObjectName(entry.path(), &key) && objects_.count(key) != 0) {
+      present.insert(key);
+    } else {
+      stale.push_back(entry.path());
+    }
+  }
+  for (const fs::path& file : stale) {
+    fs::remove(file, ec);
+  }
+  for (auto it = objects_.begin(); it != objects_.end();) {
+    if (present.count(it->first) == 0) {
+      object_bytes_ -= it->second.length;
+      it = objects_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  open_ = true;
+  return true;
+}
+
+std::wstring FrameStore::ReferencePath(const DateTimeParts& dt) const {
+  wchar_t name[32] = {};
+  swprintf(name, 32, L"%04d-%02d-%02d.p2refs", dt.year, dt.month, dt.day);
+  return (fs::path(store_dir_) / "refs" / name).wstring();
+}
+
+std::wstring StoreObjectPath(const std::wstring& store_dir, const FrameKey& key,
+                             OutputCodec codec) {
+  const std::wstring hex = FrameKeyHex(key);
+  return (fs::path(store_dir) / "objects" / hex.substr(0, 2) /
+          (hex + OutputCodecExtension(codec)))
+      .wstring();
+}
+
+std::wstring FrameStore::ObjectPath(const FrameKey& key,
+                                    OutputCodec codec) const {
+  return StoreObjectPath(store_dir_, key, codec);
+}
+
+bool FrameStore::SetDay(const DateTimeParts& dt, std::wstring* error) {
+  const std::wstring path = ReferencePath(dt);
+  if (path == day_path_ && day_log_.is_open()) {
+    return true;
+  }
+  day_log_.close();
+  day_log_.clear();
+  day_path_ = path;
+  day_stats_ = DedupStats{};
+  day_keys_.clear();
+
+  std::error_code ec;
+  std::vector<uint8_t> bytes;
+  std::vector<StoreReference> references;
+  size_t header = 0;
+  if (fs::exists(fs::path(path), ec) &&
+      ReadFileBytes(path, &bytes, nullptr) &&
+      (header = ParseReferences(bytes, nullptr, &references)) != 0) {
+    // Оборванная последняя запись отрезается перед дозаписью.
+    const size_t whole = header + references.size() * kReferenceSize;
+    if (whole < bytes.size()) {
+      fs::resize_file(fs::path(path), whole, ec);
+    }
+    day_stats_ = ComputeDedupStats(references);
+    for (const StoreReference& reference : references) {
+      day_keys_.insert(reference.key);
+    }
+  } else if (!WriteFileBytes(path, EncodeRefsHeader(identity_), error)) {
+    return false;
+  }
+  day_log_.open(fs::path(path), std::ios::binary | std::ios::app);
+  if (!day_log_.is_open()) {
+    if (error) {
+      *error = L"Не удалось открыть журнал ссылок: " + path;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool FrameStore::Contains(const FrameKey& key) const {
+  return objects_.count(key) != 0;
+}
+
+bool FrameStore::AppendReference(const StoreReference& reference,
+                                 std::wstring* error) {
+  if (!day_log_.is_open()) {
+    if (error) {
+      *error = L"Хранилище кадров не открыто.";
+    }
+    return false;
+  }
+  uint8_t bytes[kReferenceSize];
+  EncodeReference(reference, bytes);
+  day_log_.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+  day_log_.flush();
+  if (!day_log_) {
+    day_log_.clear();
+    if (error) {
+      *error = L"Не удалось записать ссылку в журнал: " + day_path_;
+    }
+    return false;
+  }
+  Object& object = objects_[reference.key];
+  if (object.references++ == 0) {
+    object.length = reference.length;
+    object.codec = reference.codec;
+    object_bytes_ += reference.length;
+  }
+  ++day_stats_.references;
+  day_stats_.logical_bytes += reference.length;
+  if (reference.new_object) {
+    ++day_stats_.new_objects;
+    day_stats_.stored_bytes += reference.length;
+  }
+  day_keys_.insert(reference.key);
+  day_stats_.unique_frames = day_keys_.size();
+  return true;
+}
+
+bool FrameStore::AddReference(StoreReference* reference,
+                              std::wstring* error) {
+  const auto it = objects_.find(reference->key);
+  if (it == objects_.end()) {
+    if (error) {
+      *error = L"Кадра нет в хранилище: " + FrameKeyHex(reference->key);
+    }
+    return false;
+  }
+  reference->length = it->second.length;
+  reference->codec = it->second.codec;
+  reference->new_object = false;
+  return AppendReference(*reference, error);
+}
+
+bool FrameStore::AddFrame(StoreReference reference,
+                          const std::vector<uint8_t>& data,
+                          std::wstring* error) {
+  if (data.size() > UINT32_MAX) {
+    if (error) {
+      *error = L"Кадр слишком велик для хранилища.";
+    }
+    return false;
+  }
+  const fs::path object(ObjectPath(reference.key, reference.codec));
+  fs::path temp = object;
+  temp += L".tmp";
+  std::error_code ec;
+  fs::create_directories(object.parent_path(), ec);
+  // Обоснование: объект появляется под своим именем только целиком, иначе
+  // оборванная запись совпала бы по ключу с будущими кадрами.
+  if (!WriteFileBytes(temp.wstring(), data, error)) {
+    return false;
+  }
+  fs::rename(temp, object, ec);
+  if (ec) {
+    fs::remove(temp, ec);
+    if (error) {
+      *error = L"Не удалось сохранить кадр в хранилище: " + object.wstring();
+    }
+    return false;
+  }
+  reference.length = static_cast<uint32_t>(data.size());
+  reference.new_object = true;
+  return AppendReference(reference, error);
+}
+
+bool FrameStore::ReleaseDay(const DateTimeParts& dt,
+                            uint64_t* removed_objects,
+                            uint64_t* removed_bytes, std::wstring* error) {
+  const std::wstring path = ReferencePath(dt);
+  std::vector<StoreReference> references;
+  if (!ReadStoreReferences(path, nullptr, &references, error)) {
+    return false;
+  }
+  if (path == day_path_) {
+    day_log_.close();
+    day_log_.clear();
+    day_path_.clear();
+    day_stats_ = DedupStats{};
+    day_keys_.clear();
+  }
+  std::error_code ec;
+  // Журнал удаляется первым: после сбоя объекты без ссылок уберет Open.
+  if (!fs::remove(fs::path(path), ec) || ec) {
+    if (error) {
+      *error = L"Не удалось удалить журнал ссылок: " + path;
+    }
+    return false;
+  }
+  uint64_t objects = 0;
+  uint64_t bytes = 0;
+  for (const StoreReference& reference : references) {
+    const auto it = objects_.find(reference.key);
+    if (it == objects_.end() || --it->second.references > 0) {
+      continue;
+    }
+    fs::remove(fs::path(ObjectPath(it->first, it->second.codec)), ec);
+    ++objects;
+    bytes += it->second.length;
+    object_bytes_ -= it->second.length;
+    objects_.erase(it);
+  }
+  if (removed_objects) {
+    *removed_objects = objects;
+  }
+  if (removed_bytes) {
+    *removed_bytes = bytes;
+  }
+  return true;
+}
+
+bool FrameStore::ReleaseDaysBefore(const DateTimeParts& first_kept,
+                                   uint64_t* removed_objects,
+                                   uint64_t* removed_bytes,
+                                   std::wstring* error) {
+  // Имена журналов YYYY-MM-DD.p2refs сравниваются как строки дат.
+  const std::wstring limit =
+      fs::path(ReferencePath(first_kept)).stem().wstring();
+  std::vector<DateTimeParts> days;
+  std::error_code ec;
+  for (const fs::directory_entry& entry :
+       fs::directory_iterator(fs::path(store_dir_) / "refs", ec)) {
+    const std::wstring stem = entry.path().stem().wstring();
+    DateTimeParts dt;
+    if (entry.path().extension() == L".p2refs" && stem < limit &&
+        swscanf(stem.c_str(), L"%4d-%2d-%2d", &dt.year, &dt.month,
+                &dt.day) == 3) {
+      days.push_back(dt);
+    }
+  }
+  uint64_t objects = 0;
+  uint64_t bytes = 0;
+  for (const DateTimeParts& dt : days) {
+    uint64_t day_objects = 0;
+    uint64_t day_bytes = 0;
+    if (!ReleaseDay(dt, &day_objects, &day_bytes, error)) {
+      return false;
+    }
+    objects += day_objects;
+    bytes += day_bytes;
+  }
+  if (removed_objects) {
+    *removed_objects = objects;
+  }
+  if (removed_bytes) {
+    *removed_bytes = bytes;
+  }
+  return true;
+}
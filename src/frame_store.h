@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "codec_select.h"
+#include "frame_archive.h"
+#include "image_buffer.h"
+#include "time_utils.h"
+
+// Content-addressed frame store: every unique image is encoded and written
+// once, each capture adds a fixed 40-byte reference.
+//
+// <store>/objects/<2 hex>/<32 hex>.jpg|.qoi  encoded frames keyed by a
+//                                            128-bit hash of the pixels
+// <store>/refs/YYYY-MM-DD.p2refs            per-day reference log: header
+//                                            "P2RF" (source computer/user),
+//                                            then entries (timestamp, key,
+//                                            length, codec, display, flags)
+// Reference counts are rebuilt from the logs on Open, so deleting a day's
+// log (ReleaseDay) is the only retention operation and a crash between an
+// object and its reference leaves an orphan that the next Open removes.
+
+struct FrameKey {
+  uint64_t low = 0;
+  uint64_t high = 0;
+};
+
+inline bool operator==(const FrameKey& a, const FrameKey& b) {
+  return a.low == b.low && a.high == b.high;
+}
+
+struct FrameKeyHash {
+  size_t operator()(const FrameKey& key) const {
+    return static_cast<size_t>(key.low);
+  }
+};
+
+// Key of the pixel data (size and format included).
+FrameKey FrameContentKey(const ImageBuffer& frame);
+// 32 lowercase hex digits: high then low half.
+std::wstring FrameKeyHex(const FrameKey& key);
+
+struct StoreReference {
+  int64_t timestamp = 0;
+  FrameKey key;
+  uint32_t length = 0;
+  OutputCodec codec = OutputCodec::kJpeg;
+  int display_index = 0;
+  int display_count = 1;
+  // Set on the reference that wrote the object.
+  bool new_object = false;
+};
+
+// Deduplication of one day: references against unique images and bytes.
+struct DedupStats {
+  uint64_t references = 0;
+  uint64_t unique_frames = 0;
+  uint64_t new_objects = 0;
+  // Bytes the day would take as separate files, and bytes actually written.
+  uint64_t logical_bytes = 0;
+  uint64_t stored_bytes = 0;
+};
+
+// Reads a reference log; a torn last entry is ignored.
+// Output: false + error when the file is missing or not a reference log.
+bool ReadStoreReferences(const std::wstring& path, ArchiveIdentity* identity,
+                         std::vector<StoreReference>* out,
+                         std::wstring* error);
+DedupStats ComputeDedupStats(const std::vector<StoreReference>& references);
+// <store_dir>/objects/<2 hex>/<32 hex><codec extension>.
+std::wstring StoreObjectPath(const std::wstring& store_dir, const FrameKey& key,
+                             OutputCodec codec);
+// One-line report: references, unique frames, ratio, written/logical bytes.
+std::wstring FormatDedupStats(const DedupStats& stats);
+
+class FrameStore {
+ public:
+  // Scans the reference logs of store_dir (reference counts) and removes
+  // unreferenced objects and temp files left by a crash.
+  bool Open(const std::wstring& store_dir, const ArchiveIdentity& identity,
+            std::wstring* error);
+  bool IsOpen() const { return open_; }
+  // Selects the day log for the following references and loads its stats.
+  bool SetDay(const DateTimeParts& dt, std::wstring* error);
+
+  bool Contains(const FrameKey& key) const;
+  // Adds a reference to a stored object; codec and length of the reference
+  // are set from the store.
+  bool AddReference(StoreReference* reference, std::wstring* error);
+  // Writes a new object (temp file + rename), then its reference.
+  bool AddFrame(StoreReference reference, const std::vector<uint8_t>& data,
+                std::wstring* error);
+  // Retention: deletes the day log and the objects it referenced last.
+  bool ReleaseDay(const DateTimeParts& dt, uint64_t* removed_objects,
+                  uint64_t* removed_bytes, std::wstring* error);
+  // ReleaseDay for every day log older than first_kept (totals).
+  bool ReleaseDaysBefore(const DateTimeParts& first_kept,
+                         uint64_t* removed_objects, uint64_t* removed_bytes,
+                         std::wstring* error);
+
+  const DedupStats& DayStats() const { return day_stats_; }
+  uint64_t Objects() const { return objects_.size(); }
+  uint64_t ObjectBytes() const { return object_bytes_; }
+  std::wstring ObjectPath(const FrameKey& key, OutputCodec codec) const;
+  std::wstring ReferencePath(const DateTimeParts& dt) const;
+
+ private:
+  struct Object {
+    uint32_t references = 0;
+    uint32_t length = 0;
+    OutputCodec codec = OutputCodec::kJpeg;
+  };
+
+  bool AppendReference(const StoreReference& reference, std::wstring* error);
+
+  bool open_ = false;
+  std::wstring store_dir_;
+  ArchiveIdentity identity_;
+  std::unordered_map<FrameKey, Object, FrameKeyHash> objects_;
+  uint64_t object_bytes_ = 0;
+  std::wstring day_path_;
+  std::ofstream day_log_;
+  DedupStats day_stats_;
+  // Keys referenced in the current day (unique_frames of the stats).
+  std::unordered_set<FrameKey, FrameKeyHash> day_keys_;
+};
@@ -0,0 +1,127 @@
+#include "hash.h"
+
+#include <cstring>
+
+#include "perf_counters.h"
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+uint64_t Rotl(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t Load64(const uint8_t* p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = Rotl(acc, 31);
+  return acc * kPrime1;
+}
+
+uint64_t Merge(uint64_t acc, uint64_t lane) {
+  acc ^= Round(0, lane);
+  return acc * kPrime1 + kPrime4;
+}
+
+// Четыре линии по 8 байт; p сдвигается до остатка < 32 байт.
+void Consume(const uint8_t*& p, const uint8_t* end, uint64_t seed,
+             uint64_t lanes[4]) {
+  lanes[0] = seed + kPrime1 + kPrime2;
+  lanes[1] = seed + kPrime2;
+  lanes[2] = seed;
+  lanes[3] = seed - kPrime1;
+  const uint8_t* limit = end - 32;
+  do {
+    lanes[0] = Round(lanes[0], Load64(p));
+    lanes[1] = Round(lanes[1], Load64(p + 8));
+    lanes[2] = Round(lanes[2], Load64(p + 16));
+    lanes[3] = Round(lanes[3], Load64(p + 24));
+    p += 32;
+  } while (p <= limit);
+}
+
+// Остаток (< 32 байт) и перемешивание результата.
+uint64_t Finish(uint64_t hash, const uint8_t* p, const uint8_t* end,
+                size_t size) {
+  hash += static_cast<uint64_t>(size);
+  while (p + 8 <= end) {
+    hash ^= Round(0, Load64(p));
+    hash = Rotl(hash, 27) * kPrime1 + kPrime4;
+    p += 8;
+  }
+  while (p < end) {
+    hash ^= (*p) * kPrime5;
+    hash = Rotl(hash, 11) * kPrime1;
+    ++p;
+  }
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+}  // namespace
+
+// Обоснование: схема XXH64 (4 независимые линии по 8 байт) — скорость
+// порядка пропускной способности памяти без SIMD и внешних зависимостей.
+uint64_t Hash64(const void* data, size_t size, uint64_t seed) {
+  const PerfScope perf_scope(PerfStage::kHash);
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + size;
+  uint64_t hash;
+  if (size >= 32) {
+    uint64_t v[4];
+    Consume(p, end, seed, v);
+    hash = Rotl(v[0], 1) + Rotl(v[1], 7) + Rotl(v[2], 12) + Rotl(v[3], 18);
+    hash = Merge(hash, v[0]);
+    hash = Merge(hash, v[1]);
+    hash = Merge(hash, v[2]);
+    hash = Merge(hash, v[3]);
+  } else {
+    hash = seed + kPrime5;
+  }
+  return Finish(hash, p, end, size);
+}
+
+// Старшая половина сворачивает те же линии другими поворотами и в обратном
+// порядке: для совпадения ключа нужна коллизия обеих сверток состояния.
+Hash128Value Hash128(const void* data, size_t size, uint64_t seed) {
+  const PerfScope perf_scope(PerfStage::kHash);
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + size;
+  uint64_t low;
+  uint64_t high;
+  if (size >= 32) {
+    uint64_t v[4];
+    Consume(p, end, seed, v);
+    low = Rotl(v[0], 1) + Rotl(v[1], 7) + Rotl(v[2], 12) + Rotl(v[3], 18);
+    low = Merge(low, v[0]);
+    low = Merge(low, v[1]);
+    low = Merge(low, v[2]);
+    low = Merge(low, v[3]);
+    high = Rotl(v[0], 41) + Rotl(v[1], 29) + Rotl(v[2], 53) + Rotl(v[3], 5);
+    high = Merge(high, v[3] ^ kPrime3);
+    high = Merge(high, v[2]);
+    high = Merge(high, v[1]);
+    high = Merge(high, v[0]);
+  } else {
+    low = seed + kPrime5;
+    high = seed + kPrime3;
+  }
+  Hash128Value value;
+  value.low = Finish(low, p, end, size);
+  value.high = Finish(high ^ kPrime4, p, end, size);
+  return value;
+}
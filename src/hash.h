@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fast non-cryptographic 64-bit hash (change detection, cache keys).
+// Input: bytes and seed (chain calls by passing the previous result).
+uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0);
+
+struct Hash128Value {
+  uint64_t low = 0;
+  uint64_t high = 0;
+};
+
+// 128-bit variant for content keys (deduplication): the same single pass
+// over the data, two independent finalizations of the 256-bit lane state.
+Hash128Value Hash128(const void* data, size_t size, uint64_t seed = 0);
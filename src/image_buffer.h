@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Pixel layout of ImageBuffer rows.
+enum class PixelFormat : uint8_t {
+  kBgra8,        // B,G,R,A по 8 бит (DXGI B8G8R8A8, GDI DIB).
+  kRgba8,        // R,G,B,A по 8 бит.
+  kR10G10B10A2,  // 10 бит на цвет, упаковано в uint32 (R в младших битах).
+  kRgba16F,      // scRGB linear, half float на канал (HDR рабочий стол).
+};
+
+// Returns bytes per pixel for format.
+constexpr uint32_t BytesPerPixel(PixelFormat format) {
+  return format == PixelFormat::kRgba16F ? 8u : 4u;
+}
+
+// Image buffer in memory (BGRA by default).
+struct ImageBuffer {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t stride = 0;
+  PixelFormat pixel_format = PixelFormat::kBgra8;
+  std::vector<uint8_t> pixels;
+};
@@ -0,0 +1,334 @@
+#include "jpeg_dct.h"
+
+#include <algorithm>
+
+#include "jpeg_tables.h"
+#include "simd.h"
+
+namespace {
+
+// Константы IJG jfdctint: FIX(x) = round(x * 2^13).
+constexpr int kConstBits = 13;
+constexpr int kPass1Bits = 2;
+constexpr int kFix0298631336 = 2446;
+constexpr int kFix0390180644 = 3196;
+constexpr int kFix0541196100 = 4433;
+constexpr int kFix0765366865 = 6270;
+constexpr int kFix0899976223 = 7373;
+constexpr int kFix1175875602 = 9633;
+constexpr int kFix1501321110 = 12299;
+constexpr int kFix1847759065 = 15137;
+constexpr int kFix1961570560 = 16069;
+constexpr int kFix2053119869 = 16819;
+constexpr int kFix2562915447 = 20995;
+constexpr int kFix3072711026 = 25172;
+
+// Коэффициенты квантованного DC/AC ограничены категориями 11/10 бит.
+constexpr int kDcLimit = 2047;
+constexpr int kAcLimit = 1023;
+// Делитель квантования: q * 8 (коэффициенты хранятся как 8 * F).
+constexpr int kDivisorShift = 3;
+
+int Descale(int value, int shift) {
+  return (value + (1 << (shift - 1))) >> shift;
+}
+
+// Одномерное преобразование 8 значений с шагом step (in/out на месте).
+// pass 0: строки, результат масштабирован на 2^kPass1Bits; pass 1: столбцы.
+void Dct1dReference(int* d, int step, int pass) {
+  const int tmp0 = d[0 * step] + d[7 * step];
+  const int tmp7 = d[0 * step] - d[7 * step];
+  const int tmp1 = d[1 * step] + d[6 * step];
+  const int tmp6 = d[1 * step] - d[6 * step];
+  const int tmp2 = d[2 * step] + d[5 * step];
+  const int tmp5 = d[2 * step] - d[5 * step];
+  const int tmp3 = d[3 * step] + d[4 * step];
+  const int tmp4 = d[3 * step] - d[4 * step];
+
+  const int tmp10 = tmp0 + tmp3;
+  const int tmp13 = tmp0 - tmp3;
+  const int tmp11 = tmp1 + tmp2;
+  const int tmp12 = tmp1 - tmp2;
+  const int shift =
+      pass == 0 ? kConstBits - kPass1Bits : kConstBits + kPass1Bits;
+  if (pass == 0) {
+    d[0 * step] = (tmp10 + tmp11) * (1 << kPass1Bits);
+    d[4 * step] = (tmp10 - tmp11) * (1 << kPass1Bits);
+  } else {
+    d[0 * step] = Descale(tmp10 + tmp11, kPass1Bits);
+    d[4 * step] = Descale(tmp10 - tmp11, kPass1Bits);
+  }
+  const int z1 = (tmp12 + tmp13) * kFix0541196100;
+  d[2 * step] = Descale(z1 + tmp13 * kFix0765366865, shift);
+  d[6 * step] = Descale(z1 - tmp12 * kFix1847759065, shift);
+
+  const int z5 = (tmp4 + tmp6 + tmp5 + tmp7) * kFix1175875602;
+  const int za = -(tmp4 + tmp7) * kFix0899976223;
+  const int zb = -(tmp5 + tmp6) * kFix2562915447;
+  const int zc = -(tmp4 + tmp6) * kFix1961570560 + z5;
+  const int zd = -(tmp5 + tmp7) * kFix0390180644 + z5;
+  d[7 * step] = Descale(tmp4 * kFix0298631336 + za + zc, shift);
+  d[5 * step] = Descale(tmp5 * kFix2053119869 + zb + zd, shift);
+  d[3 * step] = Descale(tmp6 * kFix3072711026 + zb + zc, shift);
+  d[1 * step] = Descale(tmp7 * kFix1501321110 + za + zd, shift);
+}
+
+#if P2_HAVE_SSE2
+
+// Транспонирование 8x8 int16: r[i] = строка i -> r[i] = столбец i.
+void Transpose8x8(__m128i* r) {
+  const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  const __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  const __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  const __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  const __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  const __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  const __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  const __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  const __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  const __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  const __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  const __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  const __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+__m128i PairConst(int lo, int hi) {
+  return _mm_set1_epi32(static_cast<int>(
+      (static_cast<uint32_t>(static_cast<uint16_t>(hi)) << 16) |
+      static_cast<uint16_t>(lo)));
+}
+
+// a * ca + b * cb по 8 дорожкам (32 бита), затем округление и сдвиг в int16.
+template <int Shift>
+__m128i MaddDescale(__m128i a, __m128i b, __m128i coefs) {
+  const __m128i round = _mm_set1_epi32(1 << (Shift - 1));
+  const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), coefs);
+  const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), coefs);
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), Shift),
+                         _mm_srai_epi32(_mm_add_epi32(hi, round), Shift));
+}
+
+// Нечетная часть: сумма двух пар произведений, затем округление.
+template <int Shift>
+__m128i MaddSumDescale(__m128i a, __m128i b, __m128i ab_coefs, __m128i c,
+                       __m128i d, __m128i cd_coefs) {
+  const __m128i round = _mm_set1_epi32(1 << (Shift - 1));
+  const __m128i ab_lo = _mm_unpacklo_epi16(a, b);
+  const __m128i ab_hi = _mm_unpackhi_epi16(a, b);
+  const __m128i cd_lo = _mm_unpacklo_epi16(c, d);
+  const __m128i cd_hi = _mm_unpackhi_epi16(c, d);
+  const __m128i lo = _mm_add_epi32(_mm_madd_epi16(ab_lo, ab_coefs),
+                                   _mm_madd_epi16(cd_lo, cd_coefs));
+  const __m128i hi = _mm_add_epi32(_mm_madd_epi16(ab_hi, ab_coefs),
+                                   _mm_madd_epi16(cd_hi, cd_coefs));
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, round), Shift),
+                         _mm_srai_epi32(_mm_add_epi32(hi, round), Shift));
+}
+
+// Одномерный проход по 8 блокам-строкам сразу: v[i] = элемент i всех строк.
+// Обоснование: умножения через _mm_madd_epi16 на парах (a, b) дают точные
+// 32-битные суммы jfdctint, поэтому результат побитно равен эталону.
+template <int Pass>
+void Dct1dSse2(__m128i* v) {
+  constexpr int kShift =
+      Pass == 0 ? kConstBits - kPass1Bits : kConstBits + kPass1Bits;
+  const __m128i tmp0 = _mm_add_epi16(v[0], v[7]);
+  const __m128i tmp7 = _mm_sub_epi16(v[0], v[7]);
+  const __m128i tmp1 = _mm_add_epi16(v[1], v[6]);
+  const __m128i tmp6 = _mm_sub_epi16(v[1], v[6]);
+  const __m128i tmp2 = _mm_add_epi16(v[2], v[5]);
+  const __m128i tmp5 = _mm_sub_epi16(v[2], v[5]);
+  const __m128i tmp3 = _mm_add_epi16(v[3], v[4]);
+  const __m128i tmp4 = _mm_sub_epi16(v[3], v[4]);
+
+  const __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+  const __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+  const __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+  const __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+  if (Pass == 0) {
+    v[0] = _mm_slli_epi16(_mm_add_epi16(tmp10, tmp11), kPass1Bits);
+    v[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), kPass1Bits);
+  } else {
+    const __m128i round = _mm_set1_epi16(1 << (kPass1Bits - 1));
+    v[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), round),
+                          kPass1Bits);
+    v[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), round),
+                          kPass1Bits);
+  }
+  // out2 = tmp13 * (c0 + c1) + tmp12 * c0;
+  // out6 = tmp13 * c0 + tmp12 * (c0 - c2).
+  v[2] = MaddDescale<kShift>(
+      tmp13, tmp12,
+      PairConst(kFix0541196100 + kFix0765366865, kFix0541196100));
+  v[6] = MaddDescale<kShift>(
+      tmp13, tmp12,
+      PairConst(kFix0541196100, kFix0541196100 - kFix1847759065));
+
+  const __m128i z3 = _mm_add_epi16(tmp4, tmp6);
+  const __m128i z4 = _mm_add_epi16(tmp5, tmp7);
+  const __m128i z3_coefs =
+      PairConst(kFix1175875602 - kFix1961570560, kFix1175875602);
+  const __m128i z4_coefs =
+      PairConst(kFix1175875602, kFix1175875602 - kFix0390180644);
+  v[7] = MaddSumDescale<kShift>(
+      tmp4, tmp7, PairConst(kFix0298631336 - kFix0899976223, -kFix0899976223),
+      z3, z4, z3_coefs);
+  v[1] = MaddSumDescale<kShift>(
+      tmp4, tmp7, PairConst(-kFix0899976223, kFix1501321110 - kFix0899976223),
+      z3, z4, z4_coefs);
+  v[5] = MaddSumDescale<kShift>(
+      tmp5, tmp6, PairConst(kFix2053119869 - kFix2562915447, -kFix2562915447),
+      z3, z4, z4_coefs);
+  v[3] = MaddSumDescale<kShift>(
+      tmp5, tmp6, PairConst(-kFix2562915447, kFix3072711026 - kFix2562915447),
+      z3, z4, z3_coefs);
+}
+
+#endif  // P2_HAVE_SSE2
+
+struct QuantLimits {
+  int16_t values[64];
+  constexpr QuantLimits() : values() {
+    for (int i = 0; i < 64; ++i) {
+      values[i] = i == 0 ? kDcLimit : kAcLimit;
+    }
+  }
+};
+
+constexpr QuantLimits kQuantLimits;
+
+}  // namespace
+
+void ForwardDct8x8Reference(const uint8_t* samples, size_t stride,
+                            int16_t* coef) {
+  int data[64];
+  for (int y = 0; y < 8; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      data[y * 8 + x] = samples[y * stride + x] - 128;
+    }
+  }
+  for (int row = 0; row < 8; ++row) {
+    Dct1dReference(data + row * 8, 1, 0);
+  }
+  for (int col = 0; col < 8; ++col) {
+    Dct1dReference(data + col, 8, 1);
+  }
+  for (int i = 0; i < 64; ++i) {
+    coef[i] = static_cast<int16_t>(data[i]);
+  }
+}
+
+void ForwardDct8x8(const uint8_t* samples, size_t stride, int16_t* coef) {
+#if P2_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(128);
+  __m128i v[8];
+  for (int y = 0; y < 8; ++y) {
+    const __m128i row = _mm_loadl_epi64(
+        reinterpret_cast<const __m128i*>(samples + y * stride));
+    v[y] = _mm_sub_epi16(_mm_unpacklo_epi8(row, zero), center);
+  }
+  // Строки -> столбцы: проход 1 идет по строкам блока во всех дорожках.
+  Transpose8x8(v);
+  Dct1dSse2<0>(v);
+  Transpose8x8(v);
+  Dct1dSse2<1>(v);
+  for (int i = 0; i < 8; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(coef + i * 8), v[i]);
+  }
+#else
+  ForwardDct8x8Reference(samples, stride, coef);
+#endif
+}
+
+bool QuantizeBlock(const int16_t* coef, const QuantDivisors& divisors,
+                   int16_t* zz) {
+  int16_t natural[64];
+#if P2_HAVE_SSE2
+  __m128i quantized[8];
+  __m128i any_ac = _mm_setzero_si128();
+  for (int i = 0; i < 8; ++i) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(coef + i * 8));
+    const __m128i sign = _mm_srai_epi16(value, 15);
+    __m128i magnitude = _mm_sub_epi16(_mm_xor_si128(value, sign), sign);
+    magnitude = _mm_add_epi16(
+        magnitude, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                       divisors.correction + i * 8)));
+    magnitude = _mm_mulhi_epu16(
+        magnitude, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                       divisors.reciprocal + i * 8)));
+    magnitude = _mm_mulhi_epu16(
+        magnitude, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                       divisors.scale + i * 8)));
+    magnitude = _mm_min_epi16(
+        magnitude, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                       kQuantLimits.values + i * 8)));
+    // В первом векторе дорожка 0 — DC, в признак AC она не входит.
+    any_ac = _mm_or_si128(
+        any_ac, i == 0 ? _mm_slli_si128(_mm_srli_si128(magnitude, 2), 2)
+                       : magnitude);
+    quantized[i] = _mm_sub_epi16(_mm_xor_si128(magnitude, sign), sign);
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi16(any_ac, _mm_setzero_si128())) ==
+      0xFFFF) {
+    // Пустой блок: только DC, без перестановки zigzag.
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < 8; ++i) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(zz + i * 8), zero);
+    }
+    zz[0] = static_cast<int16_t>(_mm_cvtsi128_si32(quantized[0]));
+    return false;
+  }
+  for (int i = 0; i < 8; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(natural + i * 8),
+                     quantized[i]);
+  }
+  const bool has_ac = true;
+#else
+  bool has_ac = false;
+  for (int i = 0; i < 64; ++i) {
+    const int value = coef[i];
+    const uint32_t magnitude =
+        static_cast<uint32_t>(value < 0 ? -value : value);
+    uint32_t q =
+        ((magnitude + divisors.correction[i]) * divisors.reciprocal[i]) >> 16;
+    q = (q * divisors.scale[i]) >> 16;
+    const int limited =
+        std::min<int>(static_cast<int>(q), kQuantLimits.values[i]);
+    has_ac = has_ac || (i != 0 && limited != 0);
+    natural[i] = static_cast<int16_t>(value < 0 ? -limited : limited);
+  }
+#endif
+  for (int k = 0; k < 64; ++k) {
+    zz[k] = natural[kZigzagToNatural[k]];
+  }
+  return has_ac;
+}
+
+bool QuantizeBlockReference(const int16_t* coef, const uint8_t quant[64],
+                            int16_t* zz) {
+  bool has_ac = false;
+  for (int k = 0; k < 64; ++k) {
+    const int natural = kZigzagToNatural[k];
+    const int divisor = std::max<int>(quant[natural], 1) << kDivisorShift;
+    const int value = coef[natural];
+    const int magnitude = value < 0 ? -value : value;
+    const int q = std::min<int>((magnitude + divisor / 2) / divisor,
+                                kQuantLimits.values[natural]);
+    zz[k] = static_cast<int16_t>(value < 0 ? -q : q);
+    has_ac = has_ac || (k != 0 && q != 0);
+  }
+  return has_ac;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Forward DCT and quantization kernels of the native JPEG encoder.
+// Coefficients are int16 8 * F(u,v) in natural (row-major) order, the scale
+// of the IJG integer DCT; quantization divides by 8 * q.
+
+// Integer 8x8 forward DCT (IJG "islow": 13-bit constants, 16-bit data
+// between passes). Input: 8 rows of 8 samples, stride in bytes.
+// Vectorized with SSE2 where available; bit-exact with the reference.
+void ForwardDct8x8(const uint8_t* samples, size_t stride, int16_t* coef);
+
+// Scalar reference of ForwardDct8x8 (32-bit arithmetic).
+void ForwardDct8x8Reference(const uint8_t* samples, size_t stride,
+                            int16_t* coef);
+
+// Precomputed reciprocals of 8 * q: quantization is two 16-bit high
+// multiplies per coefficient instead of a division.
+struct QuantDivisors {
+  uint16_t reciprocal[64] = {};
+  uint16_t correction[64] = {};
+  uint16_t scale[64] = {};
+};
+
+// Builds divisors of a natural-order quantization table (values 1..255).
+// constexpr: tables of the built-in quality presets are compile-time data.
+// Scheme of libjpeg-turbo compute_reciprocal: for 16-bit magnitudes
+// (|c| + correction) * reciprocal * scale >> 32 equals rounded division.
+constexpr QuantDivisors BuildQuantDivisors(const uint8_t* quant) {
+  QuantDivisors out{};
+  for (int i = 0; i < 64; ++i) {
+    const uint32_t q = quant[i] > 0 ? quant[i] : 1u;
+    const uint32_t divisor = q << 3;  // 8 * q
+    int log2 = 0;
+    while ((2u << log2) <= divisor) {
+      ++log2;
+    }
+    int shift = 16 + log2;
+    uint32_t reciprocal = (1u << shift) / divisor;
+    const uint32_t remainder = (1u << shift) % divisor;
+    uint32_t correction = divisor / 2;
+    if (remainder == 0) {
+      reciprocal >>= 1;
+      --shift;
+    } else if (remainder <= divisor / 2) {
+      ++correction;
+    } else {
+      ++reciprocal;
+    }
+    out.reciprocal[i] = static_cast<uint16_t>(reciprocal);
+    out.correction[i] = static_cast<uint16_t>(correction);
+    out.scale[i] = static_cast<uint16_t>(1u << (32 - shift));
+  }
+  return out;
+}
+
+// Quantizes natural-order coefficients (round half away from zero, DC
+// clamped to +-2047 and AC to +-1023) into zigzag order.
+// Returns false when all AC coefficients are zero (DC + EOB block).
+bool QuantizeBlock(const int16_t* coef, const QuantDivisors& divisors,
+                   int16_t* zz);
+
+// Scalar reference of QuantizeBlock (integer division).
+bool QuantizeBlockReference(const int16_t* coef, const uint8_t quant[64],
+                            int16_t* zz);
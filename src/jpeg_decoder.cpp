@@ -0,0 +1,704 @@
+#include "jpeg_decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#include "jpeg_tables.h"
+
+namespace {
+
+// Коды Huffman не длиннее kLookupBits декодируются одной выборкой из
+// таблицы; более длинные — по max_code (ITU T.81, F.2.2.3).
+constexpr int kLookupBits = 9;
+constexpr uint64_t kMaxPixels = 1ull << 30;
+
+struct HuffmanTable {
+  bool defined = false;
+  uint8_t fast_length[1 << kLookupBits] = {};
+  uint8_t fast_symbol[1 << kLookupBits] = {};
+  int32_t max_code[18] = {};
+  int32_t value_offset[18] = {};
+  uint8_t symbols[256] = {};
+};
+
+// Что делает JpegParser::Run: только заголовки, полный кадр или кадр 1/8
+// из коэффициентов DC.
+enum class ParseMode { kInfo, kFull, kDc };
+
+struct Component {
+  int id = 0;
+  int h = 1;
+  int v = 1;
+  int quant = 0;
+  int dc_table = 0;
+  int ac_table = 0;
+  int dc_pred = 0;
+  bool scanned = false;
+  // Плоскость дополнена до целых MCU: blocks_w * 8 x blocks_h * 8 (в режиме
+  // DC — по отсчету на блок).
+  uint32_t blocks_w = 0;
+  uint32_t blocks_h = 0;
+  std::vector<uint8_t> plane;
+};
+
+bool Fail(std::wstring* error) {
+  if (error) {
+    *error = L"Поврежденный или неподдерживаемый поток JPEG.";
+  }
+  return false;
+}
+
+uint32_t GetBe16(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 8) | in[1];
+}
+
+bool BuildHuffmanTable(const uint8_t* counts, const uint8_t* symbols,
+                       size_t total, HuffmanTable* table) {
+  *table = HuffmanTable{};
+  std::memcpy(table->symbols, symbols, total);
+  int32_t code = 0;
+  int32_t index = 0;
+  for (int length = 1; length <= 16; ++length) {
+    const int count = counts[length - 1];
+    table->value_offset[length] = index - code;
+    // Обоснование: проверка до заполнения — лишние коды длины <= 9 иначе
+    // пишут за границы таблиц быстрого поиска.
+    if (code + count > (1 << length)) {
+      return false;
+    }
+    for (int i = 0; i < count; ++i, ++code, ++index) {
+      if (length <= kLookupBits) {
+        const int shift = kLookupBits - length;
+        for (int fill = 0; fill < (1 << shift); ++fill) {
+          const int slot = (code << shift) | fill;
+          table->fast_length[slot] = static_cast<uint8_t>(length);
+          table->fast_symbol[slot] = symbols[index];
+        }
+      }
+    }
+    table->max_code[length] = count > 0 ? code - 1 : -1;
+    code <<= 1;
+  }
+  table->max_code[17] = INT32_MAX;
+  table->defined = true;
+  return true;
+}
+
+// Биты энтропийного сегмента: снимает вставленные 0x00 после 0xFF и
+// останавливается на маркере, дальше подает нули. Чтение за маркером или
+// концом данных означает оборванный поток (Overrun).
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t size, size_t pos)
+      : data_(data), size_(size), pos_(pos) {}
+
+  uint32_t Peek(int bits) {
+    Fill();
+    return static_cast<uint32_t>(bits_ >> (64 - bits));
+  }
+  void Skip(int bits) {
+    bits_ <<= bits;
+    count_ -= bits;
+  }
+  int Receive(int bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    const int value = static_cast<int>(Peek(bits));
+    Skip(bits);
+    return value < (1 << (bits - 1)) ? value - (1 << bits) + 1 : value;
+  }
+  int Decode(const HuffmanTable& table) {
+    const uint32_t look = Peek(kLookupBits);
+    const int length = table.fast_length[look];
+    if (length > 0) {
+      Skip(length);
+      return table.fast_symbol[look];
+    }
+    const uint32_t code16 = Peek(16);
+    for (int bits = kLookupBits + 1; bits <= 16; ++bits) {
+      const int32_t code = static_cast<int32_t>(code16 >> (16 - bits));
+      if (code <= table.max_code[bits]) {
+        Skip(bits);
+        return table.symbols[(code + table.value_offset[bits]) & 0xFF];
+      }
+    }
+    return -1;
+  }
+  bool Overrun() const { return count_ < phantom_bits_; }
+  // Переход через маркер RSTn: остаток байта отбрасывается.
+  bool Restart() {
+    if (Overrun()) {
+      return false;
+    }
+    bits_ = 0;
+    count_ = 0;
+    phantom_bits_ = 0;
+    marker_ = false;
+    while (pos_ + 1 < size_ &&
+           !(data_[pos_] == 0xFF && data_[pos_ + 1] >= 0xD0 &&
+             data_[pos_ + 1] <= 0xD7)) {
+      ++pos_;
+    }
+    if (pos_ + 1 >= size_) {
+      return false;
+    }
+    pos_ += 2;
+    return true;
+  }
+  // Позиция следующего маркера после сегмента.
+  size_t NextMarker() const {
+    size_t pos = pos_;
+    while (pos + 1 < size_ &&
+           !(data_[pos] == 0xFF && data_[pos + 1] != 0 &&
+             !(data_[pos + 1] >= 0xD0 && data_[pos + 1] <= 0xD7))) {
+      ++pos;
+    }
+    return pos;
+  }
+
+ private:
+  void Fill() {
+    while (count_ <= 56) {
+      uint64_t byte = 0;
+      if (!marker_ && pos_ < size_) {
+        byte = data_[pos_];
+        if (byte == 0xFF) {
+          const uint8_t next = pos_ + 1 < size_ ? data_[pos_ + 1] : 0xD9;
+          if (next == 0x00) {
+            pos_ += 2;
+          } else {
+            marker_ = true;
+            byte = 0;
+            phantom_bits_ += 8;
+          }
+        } else {
+          ++pos_;
+        }
+      } else {
+        phantom_bits_ += 8;
+      }
+      bits_ |= byte << (56 - count_);
+      count_ += 8;
+    }
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+  uint64_t bits_ = 0;
+  int count_ = 0;
+  int phantom_bits_ = 0;
+  bool marker_ = false;
+};
+
+// Базис обратного DCT: c[x][u] = C(u) / 2 * cos((2x + 1) u pi / 16).
+const float* IdctBasis() {
+  static const auto basis = [] {
+    std::vector<float> table(64);
+    const double pi = 3.14159265358979323846;
+    for (int x = 0; x < 8; ++x) {
+      for (int u = 0; u < 8; ++u) {
+        const double scale = u == 0 ? std::sqrt(0.5) : 1.0;
+        table[x * 8 + u] = static_cast<float>(
+            0.5 * scale * std::cos((2 * x + 1) * u * pi / 16.0));
+      }
+    }
+    return table;
+  }();
+  return basis.data();
+}
+
+uint8_t ClampSample(float value) {
+  const int sample = static_cast<int>(std::lround(value)) + 128;
+  return static_cast<uint8_t>(std::clamp(sample, 0, 255));
+}
+
+// Раздельный обратный DCT: строки, затем столбцы.
+void InverseDct(const int32_t* coef, uint8_t* out, size_t stride) {
+  const float* c = IdctBasis();
+  float rows[64];
+  for (int v = 0; v < 8; ++v) {
+    const int32_t* in = coef + v * 8;
+    for (int x = 0; x < 8; ++x) {
+      float sum = 0.0f;
+      for (int u = 0; u < 8; ++u) {
+        sum += c[x * 8 + u] * static_cast<float>(in[u]);
+      }
+      rows[v * 8 + x] = sum;
+    }
+  }
+  for (int y = 0; y < 8; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      float sum = 0.0f;
+      for (int v = 0; v < 8; ++v) {
+        sum += c[y * 8 + v] * rows[v * 8 + x];
+      }
+      out[y * stride + x] = ClampSample(sum);
+    }
+  }
+}
+
+class JpegParser {
+ public:
+  explicit JpegParser(const std::vector<uint8_t>& data) : data_(data) {}
+
+  bool Run(ParseMode mode, JpegInfo* info, ImageBuffer* out);
+
+ private:
+  bool ParseFrame(const uint8_t* p, size_t n);
+  bool ParseHuffman(const uint8_t* p, size_t n);
+  bool ParseQuant(const uint8_t* p, size_t n);
+  bool DecodeScan(const uint8_t* p, size_t n, size_t data_pos,
+                  size_t* end_pos);
+  bool DecodeBlock(BitReader* reader, Component* component, uint32_t bx,
+                   uint32_t by);
+  void ConvertToBgra(ImageBuffer* out) const;
+
+  const std::vector<uint8_t>& data_;
+  ParseMode mode_ = ParseMode::kInfo;
+  // Сторона блока в плоскости: 8 или 1 (режим DC).
+  uint32_t block_size_ = 8;
+  uint16_t quant_[4][64] = {};
+  bool quant_defined_[4] = {};
+  HuffmanTable dc_[4];
+  HuffmanTable ac_[4];
+  bool frame_ = false;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  int hmax_ = 1;
+  int vmax_ = 1;
+  uint32_t mcus_x_ = 0;
+  uint32_t mcus_y_ = 0;
+  uint32_t restart_interval_ = 0;
+  std::vector<Component> components_;
+  bool has_comment_ = false;
+  std::string comment_;
+};
+
+bool JpegParser::ParseFrame(const uint8_t* p, size_t n) {
+  if (frame_ || n < 6 || p[0] != 8) {
+    return false;
+  }
+  height_ = GetBe16(p + 1);
+  width_ = GetBe16(p + 3);
+  const int count = p[5];
+  if (width_ == 0 || height_ == 0 || (count != 1 && count != 3) ||
+      n != 6 + 3 * static_cast<size_t>(count) ||
+      static_cast<uint64_t>(width_) * height_ > kMaxPixels) {
+    return false;
+  }
+  components_.resize(count);
+  for (int i = 0; i < count; ++i) {
+    Component& component = components_[i];
+    component.id = p[6 + i * 3];
+    component.h = p[7 + i * 3] >> 4;
+    component.v = p[7 + i * 3] & 15;
+    component.quant = p[8 + i * 3];
+    if (component.h < 1 || component.h > 4 || component.v < 1 ||
+        component.v > 4 || component.quant > 3) {
+      return false;
+    }
+    hmax_ = std::max(hmax_, component.h);
+    vmax_ = std::max(vmax_, component.v);
+  }
+  mcus_x_ = (width_ + 8 * hmax_ - 1) / (8 * hmax_);
+  mcus_y_ = (height_ + 8 * vmax_ - 1) / (8 * vmax_);
+  for (Component& component : components_) {
+    component.blocks_w = mcus_x_ * component.h;
+    component.blocks_h = mcus_y_ * component.v;
+    if (mode_ != ParseMode::kInfo) {
+      component.plane.assign(static_cast<size_t>(component.blocks_w) *
+                                 component.blocks_h * block_size_ *
+                                 block_size_,
+                             0);
+    }
+  }
+  frame_ = true;
+  return true;
+}
+
+bool JpegParser::ParseHuffman(const uint8_t* p, size_t n) {
+  size_t pos = 0;
+  while (pos < n) {
+    if (pos + 17 > n) {
+      return false;
+    }
+    const int table_class = p[pos] >> 4;
+    const int id = p[pos] & 15;
+    if (table_class > 1 || id > 3) {
+      return false;
+    }
+    size_t total = 0;
+    for (int i = 0; i < 16; ++i) {
+      total += p[pos + 1 + i];
+    }
+    if (total > 256 || pos + 17 + total > n) {
+      return false;
+    }
+    HuffmanTable* table = table_class == 0 ? &dc_[id] : &ac_[id];
+    if (!BuildHuffmanTable(p + pos + 1, p + pos + 17, total, table)) {
+      return false;
+    }
+    pos += 17 + total;
+  }
+  return true;
+}
+
+bool JpegParser::ParseQuant(const uint8_t* p, size_t n) {
+  size_t pos = 0;
+  while (pos < n) {
+    const int precision = p[pos] >> 4;
+    const int id = p[pos] & 15;
+    const size_t size = precision == 0 ? 64 : 128;
+    if (precision > 1 || id > 3 || pos + 1 + size > n) {
+      return false;
+    }
+    for (int k = 0; k < 64; ++k) {
+      quant_[id][k] = static_cast<uint16_t>(
+          precision == 0 ? p[pos + 1 + k] : GetBe16(p + pos + 1 + k * 2));
+    }
+    quant_defined_[id] = true;
+    pos += 1 + size;
+  }
+  return true;
+}
+
+bool JpegParser::DecodeBlock(BitReader* reader, Component* component,
+                             uint32_t bx, uint32_t by) {
+  int32_t coef[64] = {};
+  const uint16_t* quant = quant_[component->quant];
+  const int category = reader->Decode(dc_[component->dc_table]);
+  if (category < 0 || category > 11) {
+    return false;
+  }
+  component->dc_pred += reader->Receive(category);
+  coef[0] = component->dc_pred * quant[0];
+  const bool dc_only = mode_ == ParseMode::kDc;
+  bool ac = false;
+  const HuffmanTable& ac_table = ac_[component->ac_table];
+  for (int k = 1; k < 64;) {
+    const int symbol = reader->Decode(ac_table);
+    if (symbol < 0) {
+      return false;
+    }
+    const int run = symbol >> 4;
+    const int size = symbol & 15;
+    if (size == 0) {
+      if (run != 15) {
+        break;
+      }
+      k += 16;
+      continue;
+    }
+    k += run;
+    if (k > 63 || size > 10) {
+      return false;
+    }
+    // В режиме DC значения AC только пропускаются: ни деквантования, ни
+    // обратного DCT.
+    const int value = reader->Receive(size);
+    if (!dc_only) {
+      coef[kZigzagToNatural[k]] = value * quant[k];
+      ac = true;
+    }
+    ++k;
+  }
+  const size_t stride = static_cast<size_t>(component->blocks_w) * block_size_;
+  uint8_t* out = component->plane.data() +
+                 static_cast<size_t>(by) * block_size_ * stride +
+                 bx * block_size_;
+  if (dc_only) {
+    // Среднее блока: F(0,0) / 8 — отсчет кадра 1/8.
+    *out = ClampSample(static_cast<float>(coef[0]) / 8.0f);
+    return true;
+  }
+  // Обоснование: у экранных кадров большинство блоков — ровная заливка без
+  // AC: обратный DCT вырождается в константу F(0,0) / 8.
+  if (!ac) {
+    const uint8_t value = ClampSample(static_cast<float>(coef[0]) / 8.0f);
+    for (int y = 0; y < 8; ++y) {
+      std::memset(out + y * stride, value, 8);
+    }
+    return true;
+  }
+  InverseDct(coef, out, stride);
+  return true;
+}
+
+bool JpegParser::DecodeScan(const uint8_t* p, size_t n, size_t data_pos,
+                            size_t* end_pos) {
+  if (!frame_ || n < 1) {
+    return false;
+  }
+  const int count = p[0];
+  if (count < 1 || count > static_cast<int>(components_.size()) ||
+      n != 4 + 2 * static_cast<size_t>(count)) {
+    return false;
+  }
+  std::vector<Component*> scan;
+  for (int i = 0; i < count; ++i) {
+    Component* component = nullptr;
+    for (Component& candidate : components_) {
+      if (candidate.id == p[1 + i * 2]) {
+        component = &candidate;
+      }
+    }
+    if (!component) {
+      return false;
+    }
+    component->dc_table = p[2 + i * 2] >> 4;
+    component->ac_table = p[2 + i * 2] & 15;
+    if (component->dc_table > 3 || component->ac_table > 3 ||
+        !dc_[component->dc_table].defined ||
+        !ac_[component->ac_table].defined ||
+        !quant_defined_[component->quant]) {
+      return false;
+    }
+    component->dc_pred = 0;
+    component->scanned = true;
+    scan.push_back(component);
+  }
+  const uint8_t* spectral = p + 1 + count * 2;
+  if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) {
+    return false;
+  }
+
+  BitReader reader(data_.data(), data_.size(), data_pos);
+  // Скан одной компоненты идет по ее блокам без дополнения до MCU.
+  const bool single = count == 1;
+  const Component& first = *scan[0];
+  const uint32_t units_x =
+      single ? (((width_ * first.h + hmax_ - 1) / hmax_) + 7) / 8 : mcus_x_;
+  const uint32_t units_y =
+      single ? (((height_ * first.v + vmax_ - 1) / vmax_) + 7) / 8 : mcus_y_;
+  const uint64_t units = static_cast<uint64_t>(units_x) * units_y;
+  for (uint64_t unit = 0; unit < units; ++unit) {
+    if (restart_interval_ > 0 && unit > 0 &&
+        unit % restart_interval_ == 0) {
+      if (!reader.Restart()) {
+        return false;
+      }
+      for (Component* component : scan) {
+        component->dc_pred = 0;
+      }
+    }
+    const uint32_t ux = static_cast<uint32_t>(unit % units_x);
+    const uint32_t uy = static_cast<uint32_t>(unit / units_x);
+    if (single) {
+      if (!DecodeBlock(&reader, scan[0], ux, uy)) {
+        return false;
+      }
+      continue;
+    }
+    for (Component* component : scan) {
+      for (int v = 0; v < component->v; ++v) {
+        for (int h = 0; h < component->h; ++h) {
+          if (!DecodeBlock(&reader, component, ux * component->h + h,
+                           uy * component->v + v)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  if (reader.Overrun()) {
+    return false;
+  }
+  *end_pos = reader.NextMarker();
+  return true;
+}
+
+void JpegParser::ConvertToBgra(ImageBuffer* out) const {
+  // Кадр DC: пиксель на блок 8x8 яркости при максимальной дискретизации.
+  const uint32_t width = (width_ + 8 / block_size_ - 1) / (8 / block_size_);
+  const uint32_t height =
+      (height_ + 8 / block_size_ - 1) / (8 / block_size_);
+  out->width = width;
+  out->height = height;
+  out->stride = width * 4;
+  out->pixel_format = PixelFormat::kBgra8;
+  out->pixels.resize(static_cast<size_t>(out->stride) * height);
+  const Component& luma = components_[0];
+  const size_t luma_stride = static_cast<size_t>(luma.blocks_w) * block_size_;
+  for (uint32_t y = 0; y < height; ++y) {
+    uint8_t* row = out->pixels.data() + static_cast<size_t>(y) * out->stride;
+    const uint8_t* luma_row =
+        luma.plane.data() + (static_cast<size_t>(y) * luma.v / vmax_) *
+                                luma_stride;
+    if (components_.size() == 1) {
+      for (uint32_t x = 0; x < width; ++x) {
+        const uint8_t value = luma_row[x * luma.h / hmax_];
+        row[x * 4 + 0] = value;
+        row[x * 4 + 1] = value;
+        row[x * 4 + 2] = value;
+        row[x * 4 + 3] = 255;
+      }
+      continue;
+    }
+    const Component& cb = components_[1];
+    const Component& cr = components_[2];
+    const uint8_t* cb_row =
+        cb.plane.data() + (static_cast<size_t>(y) * cb.v / vmax_) *
+                              (static_cast<size_t>(cb.blocks_w) * block_size_);
+    const uint8_t* cr_row =
+        cr.plane.data() + (static_cast<size_t>(y) * cr.v / vmax_) *
+                              (static_cast<size_t>(cr.blocks_w) * block_size_);
+    for (uint32_t x = 0; x < width; ++x) {
+      // Обоснование: цветность повторяется (ближайший отсчет) — для
+      // перекодирования и уменьшения старых кадров сглаживание не нужно.
+      const int luma_value = luma_row[x * luma.h / hmax_];
+      const int blue_diff = cb_row[x * cb.h / hmax_] - 128;
+      const int red_diff = cr_row[x * cr.h / hmax_] - 128;
+      // ITU T.871 (JFIF), коэффициенты в 16.16.
+      const int red = luma_value + ((91881 * red_diff + 32768) >> 16);
+      const int green =
+          luma_value -
+          ((22554 * blue_diff + 46802 * red_diff + 32768) >> 16);
+      const int blue = luma_value + ((116130 * blue_diff + 32768) >> 16);
+      row[x * 4 + 0] = static_cast<uint8_t>(std::clamp(blue, 0, 255));
+      row[x * 4 + 1] = static_cast<uint8_t>(std::clamp(green, 0, 255));
+      row[x * 4 + 2] = static_cast<uint8_t>(std::clamp(red, 0, 255));
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+bool JpegParser::Run(ParseMode mode, JpegInfo* info, ImageBuffer* out) {
+  mode_ = mode;
+  block_size_ = mode == ParseMode::kDc ? 1 : 8;
+  const bool decode = mode != ParseMode::kInfo;
+  const uint8_t* data = data_.data();
+  const size_t size = data_.size();
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    return false;
+  }
+  size_t pos = 2;
+  bool scanned = false;
+  while (true) {
+    if (pos >= size || data[pos] != 0xFF) {
+      return false;
+    }
+    while (pos < size && data[pos] == 0xFF) {
+      ++pos;
+    }
+    if (pos >= size) {
+      return false;
+    }
+    const uint8_t marker = data[pos++];
+    if (marker == 0xD9) {
+      break;
+    }
+    if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) {
+      continue;
+    }
+    if (pos + 2 > size) {
+      return false;
+    }
+    const size_t length = GetBe16(data + pos);
+    if (length < 2 || pos + length > size) {
+      return false;
+    }
+    const uint8_t* payload = data + pos + 2;
+    const size_t n = length - 2;
+    size_t next = pos + length;
+    bool ok = true;
+    if (marker == 0xC0 || marker == 0xC1) {
+      ok = ParseFrame(payload, n);
+    } else if (marker == 0xC4) {
+      ok = ParseHuffman(payload, n);
+    } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC8) {
+      // Прогрессивные, без потерь и арифметические потоки.
+      ok = false;
+    } else if (marker == 0xDB) {
+      ok = ParseQuant(payload, n);
+    } else if (marker == 0xDD) {
+      ok = n == 2;
+      restart_interval_ = ok ? GetBe16(payload) : 0;
+    } else if (marker == 0xFE && !has_comment_) {
+      has_comment_ = true;
+      comment_.assign(reinterpret_cast<const char*>(payload), n);
+    } else if (marker == 0xDA) {
+      if (!frame_) {
+        return false;
+      }
+      if (!decode) {
+        break;
+      }
+      ok = DecodeScan(payload, n, next, &next);
+      scanned = true;
+    }
+    if (!ok) {
+      return false;
+    }
+    pos = next;
+  }
+  if (!frame_) {
+    return false;
+  }
+  if (info) {
+    info->width = width_;
+    info->height = height_;
+    info->components = static_cast<int>(components_.size());
+    info->comment = comment_;
+  }
+  if (!decode) {
+    return true;
+  }
+  for (const Component& component : components_) {
+    if (!component.scanned) {
+      return false;
+    }
+  }
+  if (!scanned) {
+    return false;
+  }
+  ConvertToBgra(out);
+  return true;
+}
+
+}  // namespace
+
+bool ReadJpegInfo(const std::vector<uint8_t>& data, JpegInfo* out,
+                  std::wstring* error) {
+  auto parser = std::make_unique<JpegParser>(data);
+  if (!out || !parser->Run(ParseMode::kInfo, out, nullptr)) {
+    return Fail(error);
+  }
+  return true;
+}
+
+bool DecodeJpeg(const std::vector<uint8_t>& data, ImageBuffer* out,
+                std::wstring* error) {
+  // Обоснование: парсер с восемью таблицами Huffman (~11 КБ) живет в куче,
+  // а не на стеке фонового потока.
+  auto parser = std::make_unique<JpegParser>(data);
+  if (!out || !parser->Run(ParseMode::kFull, nullptr, out)) {
+    return Fail(error);
+  }
+  return true;
+}
+
+bool DecodeJpegDc(const std::vector<uint8_t>& data, ImageBuffer* out,
+                  std::wstring* error) {
+  auto parser = std::make_unique<JpegParser>(data);
+  if (!out || !parser->Run(ParseMode::kDc, nullptr, out)) {
+    return Fail(error);
+  }
+  return true;
+}
+
+void InsertJpegComment(const std::string& text, std::vector<uint8_t>* data) {
+  if (!data || data->size() < 2 || (*data)[0] != 0xFF || (*data)[1] != 0xD8 ||
+      text.size() > 65533) {
+    return;
+  }
+  const size_t length = text.size() + 2;
+  std::vector<uint8_t> segment = {0xFF, 0xFE,
+                                  static_cast<uint8_t>(length >> 8),
+                                  static_cast<uint8_t>(length & 0xFF)};
+  segment.insert(segment.end(), text.begin(), text.end());
+  data->insert(data->begin() + 2, segment.begin(), segment.end());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image_buffer.h"
+
+// Baseline JPEG decoder for tools working on saved frames (retention
+// recompression, contact sheets): 8-bit sequential Huffman streams with 1
+// or 3 components, sampling factors 1..4, interleaved or per-component
+// scans and restart markers. Progressive, lossless and arithmetic-coded
+// streams are rejected.
+
+struct JpegInfo {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int components = 0;
+  // Text of the first COM segment (empty without one).
+  std::string comment;
+};
+
+// Parses the headers up to the first scan. Output: false + error when the
+// data is not a supported JPEG.
+bool ReadJpegInfo(const std::vector<uint8_t>& data, JpegInfo* out,
+                  std::wstring* error);
+
+// Decodes into packed BGRA8 (gray streams as B = G = R).
+// Output: false + error on a malformed or unsupported stream.
+bool DecodeJpeg(const std::vector<uint8_t>& data, ImageBuffer* out,
+                std::wstring* error);
+
+// Decodes the 1/8-scale image (ceil(width / 8) x ceil(height / 8), BGRA8)
+// from block DC values only: AC values are skipped, no inverse DCT.
+// Output: false + error on a malformed or unsupported stream.
+bool DecodeJpegDc(const std::vector<uint8_t>& data, ImageBuffer* out,
+                  std::wstring* error);
+
+// Inserts a COM segment with text right after SOI (no-op on data that does
+// not start with SOI). text is at most 65533 bytes.
+void InsertJpegComment(const std::string& text, std::vector<uint8_t>* data);
@@ -0,0 +1,1120 @@
+#include "jpeg_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "hash.h"
+#include "jpeg_dct.h"
+#include "jpeg_entropy.h"
+#include "jpeg_tables.h"
+#include "perf_counters.h"
+#include "pixel_convert.h"
+#include "strip_source.h"
+
+namespace {
+
+// Перестраиваем таблицы дисплея, если они проигрывают оптимальным > 2%.
+constexpr double kHuffmanRebuildThreshold = 0.02;
+
+struct ComponentSpec {
+  uint8_t id = 1;
+  uint8_t h = 1;
+  uint8_t v = 1;
+  // 0 = таблицы яркости, 1 = таблицы цветности (квантование и Huffman).
+  uint8_t table = 0;
+};
+
+struct FrameLayout {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int components = 1;
+  ComponentSpec comp[3];
+  int h_max = 1;
+  int v_max = 1;
+  uint32_t mcus_x = 0;
+  uint32_t mcus_y = 0;
+};
+
+struct Plane {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> data;
+};
+
+FrameLayout MakeLayout(uint32_t width, uint32_t height, ColorMode mode) {
+  FrameLayout layout;
+  layout.width = width;
+  layout.height = height;
+  if (mode == ColorMode::kGray) {
+    layout.components = 1;
+  } else {
+    layout.components = 3;
+    layout.h_max = mode == ColorMode::k444 ? 1 : 2;
+    layout.v_max = mode == ColorMode::k420 ? 2 : 1;
+    layout.comp[0] = {1, static_cast<uint8_t>(layout.h_max),
+                      static_cast<uint8_t>(layout.v_max), 0};
+    layout.comp[1] = {2, 1, 1, 1};
+    layout.comp[2] = {3, 1, 1, 1};
+  }
+  const uint32_t mcu_w = 8u * layout.h_max;
+  const uint32_t mcu_h = 8u * layout.v_max;
+  layout.mcus_x = (width + mcu_w - 1) / mcu_w;
+  layout.mcus_y = (height + mcu_h - 1) / mcu_h;
+  return layout;
+}
+
+constexpr void BuildQuantTable(const uint8_t base[64], int ijg_quality,
+                               uint8_t out[64]) {
+  const int scale =
+      ijg_quality < 50 ? 5000 / ijg_quality : 200 - ijg_quality * 2;
+  for (int i = 0; i < 64; ++i) {
+    const int value = (base[i] * scale + 50) / 100;
+    out[i] = static_cast<uint8_t>(std::clamp(value, 1, 255));
+  }
+}
+
+// Таблицы квантования одного качества: значения DQT и делители.
+struct QuantTables {
+  uint8_t quant[2][64] = {};
+  QuantDivisors divisors[2];
+};
+
+constexpr QuantTables MakeQuantTables(int ijg_quality) {
+  QuantTables tables;
+  BuildQuantTable(kStdLumaQuant, ijg_quality, tables.quant[0]);
+  BuildQuantTable(kStdChromaQuant, ijg_quality, tables.quant[1]);
+  tables.divisors[0] = BuildQuantDivisors(tables.quant[0]);
+  tables.divisors[1] = BuildQuantDivisors(tables.quant[1]);
+  return tables;
+}
+
+// Встроенные пресеты качества (IJG 1 = kJpegQuality в main.cpp).
+// Обоснование: таблицы пресетов вычисляются компилятором, в рантайме
+// кадр только выбирает готовую таблицу.
+constexpr int kPresetQualities[] = {1, 50, 75, 90};
+constexpr QuantTables kPresetQuantTables[] = {
+    MakeQuantTables(1), MakeQuantTables(50), MakeQuantTables(75),
+    MakeQuantTables(90)};
+
+// Таблицы качества 1..100: пресет или кэш процесса для произвольных
+// значений (rate control перебирает весь диапазон).
+const QuantTables& QuantTablesFor(int ijg_quality) {
+  for (size_t i = 0; i < std::size(kPresetQualities); ++i) {
+    if (kPresetQualities[i] == ijg_quality) {
+      return kPresetQuantTables[i];
+    }
+  }
+  // Обоснование: кэш строится один раз при первом нестандартном качестве
+  // (инициализация static потокобезопасна), далее только чтение.
+  static const std::vector<QuantTables> runtime_tables = [] {
+    std::vector<QuantTables> tables(101);
+    for (int q = 1; q <= 100; ++q) {
+      tables[q] = MakeQuantTables(q);
+    }
+    return tables;
+  }();
+  return runtime_tables[std::clamp(ijg_quality, 1, 100)];
+}
+
+// Коды Huffman в формате быстрого кодера (см. jpeg_entropy.h).
+struct HuffmanLuts {
+  HuffmanLut dc[2];
+  HuffmanLut ac[2];
+};
+
+constexpr HuffmanLuts MakeHuffmanLuts(const JpegHuffmanTables& huffman) {
+  HuffmanLuts luts;
+  for (int t = 0; t < 2; ++t) {
+    luts.dc[t] = BuildHuffmanLut(huffman.dc[t]);
+    luts.ac[t] = BuildHuffmanLut(huffman.ac[t]);
+  }
+  return luts;
+}
+
+constexpr JpegHuffmanTables kStandardHuffman = {
+    {kStdDcLuma, kStdDcChroma}, {kStdAcLuma, kStdAcChroma}};
+constexpr HuffmanLuts kStandardLuts = MakeHuffmanLuts(kStandardHuffman);
+
+// Рабочие буферы одной полосы MCU (8 или 16 строк): плоскости компонент,
+// сконвертированная строка источника и накопители цветности.
+struct StripWorkspace {
+  Plane planes[3];
+  std::vector<uint8_t> bgra;
+  std::vector<int32_t> acc_cb;
+  std::vector<int32_t> acc_cr;
+};
+
+void InitWorkspace(const FrameLayout& layout, StripWorkspace* ws) {
+  for (int c = 0; c < layout.components; ++c) {
+    ws->planes[c].width = layout.mcus_x * 8u * layout.comp[c].h;
+    ws->planes[c].height = 8u * layout.comp[c].v;
+    ws->planes[c].data.resize(static_cast<size_t>(ws->planes[c].width) *
+                              ws->planes[c].height);
+  }
+  ws->bgra.resize(static_cast<size_t>(layout.width) * 4);
+  if (layout.components == 3) {
+    ws->acc_cb.assign(ws->planes[1].width, 0);
+    ws->acc_cr.assign(ws->planes[1].width, 0);
+  }
+}
+
+// Заполняет плоскости полосы из строк rows (row_count строк кадра ширины
+// width): яркость и усредненная цветность.
+template <PixelFormat Format>
+void BuildStripRows(const PixelRows& rows, uint32_t row_count,
+                    uint32_t width, const FrameLayout& layout,
+                    StripWorkspace* ws) {
+  const PerfScope perf_scope(PerfStage::kConvert);
+  const bool chroma = layout.components == 3;
+  const uint32_t sub_x = chroma ? static_cast<uint32_t>(layout.h_max) : 1;
+  const uint32_t sub_y = chroma ? static_cast<uint32_t>(layout.v_max) : 1;
+  const uint32_t area_shift = (sub_x == 2 ? 1 : 0) + (sub_y == 2 ? 1 : 0);
+  const uint32_t strip_height = 8u * layout.v_max;
+  Plane* planes = ws->planes;
+  const uint32_t luma_width = planes[0].width;
+  const uint8_t* row = nullptr;
+  uint32_t fetched = UINT32_MAX;
+  for (uint32_t i = 0; i < strip_height; ++i) {
+    // Строки за пределами кадра повторяют последнюю (дополнение до MCU).
+    const uint32_t sy = std::min(i, row_count - 1);
+    if (sy != fetched) {
+      row = rows.data + sy * rows.stride;
+      if constexpr (Format != PixelFormat::kBgra8) {
+        ConvertRowToBgra8<Format>(row, ws->bgra.data(), width,
+                                  DefaultToneMapLut());
+        row = ws->bgra.data();
+      }
+      fetched = sy;
+    }
+    uint8_t* luma = planes[0].data.data() + static_cast<size_t>(i) * luma_width;
+    Bgra8RowToLuma(row, luma, width);
+    std::fill(luma + width, luma + luma_width, luma[width - 1]);
+    if (!chroma) {
+      continue;
+    }
+    // JFIF: Cb/Cr в 16-битной фиксированной точке, суммы по блоку
+    // субдискретизации делятся один раз при записи строки.
+    for (uint32_t cx = 0; cx < planes[1].width; ++cx) {
+      int32_t cb = 0;
+      int32_t cr = 0;
+      for (uint32_t k = 0; k < sub_x; ++k) {
+        const uint32_t x = std::min(cx * sub_x + k, width - 1);
+        const uint8_t* px = row + static_cast<size_t>(x) * 4;
+        cb += -11059 * px[2] - 21709 * px[1] + 32768 * px[0];
+        cr += 32768 * px[2] - 27439 * px[1] - 5329 * px[0];
+      }
+      ws->acc_cb[cx] += cb;
+      ws->acc_cr[cx] += cr;
+    }
+    if ((i + 1) % sub_y != 0) {
+      continue;
+    }
+    const uint32_t cy = i / sub_y;
+    const int32_t count = 1 << area_shift;
+    const int32_t bias = count * (128 << 16) + (count << 15) - 1;
+    uint8_t* cb_row =
+        planes[1].data.data() + static_cast<size_t>(cy) * planes[1].width;
+    uint8_t* cr_row =
+        planes[2].data.data() + static_cast<size_t>(cy) * planes[2].width;
+    for (uint32_t cx = 0; cx < planes[1].width; ++cx) {
+      cb_row[cx] = static_cast<uint8_t>(std::clamp(
+          (ws->acc_cb[cx] + bias) >> (16 + area_shift), 0, 255));
+      cr_row[cx] = static_cast<uint8_t>(std::clamp(
+          (ws->acc_cr[cx] + bias) >> (16 + area_shift), 0, 255));
+      ws->acc_cb[cx] = 0;
+      ws->acc_cr[cx] = 0;
+    }
+  }
+}
+
+// Полоса mcu_row кадра в памяти.
+template <PixelFormat Format>
+void BuildStrip(const ImageBuffer& image, const FrameLayout& layout,
+                uint32_t mcu_row, StripWorkspace* ws) {
+  const uint32_t y0 = mcu_row * 8u * layout.v_max;
+  const PixelRows rows = {
+      image.pixels.data() + static_cast<size_t>(y0) * image.stride,
+      image.stride};
+  const uint32_t row_count = std::min(8u * layout.v_max, image.height - y0);
+  BuildStripRows<Format>(rows, row_count, image.width, layout, ws);
+}
+
+// DCT всех блоков полосы в порядке сканирования.
+void TransformStrip(const StripWorkspace& ws, const FrameLayout& layout,
+                    int16_t* coef) {
+  for (uint32_t mx = 0; mx < layout.mcus_x; ++mx) {
+    for (int c = 0; c < layout.components; ++c) {
+      const ComponentSpec& spec = layout.comp[c];
+      const Plane& plane = ws.planes[c];
+      for (int by = 0; by < spec.v; ++by) {
+        for (int bx = 0; bx < spec.h; ++bx) {
+          const uint8_t* samples =
+              plane.data.data() + static_cast<size_t>(by) * 8 * plane.width +
+              (mx * spec.h + bx) * 8;
+          ForwardDct8x8(samples, plane.width, coef);
+          coef += 64;
+        }
+      }
+    }
+  }
+}
+
+bool ValidateImage(const ImageBuffer& image, std::wstring* error) {
+  if (image.width == 0 || image.height == 0 || image.width > 65535 ||
+      image.height > 65535 ||
+      image.stride < image.width * BytesPerPixel(image.pixel_format) ||
+      image.pixels.size() < static_cast<size_t>(image.stride) * image.height) {
+    if (error) {
+      *error = L"Некорректные данные изображения.";
+    }
+    return false;
+  }
+  return true;
+}
+
+void PutU16(std::vector<uint8_t>* out, uint32_t value) {
+  out->push_back(static_cast<uint8_t>(value >> 8));
+  out->push_back(static_cast<uint8_t>(value & 0xFF));
+}
+
+void PutMarker(std::vector<uint8_t>* out, uint8_t marker) {
+  out->push_back(0xFF);
+  out->push_back(marker);
+}
+
+void WriteHuffmanTable(std::vector<uint8_t>* out, int table_class, int id,
+                       const HuffmanSpec& spec) {
+  PutMarker(out, 0xC4);
+  PutU16(out, static_cast<uint32_t>(2 + 1 + 16 + spec.count));
+  out->push_back(static_cast<uint8_t>((table_class << 4) | id));
+  out->insert(out->end(), spec.bits, spec.bits + 16);
+  out->insert(out->end(), spec.values, spec.values + spec.count);
+}
+
+void WriteHeaders(const FrameLayout& layout, const uint8_t quant[2][64],
+                  const JpegHuffmanTables& huffman, uint32_t restart_interval,
+                  std::vector<uint8_t>* out) {
+  PutMarker(out, 0xD8);
+  // APP0 JFIF 1.01 без миниатюры.
+  PutMarker(out, 0xE0);
+  PutU16(out, 16);
+  const uint8_t jfif[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+  out->insert(out->end(), jfif, jfif + sizeof(jfif));
+
+  const int tables = layout.components == 3 ? 2 : 1;
+  for (int t = 0; t < tables; ++t) {
+    PutMarker(out, 0xDB);
+    PutU16(out, 2 + 65);
+    out->push_back(static_cast<uint8_t>(t));
+    for (int k = 0; k < 64; ++k) {
+      out->push_back(quant[t][kZigzagToNatural[k]]);
+    }
+  }
+
+  PutMarker(out, 0xC0);
+  PutU16(out, static_cast<uint32_t>(8 + 3 * layout.components));
+  out->push_back(8);
+  PutU16(out, layout.height);
+  PutU16(out, layout.width);
+  out->push_back(static_cast<uint8_t>(layout.components));
+  for (int c = 0; c < layout.components; ++c) {
+    out->push_back(layout.comp[c].id);
+    out->push_back(
+        static_cast<uint8_t>((layout.comp[c].h << 4) | layout.comp[c].v));
+    out->push_back(layout.comp[c].table);
+  }
+
+  for (int t = 0; t < tables; ++t) {
+    WriteHuffmanTable(out, 0, t, huffman.dc[t]);
+    WriteHuffmanTable(out, 1, t, huffman.ac[t]);
+  }
+
+  if (restart_interval > 0) {
+    PutMarker(out, 0xDD);
+    PutU16(out, 4);
+    PutU16(out, restart_interval);
+  }
+
+  PutMarker(out, 0xDA);
+  PutU16(out, static_cast<uint32_t>(6 + 2 * layout.components));
+  out->push_back(static_cast<uint8_t>(layout.components));
+  for (int c = 0; c < layout.components; ++c) {
+    out->push_back(layout.comp[c].id);
+    out->push_back(
+        static_cast<uint8_t>((layout.comp[c].table << 4) | layout.comp[c].table));
+  }
+  out->push_back(0);
+  out->push_back(63);
+  out->push_back(0);
+}
+
+// Размер заголовков WriteHeaders без записи (оценка размера кадра).
+size_t HeadersSize(const FrameLayout& layout,
+                   const JpegHuffmanTables& huffman,
+                   uint32_t restart_interval) {
+  const int tables = layout.components == 3 ? 2 : 1;
+  // SOI + APP0, DQT, SOF0, SOS.
+  size_t size = 2 + 18 + 69 * tables + 10 + 3 * layout.components + 8 +
+                2 * layout.components;
+  for (int t = 0; t < tables; ++t) {
+    size += 2 * (2 + 2 + 1 + 16) + huffman.dc[t].count + huffman.ac[t].count;
+  }
+  if (restart_interval > 0) {
+    size += 6;
+  }
+  return size;
+}
+
+int BlocksPerMcu(const FrameLayout& layout) {
+  int blocks = 0;
+  for (int c = 0; c < layout.components; ++c) {
+    blocks += layout.comp[c].h * layout.comp[c].v;
+  }
+  return blocks;
+}
+
+// Размер эскиза DC: пиксель на блок 8x8 кадра. Output: true, если буфер
+// переразмечен (прежнее содержимое недействительно).
+bool PrepareThumbnail(const FrameLayout& layout, ImageBuffer* thumbnail) {
+  const uint32_t width = (layout.width + 7) / 8;
+  const uint32_t height = (layout.height + 7) / 8;
+  if (thumbnail->width == width && thumbnail->height == height &&
+      thumbnail->pixel_format == PixelFormat::kBgra8 &&
+      thumbnail->stride == width * 4 &&
+      thumbnail->pixels.size() == static_cast<size_t>(width) * 4 * height) {
+    return false;
+  }
+  thumbnail->width = width;
+  thumbnail->height = height;
+  thumbnail->stride = width * 4;
+  thumbnail->pixel_format = PixelFormat::kBgra8;
+  thumbnail->pixels.assign(static_cast<size_t>(width) * 4 * height, 0);
+  return true;
+}
+
+// DC = 8 * F(0,0) = сумма (s - 128) по блоку: среднее = DC / 64 + 128.
+int DcSample(int16_t dc) {
+  return std::clamp((dc + 8192 + 32) >> 6, 0, 255);
+}
+
+// Строки эскиза полосы mcu_row из DC блоков coef (порядок сканирования).
+void ThumbnailStrip(const int16_t* coef, const FrameLayout& layout,
+                    uint32_t mcu_row, ImageBuffer* thumbnail) {
+  const size_t mcu_values = static_cast<size_t>(BlocksPerMcu(layout)) * 64;
+  const int luma_h = layout.comp[0].h;
+  const int luma_blocks = luma_h * layout.comp[0].v;
+  for (int by = 0; by < layout.v_max; ++by) {
+    const uint32_t y = mcu_row * layout.v_max + by;
+    if (y >= thumbnail->height) {
+      break;
+    }
+    uint8_t* row =
+        thumbnail->pixels.data() + static_cast<size_t>(y) * thumbnail->stride;
+    for (uint32_t x = 0; x < thumbnail->width; ++x) {
+      const int16_t* mcu = coef + (x / layout.h_max) * mcu_values;
+      const int luma = DcSample(mcu[(by * luma_h + x % layout.h_max) * 64]);
+      int blue = luma;
+      int green = luma;
+      int red = luma;
+      if (layout.components == 3) {
+        // ITU T.871 (JFIF), как в декодере.
+        const int blue_diff = DcSample(mcu[luma_blocks * 64]) - 128;
+        const int red_diff = DcSample(mcu[(luma_blocks + 1) * 64]) - 128;
+        red = luma + ((91881 * red_diff + 32768) >> 16);
+        green = luma - ((22554 * blue_diff + 46802 * red_diff + 32768) >> 16);
+        blue = luma + ((116130 * blue_diff + 32768) >> 16);
+      }
+      row[x * 4 + 0] = static_cast<uint8_t>(std::clamp(blue, 0, 255));
+      row[x * 4 + 1] = static_cast<uint8_t>(std::clamp(green, 0, 255));
+      row[x * 4 + 2] = static_cast<uint8_t>(std::clamp(red, 0, 255));
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+// Таблицы одного прохода кодирования: ссылки на готовые квантование,
+// DHT и коды (пресеты, кэш процесса или кэш дисплея), без построения.
+struct EncoderTables {
+  const QuantTables& quant;
+  const JpegHuffmanTables& huffman;
+  const HuffmanLuts& luts;
+};
+
+EncoderTables StandardTables(int ijg_quality) {
+  return {QuantTablesFor(ijg_quality), kStandardHuffman, kStandardLuts};
+}
+
+// Обходит блоки первых mcus MCU в порядке сканирования:
+// fn(component, table, block_index).
+template <typename Fn>
+void ForEachBlock(const FrameLayout& layout, size_t mcus, Fn&& fn) {
+  size_t index = 0;
+  for (size_t mcu = 0; mcu < mcus; ++mcu) {
+    for (int c = 0; c < layout.components; ++c) {
+      const int table = layout.comp[c].table;
+      const int blocks = layout.comp[c].h * layout.comp[c].v;
+      for (int b = 0; b < blocks; ++b) {
+        fn(c, table, index++);
+      }
+    }
+  }
+}
+
+template <typename Fn>
+void ForEachBlock(const FrameLayout& layout, Fn&& fn) {
+  ForEachBlock(layout, static_cast<size_t>(layout.mcus_x) * layout.mcus_y,
+               std::forward<Fn>(fn));
+}
+
+// has_ac = false: блок из битовой карты пустых (только DC + EOB).
+void GatherBlockStats(const int16_t* zz, bool has_ac, int* last_dc,
+                      uint32_t* dc_freq, uint32_t* ac_freq) {
+  const int diff = zz[0] - *last_dc;
+  ++dc_freq[MagnitudeBits(static_cast<uint32_t>(std::abs(diff)))];
+  *last_dc = zz[0];
+  if (!has_ac) {
+    ++ac_freq[0x00];
+    return;
+  }
+  int run = 0;
+  for (int k = 1; k < 64; ++k) {
+    if (zz[k] == 0) {
+      ++run;
+      continue;
+    }
+    while (run > 15) {
+      ++ac_freq[0xF0];
+      run -= 16;
+    }
+    const int nbits = MagnitudeBits(static_cast<uint32_t>(std::abs(zz[k])));
+    ++ac_freq[(run << 4) | nbits];
+    run = 0;
+  }
+  if (run > 0) {
+    ++ac_freq[0x00];
+  }
+}
+
+template <typename Sink>
+void EncodeQuantizedBlock(Sink& sink, const int16_t* zz, bool has_ac,
+                          int* last_dc, const EncoderTables& tables,
+                          int table) {
+  if (has_ac) {
+    EncodeBlockFast(sink, zz, last_dc, tables.luts.dc[table],
+                    tables.luts.ac[table]);
+  } else {
+    EncodeDcOnlyBlock(sink, zz[0], last_dc, tables.luts.dc[table],
+                      tables.luts.ac[table]);
+  }
+}
+
+// Квантование + энтропийное кодирование кэшированных коэффициентов
+// (Sink: JpegBitWriter для записи, JpegBitCounter для оценки размера).
+// stats != nullptr: попутно собирается статистика символов.
+template <typename Sink>
+void EntropyPass(const JpegCoefficients& coefficients,
+                 const FrameLayout& layout, const EncoderTables& tables,
+                 Sink& sink, JpegSymbolStats* stats) {
+  int last_dc[3] = {};
+  int stats_dc[3] = {};
+  int16_t zz[64];
+  ForEachBlock(layout, [&](int c, int table, size_t index) {
+    const bool has_ac = QuantizeBlock(coefficients.blocks.data() + index * 64,
+                                      tables.quant.divisors[table], zz);
+    if (stats) {
+      GatherBlockStats(zz, has_ac, &stats_dc[c], stats->dc[table],
+                       stats->ac[table]);
+    }
+    EncodeQuantizedBlock(sink, zz, has_ac, &last_dc[c], tables, table);
+  });
+}
+
+// Квантованные блоки кадра (zigzag) и битовая карта пустых блоков: бит
+// установлен, если все AC блока равны нулю.
+struct QuantizedFrame {
+  std::vector<int16_t> blocks;
+  std::vector<uint64_t> zero_blocks;
+
+  bool HasAc(size_t index) const {
+    return ((zero_blocks[index >> 6] >> (index & 63)) & 1) == 0;
+  }
+};
+
+void QuantizeAll(const JpegCoefficients& coefficients,
+                 const FrameLayout& layout, const EncoderTables& tables,
+                 QuantizedFrame* quantized) {
+  const size_t blocks = coefficients.blocks.size() / 64;
+  quantized->blocks.resize(coefficients.blocks.size());
+  quantized->zero_blocks.assign((blocks + 63) / 64, 0);
+  ForEachBlock(layout, [&](int, int table, size_t index) {
+    if (!QuantizeBlock(coefficients.blocks.data() + index * 64,
+                       tables.quant.divisors[table],
+                       quantized->blocks.data() + index * 64)) {
+      quantized->zero_blocks[index >> 6] |= 1ULL << (index & 63);
+    }
+  });
+}
+
+JpegSymbolStats GatherStats(const QuantizedFrame& quantized,
+                            const FrameLayout& layout) {
+  JpegSymbolStats stats;
+  int last_dc[3] = {};
+  ForEachBlock(layout, [&](int c, int table, size_t index) {
+    GatherBlockStats(quantized.blocks.data() + index * 64,
+                     quantized.HasAc(index), &last_dc[c], stats.dc[table],
+                     stats.ac[table]);
+  });
+  return stats;
+}
+
+void EncodeQuantized(const QuantizedFrame& quantized,
+                     const FrameLayout& layout, const EncoderTables& tables,
+                     JpegBitWriter& writer) {
+  int last_dc[3] = {};
+  ForEachBlock(layout, [&](int c, int table, size_t index) {
+    EncodeQuantizedBlock(writer, quantized.blocks.data() + index * 64,
+                         quantized.HasAc(index), &last_dc[c], tables, table);
+  });
+}
+
+// Кодирует одну полосу MCU как сегмент перезапуска: предсказатели DC
+// обнуляются, последний байт дополняется единицами.
+void EncodeStripSegment(const int16_t* coef, const FrameLayout& layout,
+                        const EncoderTables& tables,
+                        std::vector<uint8_t>* segment) {
+  segment->clear();
+  JpegBitWriter writer(segment);
+  int last_dc[3] = {};
+  int16_t zz[64];
+  ForEachBlock(layout, layout.mcus_x, [&](int c, int table, size_t index) {
+    const bool has_ac =
+        QuantizeBlock(coef + index * 64, tables.quant.divisors[table], zz);
+    EncodeQuantizedBlock(writer, zz, has_ac, &last_dc[c], tables, table);
+  });
+  writer.Flush();
+}
+
+uint64_t StripHash(const ImageBuffer& image, const FrameLayout& layout,
+                   uint32_t mcu_row) {
+  const uint32_t strip_height = 8u * layout.v_max;
+  const uint32_t y0 = mcu_row * strip_height;
+  const uint32_t y1 = std::min(y0 + strip_height, image.height);
+  const size_t row_bytes =
+      static_cast<size_t>(image.width) * BytesPerPixel(image.pixel_format);
+  uint64_t hash = mcu_row;
+  for (uint32_t y = y0; y < y1; ++y) {
+    hash = Hash64(image.pixels.data() + static_cast<size_t>(y) * image.stride,
+                  row_bytes, hash);
+  }
+  return hash;
+}
+
+void FinishStream(JpegBitWriter& writer, std::vector<uint8_t>* out) {
+  writer.Flush();
+  PutMarker(out, 0xD9);
+}
+
+}  // namespace
+
+// Буферы сохраняют емкость между кадрами одного размера.
+struct JpegWorkspace {
+  StripWorkspace strip;
+  // Коэффициенты одной полосы MCU (инкрементальное кодирование).
+  std::vector<int16_t> strip_coefficients;
+  QuantizedFrame quantized;
+  // Коды для таблиц дисплея (--optimize-huffman): перестраиваются только
+  // при смене таблиц, а не на каждом кадре.
+  bool luts_valid = false;
+  JpegHuffmanTables luts_source = {};
+  HuffmanLuts luts;
+};
+
+namespace {
+
+const HuffmanLuts& LutsFor(const JpegHuffmanTables& huffman,
+                           JpegWorkspace* workspace, HuffmanLuts* local) {
+  if (!workspace) {
+    *local = MakeHuffmanLuts(huffman);
+    return *local;
+  }
+  if (!workspace->luts_valid ||
+      std::memcmp(&workspace->luts_source, &huffman, sizeof(huffman)) != 0) {
+    workspace->luts_source = huffman;
+    workspace->luts = MakeHuffmanLuts(huffman);
+    workspace->luts_valid = true;
+  }
+  return workspace->luts;
+}
+
+}  // namespace
+
+JpegEncoderContext::JpegEncoderContext()
+    : workspace(std::make_unique<JpegWorkspace>()) {}
+
+JpegEncoderContext::~JpegEncoderContext() = default;
+
+JpegEncoderContext::JpegEncoderContext(JpegEncoderContext&&) noexcept =
+    default;
+
+JpegEncoderContext& JpegEncoderContext::operator=(
+    JpegEncoderContext&&) noexcept = default;
+
+size_t JpegEncoderContextBytes(const JpegEncoderContext& context) {
+  size_t bytes = context.coefficients.blocks.capacity() * sizeof(int16_t) +
+                 context.output.capacity();
+  if (const JpegWorkspace* ws = context.workspace.get()) {
+    for (const Plane& plane : ws->strip.planes) {
+      bytes += plane.data.capacity();
+    }
+    bytes += ws->strip.bgra.capacity() +
+             (ws->strip.acc_cb.capacity() + ws->strip.acc_cr.capacity()) *
+                 sizeof(int32_t) +
+             ws->strip_coefficients.capacity() * sizeof(int16_t) +
+             ws->quantized.blocks.capacity() * sizeof(int16_t) +
+             ws->quantized.zero_blocks.capacity() * sizeof(uint64_t);
+  }
+  return bytes;
+}
+
+bool ParseColorMode(const std::wstring& value, ColorMode* out) {
+  if (!out) {
+    return false;
+  }
+  if (value == L"gray") {
+    *out = ColorMode::kGray;
+  } else if (value == L"420") {
+    *out = ColorMode::k420;
+  } else if (value == L"422") {
+    *out = ColorMode::k422;
+  } else if (value == L"444") {
+    *out = ColorMode::k444;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const wchar_t* ColorModeName(ColorMode mode) {
+  switch (mode) {
+    case ColorMode::kGray:
+      return L"gray";
+    case ColorMode::k422:
+      return L"422";
+    case ColorMode::k444:
+      return L"444";
+    case ColorMode::k420:
+    default:
+      return L"420";
+  }
+}
+
+int QualityToIjg(float quality) {
+  return std::clamp(static_cast<int>(std::lround(quality * 100.0f)), 1, 100);
+}
+
+bool ComputeJpegCoefficients(const ImageBuffer& image, ColorMode color_mode,
+                             JpegCoefficients* out, std::wstring* error,
+                             JpegWorkspace* workspace) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  if (!out) {
+    if (error) {
+      *error = L"Не передан буфер для коэффициентов JPEG.";
+    }
+    return false;
+  }
+  if (!ValidateImage(image, error)) {
+    return false;
+  }
+
+  const FrameLayout layout = MakeLayout(image.width, image.height, color_mode);
+  out->width = image.width;
+  out->height = image.height;
+  out->color_mode = color_mode;
+  const size_t row_values =
+      static_cast<size_t>(BlocksPerMcu(layout)) * layout.mcus_x * 64;
+  out->blocks.resize(row_values * layout.mcus_y);
+  StripWorkspace local;
+  StripWorkspace& ws = workspace ? workspace->strip : local;
+  InitWorkspace(layout, &ws);
+  DispatchPixelFormat(image.pixel_format, [&](auto tag) {
+    for (uint32_t row = 0; row < layout.mcus_y; ++row) {
+      BuildStrip<decltype(tag)::value>(image, layout, row, &ws);
+      TransformStrip(ws, layout, out->blocks.data() + row * row_values);
+    }
+  });
+  return true;
+}
+
+size_t EstimateJpegSize(const JpegCoefficients& coefficients,
+                        int ijg_quality) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  const FrameLayout layout = MakeLayout(
+      coefficients.width, coefficients.height, coefficients.color_mode);
+  const EncoderTables tables = StandardTables(ijg_quality);
+  JpegBitCounter counter;
+  EntropyPass(coefficients, layout, tables, counter, nullptr);
+  // +2: маркер EOI.
+  return HeadersSize(layout, tables.huffman, 0) + counter.Finish() + 2;
+}
+
+size_t EstimateJpegSizeSampled(const ImageBuffer& image, ColorMode color_mode,
+                               int ijg_quality, uint32_t step,
+                               JpegWorkspace* workspace) {
+  if (!ValidateImage(image, nullptr)) {
+    return 0;
+  }
+  step = std::max<uint32_t>(step, 1);
+  const FrameLayout layout = MakeLayout(image.width, image.height, color_mode);
+  const EncoderTables tables = StandardTables(ijg_quality);
+  JpegWorkspace local;
+  StripWorkspace& ws = workspace ? workspace->strip : local.strip;
+  std::vector<int16_t>& coef =
+      workspace ? workspace->strip_coefficients : local.strip_coefficients;
+  InitWorkspace(layout, &ws);
+  coef.resize(static_cast<size_t>(BlocksPerMcu(layout)) * layout.mcus_x * 64);
+  size_t sampled_bytes = 0;
+  uint32_t sampled_rows = 0;
+  int16_t zz[64];
+  DispatchPixelFormat(image.pixel_format, [&](auto tag) {
+    // Фаза выборки меняется от группы к группе, как в EstimateQoiSize.
+    for (uint32_t group = 0; group * step < layout.mcus_y; ++group) {
+      const uint32_t row = group * step + (group * 3 + step / 2) % step;
+      if (row >= layout.mcus_y) {
+        break;
+      }
+      BuildStrip<decltype(tag)::value>(image, layout, row, &ws);
+      TransformStrip(ws, layout, coef.data());
+      // Полоса считается как сегмент перезапуска: предсказатели DC с нуля.
+      JpegBitCounter counter;
+      int last_dc[3] = {};
+      ForEachBlock(layout, layout.mcus_x, [&](int c, int table, size_t index) {
+        const bool has_ac = QuantizeBlock(coef.data() + index * 64,
+                                          tables.quant.divisors[table], zz);
+        EncodeQuantizedBlock(counter, zz, has_ac, &last_dc[c], tables, table);
+      });
+      sampled_bytes += counter.Finish();
+      ++sampled_rows;
+    }
+  });
+  const size_t body =
+      sampled_rows == 0
+          ? 0
+          : static_cast<size_t>(static_cast<double>(sampled_bytes) *
+                                layout.mcus_y / sampled_rows);
+  return HeadersSize(layout, tables.huffman, 0) + body + 2;
+}
+
+void JpegCoefficientsThumbnail(const JpegCoefficients& coefficients,
+                               ImageBuffer* out) {
+  const FrameLayout layout = MakeLayout(
+      coefficients.width, coefficients.height, coefficients.color_mode);
+  PrepareThumbnail(layout, out);
+  const size_t row_values =
+      static_cast<size_t>(BlocksPerMcu(layout)) * layout.mcus_x * 64;
+  for (uint32_t row = 0; row < layout.mcus_y; ++row) {
+    ThumbnailStrip(coefficients.blocks.data() + row * row_values, layout, row,
+                   out);
+  }
+}
+
+void QuantizeJpegCoefficients(const JpegCoefficients& coefficients,
+                              int ijg_quality, std::vector<int16_t>* out) {
+  const FrameLayout layout = MakeLayout(
+      coefficients.width, coefficients.height, coefficients.color_mode);
+  const EncoderTables tables = StandardTables(ijg_quality);
+  QuantizedFrame quantized;
+  QuantizeAll(coefficients, layout, tables, &quantized);
+  *out = std::move(quantized.blocks);
+}
+
+void EncodeJpegCoefficients(const JpegCoefficients& coefficients,
+                            int ijg_quality, std::vector<uint8_t>* out) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  const FrameLayout layout = MakeLayout(
+      coefficients.width, coefficients.height, coefficients.color_mode);
+  const EncoderTables tables = StandardTables(ijg_quality);
+  out->clear();
+  WriteHeaders(layout, tables.quant.quant, tables.huffman, 0, out);
+  JpegBitWriter writer(out);
+  EntropyPass(coefficients, layout, tables, writer, nullptr);
+  FinishStream(writer, out);
+}
+
+void EncodeJpegOptimized(const JpegCoefficients& coefficients, int ijg_quality,
+                         HuffmanReuseState* reuse, std::vector<uint8_t>* out,
+                         JpegWorkspace* workspace) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  const FrameLayout layout = MakeLayout(
+      coefficients.width, coefficients.height, coefficients.color_mode);
+  const QuantTables& quant = QuantTablesFor(ijg_quality);
+  HuffmanLuts local_luts;
+  out->clear();
+  if (reuse && reuse->valid) {
+    // Один проход с таблицами прошлых кадров; статистика собирается попутно
+    // и решает, перестраивать ли таблицы к следующему кадру.
+    const EncoderTables tables = {
+        quant, reuse->tables, LutsFor(reuse->tables, workspace, &local_luts)};
+    WriteHeaders(layout, quant.quant, reuse->tables, 0, out);
+    JpegBitWriter writer(out);
+    JpegSymbolStats stats;
+    EntropyPass(coefficients, layout, tables, writer, &stats);
+    FinishStream(writer, out);
+    const JpegHuffmanTables fresh = BuildOptimalTables(stats, true);
+    const uint64_t reused_bits = HuffmanCostBits(stats, reuse->tables);
+    const uint64_t fresh_bits = HuffmanCostBits(stats, fresh);
+    ++reuse->reused_frames;
+    if (static_cast<double>(reused_bits) >
+        static_cast<double>(fresh_bits) * (1.0 + kHuffmanRebuildThreshold)) {
+      reuse->tables = fresh;
+      ++reuse->rebuilds;
+    }
+    return;
+  }
+
+  // Два прохода по кэшу квантованных блоков: статистика, затем запись.
+  const EncoderTables tables = StandardTables(ijg_quality);
+  QuantizedFrame local_quantized;
+  QuantizedFrame& quantized =
+      workspace ? workspace->quantized : local_quantized;
+  QuantizeAll(coefficients, layout, tables, &quantized);
+  const JpegSymbolStats stats = GatherStats(quantized, layout);
+  // Для переиспользования таблицы покрывают все символы: будущий кадр
+  // может содержать то, чего не было в этом.
+  const JpegHuffmanTables optimal = BuildOptimalTables(stats, reuse != nullptr);
+  const EncoderTables optimized = {
+      quant, optimal, LutsFor(optimal, workspace, &local_luts)};
+  WriteHeaders(layout, quant.quant, optimal, 0, out);
+  JpegBitWriter writer(out);
+  EncodeQuantized(quantized, layout, optimized, writer);
+  FinishStream(writer, out);
+  if (reuse) {
+    reuse->tables = optimal;
+    reuse->valid = true;
+    ++reuse->rebuilds;
+  }
+}
+
+bool EncodeJpegStreaming(StripSource* source,
+                         const JpegEncodeOptions& options,
+                         std::vector<uint8_t>* out, std::wstring* error,
+                         JpegWorkspace* workspace) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  if (!source || !out) {
+    if (error) {
+      *error = L"Не передан источник полос или буфер для JPEG.";
+    }
+    return false;
+  }
+  // Обоснование: оптимальные таблицы требуют статистики всего кадра до
+  // записи DHT, а поток пишется по мере чтения полос.
+  if (options.optimize_huffman) {
+    if (error) {
+      *error = L"Потоковое кодирование использует стандартные таблицы "
+               L"Huffman.";
+    }
+    return false;
+  }
+  const uint32_t width = source->Width();
+  const uint32_t height = source->Height();
+  if (width == 0 || height == 0 || width > 65535 || height > 65535) {
+    if (error) {
+      *error = L"Некорректные данные изображения.";
+    }
+    return false;
+  }
+  const FrameLayout layout = MakeLayout(width, height, options.color_mode);
+  const EncoderTables tables = StandardTables(QualityToIjg(options.quality));
+  JpegWorkspace local;
+  StripWorkspace& ws = workspace ? workspace->strip : local.strip;
+  std::vector<int16_t>& coef =
+      workspace ? workspace->strip_coefficients : local.strip_coefficients;
+  InitWorkspace(layout, &ws);
+  coef.resize(static_cast<size_t>(BlocksPerMcu(layout)) * layout.mcus_x * 64);
+  if (options.thumbnail) {
+    PrepareThumbnail(layout, options.thumbnail);
+  }
+
+  out->clear();
+  WriteHeaders(layout, tables.quant.quant, tables.huffman, 0, out);
+  JpegBitWriter writer(out);
+  // Обоснование: полоса сразу квантуется и кодируется, коэффициенты кадра
+  // не накапливаются; предсказатели DC сквозные, как у EncodeJpegCoefficients,
+  // поэтому поток совпадает побайтно.
+  int last_dc[3] = {};
+  int16_t zz[64];
+  bool read_ok = true;
+  const uint32_t strip_height = 8u * layout.v_max;
+  DispatchPixelFormat(source->Format(), [&](auto tag) {
+    for (uint32_t row = 0; row < layout.mcus_y; ++row) {
+      const uint32_t y0 = row * strip_height;
+      const uint32_t count = std::min(strip_height, height - y0);
+      PixelRows rows;
+      if (!source->ReadRows(y0, count, &rows, error)) {
+        read_ok = false;
+        return;
+      }
+      BuildStripRows<decltype(tag)::value>(rows, count, width, layout, &ws);
+      TransformStrip(ws, layout, coef.data());
+      if (options.thumbnail) {
+        ThumbnailStrip(coef.data(), layout, row, options.thumbnail);
+      }
+      ForEachBlock(layout, layout.mcus_x, [&](int c, int table, size_t index) {
+        const bool has_ac = QuantizeBlock(coef.data() + index * 64,
+                                          tables.quant.divisors[table], zz);
+        EncodeQuantizedBlock(writer, zz, has_ac, &last_dc[c], tables, table);
+      });
+    }
+  });
+  if (!read_ok) {
+    return false;
+  }
+  FinishStream(writer, out);
+  return true;
+}
+
+bool EncodeJpeg(const ImageBuffer& image, const JpegEncodeOptions& options,
+                std::vector<uint8_t>* out, std::wstring* error) {
+  if (!out) {
+    if (error) {
+      *error = L"Не передан буфер для JPEG.";
+    }
+    return false;
+  }
+  if (!options.optimize_huffman) {
+    if (!ValidateImage(image, error)) {
+      return false;
+    }
+    ImageStripSource source(image);
+    return EncodeJpegStreaming(&source, options, out, error);
+  }
+  JpegCoefficients coefficients;
+  if (!ComputeJpegCoefficients(image, options.color_mode, &coefficients,
+                               error)) {
+    return false;
+  }
+  if (options.thumbnail) {
+    JpegCoefficientsThumbnail(coefficients, options.thumbnail);
+  }
+  EncodeJpegOptimized(coefficients, QualityToIjg(options.quality), nullptr,
+                      out);
+  return true;
+}
+
+bool EncodeJpeg(const ImageBuffer& image, const JpegEncodeOptions& options,
+                JpegEncoderContext* context, std::wstring* error) {
+  if (!context) {
+    if (error) {
+      *error = L"Не передан контекст кодера JPEG.";
+    }
+    return false;
+  }
+  if (!options.optimize_huffman) {
+    if (!ValidateImage(image, error)) {
+      return false;
+    }
+    ImageStripSource source(image);
+    return EncodeJpegStreaming(&source, options, &context->output, error,
+                               context->workspace.get());
+  }
+  if (!ComputeJpegCoefficients(image, options.color_mode,
+                               &context->coefficients, error,
+                               context->workspace.get())) {
+    return false;
+  }
+  if (options.thumbnail) {
+    JpegCoefficientsThumbnail(context->coefficients, options.thumbnail);
+  }
+  EncodeJpegOptimized(context->coefficients, QualityToIjg(options.quality),
+                      nullptr, &context->output, context->workspace.get());
+  return true;
+}
+
+bool EncodeJpegIncremental(const ImageBuffer& image,
+                           const JpegEncodeOptions& options,
+                           IncrementalJpegCache* cache,
+                           std::vector<uint8_t>* out,
+                           IncrementalEncodeStats* stats, std::wstring* error,
+                           JpegWorkspace* workspace) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  if (!cache || !out) {
+    if (error) {
+      *error = L"Не передан кэш или буфер для JPEG.";
+    }
+    return false;
+  }
+  if (!ValidateImage(image, error)) {
+    return false;
+  }
+  const int ijg_quality = QualityToIjg(options.quality);
+  const FrameLayout layout =
+      MakeLayout(image.width, image.height, options.color_mode);
+  // Сегменты зависят от размера, формата, цветности и таблиц: при смене
+  // любого из них кэш сбрасывается целиком.
+  if (cache->width != image.width || cache->height != image.height ||
+      cache->color_mode != options.color_mode ||
+      cache->pixel_format != image.pixel_format ||
+      cache->ijg_quality != ijg_quality ||
+      cache->row_hashes.size() != layout.mcus_y) {
+    cache->width = image.width;
+    cache->height = image.height;
+    cache->color_mode = options.color_mode;
+    cache->pixel_format = image.pixel_format;
+    cache->ijg_quality = ijg_quality;
+    cache->row_hashes.assign(layout.mcus_y, 0);
+    cache->row_segments.assign(layout.mcus_y, {});
+    cache->row_valid.assign(layout.mcus_y, false);
+  }
+
+  const EncoderTables tables = StandardTables(ijg_quality);
+  out->clear();
+  WriteHeaders(layout, tables.quant.quant, tables.huffman, layout.mcus_x, out);
+
+  JpegWorkspace local;
+  StripWorkspace& ws = workspace ? workspace->strip : local.strip;
+  std::vector<int16_t>& coef =
+      workspace ? workspace->strip_coefficients : local.strip_coefficients;
+  // Эскиз без строк прошлых кадров требует перекодирования всех полос.
+  const bool thumbnail_reset =
+      options.thumbnail && PrepareThumbnail(layout, options.thumbnail);
+  bool prepared = false;
+  uint32_t encoded = 0;
+  DispatchPixelFormat(image.pixel_format, [&](auto tag) {
+    for (uint32_t row = 0; row < layout.mcus_y; ++row) {
+      const uint64_t hash = StripHash(image, layout, row);
+      if (thumbnail_reset || !cache->row_valid[row] ||
+          cache->row_hashes[row] != hash) {
+        if (!prepared) {
+          InitWorkspace(layout, &ws);
+          prepared = true;
+          coef.resize(static_cast<size_t>(BlocksPerMcu(layout)) *
+                      layout.mcus_x * 64);
+        }
+        BuildStrip<decltype(tag)::value>(image, layout, row, &ws);
+        TransformStrip(ws, layout, coef.data());
+        if (options.thumbnail) {
+          ThumbnailStrip(coef.data(), layout, row, options.thumbnail);
+        }
+        EncodeStripSegment(coef.data(), layout, tables,
+                           &cache->row_segments[row]);
+        cache->row_hashes[row] = hash;
+        cache->row_valid[row] = true;
+        ++encoded;
+      }
+      const std::vector<uint8_t>& segment = cache->row_segments[row];
+      out->insert(out->end(), segment.begin(), segment.end());
+      if (row + 1 < layout.mcus_y) {
+        PutMarker(out, static_cast<uint8_t>(0xD0 + (row & 7)));
+      }
+    }
+  });
+  PutMarker(out, 0xD9);
+  if (stats) {
+    stats->rows_total = layout.mcus_y;
+    stats->rows_encoded = encoded;
+  }
+  return true;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image_buffer.h"
+#include "jpeg_huffman.h"
+
+// JPEG color encoding mode.
+enum class ColorMode {
+  kGray,  // Y only: no chroma conversion, single component in the stream.
+  k420,   // Chroma subsampled 2x2 (WIC default).
+  k422,   // Chroma subsampled 2x1.
+  k444,   // Full-resolution chroma.
+};
+
+// Parses "gray" / "420" / "422" / "444". Output: false if unknown.
+bool ParseColorMode(const std::wstring& value, ColorMode* out);
+// Returns mode name for logs and reports.
+const wchar_t* ColorModeName(ColorMode mode);
+
+// Options of the native baseline encoder.
+struct JpegEncodeOptions {
+  // Quality in 0.01..1.0 (same scale as WIC ImageQuality).
+  float quality = 0.01f;
+  ColorMode color_mode = ColorMode::k420;
+  // Per-frame optimal Huffman tables instead of the Annex K tables.
+  bool optimize_huffman = false;
+  // Optional: receives the 1/8-scale BGRA8 image of the block DC values
+  // (ceil(width / 8) x ceil(height / 8)), taken from the transform of the
+  // frame without an extra pass.
+  ImageBuffer* thumbnail = nullptr;
+};
+
+// Optimized Huffman tables of one display, reused while statistics hold.
+struct HuffmanReuseState {
+  bool valid = false;
+  JpegHuffmanTables tables;
+  // Counters for logs/benchmarks.
+  int rebuilds = 0;
+  int reused_frames = 0;
+};
+
+// Maps quality 0.01..1.0 to the IJG 1..100 scale used for table scaling.
+int QualityToIjg(float quality);
+
+// DCT coefficients of a frame: color conversion and DCT done once, then
+// quantized at any quality (rate control probes several).
+struct JpegCoefficients {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  ColorMode color_mode = ColorMode::k420;
+  // Blocks in scan (MCU) order, 64 natural-order values F(u,v) * 8 each.
+  std::vector<int16_t> blocks;
+};
+
+// Scratch buffers of the native encoder (strip planes, quantized frame,
+// code tables of optimized Huffman tables). Defined in jpeg_encoder.cpp.
+struct JpegWorkspace;
+
+// Long-lived encoder state of one display. Buffers keep their capacity, so
+// encoding another frame of the same size allocates nothing; quantization
+// and Huffman tables are compile-time presets (IJG 1, 50, 75, 90) or a
+// process-wide cache built once for other qualities.
+struct JpegEncoderContext {
+  JpegEncoderContext();
+  ~JpegEncoderContext();
+  JpegEncoderContext(JpegEncoderContext&&) noexcept;
+  JpegEncoderContext& operator=(JpegEncoderContext&&) noexcept;
+
+  JpegCoefficients coefficients;
+  // Encoded stream of the last frame.
+  std::vector<uint8_t> output;
+  std::unique_ptr<JpegWorkspace> workspace;
+};
+
+// Heap capacity context keeps between frames (coefficients, stream, strip
+// buffers, quantized frame); for memory budgets.
+size_t JpegEncoderContextBytes(const JpegEncoderContext& context);
+
+// Converts and transforms image. workspace (optional) keeps strip buffers
+// between calls. Output: false + error on invalid input.
+bool ComputeJpegCoefficients(const ImageBuffer& image, ColorMode color_mode,
+                             JpegCoefficients* out, std::wstring* error,
+                             JpegWorkspace* workspace = nullptr);
+
+// Returns exact encoded size at IJG quality (1..100) without writing the
+// stream (cheaper than EncodeJpegCoefficients: no output buffer).
+size_t EstimateJpegSize(const JpegCoefficients& coefficients, int ijg_quality);
+
+// Estimates encoded size from every step-th MCU row of image (step 8 = 1/8
+// of the color conversion and DCT work), scaled to the frame; for a cheap
+// per-frame codec choice. Output: 0 on invalid input.
+size_t EstimateJpegSizeSampled(const ImageBuffer& image, ColorMode color_mode,
+                               int ijg_quality, uint32_t step,
+                               JpegWorkspace* workspace = nullptr);
+
+// 1/8-scale BGRA8 image of the block DC values of cached coefficients (same
+// as JpegEncodeOptions::thumbnail).
+void JpegCoefficientsThumbnail(const JpegCoefficients& coefficients,
+                               ImageBuffer* out);
+
+// Quantizes cached coefficients into zigzag-ordered blocks (scan order), the
+// input of the entropy coder (see jpeg_entropy.h).
+void QuantizeJpegCoefficients(const JpegCoefficients& coefficients,
+                              int ijg_quality, std::vector<int16_t>* out);
+
+// Quantizes cached coefficients and writes a complete JPEG into out.
+void EncodeJpegCoefficients(const JpegCoefficients& coefficients,
+                            int ijg_quality, std::vector<uint8_t>* out);
+
+// Encodes cached coefficients with optimized Huffman tables. Without reuse
+// (nullptr): statistics pass over cached quantized blocks, then encode.
+// With reuse: tables of earlier frames are used in a single pass and
+// rebuilt for the next frame when they lose > 2% to optimal ones.
+// workspace (optional) keeps the quantized frame and code tables.
+void EncodeJpegOptimized(const JpegCoefficients& coefficients, int ijg_quality,
+                         HuffmanReuseState* reuse, std::vector<uint8_t>* out,
+                         JpegWorkspace* workspace = nullptr);
+
+class StripSource;
+
+// Encodes a frame read strip by strip: every MCU row is converted,
+// transformed and entropy-coded right after ReadRows, so memory is a few
+// strip buffers plus the stream. Standard tables only (optimize_huffman
+// is rejected). Output: same bytes as EncodeJpegCoefficients; false + error
+// on invalid input or a failed read.
+bool EncodeJpegStreaming(StripSource* source, const JpegEncodeOptions& options,
+                         std::vector<uint8_t>* out, std::wstring* error,
+                         JpegWorkspace* workspace = nullptr);
+
+// Encodes image (any PixelFormat) as a baseline JFIF JPEG; without
+// optimize_huffman via EncodeJpegStreaming (no frame of coefficients).
+// Output: out replaced with file bytes; false + error on invalid input.
+bool EncodeJpeg(const ImageBuffer& image, const JpegEncodeOptions& options,
+                std::vector<uint8_t>* out, std::wstring* error);
+
+// Same as above with buffers of context; the stream is context->output.
+bool EncodeJpeg(const ImageBuffer& image, const JpegEncodeOptions& options,
+                JpegEncoderContext* context, std::wstring* error);
+
+// Per-display cache of the incremental encoder: pixel hash and entropy-coded
+// restart segment of every MCU row.
+struct IncrementalJpegCache {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  ColorMode color_mode = ColorMode::k420;
+  PixelFormat pixel_format = PixelFormat::kBgra8;
+  int ijg_quality = 0;
+  std::vector<uint64_t> row_hashes;
+  std::vector<bool> row_valid;
+  std::vector<std::vector<uint8_t>> row_segments;
+};
+
+struct IncrementalEncodeStats {
+  uint32_t rows_total = 0;
+  // MCU rows converted, transformed and entropy-coded in this call.
+  uint32_t rows_encoded = 0;
+};
+
+// Encodes image with a restart marker after every MCU row; rows whose pixels
+// are unchanged since the previous call with this cache are copied from it.
+// Output: standalone JPEG (Annex K tables), byte-identical to an encode with
+// an empty cache; false + error on invalid input. options.thumbnail is
+// updated in re-encoded rows only, so the same buffer must be passed with
+// the cache (a buffer of another size re-encodes every row).
+bool EncodeJpegIncremental(const ImageBuffer& image,
+                           const JpegEncodeOptions& options,
+                           IncrementalJpegCache* cache,
+                           std::vector<uint8_t>* out,
+                           IncrementalEncodeStats* stats, std::wstring* error,
+                           JpegWorkspace* workspace = nullptr);
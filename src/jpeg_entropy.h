@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "jpeg_tables.h"
+#include "simd.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Baseline JPEG entropy coding: Huffman code tables, bit writers and block
+// coders. Header-only hot path (inlined into the encoder passes); the
+// byte-at-a-time writer and the plain block coder are kept as the reference
+// for tests and benchmarks.
+
+// Huffman code of every symbol packed as (code << 5) | length, so a symbol
+// and its magnitude bits go to the writer in a single Put.
+struct HuffmanLut {
+  uint32_t packed[256] = {};
+
+  uint32_t code(int symbol) const { return packed[symbol] >> 5; }
+  int length(int symbol) const { return static_cast<int>(packed[symbol] & 31); }
+};
+
+// Builds codes from a DHT-form table (T.81 Annex C); constexpr for the
+// Annex K tables.
+constexpr HuffmanLut BuildHuffmanLut(const HuffmanSpec& spec) {
+  HuffmanLut lut;
+  uint32_t code = 0;
+  int k = 0;
+  for (int length = 1; length <= 16; ++length) {
+    for (int i = 0; i < spec.bits[length - 1]; ++i) {
+      lut.packed[spec.values[k++]] =
+          (code << 5) | static_cast<uint32_t>(length);
+      ++code;
+    }
+    code <<= 1;
+  }
+  return lut;
+}
+
+// Number of bits of magnitude (JPEG SSSS category): 0 for 0.
+inline int MagnitudeBits(uint32_t magnitude) {
+  if (magnitude == 0) {
+    return 0;
+  }
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanReverse(&index, magnitude);
+  return static_cast<int>(index) + 1;
+#else
+  return 32 - __builtin_clz(magnitude);
+#endif
+}
+
+inline int CountTrailingZeros64(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index = 0;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#elif defined(_MSC_VER)
+  unsigned long index = 0;
+  if (_BitScanForward(&index, static_cast<uint32_t>(value))) {
+    return static_cast<int>(index);
+  }
+  _BitScanForward(&index, static_cast<uint32_t>(value >> 32));
+  return static_cast<int>(index) + 32;
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+// High bit set in every byte of value equal to 0xFF (exact, no borrow
+// propagation between bytes).
+inline uint64_t FFByteMask(uint64_t value) {
+  constexpr uint64_t kLow7 = 0x7F7F7F7F7F7F7F7FULL;
+  const uint64_t inverted = ~value;
+  const uint64_t nonzero = ((inverted & kLow7) + kLow7) | inverted;
+  return ~(nonzero | kLow7);
+}
+
+// Reference writer: one byte at a time with 0xFF -> 0xFF 0x00 stuffing.
+class ByteBitWriter {
+ public:
+  explicit ByteBitWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+  // bits: at most 24 significant bits (size <= 24).
+  void Put(uint32_t bits, int size) {
+    buffer_ = (buffer_ << size) | (bits & ((1u << size) - 1));
+    count_ += size;
+    while (count_ >= 8) {
+      const uint8_t byte = static_cast<uint8_t>(buffer_ >> (count_ - 8));
+      out_->push_back(byte);
+      if (byte == 0xFF) {
+        out_->push_back(0x00);
+      }
+      count_ -= 8;
+    }
+  }
+
+  // Pads the last byte with ones, as T.81 requires.
+  void Flush() {
+    if (count_ > 0) {
+      Put(0x7F, 8 - count_);
+    }
+    buffer_ = 0;
+  }
+
+ private:
+  std::vector<uint8_t>* out_;
+  uint32_t buffer_ = 0;
+  int count_ = 0;
+};
+
+// Writer with a 64-bit accumulator: bits are emitted a whole word at a time
+// and the word is checked for 0xFF bytes with SWAR; only words that contain
+// one take the byte-wise stuffing path. Output appended to out is complete
+// after Flush (the vector is over-allocated in between).
+class JpegBitWriter {
+ public:
+  explicit JpegBitWriter(std::vector<uint8_t>* out)
+      : out_(out), pos_(out->size()) {}
+
+  // bits: exactly size significant bits, size <= 32.
+  void Put(uint32_t bits, int size) {
+    if (size < free_) {
+      free_ -= size;
+      acc_ |= static_cast<uint64_t>(bits) << free_;
+      return;
+    }
+    const int spill = size - free_;
+    acc_ |= static_cast<uint64_t>(bits) >> spill;
+    EmitWord(acc_);
+    free_ = 64 - spill;
+    acc_ = spill ? static_cast<uint64_t>(bits) << free_ : 0;
+  }
+
+  // Pads the last byte with ones and trims the output buffer.
+  void Flush() {
+    const int pad = (8 - ((64 - free_) & 7)) & 7;
+    if (pad) {
+      Put((1u << pad) - 1, pad);
+    }
+    Reserve();
+    for (int used = 64 - free_; used > 0; used -= 8) {
+      EmitByte(static_cast<uint8_t>(acc_ >> 56));
+      acc_ <<= 8;
+    }
+    acc_ = 0;
+    free_ = 64;
+    out_->resize(pos_);
+  }
+
+ private:
+  // Worst case of one word: 8 bytes 0xFF, each stuffed.
+  static constexpr size_t kMaxWordBytes = 16;
+
+  void Reserve() {
+    if (pos_ + kMaxWordBytes > out_->size()) {
+      // Обоснование: сначала занимается вся емкость — рост от размера
+      // выделял ровно запрошенное, и кадр чуть длиннее прежних снова
+      // перевыделял буфер на пару байт.
+      out_->resize(std::max(pos_ + kMaxWordBytes + out_->size(),
+                            out_->capacity()));
+    }
+  }
+
+  void EmitByte(uint8_t byte) {
+    uint8_t* dst = out_->data();
+    dst[pos_++] = byte;
+    if (byte == 0xFF) {
+      dst[pos_++] = 0x00;
+    }
+  }
+
+  void EmitWord(uint64_t word) {
+    Reserve();
+    if (FFByteMask(word) == 0) {
+      uint8_t* dst = out_->data() + pos_;
+      for (int i = 0; i < 8; ++i) {
+        dst[i] = static_cast<uint8_t>(word >> (56 - 8 * i));
+      }
+      pos_ += 8;
+      return;
+    }
+    for (int i = 0; i < 8; ++i) {
+      EmitByte(static_cast<uint8_t>(word >> (56 - 8 * i)));
+    }
+  }
+
+  std::vector<uint8_t>* out_;
+  size_t pos_;
+  uint64_t acc_ = 0;
+  int free_ = 64;
+};
+
+// Counts output bytes (including stuffing) instead of writing them: the
+// size estimate for rate control is exact and needs no stream buffer.
+class JpegBitCounter {
+ public:
+  void Put(uint32_t bits, int size) {
+    if (size < free_) {
+      free_ -= size;
+      acc_ |= static_cast<uint64_t>(bits) << free_;
+      return;
+    }
+    const int spill = size - free_;
+    acc_ |= static_cast<uint64_t>(bits) >> spill;
+    CountWord(acc_);
+    free_ = 64 - spill;
+    acc_ = spill ? static_cast<uint64_t>(bits) << free_ : 0;
+  }
+
+  size_t Finish() {
+    const int pad = (8 - ((64 - free_) & 7)) & 7;
+    if (pad) {
+      Put((1u << pad) - 1, pad);
+    }
+    for (int used = 64 - free_; used > 0; used -= 8) {
+      bytes_ += (acc_ >> 56) == 0xFF ? 2 : 1;
+      acc_ <<= 8;
+    }
+    acc_ = 0;
+    free_ = 64;
+    return bytes_;
+  }
+
+ private:
+  void CountWord(uint64_t word) {
+    // Один старший бит на каждый байт 0xFF: сумма битов — число вставок 0x00.
+    const uint64_t mask = FFByteMask(word) >> 7;
+    bytes_ += 8 + static_cast<size_t>((mask * 0x0101010101010101ULL) >> 56);
+  }
+
+  uint64_t acc_ = 0;
+  int free_ = 64;
+  size_t bytes_ = 0;
+};
+
+// Bit i set when zigzag coefficient i is nonzero.
+inline uint64_t NonZeroMask(const int16_t* zz) {
+#if P2_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    const __m128i lo =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(zz + i * 16));
+    const __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(zz + i * 16 + 8));
+    const __m128i is_zero = _mm_packs_epi16(_mm_cmpeq_epi16(lo, zero),
+                                            _mm_cmpeq_epi16(hi, zero));
+    const uint32_t zero_bits =
+        static_cast<uint32_t>(_mm_movemask_epi8(is_zero));
+    mask |= static_cast<uint64_t>(~zero_bits & 0xFFFFu) << (i * 16);
+  }
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (int k = 0; k < 64; ++k) {
+    mask |= static_cast<uint64_t>(zz[k] != 0) << k;
+  }
+  return mask;
+#endif
+}
+
+// Writes DC difference category + magnitude bits in one Put.
+template <typename Writer>
+inline void EncodeDc(Writer& writer, int dc_value, int* last_dc,
+                     const HuffmanLut& dc) {
+  const int diff = dc_value - *last_dc;
+  *last_dc = dc_value;
+  const int nbits =
+      MagnitudeBits(static_cast<uint32_t>(diff < 0 ? -diff : diff));
+  const uint32_t value = static_cast<uint32_t>(diff < 0 ? diff - 1 : diff) &
+                         ((1u << nbits) - 1);
+  const uint32_t entry = dc.packed[nbits];
+  writer.Put(((entry >> 5) << nbits) | value,
+             static_cast<int>(entry & 31) + nbits);
+}
+
+// Block whose AC coefficients are all zero (known from quantization):
+// DC + EOB without scanning the coefficients.
+template <typename Writer>
+inline void EncodeDcOnlyBlock(Writer& writer, int dc_value, int* last_dc,
+                              const HuffmanLut& dc, const HuffmanLut& ac) {
+  EncodeDc(writer, dc_value, last_dc, dc);
+  writer.Put(ac.code(0x00), ac.length(0x00));
+}
+
+// Encodes one quantized zigzag block. Nonzero coefficients are visited via
+// NonZeroMask (runs come from bit positions); symbol code and magnitude bits
+// are merged into one Put; blocks with all-zero AC emit DC + EOB directly.
+template <typename Writer>
+inline void EncodeBlockFast(Writer& writer, const int16_t* zz, int* last_dc,
+                            const HuffmanLut& dc, const HuffmanLut& ac) {
+  EncodeDc(writer, zz[0], last_dc, dc);
+  uint64_t mask = NonZeroMask(zz) & ~1ULL;
+  if (mask == 0) {
+    // Обоснование: при нашем качестве большинство блоков — только DC.
+    writer.Put(ac.code(0x00), ac.length(0x00));
+    return;
+  }
+  int last = 0;
+  while (mask) {
+    const int k = CountTrailingZeros64(mask);
+    mask &= mask - 1;
+    int run = k - last - 1;
+    last = k;
+    while (run > 15) {
+      writer.Put(ac.code(0xF0), ac.length(0xF0));
+      run -= 16;
+    }
+    const int coef = zz[k];
+    const int nbits =
+        MagnitudeBits(static_cast<uint32_t>(coef < 0 ? -coef : coef));
+    const uint32_t value = static_cast<uint32_t>(coef < 0 ? coef - 1 : coef) &
+                           ((1u << nbits) - 1);
+    const uint32_t entry = ac.packed[(run << 4) | nbits];
+    writer.Put(((entry >> 5) << nbits) | value,
+               static_cast<int>(entry & 31) + nbits);
+  }
+  if (last != 63) {
+    writer.Put(ac.code(0x00), ac.length(0x00));
+  }
+}
+
+// Straightforward coder (one Put per code and per magnitude, scan of all 63
+// AC positions). Reference for tests and benchmarks.
+template <typename Writer>
+inline void EncodeBlockReference(Writer& writer, const int16_t* zz,
+                                 int* last_dc, const HuffmanLut& dc,
+                                 const HuffmanLut& ac) {
+  const int diff = zz[0] - *last_dc;
+  *last_dc = zz[0];
+  int nbits = MagnitudeBits(static_cast<uint32_t>(diff < 0 ? -diff : diff));
+  writer.Put(dc.code(nbits), dc.length(nbits));
+  if (nbits) {
+    writer.Put(static_cast<uint32_t>(diff < 0 ? diff - 1 : diff) &
+                   ((1u << nbits) - 1),
+               nbits);
+  }
+  int run = 0;
+  for (int k = 1; k < 64; ++k) {
+    const int value = zz[k];
+    if (value == 0) {
+      ++run;
+      continue;
+    }
+    while (run > 15) {
+      writer.Put(ac.code(0xF0), ac.length(0xF0));
+      run -= 16;
+    }
+    nbits = MagnitudeBits(static_cast<uint32_t>(value < 0 ? -value : value));
+    const int symbol = (run << 4) | nbits;
+    writer.Put(ac.code(symbol), ac.length(symbol));
+    writer.Put(static_cast<uint32_t>(value < 0 ? value - 1 : value) &
+                   ((1u << nbits) - 1),
+               nbits);
+    run = 0;
+  }
+  if (run > 0) {
+    writer.Put(ac.code(0x00), ac.length(0x00));
+  }
+}
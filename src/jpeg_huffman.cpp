@@ -0,0 +1,183 @@
+#include "jpeg_huffman.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr int kMaxCodeLength = 16;
+
+void CodeLengths(const HuffmanSpec& spec, uint8_t lengths[256]) {
+  std::fill(lengths, lengths + 256, 0);
+  int k = 0;
+  for (int length = 1; length <= kMaxCodeLength; ++length) {
+    for (int i = 0; i < spec.bits[length - 1]; ++i) {
+      lengths[spec.values[k++]] = static_cast<uint8_t>(length);
+    }
+  }
+}
+
+uint64_t TableCost(const uint32_t freq[256], const HuffmanSpec& spec) {
+  uint8_t lengths[256];
+  CodeLengths(spec, lengths);
+  uint64_t bits = 0;
+  for (int symbol = 0; symbol < 256; ++symbol) {
+    if (freq[symbol] == 0) {
+      continue;
+    }
+    if (lengths[symbol] == 0) {
+      return UINT64_MAX;
+    }
+    bits += static_cast<uint64_t>(freq[symbol]) * lengths[symbol];
+  }
+  return bits;
+}
+
+// Допустимые символы baseline: DC — категории 0..11, AC — EOB, ZRL и
+// (run << 4 | size) для size 1..10.
+bool IsValidSymbol(bool ac, int symbol) {
+  if (!ac) {
+    return symbol <= 11;
+  }
+  const int size = symbol & 0x0F;
+  return symbol == 0x00 || symbol == 0xF0 || (size >= 1 && size <= 10);
+}
+
+}  // namespace
+
+JpegHuffmanTables StandardHuffmanTables() {
+  JpegHuffmanTables tables;
+  tables.dc[0] = kStdDcLuma;
+  tables.dc[1] = kStdDcChroma;
+  tables.ac[0] = kStdAcLuma;
+  tables.ac[1] = kStdAcChroma;
+  return tables;
+}
+
+HuffmanSpec BuildOptimalHuffman(const uint32_t freq_in[256]) {
+  // Символ 256 зарезервирован с частотой 1, чтобы ни один код не состоял
+  // из одних единиц (T.81 K.2, как в IJG jpeg_gen_optimal_table).
+  uint64_t freq[257];
+  int code_size[257] = {};
+  int others[257];
+  for (int i = 0; i < 256; ++i) {
+    freq[i] = freq_in[i];
+  }
+  freq[256] = 1;
+  std::fill(others, others + 257, -1);
+
+  for (;;) {
+    int c1 = -1;
+    uint64_t v = UINT64_MAX;
+    for (int i = 0; i <= 256; ++i) {
+      if (freq[i] && freq[i] <= v) {
+        v = freq[i];
+        c1 = i;
+      }
+    }
+    int c2 = -1;
+    v = UINT64_MAX;
+    for (int i = 0; i <= 256; ++i) {
+      if (freq[i] && freq[i] <= v && i != c1) {
+        v = freq[i];
+        c2 = i;
+      }
+    }
+    if (c2 < 0) {
+      break;
+    }
+    freq[c1] += freq[c2];
+    freq[c2] = 0;
+    ++code_size[c1];
+    while (others[c1] >= 0) {
+      c1 = others[c1];
+      ++code_size[c1];
+    }
+    others[c1] = c2;
+    ++code_size[c2];
+    while (others[c2] >= 0) {
+      c2 = others[c2];
+      ++code_size[c2];
+    }
+  }
+
+  int bits[33] = {};
+  for (int i = 0; i <= 256; ++i) {
+    if (code_size[i]) {
+      ++bits[code_size[i]];
+    }
+  }
+  // Ограничение длины 16: пара листьев с самого глубокого уровня
+  // поднимается, а лист с более короткого уровня опускается на 1.
+  for (int i = 32; i > kMaxCodeLength; --i) {
+    while (bits[i] > 0) {
+      int j = i - 2;
+      while (bits[j] == 0) {
+        --j;
+      }
+      bits[i] -= 2;
+      ++bits[i - 1];
+      bits[j + 1] += 2;
+      --bits[j];
+    }
+  }
+  int longest = kMaxCodeLength;
+  while (longest > 0 && bits[longest] == 0) {
+    --longest;
+  }
+  if (longest > 0) {
+    --bits[longest];  // Убираем зарезервированный символ.
+  }
+
+  HuffmanSpec spec = {};
+  for (int i = 1; i <= kMaxCodeLength; ++i) {
+    spec.bits[i - 1] = static_cast<uint8_t>(bits[i]);
+  }
+  int count = 0;
+  for (int length = 1; length <= 32; ++length) {
+    for (int symbol = 0; symbol < 256; ++symbol) {
+      if (code_size[symbol] == length) {
+        spec.values[count++] = static_cast<uint8_t>(symbol);
+      }
+    }
+  }
+  spec.count = count;
+  return spec;
+}
+
+JpegHuffmanTables BuildOptimalTables(const JpegSymbolStats& stats,
+                                     bool cover_all_symbols) {
+  JpegHuffmanTables tables;
+  for (int t = 0; t < 2; ++t) {
+    uint32_t dc[256];
+    uint32_t ac[256];
+    for (int symbol = 0; symbol < 256; ++symbol) {
+      dc[symbol] = stats.dc[t][symbol];
+      ac[symbol] = stats.ac[t][symbol];
+      if (cover_all_symbols) {
+        if (dc[symbol] == 0 && IsValidSymbol(false, symbol)) {
+          dc[symbol] = 1;
+        }
+        if (ac[symbol] == 0 && IsValidSymbol(true, symbol)) {
+          ac[symbol] = 1;
+        }
+      }
+    }
+    tables.dc[t] = BuildOptimalHuffman(dc);
+    tables.ac[t] = BuildOptimalHuffman(ac);
+  }
+  return tables;
+}
+
+uint64_t HuffmanCostBits(const JpegSymbolStats& stats,
+                         const JpegHuffmanTables& tables) {
+  uint64_t total = 0;
+  for (int t = 0; t < 2; ++t) {
+    const uint64_t dc = TableCost(stats.dc[t], tables.dc[t]);
+    const uint64_t ac = TableCost(stats.ac[t], tables.ac[t]);
+    if (dc == UINT64_MAX || ac == UINT64_MAX) {
+      return UINT64_MAX;
+    }
+    total += dc + ac;
+  }
+  return total;
+}
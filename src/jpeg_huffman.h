@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "jpeg_tables.h"
+
+// Huffman tables written in DHT (index 0 = luminance, 1 = chrominance).
+struct JpegHuffmanTables {
+  HuffmanSpec dc[2];
+  HuffmanSpec ac[2];
+};
+
+// Symbol frequencies of quantized blocks per table (0 = luma, 1 = chroma).
+struct JpegSymbolStats {
+  uint32_t dc[2][256] = {};
+  uint32_t ac[2][256] = {};
+};
+
+// Returns the Annex K tables.
+JpegHuffmanTables StandardHuffmanTables();
+
+// Builds an optimal length-limited (16 bit) code for symbol frequencies
+// (T.81 Annex K.2). Symbols with zero frequency get no code.
+HuffmanSpec BuildOptimalHuffman(const uint32_t freq[256]);
+
+// Builds tables from frame statistics. cover_all_symbols: every valid
+// DC/AC symbol gets a code, so tables can encode later frames as well.
+JpegHuffmanTables BuildOptimalTables(const JpegSymbolStats& stats,
+                                     bool cover_all_symbols);
+
+// Returns bits spent on Huffman codes (magnitude bits excluded) for stats
+// under tables; UINT64_MAX if a used symbol has no code.
+uint64_t HuffmanCostBits(const JpegSymbolStats& stats,
+                         const JpegHuffmanTables& tables);
@@ -2,6 +2,7 @@
 #include <Lmcons.h>
 #include <shellapi.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cwchar>
 #include <iostream>
@@ -13,13 +14,36 @@
 #include <utility>
 #include <vector>
 
+#include "activity_scheduler.h"
+#include "alloc_tracking.h"
 #include "capture_dxgi.h"
 #include "capture_gdi.h"
+#include "catalog.h"
+#include "codec_select.h"
+#include "contact_sheet.h"
+#include "cpu_governor.h"
+#include "cycle_scheduler.h"
 #include "display_enum.h"
 #include "encode_wic.h"
+#include "file_io.h"
+#include "frame_archive.h"
+#include "frame_ring.h"
+#include "frame_store.h"
+#include "jpeg_encoder.h"
 #include "logging.h"
+#include "memory_budget.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "mjpeg_stream.h"
 #include "path_utils.h"
+#include "pixel_convert.h"
 #include "process_utils.h"
+#include "qoi_codec.h"
+#include "rate_control.h"
+#include "resample.h"
+#include "retention.h"
+#include "strip_source.h"
 #include "time_utils.h"
 #include "win_helpers.h"
 
@@ -27,6 +51,16 @@ namespace {
 
 // Обоснование: минимальное качество дает максимальное сжатие при валидном JPEG.
 constexpr float kJpegQuality = 0.01f;
+// Обоснование: 10 кадров/с в потоке --video — сутки съемки раз в 10 с
+// (8640 кадров) просматриваются за ~15 минут.
+constexpr uint32_t kVideoFrameMs = 100;
+// Обоснование: эскиз 1/8 при минимальном качестве кадра нечитаем, а при 0.75
+// весит единицы КБ.
+constexpr float kThumbnailQuality = 0.75f;
+// Обоснование: проба активности (--adaptive-interval) — сетка 64x36 точек
+// (ячейка 30x30 на 1080p): один StretchBlt без усреднения и хеш 9 КБ.
+constexpr uint32_t kProbeWidth = 64;
+constexpr uint32_t kProbeHeight = 36;
 
 struct Options {
   std::wstring out_dir;
@@ -35,6 +69,95 @@ struct Options {
   bool out_dir_from_cwd = false;
   int interval_seconds = 10;
   int capture_count = 0;
+  ScaleOptions scale;
+  ColorMode color_mode = ColorMode::k420;
+  // Переопределения режима цвета по индексу дисплея (с 0).
+  std::unordered_map<int, ColorMode> display_color_modes;
+  bool native_encoder = false;
+  RateControlOptions rate;
+  bool optimize_huffman = false;
+  bool incremental = false;
+  OutputCodec codec = OutputCodec::kJpeg;
+  bool streaming = false;
+  bool archive = false;
+  bool video = false;
+  bool dedup = false;
+  bool retention = false;
+  RetentionPolicy retention_policy;
+  bool thumbnails = false;
+  bool catalog = false;
+  // Порт метрик на 127.0.0.1 (0: выключено).
+  int metrics_port = 0;
+  // Имя кольца последних кадров в общей памяти (пусто: выключено).
+  std::wstring frame_ring;
+  // Бюджет CPU процесса в процентах всех ядер (0: регулятор выключен) и
+  // ступени деградации регулятора.
+  float cpu_budget_percent = 0;
+  std::vector<GovernorLevel> governor_levels;
+  // Бюджет памяти кадров всех дисплеев, МБ (0: без ограничения).
+  int max_memory_mb = 0;
+  // Что делать со сроками циклов, пропущенными из-за долгого цикла.
+  OverrunPolicy overrun_policy = OverrunPolicy::kCoalesce;
+  // Границы интервала дисплея по активности, с (0: интервал общий).
+  int adaptive_min_seconds = 0;
+  int adaptive_max_seconds = 0;
+};
+
+// Состояние кодера, переносимое между циклами для одного дисплея.
+// Обоснование: буферы кадра (масштаб, коэффициенты, поток) и объекты
+// кодеров живут между циклами — установившийся цикл не выделяет память
+// и не пересоздает фабрику WIC.
+struct DisplayEncodeState {
+  RateControlState rate;
+  HuffmanReuseState huffman;
+  IncrementalJpegCache incremental;
+  JpegEncoderContext encoder;
+  WicJpegContext wic;
+  ImageBuffer scaled;
+  // Метка времени и число дисплеев текущего цикла (--archive, --dedup).
+  int64_t cycle_timestamp = 0;
+  int cycle_display_count = 1;
+  // Суточный архив дисплея (--archive).
+  FrameArchiveWriter archive;
+  // Суточный поток MJPEG дисплея (--video): имя без расширения и номер
+  // части (новая часть при смене размера кадра).
+  MjpegStreamWriter video;
+  std::wstring video_base;
+  int video_part = 0;
+  // Хранилище кадров (--dedup), ссылка текущего кадра и признак того, что
+  // кадр уже был в хранилище.
+  FrameStore* store = nullptr;
+  StoreReference store_ref;
+  bool store_hit = false;
+  // Эскиз кадра из DC (--thumbnails) и его JPEG.
+  bool write_thumbnail = false;
+  ImageBuffer thumbnail;
+  std::vector<uint8_t> thumbnail_jpeg;
+  // Байты, записанные за кадр, и оценка изменений дисплея (--catalog).
+  uint32_t saved_bytes = 0;
+  ChangeTracker change;
+  // Время записи байтов кадра (--metrics-port; 0 для WIC — файл пишет
+  // сам кодер).
+  double write_seconds = 0;
+  // Оценка изменений для пропуска неизмененного дисплея (ступень skip
+  // регулятора CPU); отдельно от оценки каталога.
+  ChangeTracker governor_change;
+  // Резерв бюджета памяти (--max-memory-mb) под буферы, которые дисплей
+  // держит между кадрами (контекст кодера, масштаб, кэш полос).
+  MemoryReservation retained;
+  // Оценка изменений для интервала по активности (--adaptive-interval).
+  ChangeTracker activity_change;
+};
+
+// Метрики дисплея (--metrics-port); kNoMetric, пока метрики выключены.
+struct DisplayMetrics {
+  MetricId capture_seconds = kNoMetric;
+  MetricId encode_seconds = kNoMetric;
+  MetricId write_seconds = kNoMetric;
+  MetricId written_bytes = kNoMetric;
+  MetricId frames_saved = kNoMetric;
+  MetricId frames_skipped = kNoMetric;
+  MetricId capture_interval = kNoMetric;
 };
 
 struct ProcessState {
@@ -102,10 +225,47 @@ void PrintUsage() {
   std::wcerr
       << L"Использование:\n"
       << L"  p2_screenshot [--out \"D:\\\\Screens\"] [--interval-seconds 10]\n"
-      << L"               [--count N] [--test-image] [--simulate-displays N]\n";
+      << L"               [--count N] [--test-image] [--simulate-displays N]\n"
+      << L"               [--scale F] [--max-width N]\n"
+      << L"               [--color-mode gray|420|422|444]\n"
+      << L"               [--display-color-mode N=MODE] [--encoder wic|native]\n"
+      << L"               [--target-bytes N] [--daily-budget-mb N]\n"
+      << L"               [--optimize-huffman] [--incremental]\n"
+      << L"               [--codec jpeg|lossless|auto] [--streaming]\n"
+      << L"               [--archive] [--video] [--dedup]\n"
+      << L"               [--retention 7:0.5:gray,365:delete]\n"
+      << L"               [--thumbnails] [--catalog] [--metrics-port N]\n"
+      << L"               [--frame-ring NAME] [--cpu-budget-percent P]\n"
+      << L"               [--cpu-governor-levels quality,gray,scale:0.5,skip,interval:2]\n"
+      << L"               [--max-memory-mb N] [--adaptive-interval MIN:MAX]\n"
+      << L"               [--overrun-policy skip|catch-up|coalesce]\n";
   std::wcerr << L"\n--out необязателен: по умолчанию используется подпапка p в текущей папке.\n";
   std::wcerr << L"--interval-seconds задает интервал между кадрами (>= 1).\n";
   std::wcerr << L"--count задает число циклов (0 = бесконечно).\n";
+  std::wcerr << L"--scale уменьшает кадр перед кодированием (0 < F <= 1).\n";
+  std::wcerr << L"--max-width ограничивает ширину кадра в пикселях.\n";
+  std::wcerr << L"--color-mode задает цветность JPEG (по умолчанию 420).\n";
+  std::wcerr << L"--display-color-mode задает режим для дисплея N (с 1), можно повторять.\n";
+  std::wcerr << L"--encoder выбирает кодер JPEG: wic (по умолчанию) или native.\n";
+  std::wcerr << L"--target-bytes задает целевой размер кадра в байтах (rate control).\n";
+  std::wcerr << L"--daily-budget-mb задает суточный объем на дисплей в МБ (rate control).\n";
+  std::wcerr << L"--optimize-huffman строит оптимальные таблицы Huffman (меньше файлы).\n";
+  std::wcerr << L"--incremental перекодирует только измененные полосы кадра.\n";
+  std::wcerr << L"--codec: jpeg (по умолчанию), lossless (QOI без потерь) или auto.\n";
+  std::wcerr << L"--streaming кодирует кадр полосами по 16 строк без копии кадра.\n";
+  std::wcerr << L"--archive дописывает кадры в суточный архив дисплея (.p2pack/.p2idx); файлы извлекает p2_extract.\n";
+  std::wcerr << L"--video дописывает кадры в суточный видеопоток дисплея (Motion-JPEG в .mkv).\n";
+  std::wcerr << L"--dedup пишет каждое уникальное изображение один раз в хранилище PC_USER\\store, повтор — ссылкой.\n";
+  std::wcerr << L"--retention в фоне пережимает старые дни (ДНЕЙ:масштаб[:gray]) и удаляет их (ДНЕЙ:delete).\n";
+  std::wcerr << L"--thumbnails пишет эскиз 1/8 каждого кадра в подпапку t папки дня (листы дня строит p2_extract --sheets).\n";
+  std::wcerr << L"--catalog ведет каталог кадров PC_USER\\catalog (время, дисплей, размер, изменения); запросы — p2_query.\n";
+  std::wcerr << L"--metrics-port отдает метрики Prometheus на http://127.0.0.1:N/metrics.\n";
+  std::wcerr << L"--frame-ring публикует последний захваченный кадр каждого дисплея в общей памяти NAME для локальных читателей.\n";
+  std::wcerr << L"--cpu-budget-percent ограничивает долю CPU всех ядер (0 < P <= 100): при превышении ступени деградации включаются по одной.\n";
+  std::wcerr << L"--cpu-governor-levels задает ступени регулятора (quality, gray, scale:F, skip, interval:N), каждая добавляется к предыдущей.\n";
+  std::wcerr << L"--adaptive-interval задает каждому дисплею свой интервал от MIN до MAX секунд по активности (проба раз в MIN секунд).\n";
+  std::wcerr << L"--overrun-policy: после цикла дольше интервала пропустить прошедшие сроки (skip), выполнить каждый подряд (catch-up) или один цикл сразу (coalesce, по умолчанию).\n";
+  std::wcerr << L"--max-memory-mb ограничивает память кадров всех дисплеев: буферы сверх бюджета освобождаются, крупный кадр кодируется полосами.\n";
 }
 
 bool ParseIntArg(const std::wstring& value, int* out) {
@@ -125,6 +285,28 @@ bool ParseIntArg(const std::wstring& value, int* out) {
   return true;
 }
 
+bool ParseFloatArg(const std::wstring& value, float* out) {
+  if (!out) {
+    return false;
+  }
+  wchar_t* end = nullptr;
+  float parsed = std::wcstof(value.c_str(), &end);
+  if (end == value.c_str() || *end != L'\0') {
+    return false;
+  }
+  *out = parsed;
+  return true;
+}
+
+// Опции, с которыми кадр можно кодировать полосами (--streaming и кадр
+// сверх --max-memory-mb): без масштаба, подбора качества, своих таблиц,
+// кэша полос и выбора кодека.
+bool StreamingCompatible(const Options& options) {
+  return !RateControlEnabled(options.rate) && !options.optimize_huffman &&
+         !options.incremental && options.codec == OutputCodec::kJpeg &&
+         !(options.scale.scale < 1.0f) && options.scale.max_width == 0;
+}
+
 bool ParseArgs(int argc, wchar_t* argv[], Options* options,
                std::wstring* error) {
   if (!options) {
@@ -175,6 +357,42 @@ bool ParseArgs(int argc, wchar_t* argv[], Options* options,
         return false;
       }
       options->interval_seconds = value;
+    } else if (arg == L"--overrun-policy") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --overrun-policy.";
+        }
+        return false;
+      }
+      if (!ParseOverrunPolicy(argv[++i], &options->overrun_policy)) {
+        if (error) {
+          *error = L"Некорректное значение --overrun-policy.";
+        }
+        return false;
+      }
+    } else if (arg == L"--adaptive-interval") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --adaptive-interval.";
+        }
+        return false;
+      }
+      const std::wstring value = argv[++i];
+      const size_t colon = value.find(L':');
+      int min_seconds = 0;
+      int max_seconds = 0;
+      if (colon == std::wstring::npos ||
+          !ParseIntArg(value.substr(0, colon), &min_seconds) ||
+          !ParseIntArg(value.substr(colon + 1), &max_seconds) ||
+          min_seconds < 1 || max_seconds <= min_seconds ||
+          max_seconds > 86400) {
+        if (error) {
+          *error = L"Некорректное значение --adaptive-interval.";
+        }
+        return false;
+      }
+      options->adaptive_min_seconds = min_seconds;
+      options->adaptive_max_seconds = max_seconds;
     } else if (arg == L"--count") {
       if (i + 1 >= argc) {
         if (error) {
@@ -190,6 +408,234 @@ bool ParseArgs(int argc, wchar_t* argv[], Options* options,
         return false;
       }
       options->capture_count = value;
+    } else if (arg == L"--scale") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --scale.";
+        }
+        return false;
+      }
+      float value = 0.0f;
+      if (!ParseFloatArg(argv[++i], &value) || !(value > 0.0f) ||
+          value > 1.0f) {
+        if (error) {
+          *error = L"Некорректное значение --scale.";
+        }
+        return false;
+      }
+      options->scale.scale = value;
+    } else if (arg == L"--max-width") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --max-width.";
+        }
+        return false;
+      }
+      int value = 0;
+      if (!ParseIntArg(argv[++i], &value) || value < 1) {
+        if (error) {
+          *error = L"Некорректное значение --max-width.";
+        }
+        return false;
+      }
+      options->scale.max_width = static_cast<uint32_t>(value);
+    } else if (arg == L"--color-mode") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --color-mode.";
+        }
+        return false;
+      }
+      if (!ParseColorMode(argv[++i], &options->color_mode)) {
+        if (error) {
+          *error = L"Некорректное значение --color-mode.";
+        }
+        return false;
+      }
+    } else if (arg == L"--display-color-mode") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --display-color-mode.";
+        }
+        return false;
+      }
+      const std::wstring value = argv[++i];
+      const size_t eq = value.find(L'=');
+      int display = 0;
+      ColorMode mode = ColorMode::k420;
+      if (eq == std::wstring::npos ||
+          !ParseIntArg(value.substr(0, eq), &display) || display < 1 ||
+          !ParseColorMode(value.substr(eq + 1), &mode)) {
+        if (error) {
+          *error = L"Некорректное значение --display-color-mode (ожидается N=MODE).";
+        }
+        return false;
+      }
+      options->display_color_modes[display - 1] = mode;
+    } else if (arg == L"--encoder") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --encoder.";
+        }
+        return false;
+      }
+      const std::wstring value = argv[++i];
+      if (value == L"native") {
+        options->native_encoder = true;
+      } else if (value == L"wic") {
+        options->native_encoder = false;
+      } else {
+        if (error) {
+          *error = L"Некорректное значение --encoder.";
+        }
+        return false;
+      }
+    } else if (arg == L"--target-bytes") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --target-bytes.";
+        }
+        return false;
+      }
+      int value = 0;
+      if (!ParseIntArg(argv[++i], &value) || value < 1) {
+        if (error) {
+          *error = L"Некорректное значение --target-bytes.";
+        }
+        return false;
+      }
+      options->rate.target_bytes = static_cast<uint64_t>(value);
+    } else if (arg == L"--daily-budget-mb") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --daily-budget-mb.";
+        }
+        return false;
+      }
+      int value = 0;
+      if (!ParseIntArg(argv[++i], &value) || value < 1) {
+        if (error) {
+          *error = L"Некорректное значение --daily-budget-mb.";
+        }
+        return false;
+      }
+      options->rate.daily_budget_bytes = static_cast<uint64_t>(value) << 20;
+    } else if (arg == L"--optimize-huffman") {
+      options->optimize_huffman = true;
+    } else if (arg == L"--incremental") {
+      options->incremental = true;
+    } else if (arg == L"--streaming") {
+      options->streaming = true;
+    } else if (arg == L"--archive") {
+      options->archive = true;
+    } else if (arg == L"--video") {
+      options->video = true;
+    } else if (arg == L"--dedup") {
+      options->dedup = true;
+    } else if (arg == L"--thumbnails") {
+      options->thumbnails = true;
+    } else if (arg == L"--catalog") {
+      options->catalog = true;
+    } else if (arg == L"--metrics-port") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --metrics-port.";
+        }
+        return false;
+      }
+      int value = 0;
+      if (!ParseIntArg(argv[++i], &value) || value < 1 || value > 65535) {
+        if (error) {
+          *error = L"Некорректное значение --metrics-port.";
+        }
+        return false;
+      }
+      options->metrics_port = value;
+    } else if (arg == L"--frame-ring") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --frame-ring.";
+        }
+        return false;
+      }
+      options->frame_ring = argv[++i];
+    } else if (arg == L"--cpu-budget-percent") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --cpu-budget-percent.";
+        }
+        return false;
+      }
+      float value = 0.0f;
+      if (!ParseFloatArg(argv[++i], &value) || !(value > 0.0f) ||
+          value > 100.0f) {
+        if (error) {
+          *error = L"Некорректное значение --cpu-budget-percent.";
+        }
+        return false;
+      }
+      options->cpu_budget_percent = value;
+    } else if (arg == L"--cpu-governor-levels") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --cpu-governor-levels.";
+        }
+        return false;
+      }
+      std::wstring levels_error;
+      if (!ParseGovernorLevels(argv[++i], &options->governor_levels,
+                               &levels_error)) {
+        if (error) {
+          *error = L"Некорректное значение --cpu-governor-levels: " +
+                   levels_error;
+        }
+        return false;
+      }
+    } else if (arg == L"--max-memory-mb") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --max-memory-mb.";
+        }
+        return false;
+      }
+      int value = 0;
+      if (!ParseIntArg(argv[++i], &value) || value < 1) {
+        if (error) {
+          *error = L"Некорректное значение --max-memory-mb.";
+        }
+        return false;
+      }
+      options->max_memory_mb = value;
+    } else if (arg == L"--retention") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --retention.";
+        }
+        return false;
+      }
+      std::wstring policy_error;
+      options->retention_policy.jpeg_quality = kJpegQuality;
+      if (!ParseRetentionPolicy(argv[++i], &options->retention_policy,
+                                &policy_error)) {
+        if (error) {
+          *error = L"Некорректное значение --retention: " + policy_error;
+        }
+        return false;
+      }
+      options->retention = true;
+    } else if (arg == L"--codec") {
+      if (i + 1 >= argc) {
+        if (error) {
+          *error = L"Не указан аргумент после --codec.";
+        }
+        return false;
+      }
+      if (!ParseOutputCodec(argv[++i], &options->codec)) {
+        if (error) {
+          *error = L"Некорректное значение --codec.";
+        }
+        return false;
+      }
     } else if (arg == L"--help" || arg == L"-h" || arg == L"/?") {
       return false;
     } else {
@@ -220,6 +666,78 @@ bool ParseArgs(int argc, wchar_t* argv[], Options* options,
   if (options->simulate_displays > 0) {
     options->test_image = true;
   }
+  // Обоснование: цикл идет с шагом MIN — на каждом шаге пробы всех
+  // дисплеев и захват тех, чей интервал истек.
+  if (options->adaptive_min_seconds > 0) {
+    options->interval_seconds = options->adaptive_min_seconds;
+  }
+  if (!options->governor_levels.empty() && options->cpu_budget_percent <= 0) {
+    if (error) {
+      *error = L"--cpu-governor-levels требует --cpu-budget-percent.";
+    }
+    return false;
+  }
+  if (options->cpu_budget_percent > 0 && options->governor_levels.empty()) {
+    ParseGovernorLevels(kDefaultGovernorLevels, &options->governor_levels,
+                        nullptr);
+  }
+  // Обоснование: подбор качества и сбор статистики Huffman работают по
+  // кэшированным DCT-коэффициентам, которых WIC не предоставляет.
+  // Сегменты полос кодируются стандартными таблицами при фиксированном
+  // качестве: подбор качества и свои таблицы сбрасывали бы кэш каждый кадр.
+  if (options->incremental &&
+      (RateControlEnabled(options->rate) || options->optimize_huffman)) {
+    if (error) {
+      *error = L"--incremental несовместим с --target-bytes, --daily-budget-mb "
+               L"и --optimize-huffman.";
+    }
+    return false;
+  }
+  // Обоснование: потоковый путь не держит кадр целиком, а масштабирование,
+  // подбор качества, свои таблицы, кэш полос и оценка кодека требуют
+  // всего кадра.
+  if (options->streaming && !StreamingCompatible(*options)) {
+    if (error) {
+      *error = L"--streaming несовместим с --scale, --max-width, "
+               L"--target-bytes, --daily-budget-mb, --optimize-huffman, "
+               L"--incremental и --codec lossless|auto.";
+    }
+    return false;
+  }
+  // Обоснование: в потоке Motion-JPEG могут быть только кадры JPEG.
+  if (options->video &&
+      (options->archive || options->codec != OutputCodec::kJpeg)) {
+    if (error) {
+      *error = L"--video несовместим с --archive и --codec lossless|auto.";
+    }
+    return false;
+  }
+  // Обоснование: ключ хранилища считается по готовому кадру, а при --streaming
+  // кадр целиком не существует; архив и поток сами хранят каждый кадр.
+  if (options->dedup &&
+      (options->streaming || options->archive || options->video)) {
+    if (error) {
+      *error = L"--dedup несовместим с --streaming, --archive и --video.";
+    }
+    return false;
+  }
+  // Обоснование: эскиз лежит рядом с файлом кадра в папке дня, а в архиве,
+  // потоке и хранилище отдельных файлов нет.
+  if (options->thumbnails &&
+      (options->archive || options->video || options->dedup)) {
+    if (error) {
+      *error = L"--thumbnails несовместим с --archive, --video и --dedup.";
+    }
+    return false;
+  }
+  // Обоснование: WIC пишет файл сам, в архив, поток и хранилище попадают
+  // только байты собственного кодера; эскиз берется из DC собственного
+  // кодера.
+  if (RateControlEnabled(options->rate) || options->optimize_huffman ||
+      options->incremental || options->streaming || options->archive ||
+      options->video || options->dedup || options->thumbnails) {
+    options->native_encoder = true;
+  }
   return true;
 }
 
@@ -235,7 +753,7 @@ ImageBuffer MakeTestPattern(uint32_t width, uint32_t height, uint32_t seed) {
   buffer.width = width;
   buffer.height = height;
   buffer.stride = width * 4;
-  buffer.pixel_format = GUID_WICPixelFormat32bppBGRA;
+  buffer.pixel_format = PixelFormat::kBgra8;
   buffer.pixels.resize(static_cast<size_t>(buffer.stride) * height);
 
   for (uint32_t y = 0; y < height; ++y) {
@@ -325,8 +843,363 @@ std::chrono::milliseconds FileTimeDiffMs(const FILETIME& start,
   return std::chrono::milliseconds(diff_100ns / 10000ULL);
 }
 
+// Applies --scale/--max-width before encoding.
+// Output: frame to encode (the source itself when no resize is needed).
+const ImageBuffer& PrepareOutputFrame(const ImageBuffer& frame,
+                                      const ScaleOptions& scale,
+                                      ImageBuffer* scaled) {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  if (!ComputeScaledSize(frame.width, frame.height, scale, &width, &height)) {
+    return frame;
+  }
+  // Обоснование: уменьшение до кодирования сокращает DCT и запись в 4-16 раз;
+  // конвертация HDR-форматов совмещена с чтением строк ресемплера.
+  if (!ResampleImage(frame, width, height, ResampleFilter::kAuto, 0, scaled,
+                     nullptr)) {
+    return frame;
+  }
+  return *scaled;
+}
+
+// Байты буферов, которые дисплей держит между кадрами (--max-memory-mb).
+size_t RetainedBytes(const DisplayEncodeState& state) {
+  size_t bytes =
+      JpegEncoderContextBytes(state.encoder) + state.scaled.pixels.capacity();
+  for (const std::vector<uint8_t>& segment : state.incremental.row_segments) {
+    bytes += segment.capacity();
+  }
+  return bytes;
+}
+
+// Освобождает буферы дисплея и их резерв; следующий кадр выделит их
+// заново (с пустым кэшем полос --incremental кодирует кадр целиком).
+void ReleaseRetainedBuffers(DisplayEncodeState* state) {
+  state->retained.Reset();
+  state->encoder = JpegEncoderContext();
+  state->scaled = ImageBuffer();
+  state->incremental = IncrementalJpegCache();
+}
+
+// Опции цикла на уровне регулятора CPU: base с ограничениями level.
+void ApplyGovernorLevel(const Options& base, const GovernorLevel& level,
+                        Options* out) {
+  *out = base;
+  if (level.fixed_quality) {
+    out->rate = RateControlOptions();
+    out->optimize_huffman = false;
+    if (out->codec == OutputCodec::kAuto) {
+      out->codec = OutputCodec::kJpeg;
+    }
+  }
+  if (level.grayscale) {
+    out->color_mode = ColorMode::kGray;
+    out->display_color_modes.clear();
+  }
+  // Потоковый путь кадр не масштабирует (--streaming несовместим с --scale).
+  if (!base.streaming) {
+    out->scale.scale = base.scale.scale * level.scale;
+  }
+  out->interval_seconds = base.interval_seconds * level.interval_factor;
+}
+
+ColorMode ColorModeForDisplay(const Options& options, int display_index) {
+  auto it = options.display_color_modes.find(display_index);
+  return it != options.display_color_modes.end() ? it->second
+                                                 : options.color_mode;
+}
+
+int SecondsLeftInDay(const DateTimeParts& dt) {
+  return 24 * 3600 - (dt.hour * 3600 + dt.minute * 60 + dt.second);
+}
+
+// Возвращает кодек кадра; для auto — меньший файл по выборочной оценке.
+OutputCodec ResolveCodec(const ImageBuffer& frame, const Options& options,
+                         int display_index, DisplayEncodeState* state,
+                         Logger* logger) {
+  if (options.codec != OutputCodec::kAuto) {
+    return options.codec;
+  }
+  const CodecChoice choice =
+      ChooseCodec(frame, ColorModeForDisplay(options, display_index),
+                  kJpegQuality, state->encoder.workspace.get());
+  if (logger) {
+    logger->Info(L"Выбор кодека дисплея " + std::to_wstring(display_index + 1) +
+                 L": оценка jpeg, байт: " + std::to_wstring(choice.jpeg_bytes) +
+                 L", lossless, байт: " +
+                 std::to_wstring(choice.lossless_bytes) + L" -> " +
+                 OutputCodecName(choice.codec));
+  }
+  return choice.codec;
+}
+
+std::wstring VideoPartPath(const std::wstring& base, int part) {
+  return part == 0 ? base + L".mkv"
+                   : base + L"_part" + std::to_wstring(part + 1) + L".mkv";
+}
+
+// Дописывает кадр в поток MJPEG дисплея. Кадр другого размера закрывает
+// поток (с индексом) и продолжает его в следующей части.
+bool AppendVideoFrame(const std::vector<uint8_t>& jpeg, uint32_t width,
+                      uint32_t height, DisplayEncodeState* state,
+                      std::wstring* error) {
+  while (!state->video.Accepts(width, height)) {
+    ++state->video_part;
+    if (!state->video.Finalize(error) ||
+        !state->video.Open(VideoPartPath(state->video_base, state->video_part),
+                           kVideoFrameMs, error)) {
+      return false;
+    }
+  }
+  return state->video.Append(jpeg, width, height, error);
+}
+
+// Пишет закодированный кадр в хранилище, суточный поток или архив дисплея,
+// если они открыты, иначе отдельным файлом path.
+bool WriteEncodedFrame(const std::wstring& path,
+                       const std::vector<uint8_t>& data, OutputCodec codec,
+                       uint32_t width, uint32_t height,
+                       DisplayEncodeState* state, std::wstring* error) {
+  if (state->store) {
+    state->store_ref.codec = codec;
+    return state->store->AddFrame(state->store_ref, data, error);
+  }
+  if (state->video.IsOpen()) {
+    return AppendVideoFrame(data, width, height, state, error);
+  }
+  if (state->archive.IsOpen()) {
+    return state->archive.Append(state->cycle_timestamp, codec,
+                                 state->cycle_display_count, data, error);
+  }
+  return WriteFileBytes(path, data, error);
+}
+
+// WriteEncodedFrame с учетом байтов и времени записи кадра.
+bool StoreFrame(const std::wstring& path, const std::vector<uint8_t>& data,
+                OutputCodec codec, uint32_t width, uint32_t height,
+                DisplayEncodeState* state, std::wstring* error) {
+  state->saved_bytes = static_cast<uint32_t>(data.size());
+  const auto start = std::chrono::steady_clock::now();
+  const bool stored =
+      WriteEncodedFrame(path, data, codec, width, height, state, error);
+  state->write_seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  return stored;
+}
+
+std::wstring SavedFrameMessage(const DisplayEncodeState& state,
+                               const std::wstring& path) {
+  if (state.store) {
+    const std::wstring object =
+        state.store->ObjectPath(state.store_ref.key, state.store_ref.codec);
+    return state.store_hit ? L"Кадр уже в хранилище, добавлена ссылка: " +
+                                 object
+                           : L"Кадр добавлен в хранилище: " + object;
+  }
+  if (state.video.IsOpen()) {
+    return L"Кадр добавлен в поток: " + state.video.Path();
+  }
+  return state.archive.IsOpen()
+             ? L"Кадр добавлен в архив: " + state.archive.PackPath()
+             : L"Создан файл: " + path;
+}
+
+// Пишет эскиз DC кадра (--thumbnails) в подпапку t папки дня.
+bool SaveThumbnail(const std::wstring& frame_path, DisplayEncodeState* state,
+                   std::wstring* error) {
+  if (!state->write_thumbnail) {
+    return true;
+  }
+  JpegEncodeOptions options;
+  options.quality = kThumbnailQuality;
+  std::wstring thumbnail_error;
+  if (!EncodeJpeg(state->thumbnail, options, &state->thumbnail_jpeg,
+                  &thumbnail_error) ||
+      !WriteFileBytes(ThumbnailPathForFrame(frame_path),
+                      state->thumbnail_jpeg, &thumbnail_error)) {
+    if (error) {
+      *error = L"Кадр сохранен, эскиз не записан: " + thumbnail_error;
+    }
+    return false;
+  }
+  return true;
+}
+
+// Кодирует кадр из источника полос (--streaming) и пишет файл.
+bool SaveFrameStreaming(StripSource* source, const std::wstring& path,
+                        ColorMode mode, DisplayEncodeState* state,
+                        std::wstring* error, HRESULT* hr) {
+  static const AllocRegion alloc_region = RegisterAllocRegion("save");
+  const AllocScope alloc_scope(alloc_region);
+  if (hr) {
+    *hr = E_FAIL;
+  }
+  JpegEncodeOptions encode_options;
+  encode_options.quality = kJpegQuality;
+  encode_options.color_mode = mode;
+  encode_options.thumbnail =
+      state->write_thumbnail ? &state->thumbnail : nullptr;
+  JpegEncoderContext& encoder = state->encoder;
+  if (!EncodeJpegStreaming(source, encode_options, &encoder.output, error,
+                           encoder.workspace.get()) ||
+      !StoreFrame(path, encoder.output, OutputCodec::kJpeg, source->Width(),
+                  source->Height(), state, error) ||
+      !SaveThumbnail(path, state, error)) {
+    return false;
+  }
+  if (hr) {
+    *hr = S_OK;
+  }
+  return true;
+}
+
+// Кодирует кадр выбранным кодеком и кодером (WIC или собственный) и пишет
+// файл. state хранит оценку rate control и таблицы Huffman дисплея.
+bool SaveFrame(const ImageBuffer& frame, const std::wstring& path,
+               const Options& options, OutputCodec codec, int display_index,
+               const DateTimeParts& cycle_time, DisplayEncodeState* state,
+               Logger* logger, std::wstring* error, HRESULT* hr) {
+  static const AllocRegion alloc_region = RegisterAllocRegion("save");
+  const AllocScope alloc_scope(alloc_region);
+  state->store_hit = false;
+  state->saved_bytes = 0;
+  state->write_seconds = 0;
+  if (state->store) {
+    StoreReference& reference = state->store_ref;
+    reference.key = FrameContentKey(frame);
+    reference.timestamp = state->cycle_timestamp;
+    reference.display_index = display_index;
+    reference.display_count = state->cycle_display_count;
+    reference.codec = codec;
+    // Обоснование: повтор изображения (статичный экран, одинаковые дисплеи)
+    // не кодируется вовсе — хэш кадра дешевле любого кодера.
+    if (state->store->Contains(reference.key)) {
+      state->store_hit = true;
+      const bool added = state->store->AddReference(&reference, error);
+      if (hr) {
+        *hr = added ? S_OK : E_FAIL;
+      }
+      return added;
+    }
+  }
+  if (codec == OutputCodec::kLossless) {
+    if (hr) {
+      *hr = E_FAIL;
+    }
+    std::vector<uint8_t>& data = state->encoder.output;
+    if (!EncodeQoi(frame, &data, error) ||
+        !StoreFrame(path, data, OutputCodec::kLossless, frame.width,
+                    frame.height, state, error)) {
+      return false;
+    }
+    // Суточный бюджет учитывает все сохраненные байты дисплея.
+    if (RateControlEnabled(options.rate)) {
+      state->rate.used_today += data.size();
+    }
+    if (hr) {
+      *hr = S_OK;
+    }
+    return true;
+  }
+  const ColorMode mode = ColorModeForDisplay(options, display_index);
+  if (options.streaming) {
+    ImageStripSource source(frame);
+    return SaveFrameStreaming(&source, path, mode, state, error, hr);
+  }
+  if (!options.native_encoder) {
+    if (!SaveJpeg(frame, path, kJpegQuality, mode, error, hr, &state->wic)) {
+      return false;
+    }
+    // WIC пишет файл сам: размер для каталога берется с диска.
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetFileAttributesExW(path.c_str(), GetFileExInfoStandard,
+                             &attributes)) {
+      state->saved_bytes = attributes.nFileSizeLow;
+    }
+    return true;
+  }
+  if (hr) {
+    *hr = E_FAIL;
+  }
+  JpegEncoderContext& encoder = state->encoder;
+  std::vector<uint8_t>& jpeg = encoder.output;
+  if (options.incremental) {
+    JpegEncodeOptions encode_options;
+    encode_options.quality = kJpegQuality;
+    encode_options.color_mode = mode;
+    encode_options.thumbnail =
+        state->write_thumbnail ? &state->thumbnail : nullptr;
+    IncrementalEncodeStats stats;
+    if (!EncodeJpegIncremental(frame, encode_options, &state->incremental,
+                               &jpeg, &stats, error,
+                               encoder.workspace.get())) {
+      return false;
+    }
+    if (logger) {
+      logger->Info(L"Инкрементальное кодирование дисплея " +
+                   std::to_wstring(display_index + 1) + L": полос " +
+                   std::to_wstring(stats.rows_encoded) + L" из " +
+                   std::to_wstring(stats.rows_total));
+    }
+    if (!StoreFrame(path, jpeg, OutputCodec::kJpeg, frame.width,
+                    frame.height, state, error) ||
+        !SaveThumbnail(path, state, error)) {
+      return false;
+    }
+    if (hr) {
+      *hr = S_OK;
+    }
+    return true;
+  }
+  const JpegCoefficients& coefficients = encoder.coefficients;
+  if (!ComputeJpegCoefficients(frame, mode, &encoder.coefficients, error,
+                               encoder.workspace.get())) {
+    return false;
+  }
+  if (state->write_thumbnail) {
+    JpegCoefficientsThumbnail(coefficients, &state->thumbnail);
+  }
+  HuffmanReuseState* huffman =
+      options.optimize_huffman ? &state->huffman : nullptr;
+  const bool rate_control = RateControlEnabled(options.rate);
+  if (rate_control) {
+    const uint64_t target =
+        FrameByteTarget(options.rate, state->rate,
+                        SecondsLeftInDay(cycle_time), options.interval_seconds);
+    RateControlResult result;
+    EncodeJpegToTarget(coefficients, target, &state->rate, huffman, &jpeg,
+                       &result, encoder.workspace.get());
+    if (logger) {
+      logger->Info(L"Rate control дисплея " +
+                   std::to_wstring(display_index + 1) + L": цель, байт: " +
+                   std::to_wstring(target) +
+                   L", качество: " + std::to_wstring(result.quality) +
+                   L", проходов: " + std::to_wstring(result.passes));
+    }
+  } else if (huffman) {
+    EncodeJpegOptimized(coefficients, QualityToIjg(kJpegQuality), huffman,
+                        &jpeg, encoder.workspace.get());
+  } else {
+    EncodeJpegCoefficients(coefficients, QualityToIjg(kJpegQuality), &jpeg);
+  }
+  if (!StoreFrame(path, jpeg, OutputCodec::kJpeg, frame.width, frame.height,
+                  state, error) ||
+      !SaveThumbnail(path, state, error)) {
+    return false;
+  }
+  if (rate_control) {
+    state->rate.used_today += jpeg.size();
+  }
+  if (hr) {
+    *hr = S_OK;
+  }
+  return true;
+}
+
 bool IsLikelyBlackFrame(const ImageBuffer& buffer) {
-  if (buffer.width == 0 || buffer.height == 0 || buffer.stride < buffer.width * 4 ||
+  if (buffer.width == 0 || buffer.height == 0 ||
+      buffer.stride < buffer.width * BytesPerPixel(buffer.pixel_format) ||
       buffer.pixels.empty()) {
     return true;
   }
@@ -338,12 +1211,44 @@ bool IsLikelyBlackFrame(const ImageBuffer& buffer) {
   for (uint32_t sy = 0; sy < samples_y; ++sy) {
     uint32_t y = buffer.height == 1 ? 0
                                     : (buffer.height - 1) * sy / (samples_y - 1);
-    const uint8_t* row = buffer.pixels.data() +
-                         static_cast<size_t>(y) * buffer.stride;
     for (uint32_t sx = 0; sx < samples_x; ++sx) {
       uint32_t x = buffer.width == 1 ? 0
                                      : (buffer.width - 1) * sx / (samples_x - 1);
-      const uint8_t* px = row + static_cast<size_t>(x) * 4;
+      uint8_t px[4] = {};
+      SamplePixelBgra8(buffer, x, y, px);
+      if (px[0] > threshold || px[1] > threshold || px[2] > threshold) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// IsLikelyBlackFrame для источника полос: те же 8x8 проб по отдельным
+// строкам. Ошибка чтения считается черным кадром (переход на GDI).
+bool IsLikelyBlackSource(StripSource* source) {
+  const uint32_t width = source->Width();
+  const uint32_t height = source->Height();
+  if (width == 0 || height == 0) {
+    return true;
+  }
+  const uint32_t samples = 8;
+  const uint8_t threshold = 8;
+  const uint32_t bytes_per_pixel = BytesPerPixel(source->Format());
+  for (uint32_t sy = 0; sy < samples; ++sy) {
+    const uint32_t y = height == 1 ? 0 : (height - 1) * sy / (samples - 1);
+    PixelRows rows;
+    if (!source->ReadRows(y, 1, &rows, nullptr)) {
+      return true;
+    }
+    for (uint32_t sx = 0; sx < samples; ++sx) {
+      const uint32_t x = width == 1 ? 0 : (width - 1) * sx / (samples - 1);
+      uint8_t px[4] = {};
+      DispatchPixelFormat(source->Format(), [&](auto tag) {
+        ConvertRowToBgra8<decltype(tag)::value>(
+            rows.data + static_cast<size_t>(x) * bytes_per_pixel, px, 1,
+            DefaultToneMapLut());
+      });
       if (px[0] > threshold || px[1] > threshold || px[2] > threshold) {
         return false;
       }
@@ -352,6 +1257,46 @@ bool IsLikelyBlackFrame(const ImageBuffer& buffer) {
   return true;
 }
 
+// Потоковый захват дисплея (--streaming): DXGI (adapter != nullptr) с
+// переходом на GDI при ошибке или черном кадре; кадр кодируется полосами
+// прямо из staging-текстуры или DIB полосы.
+bool CaptureAndSaveStreaming(const DxgiAdapterContext* adapter,
+                             const DxgiOutputInfo* output, const RECT& rect,
+                             const std::wstring& path, ColorMode mode,
+                             int display_index, DisplayEncodeState* state,
+                             Logger* logger, std::wstring* error,
+                             HRESULT* hr) {
+  const std::wstring display = std::to_wstring(display_index + 1);
+  if (adapter && output) {
+    DxgiStripSource dxgi;
+    std::wstring dxgi_error;
+    HRESULT dxgi_hr = S_OK;
+    if (dxgi.Open(*adapter, *output, &dxgi_error, &dxgi_hr)) {
+      if (!IsLikelyBlackSource(&dxgi)) {
+        return SaveFrameStreaming(&dxgi, path, mode, state, error, hr);
+      }
+      if (logger) {
+        logger->Info(
+            L"Кадр DXGI выглядит пустым (почти черным), пробуем GDI.");
+      }
+    } else if (logger) {
+      logger->Error(L"DXGI захват дисплея " + display + L" не удался: " +
+                    dxgi_error + L" (код " + FormatHresult(dxgi_hr) + L")");
+    }
+  }
+  GdiStripSource gdi;
+  if (!gdi.Open(rect, error)) {
+    if (hr) {
+      *hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    return false;
+  }
+  if (adapter && logger) {
+    logger->Info(L"Использован резервный путь GDI для дисплея " + display);
+  }
+  return SaveFrameStreaming(&gdi, path, mode, state, error, hr);
+}
+
 }  // namespace
 
 int RunApp(int argc, wchar_t* argv[]) {
@@ -469,6 +1414,19 @@ int RunApp(int argc, wchar_t* argv[]) {
       return false;
     }
 
+    // Эскизы кадров (--thumbnails) — подпапка t папки дня.
+    if (options.thumbnails) {
+      const std::wstring thumbnail_dir =
+          JoinPath(new_paths.day_dir, kThumbnailDirName);
+      if (CreateDirectoryW(thumbnail_dir.c_str(), nullptr)) {
+        created_dirs.push_back(thumbnail_dir);
+      } else if (GetLastError() != ERROR_ALREADY_EXISTS) {
+        std::wcerr << L"Не удалось создать папку эскизов: " << thumbnail_dir
+                   << L"\n";
+        return false;
+      }
+    }
+
     std::wstring app_log_path = JoinPath(app_dir, FormatDate(dt) + L".log");
     auto new_main_logger = std::make_unique<Logger>(app_log_path);
     if (!new_main_logger->IsOpen()) {
@@ -504,6 +1462,55 @@ int RunApp(int argc, wchar_t* argv[]) {
       }
       main_logger->Info(L"Интервал захвата, сек: " +
                         std::to_wstring(options.interval_seconds));
+      if (options.adaptive_min_seconds > 0) {
+        main_logger->Info(L"Интервал по активности, сек: " +
+                          std::to_wstring(options.adaptive_min_seconds) +
+                          L".." +
+                          std::to_wstring(options.adaptive_max_seconds));
+      }
+      main_logger->Info(std::wstring(L"Кодер JPEG: ") +
+                        (options.native_encoder ? L"native" : L"wic") +
+                        L", цветность: " + ColorModeName(options.color_mode));
+      if (options.codec != OutputCodec::kJpeg) {
+        main_logger->Info(std::wstring(L"Кодек кадров: ") +
+                          OutputCodecName(options.codec));
+      }
+      if (options.optimize_huffman) {
+        main_logger->Info(L"Оптимизация таблиц Huffman включена.");
+      }
+      if (options.incremental) {
+        main_logger->Info(L"Инкрементальное кодирование включено.");
+      }
+      if (options.streaming) {
+        main_logger->Info(L"Потоковое кодирование полосами включено.");
+      }
+      if (options.thumbnails) {
+        main_logger->Info(L"Эскизы кадров из DC включены (подпапка t).");
+      }
+      for (const RetentionTier& tier : options.retention_policy.tiers) {
+        main_logger->Info(
+            L"Хранение: с возраста, дней: " +
+            std::to_wstring(tier.min_age_days) + L" — " +
+            (tier.remove ? std::wstring(L"удаление")
+                         : L"масштаб " + std::to_wstring(tier.scale) +
+                               (tier.grayscale ? L", оттенки серого" : L"")));
+      }
+      if (RateControlEnabled(options.rate)) {
+        main_logger->Info(L"Rate control: цель кадра, байт: " +
+                          std::to_wstring(options.rate.target_bytes) +
+                          L", суточный бюджет дисплея, байт: " +
+                          std::to_wstring(options.rate.daily_budget_bytes));
+      }
+      for (const auto& [display, mode] : options.display_color_modes) {
+        main_logger->Info(L"Цветность дисплея " + std::to_wstring(display + 1) +
+                          L": " + ColorModeName(mode));
+      }
+      if (options.scale.scale < 1.0f || options.scale.max_width > 0) {
+        main_logger->Info(L"Масштабирование: коэффициент " +
+                          std::to_wstring(options.scale.scale) +
+                          L", максимальная ширина " +
+                          std::to_wstring(options.scale.max_width));
+      }
       if (options.capture_count > 0) {
         main_logger->Info(L"Количество циклов: " +
                           std::to_wstring(options.capture_count));
@@ -547,6 +1554,13 @@ int RunApp(int argc, wchar_t* argv[]) {
   std::vector<DisplayInfo> gdi_displays;
   ProcessStateMap known_processes;
   bool process_baseline_ready = false;
+  // Бюджет памяти кадров (--max-memory-mb), общий для всех дисплеев;
+  // объявлен до encode_states — резервы дисплеев возвращаются в него.
+  MemoryBudget memory_budget(static_cast<size_t>(options.max_memory_mb)
+                             << 20);
+  // Состояние кодера (rate control, таблицы Huffman, буферы) по индексу
+  // дисплея.
+  std::unordered_map<int, DisplayEncodeState> encode_states;
 
   if (options.test_image) {
     display_count = options.simulate_displays;
@@ -636,9 +1650,658 @@ int RunApp(int argc, wchar_t* argv[]) {
     }
   }
 
-  auto next_tick = std::chrono::steady_clock::now();
+  // Метрики (--metrics-port): регистрируются до запуска сервера, пишутся
+  // только потоком захвата в его шард, сервер суммирует их при запросе на
+  // своем потоке — запрос не задерживает цикл захвата.
+  MetricsRegistry metrics;
+  MetricsServer metrics_server;
+  const int metric_displays = options.test_image
+                                  ? display_count
+                                  : static_cast<int>(total_outputs);
+  std::vector<DisplayMetrics> display_metrics(
+      static_cast<size_t>(metric_displays));
+  MetricId cycle_seconds = kNoMetric;
+  MetricId cycle_overruns = kNoMetric;
+  MetricId cycle_lateness = kNoMetric;
+  MetricId missed_deadlines = kNoMetric;
+  MetricId pending_displays = kNoMetric;
+  MetricId gdi_fallbacks = kNoMetric;
+  MetricId black_frames = kNoMetric;
+  MetricId process_opened = kNoMetric;
+  MetricId process_closed = kNoMetric;
+  MetricId process_running = kNoMetric;
+  MetricId governor_level = kNoMetric;
+  MetricId cpu_usage = kNoMetric;
+  if (options.metrics_port > 0) {
+    for (int i = 0; i < metric_displays; ++i) {
+      const std::vector<MetricLabel> labels = {
+          {"display", std::to_string(i + 1)}};
+      DisplayMetrics& m = display_metrics[i];
+      m.capture_seconds = metrics.Histogram(
+          "p2_capture_seconds", "Frame capture time.", labels,
+          LatencyBuckets());
+      m.encode_seconds = metrics.Histogram(
+          "p2_encode_seconds", "Frame encode time (WIC: with the write).",
+          labels, LatencyBuckets());
+      m.write_seconds = metrics.Histogram(
+          "p2_write_seconds", "Encoded frame write time.", labels,
+          LatencyBuckets());
+      m.written_bytes = metrics.Counter(
+          "p2_written_bytes_total", "Encoded bytes written.", labels);
+      m.frames_saved =
+          metrics.Counter("p2_frames_saved_total", "Frames saved.", labels);
+      m.frames_skipped = metrics.Counter(
+          "p2_frames_skipped_total",
+          "Frames not saved (capture or save failure, unchanged frame "
+          "skipped by the CPU governor).",
+          labels);
+      if (options.adaptive_min_seconds > 0) {
+        m.capture_interval = metrics.Gauge(
+            "p2_capture_interval_seconds",
+            "Current capture interval of the display (--adaptive-interval).",
+            labels);
+      }
+    }
+    cycle_seconds =
+        metrics.Histogram("p2_cycle_seconds", "Capture cycle duration.", {},
+                          LatencyBuckets());
+    cycle_overruns = metrics.Counter(
+        "p2_cycle_overruns_total", "Cycles longer than the interval.");
+    cycle_lateness = metrics.Histogram(
+        "p2_cycle_lateness_seconds",
+        "Cycle start after its scheduled deadline.", {}, LatencyBuckets());
+    missed_deadlines = metrics.Counter(
+        "p2_cycle_missed_deadlines_total",
+        "Cycle deadlines passed during an overrun without a cycle of their "
+        "own (skipped or coalesced).");
+    pending_displays = metrics.Gauge(
+        "p2_pending_displays", "Displays still queued in the current cycle.");
+    gdi_fallbacks = metrics.Counter("p2_gdi_fallbacks_total",
+                                    "DXGI captures replaced by GDI.");
+    black_frames = metrics.Counter("p2_black_frames_total",
+                                   "DXGI frames detected as black.");
+    const char* const kProcessEventsHelp = "Process log events.";
+    process_opened = metrics.Counter("p2_process_events_total",
+                                     kProcessEventsHelp,
+                                     {{"event", "opened"}});
+    process_closed = metrics.Counter("p2_process_events_total",
+                                     kProcessEventsHelp,
+                                     {{"event", "closed"}});
+    process_running = metrics.Counter("p2_process_events_total",
+                                      kProcessEventsHelp,
+                                      {{"event", "running"}});
+    if (options.cpu_budget_percent > 0) {
+      governor_level = metrics.Gauge("p2_cpu_governor_level",
+                                     "Degradation level of the CPU governor.");
+      cpu_usage = metrics.Gauge(
+          "p2_cpu_usage_percent",
+          "CPU share of the process over the last cycle, all cores.");
+    }
+    metrics.GaugeCallback("p2_resident_memory_bytes",
+                          "Resident memory of the process.", []() {
+                            ProcessMemory memory;
+                            return QueryProcessMemory(&memory)
+                                       ? static_cast<double>(memory.rss_bytes)
+                                       : 0.0;
+                          });
+    std::wstring metrics_error;
+    if (metrics_server.Start(&metrics,
+                             static_cast<uint16_t>(options.metrics_port),
+                             &metrics_error)) {
+      main_logger->Info(L"Метрики: http://127.0.0.1:" +
+                        std::to_wstring(metrics_server.Port()) +
+                        L"/metrics");
+    } else {
+      any_failure = true;
+      main_logger->Error(metrics_error);
+    }
+  }
+  // Кольцо последних кадров (--frame-ring): кадр публикуется сразу после
+  // захвата, до масштаба и кодирования. Слот рассчитан на 4 байта на пиксель
+  // самого большого дисплея; кадр HDR (8 байт) в него не помещается.
+  FrameRingWriter frame_ring;
+  std::vector<bool> frame_ring_warned(static_cast<size_t>(metric_displays));
+  if (!options.frame_ring.empty()) {
+    size_t max_pixels = options.test_image ? 256 * 256 : 0;
+    auto fit = [&](const RECT& rect) {
+      const size_t pixels =
+          static_cast<size_t>(rect.right - rect.left) *
+          static_cast<size_t>(rect.bottom - rect.top);
+      max_pixels = pixels > max_pixels ? pixels : max_pixels;
+    };
+    for (const auto& adapter : dxgi.adapters) {
+      for (const auto& output : adapter.outputs) {
+        fit(output.desc.DesktopCoordinates);
+      }
+    }
+    for (const auto& display : gdi_displays) {
+      fit(display.rect);
+    }
+    std::wstring ring_error;
+    if (frame_ring.Create(options.frame_ring,
+                          static_cast<uint32_t>(metric_displays),
+                          max_pixels * 4, &ring_error)) {
+      main_logger->Info(L"Кольцо кадров в общей памяти: " +
+                        options.frame_ring + L", байт на слот: " +
+                        std::to_wstring(frame_ring.SlotBytes()));
+    } else {
+      any_failure = true;
+      main_logger->Error(ring_error);
+    }
+  }
+  // Ошибка публикации (кадр больше слота) пишется в лог один раз на дисплей.
+  auto publish_frame = [&](int display_index, const ImageBuffer& frame) {
+    if (!frame_ring.IsOpen() || display_index < 0 ||
+        display_index >= metric_displays) {
+      return;
+    }
+    std::wstring ring_error;
+    if (!frame_ring.Publish(static_cast<uint32_t>(display_index), frame,
+                            encode_states[display_index].cycle_timestamp,
+                            &ring_error) &&
+        !frame_ring_warned[display_index]) {
+      frame_ring_warned[display_index] = true;
+      main_logger->Error(ring_error);
+    }
+  };
+  int cycle_pending = 0;
+  // Итог кадра дисплея для метрик. capture_seconds < 0: захват не отделен
+  // от кодирования (--streaming).
+  auto record_frame = [&](int display_index, bool saved,
+                          double capture_seconds, double save_seconds) {
+    if (display_index < 0 || display_index >= metric_displays) {
+      return;
+    }
+    const DisplayMetrics& m = display_metrics[display_index];
+    metrics.Set(pending_displays, --cycle_pending);
+    if (!saved) {
+      metrics.Add(m.frames_skipped);
+      return;
+    }
+    const DisplayEncodeState& state = encode_states[display_index];
+    if (capture_seconds >= 0) {
+      metrics.Observe(m.capture_seconds, capture_seconds);
+    }
+    metrics.Observe(m.encode_seconds, save_seconds - state.write_seconds);
+    metrics.Observe(m.write_seconds, state.write_seconds);
+    metrics.Add(m.written_bytes, state.saved_bytes);
+    metrics.Add(m.frames_saved);
+  };
+
+  // Регулятор CPU (--cpu-budget-percent): смена уровня пересобирает
+  // options из исходных base_options, поэтому все пути захвата видят
+  // ограничения уровня без отдельной проверки.
+  const Options base_options = options;
+  ProcessCpuMeter cpu_meter;
+  CpuGovernorConfig governor_config;
+  governor_config.budget_percent = options.cpu_budget_percent;
+  governor_config.processors =
+      std::max(1u, std::thread::hardware_concurrency());
+  governor_config.levels = options.governor_levels;
+  CpuGovernor governor(governor_config, &cpu_meter);
+  if (options.cpu_budget_percent > 0) {
+    governor.Start();
+    std::wstring ladder;
+    for (const GovernorLevel& level : options.governor_levels) {
+      ladder += L"\n  " + FormatGovernorLevel(level);
+    }
+    main_logger->Info(L"Регулятор CPU: бюджет, %: " +
+                      std::to_wstring(options.cpu_budget_percent) +
+                      L", ядер: " +
+                      std::to_wstring(governor_config.processors) +
+                      L", ступени:" + ladder);
+  }
+  // Ступень skip: кадр дисплея без изменений с прошлого цикла не
+  // кодируется. true — кадр пропущен.
+  auto skip_unchanged = [&](int display_index, const ImageBuffer& frame) {
+    ChangeTracker& change = encode_states[display_index].governor_change;
+    if (!governor.Current().skip_unchanged) {
+      change.Reset();
+      return false;
+    }
+    if (change.Update(frame) != 0) {
+      return false;
+    }
+    main_logger->Info(L"Дисплей " + std::to_wstring(display_index + 1) +
+                      L" не изменился, кадр пропущен (регулятор CPU).");
+    record_frame(display_index, false, 0, 0);
+    return true;
+  };
+
+  // Интервалы дисплеев по активности (--adaptive-interval): цикл идет с
+  // шагом MIN; в начале цикла каждый дисплей пробуется (выборка
+  // kProbeWidth x kProbeHeight через GDI), захватываются дисплеи, чей
+  // интервал истек. Время — плановое время цикла, а не фактическое:
+  // иначе задержка начала цикла откладывала бы захват на целый шаг.
+  ActivitySchedulerConfig activity_config;
+  activity_config.min_interval = options.adaptive_min_seconds;
+  activity_config.max_interval = options.adaptive_max_seconds;
+  ActivityScheduler activity(activity_config);
+  double activity_clock = 0;
+  std::vector<bool> capture_now;
+  ImageBuffer probe_frame;
+  // Пробует дисплеи цикла и отмечает, какие захватывать. Output: число
+  // дисплеев к захвату.
+  auto plan_captures = [&](int displays, double clock) {
+    activity_clock = clock;
+    activity.Resize(static_cast<size_t>(displays), clock);
+    auto probe = [&](int display_index, const RECT& rect) {
+      std::wstring probe_error;
+      if (ProbeRectGdi(rect, kProbeWidth, kProbeHeight, &probe_frame,
+                       &probe_error)) {
+        activity.Probe(display_index, SparseProbeHash(probe_frame,
+                                                      kProbeWidth,
+                                                      kProbeHeight));
+      }
+    };
+    // Тестовый кадр неизменен — пробовать нечего.
+    if (!options.test_image && dxgi_ok) {
+      int display_index = 0;
+      for (const auto& adapter : dxgi.adapters) {
+        for (const auto& output : adapter.outputs) {
+          probe(display_index++, output.desc.DesktopCoordinates);
+        }
+      }
+    } else if (!options.test_image) {
+      for (const auto& display : gdi_displays) {
+        probe(display.index, display.rect);
+      }
+    }
+    capture_now.assign(static_cast<size_t>(displays), false);
+    int due = 0;
+    for (int i = 0; i < displays; ++i) {
+      capture_now[i] = activity.CaptureDue(i, clock);
+      due += capture_now[i] ? 1 : 0;
+    }
+    return due;
+  };
+  // true — интервал дисплея еще не истек, в этом цикле он не захватывается.
+  auto capture_deferred = [&](int display_index) {
+    return options.adaptive_min_seconds > 0 &&
+           (display_index < 0 ||
+            display_index >= static_cast<int>(capture_now.size()) ||
+            !capture_now[display_index]);
+  };
+  // Дисплей захвачен: frame (нет при кодировании полосами — тогда
+  // активность видят только пробы) сравнивается с прошлым кадром.
+  auto activity_captured = [&](int display_index, const ImageBuffer* frame) {
+    if (options.adaptive_min_seconds == 0) {
+      return;
+    }
+    DisplayEncodeState& state = encode_states[display_index];
+    const bool changed =
+        frame && state.activity_change.Update(*frame) != 0;
+    const double before = activity.Interval(display_index);
+    activity.Captured(display_index, activity_clock, changed);
+    const double interval = activity.Interval(display_index);
+    if (display_index < metric_displays) {
+      metrics.Set(display_metrics[display_index].capture_interval, interval);
+    }
+    if (interval != before) {
+      main_logger->Info(L"Дисплей " + std::to_wstring(display_index + 1) +
+                        L": интервал захвата, с: " +
+                        std::to_wstring(interval));
+    }
+  };
+
+  // Бюджет памяти (--max-memory-mb): резервирует оценку полного кадра
+  // дисплея rect до захвата. Свои буферы дисплея кадр переиспользует, их
+  // резерв входит в оценку. Кадр, который не помещается, сначала
+  // освобождает буферы других дисплеев; false — места все равно нет и
+  // опции позволяют кодирование полосами. Иначе кадр идет сверх бюджета.
+  // Обоснование: дисплеи обрабатываются по одному (параллельность 1) —
+  // API захвата и лог не потокобезопасны; бюджет ограничивает буферы,
+  // которые дисплеи держат между кадрами, и размер одного кадра.
+  std::vector<bool> memory_warned(static_cast<size_t>(metric_displays));
+  auto reserve_frame = [&](int display_index, const RECT& rect,
+                           MemoryReservation* frame) {
+    if (memory_budget.Limit() == 0) {
+      return true;
+    }
+    DisplayEncodeState& state = encode_states[display_index];
+    const uint32_t width = static_cast<uint32_t>(rect.right - rect.left);
+    const uint32_t height = static_cast<uint32_t>(rect.bottom - rect.top);
+    uint32_t out_width = width;
+    uint32_t out_height = height;
+    if (!ComputeScaledSize(width, height, options.scale, &out_width,
+                           &out_height)) {
+      out_width = width;
+      out_height = height;
+    }
+    const size_t full =
+        FullFrameBytes(width, height, out_width, out_height,
+                       ColorModeForDisplay(options, display_index));
+    const size_t own = state.retained.Bytes();
+    const size_t need = full > own ? full - own : 0;
+    if (frame->TryAcquire(&memory_budget, need)) {
+      return true;
+    }
+    for (auto& [index, other] : encode_states) {
+      if (index != display_index && other.retained.Bytes() != 0) {
+        ReleaseRetainedBuffers(&other);
+      }
+    }
+    if (frame->TryAcquire(&memory_budget, need)) {
+      return true;
+    }
+    const std::wstring display = std::to_wstring(display_index + 1);
+    if (StreamingCompatible(options) && !options.dedup) {
+      ReleaseRetainedBuffers(&state);
+      frame->ForceAcquire(&memory_budget, StripFrameBytes(width, height));
+      main_logger->Info(L"Кадр дисплея " + display +
+                        L" не помещается в бюджет памяти, кодирование "
+                        L"полосами.");
+      return false;
+    }
+    frame->ForceAcquire(&memory_budget, need);
+    if (display_index < metric_displays && !memory_warned[display_index]) {
+      memory_warned[display_index] = true;
+      main_logger->Error(L"Кадр дисплея " + display + L" (оценка, МБ: " +
+                         std::to_wstring(full >> 20) +
+                         L") не помещается в --max-memory-mb, а опции "
+                         L"требуют полного кадра; бюджет превышен.");
+    }
+    return true;
+  };
+  // После кадра буферы дисплея остаются до следующего кадра, только пока
+  // помещаются в бюджет вместе с буферами других дисплеев.
+  auto settle_frame = [&](int display_index, MemoryReservation* frame) {
+    if (memory_budget.Limit() == 0) {
+      return;
+    }
+    frame->Reset();
+    DisplayEncodeState& state = encode_states[display_index];
+    if (!state.retained.TryAcquire(&memory_budget, RetainedBytes(state))) {
+      ReleaseRetainedBuffers(&state);
+    }
+  };
+
+  // Каталог кадров (--catalog) общий для всех дисплеев PC_USER: запись на
+  // каждый сохраненный кадр. frame — кадр в памяти (нет при --streaming:
+  // оценка изменений и признак черного кадра тогда неизвестны).
+  CatalogWriter catalog;
+  auto catalog_frame = [&](int display_index, const ImageBuffer* frame,
+                           OutputCodec codec) {
+    if (!options.catalog) {
+      return;
+    }
+    std::wstring catalog_error;
+    if (!catalog.IsOpen()) {
+      ArchiveIdentity identity;
+      identity.computer = computer;
+      identity.user = user;
+      const std::wstring catalog_dir =
+          JoinPath(paths.pc_user_dir, L"catalog");
+      if (!catalog.Open(catalog_dir, identity, &catalog_error)) {
+        any_failure = true;
+        main_logger->Error(L"Не удалось открыть каталог кадров: " +
+                           catalog_error);
+        return;
+      }
+      main_logger->Info(L"Каталог кадров: " + catalog_dir);
+    }
+    DisplayEncodeState& state = encode_states[display_index];
+    CatalogEntry entry;
+    entry.timestamp = state.cycle_timestamp;
+    entry.size = state.saved_bytes;
+    entry.codec = codec;
+    entry.display_index = display_index;
+    entry.display_count = state.cycle_display_count;
+    if (frame) {
+      entry.change = state.change.Update(*frame);
+      entry.black = IsLikelyBlackFrame(*frame);
+    }
+    if (state.store) {
+      entry.storage = CatalogStorage::kStore;
+    } else if (state.video.IsOpen()) {
+      entry.storage = CatalogStorage::kVideo;
+      entry.video_part = state.video_part;
+    } else if (state.archive.IsOpen()) {
+      entry.storage = CatalogStorage::kArchive;
+    }
+    if (!catalog.Append(entry, &catalog_error)) {
+      any_failure = true;
+      main_logger->Error(L"Не удалось дописать каталог кадров: " +
+                         catalog_error);
+    }
+  };
+
+  // Потоковый захват и кодирование одного дисплея с логом (--streaming).
+  auto save_streaming = [&](const DxgiAdapterContext* adapter,
+                            const DxgiOutputInfo* output, const RECT& rect,
+                            int display_index,
+                            const DateTimeParts& cycle_time) {
+    auto start = std::chrono::steady_clock::now();
+    const std::wstring filepath = JoinPath(
+        paths.day_dir, BuildFileName(computer, user, cycle_time, display_index,
+                                     static_cast<int>(total_outputs)));
+    std::wstring save_error;
+    HRESULT save_hr = S_OK;
+    const bool saved = CaptureAndSaveStreaming(
+        adapter, output, rect, filepath,
+        ColorModeForDisplay(options, display_index),
+        display_index, &encode_states[display_index], main_logger.get(),
+        &save_error, &save_hr);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    record_frame(display_index, saved, -1,
+                 std::chrono::duration<double>(elapsed).count());
+    if (!saved) {
+      any_failure = true;
+      main_logger->Error(L"Ошибка сохранения дисплея " +
+                         std::to_wstring(display_index + 1) + L": " +
+                         save_error + L" (код " + FormatHresult(save_hr) +
+                         L")");
+      return;
+    }
+    activity_captured(display_index, nullptr);
+    main_logger->Info(
+        SavedFrameMessage(encode_states[display_index], filepath));
+    catalog_frame(display_index, nullptr, OutputCodec::kJpeg);
+    main_logger->Info(L"Время захвата и кодирования полосами, мс: " +
+                      std::to_wstring(elapsed_ms));
+  };
+
+  // Открывает суточные архивы дисплеев (--archive); смена даты меняет имя
+  // файла и открывает новый архив. Ошибка открытия оставляет запись
+  // отдельными файлами.
+  auto open_archives = [&](const DateTimeParts& cycle_time, int count) {
+    for (int i = 0; i < count; ++i) {
+      DisplayEncodeState& state = encode_states[i];
+      const std::wstring pack_path = JoinPath(
+          paths.day_dir,
+          BuildArchiveFileName(computer, user, cycle_time, i, count,
+                               L".p2pack"));
+      if (state.archive.IsOpen() && state.archive.PackPath() == pack_path) {
+        continue;
+      }
+      const std::wstring index_path = JoinPath(
+          paths.day_dir,
+          BuildArchiveFileName(computer, user, cycle_time, i, count,
+                               L".p2idx"));
+      ArchiveIdentity identity;
+      identity.computer = computer;
+      identity.user = user;
+      identity.display_index = i;
+      std::wstring archive_error;
+      if (!state.archive.Open(pack_path, index_path, identity,
+                              &archive_error)) {
+        any_failure = true;
+        main_logger->Error(L"Не удалось открыть архив дисплея " +
+                           std::to_wstring(i + 1) + L": " + archive_error);
+        continue;
+      }
+      main_logger->Info(L"Архив дисплея " + std::to_wstring(i + 1) + L": " +
+                        pack_path + L", кадров: " +
+                        std::to_wstring(state.archive.Frames()));
+      if (state.archive.RecoveredFrames() > 0 ||
+          state.archive.TruncatedBytes() > 0) {
+        main_logger->Info(L"Архив восстановлен после сбоя: переиндексировано "
+                          L"кадров: " +
+                          std::to_wstring(state.archive.RecoveredFrames()) +
+                          L", отрезано байт: " +
+                          std::to_wstring(state.archive.TruncatedBytes()));
+      }
+    }
+  };
+
+  // Открывает суточные потоки MJPEG дисплеев (--video); смена даты
+  // закрывает поток прошлого дня с индексом. Ошибка открытия оставляет
+  // запись отдельными файлами.
+  auto open_videos = [&](const DateTimeParts& cycle_time, int count) {
+    for (int i = 0; i < count; ++i) {
+      DisplayEncodeState& state = encode_states[i];
+      const std::wstring base = JoinPath(
+          paths.day_dir,
+          BuildArchiveFileName(computer, user, cycle_time, i, count, L""));
+      if (state.video.IsOpen() && state.video_base == base) {
+        continue;
+      }
+      std::wstring video_error;
+      if (!state.video.Finalize(&video_error)) {
+        main_logger->Error(video_error);
+      }
+      state.video_base = base;
+      state.video_part = 0;
+      if (!state.video.Open(VideoPartPath(base, 0), kVideoFrameMs,
+                            &video_error)) {
+        any_failure = true;
+        main_logger->Error(L"Не удалось открыть видеопоток дисплея " +
+                           std::to_wstring(i + 1) + L": " + video_error);
+        continue;
+      }
+      main_logger->Info(L"Видеопоток дисплея " + std::to_wstring(i + 1) +
+                        L": " + state.video.Path() + L", кадров: " +
+                        std::to_wstring(state.video.Frames()));
+      if (state.video.TruncatedBytes() > 0) {
+        main_logger->Info(L"Видеопоток восстановлен после сбоя: отрезано "
+                          L"байт: " +
+                          std::to_wstring(state.video.TruncatedBytes()));
+      }
+    }
+  };
+
+  // Хранилище кадров (--dedup) общее для всех дисплеев и дней PC_USER;
+  // смена даты начинает журнал ссылок нового дня и пишет итог прошлого.
+  // Ошибка оставляет запись цикла отдельными файлами.
+  FrameStore frame_store;
+  std::wstring store_day;
+  auto log_store_day = [&]() {
+    main_logger->Info(L"Дедупликация за " + store_day + L": " +
+                      FormatDedupStats(frame_store.DayStats()));
+  };
+  auto open_store = [&](const DateTimeParts& cycle_time, int count) {
+    std::wstring store_error;
+    bool ok = true;
+    if (!frame_store.IsOpen()) {
+      ArchiveIdentity identity;
+      identity.computer = computer;
+      identity.user = user;
+      const std::wstring store_dir = JoinPath(paths.pc_user_dir, L"store");
+      ok = frame_store.Open(store_dir, identity, &store_error);
+      if (ok) {
+        main_logger->Info(L"Хранилище кадров: " + store_dir +
+                          L", объектов: " +
+                          std::to_wstring(frame_store.Objects()) +
+                          L", байт: " +
+                          std::to_wstring(frame_store.ObjectBytes()));
+      }
+    }
+    const std::wstring day = FormatDate(cycle_time);
+    if (ok && day != store_day) {
+      if (!store_day.empty()) {
+        log_store_day();
+      }
+      ok = frame_store.SetDay(cycle_time, &store_error);
+      store_day = ok ? day : std::wstring();
+      // Обоснование: уровень удаления (--retention) стирает папки дней, а
+      // объекты хранилища живут по ссылкам — журналы ссылок тех же дней
+      // освобождаются здесь, в потоке захвата, владеющем хранилищем.
+      DateTimeParts first_kept;
+      if (ok && RetentionDeleteCutoff(options.retention_policy, cycle_time,
+                                      &first_kept)) {
+        uint64_t removed = 0;
+        uint64_t removed_bytes = 0;
+        ok = frame_store.ReleaseDaysBefore(first_kept, &removed,
+                                           &removed_bytes, &store_error);
+        if (ok && removed > 0) {
+          main_logger->Info(L"Хранение: освобождено объектов хранилища: " +
+                            std::to_wstring(removed) + L", байт: " +
+                            std::to_wstring(removed_bytes));
+        }
+      }
+    }
+    if (!ok) {
+      any_failure = true;
+      main_logger->Error(L"Не удалось открыть хранилище кадров: " +
+                         store_error);
+    }
+    for (int i = 0; i < count; ++i) {
+      encode_states[i].store = ok ? &frame_store : nullptr;
+    }
+  };
+
+  // Хранение по сроку (--retention): один фоновый поток с пониженным
+  // приоритетом процессора и ввода-вывода, проход при старте и при смене
+  // даты. Итог забирает поток захвата, так как логгер не потокобезопасен.
+  RetentionEngine retention;
+  bool retention_started = false;
+  auto schedule_retention = [&](const DateTimeParts& cycle_time) {
+    if (!retention_started) {
+      std::wstring retention_error;
+      if (!retention.Open(paths.pc_user_dir, options.retention_policy,
+                          RetentionBudget{}, &retention_error)) {
+        any_failure = true;
+        main_logger->Error(L"Не удалось запустить хранение по сроку: " +
+                           retention_error);
+        return;
+      }
+      retention.Start([]() {
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+      });
+      retention_started = true;
+    }
+    retention.Schedule(cycle_time);
+  };
+  // Обоснование: первый проход — при старте, а не с первой смены даты:
+  // агент, который перезапускается каждый день, иначе ничего не сжимает
+  // и не доводит прерванный проход из журнала.
+  if (options.retention) {
+    schedule_retention(NowLocal());
+  }
+
+  // Счетчик выделений (сборка с P2_ALLOC_TRACKING): итог цикла потока
+  // захвата пишется в лог, итоги областей — при завершении.
+  const AllocRegion alloc_cycle = RegisterAllocRegion("cycle");
+  const AllocRegion alloc_processes = RegisterAllocRegion("processes");
+  // Обоснование: список и карта процессов живут между циклами — емкость
+  // вектора и корзины карты не выделяются заново каждый цикл.
+  std::vector<ProcessInfo> snapshot;
+  ProcessMap current;
+
+  // Обоснование: сроки циклов абсолютные (начало + k * интервал) —
+  // дрожание пробуждения и длина цикла не сдвигают следующие циклы;
+  // пропущенные при долгом цикле сроки обрабатывает --overrun-policy.
+  SystemCycleClock cycle_clock;
+  CycleScheduler cycle_scheduler(
+      &cycle_clock, int64_t{options.interval_seconds} * 1000000000,
+      options.overrun_policy);
+  int64_t loop_start = 0;
   int iteration = 0;
   while (options.capture_count == 0 || iteration < options.capture_count) {
+    const CycleTick tick = cycle_scheduler.Wait();
+    if (tick.index == 0) {
+      loop_start = tick.deadline;
+    }
+    metrics.Observe(cycle_lateness, tick.lateness * 1e-9);
+    if (tick.overrun) {
+      metrics.Add(cycle_overruns);
+      metrics.Add(missed_deadlines, tick.missed);
+    }
+    const auto cycle_start = std::chrono::steady_clock::now();
+    const AllocCounts cycle_allocations = ThreadAllocCounts();
+    const AllocScope cycle_alloc_scope(alloc_cycle);
     DateTimeParts cycle_time = NowLocal();
     std::wstring date_key = FormatDate(cycle_time);
     if (date_key != current_date_key) {
@@ -648,18 +2311,67 @@ int RunApp(int argc, wchar_t* argv[]) {
       }
       known_processes.clear();
       process_baseline_ready = false;
+      for (auto& [display, state] : encode_states) {
+        state.rate.used_today = 0;
+      }
+      if (options.retention) {
+        schedule_retention(cycle_time);
+      }
+    }
+    if (retention_started) {
+      RetentionStats retention_stats;
+      std::wstring retention_error;
+      if (retention.TakeResult(&retention_stats, &retention_error)) {
+        main_logger->Info(L"Хранение по сроку: " +
+                          FormatRetentionStats(retention_stats));
+        if (!retention_error.empty()) {
+          any_failure = true;
+          main_logger->Error(retention_error);
+        }
+      }
     }
 
-    main_logger->Info(L"Цикл захвата: " + std::to_wstring(iteration + 1));
+    main_logger->Info(L"Цикл захвата: " + std::to_wstring(iteration + 1) +
+                      L", опоздание, мс: " +
+                      std::to_wstring(tick.lateness / 1000000));
+    if (tick.overrun) {
+      main_logger->Info(
+          L"Прошлый цикл дольше интервала, пропущено сроков: " +
+          std::to_wstring(tick.missed) + L" (--overrun-policy " +
+          OverrunPolicyName(options.overrun_policy) + L")");
+    }
+    const int cycle_displays = options.test_image
+                                   ? display_count
+                                   : static_cast<int>(total_outputs);
+    cycle_pending =
+        options.adaptive_min_seconds > 0
+            ? plan_captures(cycle_displays,
+                            (tick.deadline - loop_start) * 1e-9)
+            : cycle_displays;
+    metrics.Set(pending_displays, cycle_pending);
+    for (int i = 0; i < cycle_displays; ++i) {
+      encode_states[i].cycle_timestamp = ArchiveTimestamp(cycle_time);
+      encode_states[i].cycle_display_count = cycle_displays;
+      encode_states[i].write_thumbnail = options.thumbnails;
+    }
+    if (options.dedup) {
+      open_store(cycle_time, cycle_displays);
+    }
+    if (options.archive) {
+      open_archives(cycle_time, cycle_displays);
+    }
+    if (options.video) {
+      open_videos(cycle_time, cycle_displays);
+    }
 
     {
-      std::vector<ProcessInfo> snapshot;
+      const AllocScope process_alloc_scope(alloc_processes);
       std::wstring process_error;
       if (SnapshotProcesses(&snapshot, &process_error)) {
         if (process_dir.empty()) {
           main_logger->Error(L"Папка логов процессов не определена.");
         }
-        ProcessMap current;
+        current.clear();
         current.reserve(snapshot.size());
         FILETIME now_ft = FileTimeNow();
         const int hour_key = MakeHourKey(cycle_time);
@@ -671,7 +2383,7 @@ int RunApp(int argc, wchar_t* argv[]) {
             info.start_time_valid = true;
             info.start_time_approx = true;
           }
-          current.emplace(info.pid, info);
+          current.emplace(info.pid, std::move(info));
         }
 
         if (!process_baseline_ready) {
@@ -685,6 +2397,7 @@ int RunApp(int argc, wchar_t* argv[]) {
                 FormatDuration(FileTimeDiffMs(info.start_time, now_ft));
             WriteProcessEvent(state.log_path, timestamp, L"работает", &runtime,
                               main_logger.get());
+            metrics.Add(process_running);
             known_processes.emplace(pid, std::move(state));
           }
           process_baseline_ready = true;
@@ -698,6 +2411,7 @@ int RunApp(int argc, wchar_t* argv[]) {
               state.log_path = BuildProcessLogPath(process_dir, info);
               WriteProcessEvent(state.log_path, timestamp, L"открыт", nullptr,
                                 main_logger.get());
+              metrics.Add(process_opened);
               known_processes.emplace(pid, std::move(state));
             } else {
               it->second.info.name = info.name;
@@ -716,6 +2430,7 @@ int RunApp(int argc, wchar_t* argv[]) {
                                                 now_ft));
               WriteProcessEvent(it->second.log_path, timestamp, L"закрыт",
                                 &runtime, main_logger.get());
+              metrics.Add(process_closed);
               it = known_processes.erase(it);
             } else {
               ++it;
@@ -728,6 +2443,7 @@ int RunApp(int argc, wchar_t* argv[]) {
                   FormatDuration(FileTimeDiffMs(state.info.start_time, now_ft));
               WriteProcessEvent(state.log_path, timestamp, L"работает",
                                 &runtime, main_logger.get());
+              metrics.Add(process_running);
               state.last_work_hour = hour_key;
             }
           }
@@ -740,19 +2456,33 @@ int RunApp(int argc, wchar_t* argv[]) {
 
     if (options.test_image) {
       for (int i = 0; i < display_count; ++i) {
+        if (capture_deferred(i)) {
+          continue;
+        }
         auto capture_start = std::chrono::steady_clock::now();
         ImageBuffer buffer = MakeTestPattern(256, 256, static_cast<uint32_t>(i));
         auto capture_end = std::chrono::steady_clock::now();
+        publish_frame(i, buffer);
+        activity_captured(i, &buffer);
+        if (skip_unchanged(i, buffer)) {
+          continue;
+        }
 
+        auto encode_start = std::chrono::steady_clock::now();
+        DisplayEncodeState& encode_state = encode_states[i];
+        const ImageBuffer& output_frame =
+            PrepareOutputFrame(buffer, options.scale, &encode_state.scaled);
+        const OutputCodec codec = ResolveCodec(
+            output_frame, options, i, &encode_state, main_logger.get());
         std::wstring filename =
-            BuildFileName(computer, user, cycle_time, i, display_count);
+            BuildFileName(computer, user, cycle_time, i, display_count,
+                          OutputCodecExtension(codec));
         std::wstring filepath = JoinPath(paths.day_dir, filename);
-
-        auto encode_start = std::chrono::steady_clock::now();
         std::wstring save_error;
         HRESULT save_hr = S_OK;
-        bool saved =
-            SaveJpeg(buffer, filepath, kJpegQuality, &save_error, &save_hr);
+        bool saved = SaveFrame(output_frame, filepath, options, codec, i,
+                               cycle_time, &encode_state, main_logger.get(),
+                               &save_error, &save_hr);
         auto encode_end = std::chrono::steady_clock::now();
 
         const auto capture_ms = std::chrono::duration_cast<
@@ -761,6 +2491,11 @@ int RunApp(int argc, wchar_t* argv[]) {
         const auto encode_ms = std::chrono::duration_cast<
             std::chrono::milliseconds>(encode_end - encode_start)
                                     .count();
+        record_frame(i, saved,
+                     std::chrono::duration<double>(capture_end -
+                                                   capture_start).count(),
+                     std::chrono::duration<double>(encode_end -
+                                                   encode_start).count());
 
         if (!saved) {
           any_failure = true;
@@ -770,7 +2505,8 @@ int RunApp(int argc, wchar_t* argv[]) {
           continue;
         }
 
-        main_logger->Info(L"Создан файл: " + filepath);
+        main_logger->Info(SavedFrameMessage(encode_state, filepath));
+        catalog_frame(i, &output_frame, codec);
         main_logger->Info(L"Время синтетического кадра, мс: " +
                      std::to_wstring(capture_ms) +
                      L", кодирование, мс: " + std::to_wstring(encode_ms));
@@ -779,6 +2515,21 @@ int RunApp(int argc, wchar_t* argv[]) {
       size_t global_index = 0;
       for (const auto& adapter : dxgi.adapters) {
         for (const auto& output : adapter.outputs) {
+          const int display_index = static_cast<int>(global_index);
+          if (capture_deferred(display_index)) {
+            ++global_index;
+            continue;
+          }
+          MemoryReservation frame_memory;
+          if (options.streaming ||
+              !reserve_frame(display_index, output.desc.DesktopCoordinates,
+                             &frame_memory)) {
+            save_streaming(&adapter, &output, output.desc.DesktopCoordinates,
+                           display_index, cycle_time);
+            settle_frame(display_index, &frame_memory);
+            ++global_index;
+            continue;
+          }
           auto capture_start = std::chrono::steady_clock::now();
           ImageBuffer buffer;
           std::wstring capture_error;
@@ -795,6 +2546,7 @@ int RunApp(int argc, wchar_t* argv[]) {
                                &gdi_error)) {
               main_logger->Info(L"Использован резервный путь GDI для дисплея " +
                            std::to_wstring(global_index + 1));
+              metrics.Add(gdi_fallbacks);
               captured = true;
             } else {
               main_logger->Error(L"Резервный путь GDI тоже не удался: " + gdi_error +
@@ -805,38 +2557,56 @@ int RunApp(int argc, wchar_t* argv[]) {
 
           if (!captured) {
             any_failure = true;
+            record_frame(display_index, false, 0, 0);
             ++global_index;
             continue;
           }
 
           if (IsLikelyBlackFrame(buffer)) {
             main_logger->Info(L"Кадр DXGI выглядит пустым (почти черным), пробуем GDI.");
+            metrics.Add(black_frames);
             std::wstring gdi_error;
-            ImageBuffer gdi_buffer;
-            if (CaptureRectGdi(output.desc.DesktopCoordinates, &gdi_buffer,
+            // Обоснование: черный кадр DXGI освобождается до захвата GDI —
+            // иначе в памяти два полных кадра сразу.
+            buffer = ImageBuffer();
+            if (CaptureRectGdi(output.desc.DesktopCoordinates, &buffer,
                                &gdi_error)) {
-              buffer = std::move(gdi_buffer);
               main_logger->Info(L"Использован резервный путь GDI из-за черного кадра.");
+              metrics.Add(gdi_fallbacks);
             } else {
               main_logger->Error(L"Резервный путь GDI не удался: " + gdi_error +
                             L" (код " + FormatWin32Error(GetLastError()) + L")");
               any_failure = true;
+              record_frame(display_index, false, 0, 0);
               ++global_index;
               continue;
             }
           }
 
+          publish_frame(display_index, buffer);
+          activity_captured(display_index, &buffer);
+          if (skip_unchanged(display_index, buffer)) {
+            ++global_index;
+            continue;
+          }
+          auto encode_start = std::chrono::steady_clock::now();
+          DisplayEncodeState& encode_state = encode_states[display_index];
+          const ImageBuffer& output_frame =
+              PrepareOutputFrame(buffer, options.scale, &encode_state.scaled);
+          const OutputCodec codec =
+              ResolveCodec(output_frame, options, display_index,
+                           &encode_state, main_logger.get());
           std::wstring filename = BuildFileName(
-              computer, user, cycle_time, static_cast<int>(global_index),
-              static_cast<int>(total_outputs));
+              computer, user, cycle_time, display_index,
+              static_cast<int>(total_outputs), OutputCodecExtension(codec));
           std::wstring filepath = JoinPath(paths.day_dir, filename);
-
-          auto encode_start = std::chrono::steady_clock::now();
           std::wstring save_error;
           HRESULT save_hr = S_OK;
-          bool saved =
-              SaveJpeg(buffer, filepath, kJpegQuality, &save_error, &save_hr);
+          bool saved = SaveFrame(output_frame, filepath, options, codec,
+                                 display_index, cycle_time, &encode_state,
+                                 main_logger.get(), &save_error, &save_hr);
           auto encode_end = std::chrono::steady_clock::now();
+          settle_frame(display_index, &frame_memory);
 
           const auto capture_ms = std::chrono::duration_cast<
               std::chrono::milliseconds>(capture_end - capture_start)
@@ -844,6 +2614,11 @@ int RunApp(int argc, wchar_t* argv[]) {
           const auto encode_ms = std::chrono::duration_cast<
               std::chrono::milliseconds>(encode_end - encode_start)
                                       .count();
+          record_frame(display_index, saved,
+                       std::chrono::duration<double>(capture_end -
+                                                     capture_start).count(),
+                       std::chrono::duration<double>(encode_end -
+                                                     encode_start).count());
 
           if (!saved) {
             any_failure = true;
@@ -855,7 +2630,8 @@ int RunApp(int argc, wchar_t* argv[]) {
             continue;
           }
 
-          main_logger->Info(L"Создан файл: " + filepath);
+          main_logger->Info(SavedFrameMessage(encode_state, filepath));
+          catalog_frame(display_index, &output_frame, codec);
           main_logger->Info(L"Время захвата, мс: " + std::to_wstring(capture_ms) +
                        L", кодирование, мс: " + std::to_wstring(encode_ms));
           ++global_index;
@@ -863,6 +2639,17 @@ int RunApp(int argc, wchar_t* argv[]) {
       }
     } else {
       for (const auto& display : gdi_displays) {
+        if (capture_deferred(display.index)) {
+          continue;
+        }
+        MemoryReservation frame_memory;
+        if (options.streaming ||
+            !reserve_frame(display.index, display.rect, &frame_memory)) {
+          save_streaming(nullptr, nullptr, display.rect, display.index,
+                         cycle_time);
+          settle_frame(display.index, &frame_memory);
+          continue;
+        }
         auto capture_start = std::chrono::steady_clock::now();
         ImageBuffer buffer;
         std::wstring capture_error;
@@ -874,20 +2661,33 @@ int RunApp(int argc, wchar_t* argv[]) {
                         std::to_wstring(display.index + 1) +
                         L" не удался: " + capture_error + L" (код " +
                         FormatWin32Error(GetLastError()) + L")");
+          record_frame(display.index, false, 0, 0);
           continue;
         }
 
+        publish_frame(display.index, buffer);
+        activity_captured(display.index, &buffer);
+        if (skip_unchanged(display.index, buffer)) {
+          continue;
+        }
+        auto encode_start = std::chrono::steady_clock::now();
+        DisplayEncodeState& encode_state = encode_states[display.index];
+        const ImageBuffer& output_frame =
+            PrepareOutputFrame(buffer, options.scale, &encode_state.scaled);
+        const OutputCodec codec = ResolveCodec(
+            output_frame, options, display.index, &encode_state,
+            main_logger.get());
         std::wstring filename = BuildFileName(
             computer, user, cycle_time, display.index,
-            static_cast<int>(total_outputs));
+            static_cast<int>(total_outputs), OutputCodecExtension(codec));
         std::wstring filepath = JoinPath(paths.day_dir, filename);
-
-        auto encode_start = std::chrono::steady_clock::now();
         std::wstring save_error;
         HRESULT save_hr = S_OK;
-        bool saved =
-            SaveJpeg(buffer, filepath, kJpegQuality, &save_error, &save_hr);
+        bool saved = SaveFrame(output_frame, filepath, options, codec,
+                               display.index, cycle_time, &encode_state,
+                               main_logger.get(), &save_error, &save_hr);
         auto encode_end = std::chrono::steady_clock::now();
+        settle_frame(display.index, &frame_memory);
 
         const auto capture_ms = std::chrono::duration_cast<
             std::chrono::milliseconds>(capture_end - capture_start)
@@ -895,6 +2695,11 @@ int RunApp(int argc, wchar_t* argv[]) {
         const auto encode_ms = std::chrono::duration_cast<
             std::chrono::milliseconds>(encode_end - encode_start)
                                     .count();
+        record_frame(display.index, saved,
+                     std::chrono::duration<double>(capture_end -
+                                                   capture_start).count(),
+                     std::chrono::duration<double>(encode_end -
+                                                   encode_start).count());
 
         if (!saved) {
           any_failure = true;
@@ -904,23 +2709,96 @@ int RunApp(int argc, wchar_t* argv[]) {
           continue;
         }
 
-        main_logger->Info(L"Создан файл: " + filepath);
+        main_logger->Info(SavedFrameMessage(encode_state, filepath));
+        catalog_frame(display.index, &output_frame, codec);
         main_logger->Info(L"Время захвата, мс: " + std::to_wstring(capture_ms) +
                      L", кодирование, мс: " + std::to_wstring(encode_ms));
       }
     }
 
+    ProcessMemory memory;
+    if (QueryProcessMemory(&memory)) {
+      main_logger->Info(L"Память процесса, МБ: " +
+                        std::to_wstring(memory.rss_bytes >> 20) +
+                        L", пик: " +
+                        std::to_wstring(memory.peak_rss_bytes >> 20));
+    }
+    if (memory_budget.Limit() != 0) {
+      main_logger->Info(L"Бюджет памяти кадров, МБ: " +
+                        std::to_wstring(memory_budget.Limit() >> 20) +
+                        L", занято буферами: " +
+                        std::to_wstring(memory_budget.Used() >> 20) +
+                        L", пик: " +
+                        std::to_wstring(memory_budget.Peak() >> 20));
+    }
+    if (kAllocTrackingEnabled) {
+      const AllocCounts allocations = ThreadAllocCounts() - cycle_allocations;
+      main_logger->Info(L"Выделений памяти за цикл: " +
+                        std::to_wstring(allocations.allocations) + L", КБ: " +
+                        std::to_wstring(allocations.bytes >> 10));
+    }
+
     ++iteration;
     if (options.capture_count != 0 && iteration >= options.capture_count) {
       break;
     }
 
-    next_tick += std::chrono::seconds(options.interval_seconds);
-    auto now_tick = std::chrono::steady_clock::now();
-    if (now_tick < next_tick) {
-      std::this_thread::sleep_until(next_tick);
-    } else {
-      next_tick = now_tick;
+    GovernorTransition transition;
+    if (options.cpu_budget_percent > 0) {
+      const bool changed = governor.EndCycle(&transition);
+      metrics.Set(governor_level, governor.Level());
+      metrics.Set(cpu_usage, governor.UsagePercent());
+      if (changed) {
+        ApplyGovernorLevel(base_options, governor.Current(), &options);
+        main_logger->Info(
+            L"Регулятор CPU: загрузка, %: " +
+            std::to_wstring(transition.usage_percent) + L", уровень " +
+            std::to_wstring(transition.from_level) + L" -> " +
+            std::to_wstring(transition.to_level) + L" (" +
+            FormatGovernorLevel(governor.Current()) + L"), интервал, с: " +
+            std::to_wstring(options.interval_seconds));
+        cycle_scheduler.SetPeriod(int64_t{options.interval_seconds} *
+                                  1000000000);
+      }
+    }
+
+    metrics.Observe(cycle_seconds,
+                    std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - cycle_start)
+                        .count());
+  }
+  const CycleStats& cycle_stats = cycle_scheduler.Stats();
+  if (cycle_stats.cycles > 0) {
+    main_logger->Info(
+        L"Циклов: " + std::to_wstring(cycle_stats.cycles) +
+        L", дольше интервала: " + std::to_wstring(cycle_stats.overruns) +
+        L", пропущено сроков: " + std::to_wstring(cycle_stats.missed) +
+        L", опоздание, мс: среднее " +
+        std::to_wstring(cycle_stats.total_lateness /
+                        static_cast<int64_t>(cycle_stats.cycles) / 1000000) +
+        L", макс " + std::to_wstring(cycle_stats.max_lateness / 1000000));
+  }
+
+  for (auto& [display, state] : encode_states) {
+    std::wstring video_error;
+    if (!state.video.Finalize(&video_error)) {
+      any_failure = true;
+      main_logger->Error(video_error);
+    }
+  }
+  if (!store_day.empty()) {
+    log_store_day();
+  }
+  retention.Stop();
+  metrics_server.Stop();
+  frame_ring.Close();
+  if (kAllocTrackingEnabled) {
+    for (const AllocRegionTotals& region : AllocRegionReport()) {
+      main_logger->Info(
+          L"Выделения памяти, " +
+          std::wstring(region.name.begin(), region.name.end()) + L": " +
+          std::to_wstring(region.counts.allocations) + L", КБ: " +
+          std::to_wstring(region.counts.bytes >> 10));
     }
   }
 
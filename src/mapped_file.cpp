@@ -0,0 +1,114 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { Close(); }
+
+void MappedFile::Close() {
+#if defined(_WIN32)
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  if (file_) {
+    CloseHandle(file_);
+  }
+  file_ = nullptr;
+  mapping_ = nullptr;
+#else
+  if (data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
+bool MappedFile::Open(const std::wstring& path, std::wstring* error) {
+  Close();
+#if defined(_WIN32)
+  // Обоснование: FILE_SHARE_WRITE — индекс читается, пока захват дописывает
+  // в него новые кадры.
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                FILE_SHARE_DELETE,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    if (error) {
+      *error = L"Не удалось открыть файл: " + path;
+    }
+    return false;
+  }
+  file_ = file;
+  LARGE_INTEGER size = {};
+  if (!GetFileSizeEx(file, &size)) {
+    Close();
+    if (error) {
+      *error = L"Не удалось получить размер файла: " + path;
+    }
+    return false;
+  }
+  if (size.QuadPart == 0) {
+    return true;
+  }
+  mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void* view = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)
+                        : nullptr;
+  if (!view) {
+    Close();
+    if (error) {
+      *error = L"Не удалось отобразить файл в память: " + path;
+    }
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = static_cast<size_t>(size.QuadPart);
+  return true;
+#else
+  const std::filesystem::path native(path);
+  const int fd = open(native.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (error) {
+      *error = L"Не удалось открыть файл: " + path;
+    }
+    return false;
+  }
+  struct stat info = {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    if (error) {
+      *error = L"Не удалось получить размер файла: " + path;
+    }
+    return false;
+  }
+  if (info.st_size == 0) {
+    close(fd);
+    return true;
+  }
+  // Отображение переживает закрытие дескриптора.
+  void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    if (error) {
+      *error = L"Не удалось отобразить файл в память: " + path;
+    }
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(view);
+  size_ = static_cast<size_t>(info.st_size);
+  return true;
+#endif
+}
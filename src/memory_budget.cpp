@@ -0,0 +1,160 @@
+#include "memory_budget.h"
+
+namespace {
+
+// Обоснование: 16 строк BGRA источника полосы (64 байта на столбец) плюс
+// плоскости, аккумуляторы и коэффициенты одной строки MCU (до 4:4:4) —
+// с запасом 256 байт на столбец кадра.
+constexpr size_t kStripBytesPerColumn = 256;
+
+// Выходной поток: при минимальном качестве рабочий стол сжимается до
+// 0.1-0.3 байта на пиксель; половина байта — запас на шумные кадры и
+// рост вектора.
+size_t StreamBytes(uint32_t width, uint32_t height) {
+  return static_cast<size_t>(width) * height / 2;
+}
+
+}  // namespace
+
+bool MemoryBudget::Fits(size_t bytes) const {
+  return limit_ == 0 || (bytes <= limit_ && used_ <= limit_ - bytes);
+}
+
+void MemoryBudget::Add(size_t bytes) {
+  used_ += bytes;
+  peak_ = used_ > peak_ ? used_ : peak_;
+}
+
+bool MemoryBudget::TryReserve(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!Fits(bytes)) {
+    return false;
+  }
+  Add(bytes);
+  return true;
+}
+
+bool MemoryBudget::Reserve(size_t bytes) {
+  if (limit_ != 0 && bytes > limit_) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  released_.wait(lock, [&] { return Fits(bytes); });
+  Add(bytes);
+  return true;
+}
+
+void MemoryBudget::ForceReserve(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Add(bytes);
+}
+
+void MemoryBudget::Release(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes < used_ ? bytes : used_;
+  }
+  released_.notify_all();
+}
+
+size_t MemoryBudget::Used() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_;
+}
+
+size_t MemoryBudget::Peak() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_;
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation&& other) noexcept
+    : budget_(other.budget_), bytes_(other.bytes_) {
+  other.budget_ = nullptr;
+  other.bytes_ = 0;
+}
+
+MemoryReservation& MemoryReservation::operator=(
+    MemoryReservation&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    budget_ = other.budget_;
+    bytes_ = other.bytes_;
+    other.budget_ = nullptr;
+    other.bytes_ = 0;
+  }
+  return *this;
+}
+
+bool MemoryReservation::TryAcquire(MemoryBudget* budget, size_t bytes) {
+  Reset();
+  if (!budget || !budget->TryReserve(bytes)) {
+    return false;
+  }
+  budget_ = budget;
+  bytes_ = bytes;
+  return true;
+}
+
+bool MemoryReservation::Acquire(MemoryBudget* budget, size_t bytes) {
+  Reset();
+  if (!budget || !budget->Reserve(bytes)) {
+    return false;
+  }
+  budget_ = budget;
+  bytes_ = bytes;
+  return true;
+}
+
+void MemoryReservation::ForceAcquire(MemoryBudget* budget, size_t bytes) {
+  Reset();
+  if (!budget) {
+    return;
+  }
+  budget->ForceReserve(bytes);
+  budget_ = budget;
+  bytes_ = bytes;
+}
+
+void MemoryReservation::Reset() {
+  if (budget_) {
+    budget_->Release(bytes_);
+  }
+  budget_ = nullptr;
+  bytes_ = 0;
+}
+
+size_t FullFrameBytes(uint32_t width, uint32_t height, uint32_t out_width,
+                      uint32_t out_height, ColorMode color_mode) {
+  const size_t frame = static_cast<size_t>(width) * height * 4;
+  const size_t scaled =
+      out_width == width && out_height == height
+          ? 0
+          : static_cast<size_t>(out_width) * out_height * 4;
+  // Отсчетов на пиксель, в половинах: Y, затем Cb и Cr по схеме
+  // субдискретизации; размер дополнен до MCU 16x16.
+  size_t halves = 6;
+  switch (color_mode) {
+    case ColorMode::kGray:
+      halves = 2;
+      break;
+    case ColorMode::k420:
+      halves = 3;
+      break;
+    case ColorMode::k422:
+      halves = 4;
+      break;
+    case ColorMode::k444:
+      halves = 6;
+      break;
+  }
+  const size_t padded = static_cast<size_t>((out_width + 15) & ~15u) *
+                        ((out_height + 15) & ~15u);
+  // Коэффициенты и квантованная копия: по 2 байта на отсчет.
+  const size_t coefficients = padded * halves / 2 * sizeof(int16_t) * 2;
+  return frame + scaled + coefficients + StreamBytes(out_width, out_height);
+}
+
+size_t StripFrameBytes(uint32_t width, uint32_t height) {
+  return static_cast<size_t>(width) * kStripBytesPerColumn +
+         StreamBytes(width, height);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "jpeg_encoder.h"
+
+// Shared budget of transient frame memory (--max-memory-mb). Work that
+// needs a large buffer reserves its estimated size first; when the
+// reservation does not fit, the caller frees cached buffers, takes a path
+// that needs less (strip encoding) or waits for other workers. The budget
+// counts reservations only: it allocates nothing and bounds real memory
+// as far as the estimates hold. Thread-safe.
+class MemoryBudget {
+ public:
+  // limit_bytes 0: unlimited, every reservation fits.
+  explicit MemoryBudget(size_t limit_bytes) : limit_(limit_bytes) {}
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  // Output: false when bytes do not fit next to the current reservations.
+  bool TryReserve(size_t bytes);
+  // Waits until bytes fit. Output: false at once when bytes exceed the
+  // limit itself (waiting would never end).
+  bool Reserve(size_t bytes);
+  // Reserves over the limit (work that can neither wait nor shrink); Peak
+  // then shows by how much the limit was exceeded.
+  void ForceReserve(size_t bytes);
+  void Release(size_t bytes);
+
+  size_t Limit() const { return limit_; }
+  size_t Used() const;
+  // Maximum of Used since construction.
+  size_t Peak() const;
+
+ private:
+  bool Fits(size_t bytes) const;
+  void Add(size_t bytes);
+
+  const size_t limit_;
+  mutable std::mutex mutex_;
+  std::condition_variable released_;
+  size_t used_ = 0;
+  size_t peak_ = 0;
+};
+
+// Reservation released on destruction (or Reset). Movable.
+class MemoryReservation {
+ public:
+  MemoryReservation() = default;
+  ~MemoryReservation() { Reset(); }
+  MemoryReservation(MemoryReservation&& other) noexcept;
+  MemoryReservation& operator=(MemoryReservation&& other) noexcept;
+  MemoryReservation(const MemoryReservation&) = delete;
+  MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+  // Replace the held reservation with bytes of budget (the old one is
+  // released first). Output: false (nothing held) as with the budget calls.
+  bool TryAcquire(MemoryBudget* budget, size_t bytes);
+  bool Acquire(MemoryBudget* budget, size_t bytes);
+  void ForceAcquire(MemoryBudget* budget, size_t bytes);
+  void Reset();
+
+  size_t Bytes() const { return bytes_; }
+
+ private:
+  MemoryBudget* budget_ = nullptr;
+  size_t bytes_ = 0;
+};
+
+// Estimated peak of one frame on the full-frame path: the captured BGRA8
+// frame, its scaled copy when the output size differs, and the coefficient
+// encode of the output frame (coefficients and their quantized copy, 2
+// bytes per sample each, plus the stream).
+size_t FullFrameBytes(uint32_t width, uint32_t height, uint32_t out_width,
+                      uint32_t out_height, ColorMode color_mode);
+// Estimated peak of one frame on the strip path (EncodeJpegStreaming):
+// 16-row source strip, planes and coefficients of one MCU row, the stream.
+size_t StripFrameBytes(uint32_t width, uint32_t height);
@@ -0,0 +1,78 @@
+#include "memory_stats.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <cstring>
+#endif
+
+#if defined(__linux__)
+namespace {
+
+// Строка "Name:   12345 kB" из /proc/self/status, в байтах.
+bool ParseStatusKb(const char* line, const char* name, size_t* out) {
+  const size_t length = std::strlen(name);
+  if (std::strncmp(line, name, length) != 0) {
+    return false;
+  }
+  unsigned long long kb = 0;
+  if (std::sscanf(line + length, " %llu", &kb) != 1) {
+    return false;
+  }
+  *out = static_cast<size_t>(kb) * 1024;
+  return true;
+}
+
+}  // namespace
+#endif
+
+bool QueryProcessMemory(ProcessMemory* out) {
+  if (!out) {
+    return false;
+  }
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters = {};
+  counters.cb = sizeof(counters);
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return false;
+  }
+  out->rss_bytes = counters.WorkingSetSize;
+  out->peak_rss_bytes = counters.PeakWorkingSetSize;
+  return true;
+#elif defined(__linux__)
+  std::FILE* file = std::fopen("/proc/self/status", "r");
+  if (!file) {
+    return false;
+  }
+  char line[256];
+  bool rss = false;
+  bool peak = false;
+  while (std::fgets(line, sizeof(line), file)) {
+    rss = ParseStatusKb(line, "VmRSS:", &out->rss_bytes) || rss;
+    peak = ParseStatusKb(line, "VmHWM:", &out->peak_rss_bytes) || peak;
+  }
+  std::fclose(file);
+  return rss && peak;
+#else
+  return false;
+#endif
+}
+
+bool ResetPeakRss() {
+#if defined(__linux__)
+  // "5" сбрасывает VmHWM до текущего RSS (Documentation/filesystems/proc).
+  std::FILE* file = std::fopen("/proc/self/clear_refs", "w");
+  if (!file) {
+    return false;
+  }
+  const bool written = std::fputs("5", file) >= 0;
+  return std::fclose(file) == 0 && written;
+#else
+  // Обоснование: пиковый рабочий набор Windows не сбрасывается, вызывающий
+  // сравнивает пик с уже накопленным максимумом процесса.
+  return false;
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+// Resident memory of the current process (working set on Windows).
+struct ProcessMemory {
+  size_t rss_bytes = 0;
+  // Peak since process start or the last ResetPeakRss.
+  size_t peak_rss_bytes = 0;
+};
+
+// Output: false when the platform does not report memory usage.
+bool QueryProcessMemory(ProcessMemory* out);
+
+// Restarts peak tracking from the current RSS (Linux 4.0+ clear_refs).
+// Output: false when unsupported; peak then keeps the process-wide maximum.
+bool ResetPeakRss();
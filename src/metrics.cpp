@@ -0,0 +1,277 @@
+#include "metrics.h"
+
+#include <cstring>
+#include <locale>
+#include <sstream>
+
+namespace {
+
+// Слотов на поток и шкал (с запасом на 64 дисплея).
+constexpr size_t kMaxSlots = 4096;
+constexpr size_t kMaxGauges = 256;
+
+std::atomic<uint64_t> g_next_registry_id{1};
+
+// Шард текущего потока для последнего реестра, с которым он работал.
+struct ShardCache {
+  uint64_t registry_id = 0;
+  std::atomic<uint64_t>* slots = nullptr;
+};
+thread_local ShardCache t_shard_cache;
+
+uint64_t DoubleBits(double value) {
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+double BitsDouble(uint64_t bits) {
+  double value = 0;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+std::unique_ptr<std::atomic<uint64_t>[]> ZeroSlots(size_t count) {
+  std::unique_ptr<std::atomic<uint64_t>[]> slots(
+      new std::atomic<uint64_t>[count]);
+  for (size_t i = 0; i < count; ++i) {
+    slots[i].store(0, std::memory_order_relaxed);
+  }
+  return slots;
+}
+
+std::string EscapeLabel(const std::string& value) {
+  std::string out;
+  for (char ch : value) {
+    if (ch == '\\' || ch == '"') {
+      out += '\\';
+      out += ch;
+    } else if (ch == '\n') {
+      out += "\\n";
+    } else {
+      out += ch;
+    }
+  }
+  return out;
+}
+
+// {a="1",le="0.5"}; пусто без меток.
+void WriteLabels(std::ostream& out, const std::vector<MetricLabel>& labels,
+                 const char* le = nullptr) {
+  if (labels.empty() && !le) {
+    return;
+  }
+  out << '{';
+  bool first = true;
+  for (const MetricLabel& label : labels) {
+    out << (first ? "" : ",") << label.name << "=\""
+        << EscapeLabel(label.value) << '"';
+    first = false;
+  }
+  if (le) {
+    out << (first ? "" : ",") << "le=\"" << le << '"';
+  }
+  out << '}';
+}
+
+}  // namespace
+
+std::vector<double> LatencyBuckets() {
+  return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+          0.25,  0.5,    1,     2.5,  5,     10};
+}
+
+MetricsRegistry::MetricsRegistry()
+    : id_(g_next_registry_id.fetch_add(1)), gauges_(ZeroSlots(kMaxGauges)) {}
+
+MetricId MetricsRegistry::AddSeries(const std::string& name,
+                                    const std::string& help, Type type,
+                                    Series series, size_t slots) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t* used = type == Type::kGauge ? &gauges_used_ : &slots_used_;
+  const size_t capacity = type == Type::kGauge ? kMaxGauges : kMaxSlots;
+  if (*used + slots > capacity) {
+    return kNoMetric;
+  }
+  series.slot = *used;
+  *used += slots;
+  size_t family = 0;
+  while (family < families_.size() && families_[family].name != name) {
+    ++family;
+  }
+  if (family == families_.size()) {
+    Family added;
+    added.name = name;
+    added.help = help;
+    added.type = type;
+    families_.push_back(std::move(added));
+  }
+  families_[family].series.push_back(std::move(series));
+  metrics_.emplace_back(family, families_[family].series.size() - 1);
+  return metrics_.size() - 1;
+}
+
+MetricId MetricsRegistry::Counter(const std::string& name,
+                                  const std::string& help,
+                                  std::vector<MetricLabel> labels) {
+  Series series;
+  series.labels = std::move(labels);
+  return AddSeries(name, help, Type::kCounter, std::move(series), 1);
+}
+
+MetricId MetricsRegistry::Histogram(const std::string& name,
+                                    const std::string& help,
+                                    std::vector<MetricLabel> labels,
+                                    std::vector<double> bounds) {
+  Series series;
+  series.labels = std::move(labels);
+  series.bounds = std::move(bounds);
+  const size_t slots = series.bounds.size() + 2;
+  return AddSeries(name, help, Type::kHistogram, std::move(series), slots);
+}
+
+MetricId MetricsRegistry::Gauge(const std::string& name,
+                                const std::string& help,
+                                std::vector<MetricLabel> labels) {
+  Series series;
+  series.labels = std::move(labels);
+  return AddSeries(name, help, Type::kGauge, std::move(series), 1);
+}
+
+void MetricsRegistry::GaugeCallback(const std::string& name,
+                                    const std::string& help,
+                                    std::function<double()> read) {
+  Series series;
+  series.read = std::move(read);
+  AddSeries(name, help, Type::kGauge, std::move(series), 0);
+}
+
+std::atomic<uint64_t>* MetricsRegistry::Slots() {
+  ShardCache& cache = t_shard_cache;
+  if (cache.registry_id == id_) {
+    return cache.slots;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Shard>& shard = shards_[std::this_thread::get_id()];
+  if (!shard) {
+    shard = std::make_unique<Shard>();
+    shard->slots = ZeroSlots(kMaxSlots);
+  }
+  cache.registry_id = id_;
+  cache.slots = shard->slots.get();
+  return cache.slots;
+}
+
+void MetricsRegistry::Add(MetricId counter, uint64_t value) {
+  if (counter >= metrics_.size()) {
+    return;
+  }
+  const auto [family, index] = metrics_[counter];
+  std::atomic<uint64_t>& slot =
+      Slots()[families_[family].series[index].slot];
+  // Обоснование: слот пишет только поток-владелец — чтение и запись
+  // вместо атомарного сложения, без lock-префикса.
+  slot.store(slot.load(std::memory_order_relaxed) + value,
+             std::memory_order_relaxed);
+}
+
+void MetricsRegistry::Observe(MetricId histogram, double value) {
+  if (histogram >= metrics_.size()) {
+    return;
+  }
+  const auto [family, index] = metrics_[histogram];
+  const Series& series = families_[family].series[index];
+  std::atomic<uint64_t>* slots = Slots() + series.slot;
+  size_t bucket = 0;
+  while (bucket < series.bounds.size() && value > series.bounds[bucket]) {
+    ++bucket;
+  }
+  slots[bucket].store(slots[bucket].load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  std::atomic<uint64_t>& sum = slots[series.bounds.size() + 1];
+  sum.store(DoubleBits(BitsDouble(sum.load(std::memory_order_relaxed)) +
+                       value),
+            std::memory_order_relaxed);
+}
+
+void MetricsRegistry::Set(MetricId gauge, double value) {
+  if (gauge >= metrics_.size()) {
+    return;
+  }
+  const auto [family, index] = metrics_[gauge];
+  gauges_[families_[family].series[index].slot].store(
+      DoubleBits(value), std::memory_order_relaxed);
+}
+
+uint64_t MetricsRegistry::SumSlot(size_t slot) const {
+  uint64_t sum = 0;
+  for (const auto& [thread, shard] : shards_) {
+    sum += shard->slots[slot].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+double MetricsRegistry::SumDoubleSlot(size_t slot) const {
+  double sum = 0;
+  for (const auto& [thread, shard] : shards_) {
+    sum += BitsDouble(shard->slots[slot].load(std::memory_order_relaxed));
+  }
+  return sum;
+}
+
+std::string MetricsRegistry::Render() const {
+  std::ostringstream out;
+  // Точка как разделитель дробной части при любой локали процесса.
+  out.imbue(std::locale::classic());
+  out.precision(9);
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const Family& family : families_) {
+    static const char* const kTypeNames[] = {"counter", "histogram", "gauge"};
+    out << "# HELP " << family.name << ' ' << family.help << '\n'
+        << "# TYPE " << family.name << ' '
+        << kTypeNames[static_cast<int>(family.type)] << '\n';
+    for (const Series& series : family.series) {
+      switch (family.type) {
+        case Type::kCounter:
+          out << family.name;
+          WriteLabels(out, series.labels);
+          out << ' ' << SumSlot(series.slot) << '\n';
+          break;
+        case Type::kGauge:
+          out << family.name;
+          WriteLabels(out, series.labels);
+          out << ' '
+              << (series.read ? series.read()
+                              : BitsDouble(gauges_[series.slot].load(
+                                    std::memory_order_relaxed)))
+              << '\n';
+          break;
+        case Type::kHistogram: {
+          uint64_t cumulative = 0;
+          for (size_t i = 0; i <= series.bounds.size(); ++i) {
+            cumulative += SumSlot(series.slot + i);
+            std::ostringstream le;
+            le.imbue(std::locale::classic());
+            if (i < series.bounds.size()) {
+              le << series.bounds[i];
+            } else {
+              le << "+Inf";
+            }
+            out << family.name << "_bucket";
+            WriteLabels(out, series.labels, le.str().c_str());
+            out << ' ' << cumulative << '\n';
+          }
+          out << family.name << "_sum";
+          WriteLabels(out, series.labels);
+          out << ' ' << SumDoubleSlot(series.slot + series.bounds.size() + 1)
+              << '\n';
+          out << family.name << "_count";
+          WriteLabels(out, series.labels);
+          out << ' ' << cumulative << '\n';
+          break;
+        }
+      }
+    }
+  }
+  return out.str();
+}
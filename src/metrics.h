@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Process metrics in the Prometheus text format (version 0.0.4).
+//
+// Counters and histograms are written without locks: every writing thread
+// owns a shard of relaxed atomic slots that only it updates, and Render
+// sums the shards on demand (from the server thread). Metrics are
+// registered before other threads update them; the first update from a new
+// thread takes the registry lock once to create its shard.
+
+// Handle of a registered metric; kNoMetric (registry full) ignores updates.
+using MetricId = size_t;
+constexpr MetricId kNoMetric = static_cast<MetricId>(-1);
+
+// One label pair, e.g. {"display", "1"}.
+struct MetricLabel {
+  std::string name;
+  std::string value;
+};
+
+// Upper bounds in seconds for latency histograms (1 ms .. 10 s).
+std::vector<double> LatencyBuckets();
+
+class MetricsRegistry {
+ public:
+  MetricsRegistry();
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // Series of the family name; families keep the order of first
+  // registration, help and type come from it.
+  MetricId Counter(const std::string& name, const std::string& help,
+                   std::vector<MetricLabel> labels = {});
+  // bounds ascending; +Inf is implied.
+  MetricId Histogram(const std::string& name, const std::string& help,
+                     std::vector<MetricLabel> labels,
+                     std::vector<double> bounds);
+  // Last Set wins (any thread).
+  MetricId Gauge(const std::string& name, const std::string& help,
+                 std::vector<MetricLabel> labels = {});
+  // Gauge read at Render time on the rendering thread.
+  void GaugeCallback(const std::string& name, const std::string& help,
+                     std::function<double()> read);
+
+  void Add(MetricId counter, uint64_t value = 1);
+  void Observe(MetricId histogram, double value);
+  void Set(MetricId gauge, double value);
+
+  // Text exposition of all series.
+  std::string Render() const;
+
+ private:
+  enum class Type { kCounter, kHistogram, kGauge };
+  struct Series {
+    std::vector<MetricLabel> labels;
+    std::vector<double> bounds;
+    // First slot: counter value; histogram buckets (bounds + +Inf), then
+    // the sum as double bits; gauge index in gauges_.
+    size_t slot = 0;
+    std::function<double()> read;
+  };
+  struct Family {
+    std::string name;
+    std::string help;
+    Type type = Type::kCounter;
+    std::vector<Series> series;
+  };
+  struct Shard {
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+  };
+
+  MetricId AddSeries(const std::string& name, const std::string& help,
+                     Type type, Series series, size_t slots);
+  std::atomic<uint64_t>* Slots();
+  uint64_t SumSlot(size_t slot) const;
+  double SumDoubleSlot(size_t slot) const;
+
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  std::vector<Family> families_;
+  // Metric id -> (family, series).
+  std::vector<std::pair<size_t, size_t>> metrics_;
+  // Slots and gauges are fixed arrays: shards never move under Render.
+  size_t slots_used_ = 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> gauges_;
+  size_t gauges_used_ = 0;
+  std::unordered_map<std::thread::id, std::unique_ptr<Shard>> shards_;
+};
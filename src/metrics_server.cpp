@@ -0,0 +1,202 @@
+#include "metrics_server.h"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uintptr_t kNoSocket = static_cast<uintptr_t>(-1);
+// Период проверки флага остановки в ожидании соединения.
+constexpr int kPollMs = 200;
+// Клиент, не приславший запрос за это время, отключается.
+constexpr int kReceiveTimeoutMs = 2000;
+constexpr size_t kMaxRequestBytes = 4096;
+constexpr size_t kMaxSendChunk = 1 << 20;
+
+#if defined(MSG_NOSIGNAL)
+// Клиент, закрывший соединение, не должен завершать процесс SIGPIPE.
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+#if defined(_WIN32)
+using NativeSocket = SOCKET;
+#else
+using NativeSocket = int;
+#endif
+
+NativeSocket Native(uintptr_t socket) {
+  return static_cast<NativeSocket>(socket);
+}
+
+void CloseSocket(uintptr_t socket) {
+#if defined(_WIN32)
+  closesocket(Native(socket));
+#else
+  close(Native(socket));
+#endif
+}
+
+// Ждет входящее соединение не дольше kPollMs.
+bool WaitReadable(uintptr_t socket) {
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(Native(socket), &readable);
+  timeval timeout = {};
+  timeout.tv_usec = kPollMs * 1000;
+  return select(static_cast<int>(Native(socket)) + 1, &readable, nullptr,
+                nullptr, &timeout) > 0;
+}
+
+void SetReceiveTimeout(uintptr_t socket) {
+#if defined(_WIN32)
+  const DWORD timeout = kReceiveTimeoutMs;
+#else
+  timeval timeout = {};
+  timeout.tv_sec = kReceiveTimeoutMs / 1000;
+  timeout.tv_usec = (kReceiveTimeoutMs % 1000) * 1000;
+#endif
+  setsockopt(Native(socket), SOL_SOCKET, SO_RCVTIMEO,
+             reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+bool SendAll(uintptr_t socket, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const size_t remaining = data.size() - sent;
+    const int chunk = static_cast<int>(
+        remaining < kMaxSendChunk ? remaining : kMaxSendChunk);
+    const auto result =
+        send(Native(socket), data.data() + sent, chunk, kSendFlags);
+    if (result <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+std::string Response(const char* status, const char* content_type,
+                     const std::string& body) {
+  return std::string("HTTP/1.0 ") + status +
+         "\r\nContent-Type: " + content_type +
+         "\r\nContent-Length: " + std::to_string(body.size()) +
+         "\r\nConnection: close\r\n\r\n" + body;
+}
+
+}  // namespace
+
+MetricsServer::~MetricsServer() { Stop(); }
+
+bool MetricsServer::Start(const MetricsRegistry* registry, uint16_t port,
+                          std::wstring* error) {
+  Stop();
+#if defined(_WIN32)
+  WSADATA wsa = {};
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+    if (error) {
+      *error = L"Не удалось инициализировать Winsock.";
+    }
+    return false;
+  }
+#endif
+  const NativeSocket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  socket_ = static_cast<uintptr_t>(listener);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  // Обоснование: только локальный интерфейс — метрики не публикуются в
+  // сеть, сбор идет локальным агентом.
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if (socket_ == kNoSocket ||
+      bind(listener, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, 8) != 0 ||
+      getsockname(listener, reinterpret_cast<sockaddr*>(&address),
+                  &length) != 0) {
+    if (socket_ != kNoSocket) {
+      CloseSocket(socket_);
+      socket_ = kNoSocket;
+    }
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+    if (error) {
+      *error = L"Не удалось открыть порт метрик 127.0.0.1:" +
+               std::to_wstring(port);
+    }
+    return false;
+  }
+  registry_ = registry;
+  port_ = ntohs(address.sin_port);
+  stop_ = false;
+  thread_ = std::thread(&MetricsServer::ThreadMain, this);
+  return true;
+}
+
+void MetricsServer::Stop() {
+  stop_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (socket_ != kNoSocket) {
+    CloseSocket(socket_);
+    socket_ = kNoSocket;
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+  }
+}
+
+void MetricsServer::ThreadMain() {
+  while (!stop_) {
+    if (!WaitReadable(socket_)) {
+      continue;
+    }
+    const NativeSocket client = accept(Native(socket_), nullptr, nullptr);
+    if (static_cast<uintptr_t>(client) == kNoSocket) {
+      continue;
+    }
+    Serve(static_cast<uintptr_t>(client));
+    CloseSocket(static_cast<uintptr_t>(client));
+  }
+}
+
+void MetricsServer::Serve(uintptr_t client) {
+  SetReceiveTimeout(client);
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < kMaxRequestBytes) {
+    const auto received = recv(Native(client), buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
+    }
+    request.append(buffer, static_cast<size_t>(received));
+  }
+  ++requests_;
+  const size_t line_end = request.find("\r\n");
+  const std::string line = request.substr(0, line_end);
+  // Строка запроса: "GET /metrics HTTP/1.1" (путь может нести ?query).
+  const bool metrics = line.rfind("GET /metrics ", 0) == 0 ||
+                       line.rfind("GET /metrics?", 0) == 0;
+  if (metrics) {
+    SendAll(client, Response("200 OK", "text/plain; version=0.0.4",
+                             registry_->Render()));
+  } else {
+    SendAll(client, Response("404 Not Found", "text/plain", "not found\n"));
+  }
+}
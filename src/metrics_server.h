@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "metrics.h"
+
+// Serves GET /metrics of a registry over HTTP/1.0 on 127.0.0.1 from its
+// own thread, one connection at a time; other paths get 404.
+class MetricsServer {
+ public:
+  MetricsServer() = default;
+  ~MetricsServer();
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  // port 0 picks a free port (see Port). Output: false + error when the
+  // socket cannot be bound.
+  bool Start(const MetricsRegistry* registry, uint16_t port,
+             std::wstring* error);
+  // Stops accepting and joins the thread (within the poll interval).
+  void Stop();
+  uint16_t Port() const { return port_; }
+  uint64_t Requests() const { return requests_.load(); }
+
+ private:
+  void ThreadMain();
+  void Serve(uintptr_t client);
+
+  const MetricsRegistry* registry_ = nullptr;
+  uintptr_t socket_ = static_cast<uintptr_t>(-1);
+  uint16_t port_ = 0;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<uint64_t> requests_{0};
+};
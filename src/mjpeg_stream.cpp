@@ -0,0 +1,451 @@
+#include "mjpeg_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+
+// Идентификаторы элементов Matroska (EBML).
+constexpr uint32_t kIdEbml = 0x1A45DFA3;
+constexpr uint32_t kIdSegment = 0x18538067;
+constexpr uint32_t kIdSeekHead = 0x114D9B74;
+constexpr uint32_t kIdSeek = 0x4DBB;
+constexpr uint32_t kIdSeekId = 0x53AB;
+constexpr uint32_t kIdSeekPosition = 0x53AC;
+constexpr uint32_t kIdVoid = 0xEC;
+constexpr uint32_t kIdInfo = 0x1549A966;
+constexpr uint32_t kIdTracks = 0x1654AE6B;
+constexpr uint32_t kIdTrackEntry = 0xAE;
+constexpr uint32_t kIdVideo = 0xE0;
+constexpr uint32_t kIdCluster = 0x1F43B675;
+constexpr uint32_t kIdTimecode = 0xE7;
+constexpr uint32_t kIdSimpleBlock = 0xA3;
+constexpr uint32_t kIdCues = 0x1C53BB6B;
+constexpr uint32_t kIdCuePoint = 0xBB;
+constexpr uint32_t kIdCueTime = 0xB3;
+constexpr uint32_t kIdCueTrackPositions = 0xB7;
+constexpr uint32_t kIdCueTrack = 0xF7;
+constexpr uint32_t kIdCueClusterPosition = 0xF1;
+
+// Место под SeekHead сразу после начала сегмента: до Finalize это Void.
+constexpr size_t kSeekHeadReserve = 96;
+// Заголовок кластера (8-байтовый размер), Timecode и заголовок SimpleBlock
+// фиксированной длины: смещения и восстановление не требуют разбора.
+constexpr size_t kClusterPrefixSize = 35;
+constexpr size_t kClusterHeaderSize = 12;
+constexpr uint64_t kUnknownSize = 0x00FFFFFFFFFFFFFF;
+
+void PutBe(uint8_t* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+  }
+}
+
+uint64_t GetBe(const uint8_t* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+void PutId(uint32_t id, std::vector<uint8_t>* out) {
+  const int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+  for (int i = bytes - 1; i >= 0; --i) {
+    out->push_back(static_cast<uint8_t>(id >> (8 * i)));
+  }
+}
+
+// Размер элемента всегда 8-байтовым vint: место под размер не зависит от
+// содержимого, его можно дописать позже.
+void PatchSize8(uint8_t* out, uint64_t size) {
+  out[0] = 0x01;
+  PutBe(out + 1, size, 7);
+}
+
+size_t BeginMaster(uint32_t id, std::vector<uint8_t>* out) {
+  PutId(id, out);
+  const size_t size_offset = out->size();
+  out->resize(out->size() + 8);
+  return size_offset;
+}
+
+void EndMaster(size_t size_offset, std::vector<uint8_t>* out) {
+  PatchSize8(out->data() + size_offset, out->size() - size_offset - 8);
+}
+
+// Мелкие элементы с однобайтовым размером. Возвращает смещение значения.
+size_t PutUint(uint32_t id, uint64_t value, int bytes,
+               std::vector<uint8_t>* out) {
+  PutId(id, out);
+  out->push_back(static_cast<uint8_t>(0x80 | bytes));
+  const size_t offset = out->size();
+  out->resize(offset + bytes);
+  PutBe(out->data() + offset, value, bytes);
+  return offset;
+}
+
+void PutString(uint32_t id, const char* value, std::vector<uint8_t>* out) {
+  const size_t length = std::strlen(value);
+  PutId(id, out);
+  out->push_back(static_cast<uint8_t>(0x80 | length));
+  out->insert(out->end(), value, value + length);
+}
+
+void PutSmallMaster(uint32_t id, const std::vector<uint8_t>& content,
+                    std::vector<uint8_t>* out) {
+  PutId(id, out);
+  out->push_back(static_cast<uint8_t>(0x80 | content.size()));
+  out->insert(out->end(), content.begin(), content.end());
+}
+
+void PutVoid(size_t total, uint8_t* out) {
+  std::memset(out, 0, total);
+  out[0] = static_cast<uint8_t>(kIdVoid);
+  out[1] = static_cast<uint8_t>(0x80 | (total - 2));
+}
+
+uint64_t DoubleBits(double value) {
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// Смещения полей заголовка; раскладка не зависит от значений.
+struct HeaderLayout {
+  size_t segment_size = 0;
+  size_t segment_data = 0;
+  size_t info = 0;
+  size_t duration = 0;
+  size_t tracks = 0;
+  size_t default_duration = 0;
+  size_t width = 0;
+  size_t height = 0;
+  size_t size = 0;
+};
+
+HeaderLayout BuildHeader(uint32_t width, uint32_t height, uint64_t frame_ns,
+                         std::vector<uint8_t>* out) {
+  HeaderLayout layout;
+  out->clear();
+  const size_t ebml = BeginMaster(kIdEbml, out);
+  PutUint(0x4286, 1, 1, out);  // EBMLVersion
+  PutUint(0x42F7, 1, 1, out);  // EBMLReadVersion
+  PutUint(0x42F2, 4, 1, out);  // EBMLMaxIDLength
+  PutUint(0x42F3, 8, 1, out);  // EBMLMaxSizeLength
+  PutString(0x4282, "matroska", out);
+  PutUint(0x4287, 4, 1, out);  // DocTypeVersion
+  PutUint(0x4285, 2, 1, out);  // DocTypeReadVersion
+  EndMaster(ebml, out);
+
+  PutId(kIdSegment, out);
+  layout.segment_size = out->size();
+  out->resize(out->size() + 8);
+  PatchSize8(out->data() + layout.segment_size, kUnknownSize);
+  layout.segment_data = out->size();
+  out->resize(out->size() + kSeekHeadReserve);
+  PutVoid(kSeekHeadReserve, out->data() + layout.segment_data);
+
+  layout.info = out->size();
+  const size_t info = BeginMaster(kIdInfo, out);
+  PutUint(0x2AD7B1, 1000000, 4, out);  // TimecodeScale: 1 мс
+  layout.duration = PutUint(0x4489, DoubleBits(0.0), 8, out);
+  PutString(0x4D80, "p2_screenshot", out);  // MuxingApp
+  PutString(0x5741, "p2_screenshot", out);  // WritingApp
+  EndMaster(info, out);
+
+  layout.tracks = out->size();
+  const size_t tracks = BeginMaster(kIdTracks, out);
+  const size_t entry = BeginMaster(kIdTrackEntry, out);
+  PutUint(0xD7, 1, 1, out);           // TrackNumber
+  PutUint(0x73C5, 1, 8, out);         // TrackUID
+  PutUint(0x83, 1, 1, out);           // TrackType: видео
+  PutUint(0x9C, 0, 1, out);           // FlagLacing
+  PutString(0x86, "V_MJPEG", out);    // CodecID
+  layout.default_duration = PutUint(0x23E383, frame_ns, 4, out);
+  const size_t video = BeginMaster(kIdVideo, out);
+  layout.width = PutUint(0xB0, width, 4, out);    // PixelWidth
+  layout.height = PutUint(0xBA, height, 4, out);  // PixelHeight
+  EndMaster(video, out);
+  EndMaster(entry, out);
+  EndMaster(tracks, out);
+  layout.size = out->size();
+  return layout;
+}
+
+const HeaderLayout& Layout() {
+  static const HeaderLayout layout = [] {
+    std::vector<uint8_t> header;
+    return BuildHeader(0, 0, 0, &header);
+  }();
+  return layout;
+}
+
+}  // namespace
+
+bool MjpegStreamWriter::Fail(const wchar_t* message, std::wstring* error) {
+  if (file_.is_open()) {
+    file_.close();
+  }
+  file_.clear();
+  open_ = false;
+  if (error) {
+    *error = message + path_;
+  }
+  return false;
+}
+
+bool MjpegStreamWriter::Open(const std::wstring& path, uint32_t frame_ms,
+                             std::wstring* error) {
+  namespace fs = std::filesystem;
+  if (file_.is_open()) {
+    file_.close();
+  }
+  file_.clear();
+  path_ = path;
+  open_ = true;
+  frame_ms_ = frame_ms;
+  width_ = 0;
+  height_ = 0;
+  file_size_ = 0;
+  truncated_bytes_ = 0;
+  clusters_.clear();
+
+  const fs::path file(path);
+  std::error_code ec;
+  const uintmax_t size = fs::file_size(file, ec);
+  if (ec || size == 0) {
+    // Файл создается первым кадром: размер кадра пишется в заголовок.
+    return true;
+  }
+  const HeaderLayout& layout = Layout();
+  std::vector<uint8_t> header(layout.size);
+  std::vector<uint8_t> expected;
+  {
+    std::ifstream in(file, std::ios::binary);
+    in.read(reinterpret_cast<char*>(header.data()),
+            static_cast<std::streamsize>(
+                std::min<uintmax_t>(size, header.size())));
+  }
+  if (size < layout.size) {
+    // Сбой при записи первого кадра: заголовок оборван, поток начинается
+    // заново.
+    BuildHeader(0, 0, 0, &expected);
+    if (std::memcmp(header.data(), expected.data(),
+                    std::min<size_t>(size, layout.segment_size)) != 0) {
+      return Fail(L"Файл не является потоком MJPEG: ", error);
+    }
+    fs::resize_file(file, 0, ec);
+    truncated_bytes_ = size;
+    return ec ? Fail(L"Не удалось очистить поток MJPEG: ", error) : true;
+  }
+  const uint32_t width =
+      static_cast<uint32_t>(GetBe(header.data() + layout.width, 4));
+  const uint32_t height =
+      static_cast<uint32_t>(GetBe(header.data() + layout.height, 4));
+  const uint64_t frame_ns = GetBe(header.data() + layout.default_duration, 4);
+  BuildHeader(width, height, frame_ns, &expected);
+  if (std::memcmp(header.data(), expected.data(), layout.segment_size) != 0 ||
+      std::memcmp(header.data() + layout.tracks,
+                  expected.data() + layout.tracks,
+                  layout.size - layout.tracks) != 0 ||
+      frame_ns < 1000000) {
+    return Fail(L"Файл не является потоком MJPEG: ", error);
+  }
+
+  // Кластеры идут подряд; индекс (Cues) прошлого Finalize и оборванный
+  // последний кластер отрезаются.
+  uint64_t end = layout.size;
+  bool indexed = false;
+  {
+    std::ifstream in(file, std::ios::binary);
+    uint8_t prefix[kClusterHeaderSize + 10];
+    while (end + kClusterHeaderSize <= size) {
+      in.seekg(static_cast<std::streamoff>(end));
+      if (!in.read(reinterpret_cast<char*>(prefix), kClusterHeaderSize) ||
+          prefix[4] != 0x01) {
+        break;
+      }
+      const uint32_t id = static_cast<uint32_t>(GetBe(prefix, 4));
+      const uint64_t length = GetBe(prefix + 5, 7);
+      if (end + kClusterHeaderSize + length > size) {
+        break;
+      }
+      if (id == kIdCues) {
+        indexed = end + kClusterHeaderSize + length == size;
+        break;
+      }
+      if (id != kIdCluster ||
+          length < kClusterPrefixSize - kClusterHeaderSize ||
+          !in.read(reinterpret_cast<char*>(prefix + kClusterHeaderSize), 10) ||
+          prefix[12] != kIdTimecode || prefix[13] != 0x88) {
+        break;
+      }
+      clusters_.push_back(
+          Cluster{GetBe(prefix + 14, 8), end - layout.segment_data});
+      end += kClusterHeaderSize + length;
+    }
+  }
+  if (end < size) {
+    fs::resize_file(file, end, ec);
+    if (ec) {
+      return Fail(L"Не удалось отрезать хвост потока MJPEG: ", error);
+    }
+    if (!indexed) {
+      truncated_bytes_ = size - end;
+    }
+  }
+
+  // Сегмент снова неизвестного размера, SeekHead снова Void: до следующего
+  // Finalize файл — живой поток.
+  file_.open(file, std::ios::in | std::ios::out | std::ios::binary);
+  uint8_t patch[kSeekHeadReserve];
+  PatchSize8(patch, kUnknownSize);
+  file_.seekp(static_cast<std::streamoff>(layout.segment_size));
+  file_.write(reinterpret_cast<const char*>(patch), 8);
+  PutVoid(kSeekHeadReserve, patch);
+  file_.write(reinterpret_cast<const char*>(patch), kSeekHeadReserve);
+  PutBe(patch, DoubleBits(0.0), 8);
+  file_.seekp(static_cast<std::streamoff>(layout.duration));
+  file_.write(reinterpret_cast<const char*>(patch), 8);
+  file_.flush();
+  if (!file_) {
+    return Fail(L"Не удалось открыть поток MJPEG для записи: ", error);
+  }
+  width_ = width;
+  height_ = height;
+  frame_ms_ = static_cast<uint32_t>(frame_ns / 1000000);
+  file_size_ = end;
+  return true;
+}
+
+bool MjpegStreamWriter::Accepts(uint32_t width, uint32_t height) const {
+  return file_size_ == 0 || (width == width_ && height == height_);
+}
+
+bool MjpegStreamWriter::Append(const std::vector<uint8_t>& jpeg,
+                               uint32_t width, uint32_t height,
+                               std::wstring* error) {
+  if (!open_) {
+    return Fail(L"Поток MJPEG не открыт: ", error);
+  }
+  if (!Accepts(width, height)) {
+    if (error) {
+      *error = L"Размер кадра отличается от размера потока MJPEG: " + path_;
+    }
+    return false;
+  }
+  const HeaderLayout& layout = Layout();
+  if (file_size_ == 0) {
+    file_.open(std::filesystem::path(path_),
+               std::ios::out | std::ios::trunc | std::ios::binary);
+    BuildHeader(width, height, static_cast<uint64_t>(frame_ms_) * 1000000,
+                &scratch_);
+    file_.write(reinterpret_cast<const char*>(scratch_.data()),
+                static_cast<std::streamsize>(scratch_.size()));
+    if (!file_) {
+      return Fail(L"Не удалось создать поток MJPEG: ", error);
+    }
+    width_ = width;
+    height_ = height;
+    file_size_ = scratch_.size();
+  }
+  const uint64_t timecode =
+      clusters_.empty() ? 0 : clusters_.back().timecode + frame_ms_;
+  // Кластер: Timecode + SimpleBlock (дорожка 1, смещение 0, ключевой кадр).
+  uint8_t prefix[kClusterPrefixSize];
+  PutBe(prefix, kIdCluster, 4);
+  PatchSize8(prefix + 4, kClusterPrefixSize - kClusterHeaderSize + jpeg.size());
+  prefix[12] = static_cast<uint8_t>(kIdTimecode);
+  prefix[13] = 0x88;
+  PutBe(prefix + 14, timecode, 8);
+  prefix[22] = static_cast<uint8_t>(kIdSimpleBlock);
+  PatchSize8(prefix + 23, 4 + jpeg.size());
+  prefix[31] = 0x81;
+  prefix[32] = 0;
+  prefix[33] = 0;
+  prefix[34] = 0x80;
+  file_.seekp(static_cast<std::streamoff>(file_size_));
+  file_.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+  file_.write(reinterpret_cast<const char*>(jpeg.data()),
+              static_cast<std::streamsize>(jpeg.size()));
+  file_.flush();
+  if (!file_) {
+    return Fail(L"Не удалось записать кадр в поток MJPEG: ", error);
+  }
+  clusters_.push_back(Cluster{timecode, file_size_ - layout.segment_data});
+  file_size_ += sizeof(prefix) + jpeg.size();
+  return true;
+}
+
+bool MjpegStreamWriter::Finalize(std::wstring* error) {
+  if (!open_) {
+    return true;
+  }
+  if (file_size_ == 0) {
+    open_ = false;
+    return true;
+  }
+  const HeaderLayout& layout = Layout();
+  std::vector<uint8_t>& cues = scratch_;
+  cues.clear();
+  const size_t cues_size = BeginMaster(kIdCues, &cues);
+  std::vector<uint8_t> positions;
+  std::vector<uint8_t> point;
+  for (const Cluster& cluster : clusters_) {
+    positions.clear();
+    PutUint(kIdCueTrack, 1, 1, &positions);
+    PutUint(kIdCueClusterPosition, cluster.position, 8, &positions);
+    point.clear();
+    PutUint(kIdCueTime, cluster.timecode, 8, &point);
+    PutSmallMaster(kIdCueTrackPositions, positions, &point);
+    PutSmallMaster(kIdCuePoint, point, &cues);
+  }
+  EndMaster(cues_size, &cues);
+  const uint64_t cues_position = file_size_ - layout.segment_data;
+  file_.seekp(static_cast<std::streamoff>(file_size_));
+  file_.write(reinterpret_cast<const char*>(cues.data()),
+              static_cast<std::streamsize>(cues.size()));
+
+  // SeekHead (Info, Tracks, Cues) в зарезервированном месте, остаток — Void.
+  std::vector<uint8_t> seek_head;
+  const struct {
+    uint32_t id;
+    uint64_t position;
+  } targets[] = {{kIdInfo, layout.info - layout.segment_data},
+                 {kIdTracks, layout.tracks - layout.segment_data},
+                 {kIdCues, cues_position}};
+  std::vector<uint8_t> seeks;
+  std::vector<uint8_t> seek;
+  for (const auto& target : targets) {
+    seek.clear();
+    PutUint(kIdSeekId, target.id, 4, &seek);
+    PutUint(kIdSeekPosition, target.position, 8, &seek);
+    PutSmallMaster(kIdSeek, seek, &seeks);
+  }
+  PutSmallMaster(kIdSeekHead, seeks, &seek_head);
+  const size_t void_size = kSeekHeadReserve - seek_head.size();
+  seek_head.resize(kSeekHeadReserve);
+  PutVoid(void_size, seek_head.data() + kSeekHeadReserve - void_size);
+
+  uint8_t patch[8];
+  PatchSize8(patch,
+             file_size_ + cues.size() - layout.segment_data);
+  file_.seekp(static_cast<std::streamoff>(layout.segment_size));
+  file_.write(reinterpret_cast<const char*>(patch), sizeof(patch));
+  file_.write(reinterpret_cast<const char*>(seek_head.data()),
+              static_cast<std::streamsize>(seek_head.size()));
+  PutBe(patch, DoubleBits(static_cast<double>(clusters_.back().timecode +
+                                              frame_ms_)),
+        8);
+  file_.seekp(static_cast<std::streamoff>(layout.duration));
+  file_.write(reinterpret_cast<const char*>(patch), sizeof(patch));
+  file_.flush();
+  if (!file_) {
+    return Fail(L"Не удалось записать индекс потока MJPEG: ", error);
+  }
+  file_.close();
+  open_ = false;
+  return true;
+}
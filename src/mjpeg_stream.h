@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Daily Motion-JPEG stream of one display in a Matroska (.mkv) file: every
+// frame is appended as its own cluster with one keyframe SimpleBlock, so a
+// frame costs one sequential append. Until Finalize the segment has unknown
+// size and no cues, which players handle as a live stream: a file cut by a
+// killed process stays playable up to the last complete frame. Finalize
+// appends the cues (seek index) and fills in SeekHead, Duration and the
+// segment size; Open on an existing file strips the index again and keeps
+// appending.
+//
+// Frames are timed for time-lapse playback: frame N at N * frame_ms.
+
+class MjpegStreamWriter {
+ public:
+  MjpegStreamWriter() = default;
+  // Closes without Finalize; the file stays playable, the index is rebuilt
+  // by the next Open + Finalize.
+  ~MjpegStreamWriter() = default;
+  MjpegStreamWriter(const MjpegStreamWriter&) = delete;
+  MjpegStreamWriter& operator=(const MjpegStreamWriter&) = delete;
+
+  // Starts or resumes the stream at path. The file is created by the first
+  // Append; an existing one keeps its frame size and timing, a torn tail
+  // cluster is truncated. Output: false + error when the file is not a
+  // stream of this writer or cannot be repaired.
+  bool Open(const std::wstring& path, uint32_t frame_ms, std::wstring* error);
+  bool IsOpen() const { return open_; }
+  const std::wstring& Path() const { return path_; }
+  uint64_t Frames() const { return clusters_.size(); }
+  uint32_t Width() const { return width_; }
+  uint32_t Height() const { return height_; }
+  // Bytes of a torn last cluster removed by Open.
+  uint64_t TruncatedBytes() const { return truncated_bytes_; }
+
+  // False when the stream already has frames of another size: the caller
+  // finalizes it and continues in a new file.
+  bool Accepts(uint32_t width, uint32_t height) const;
+  bool Append(const std::vector<uint8_t>& jpeg, uint32_t width,
+              uint32_t height, std::wstring* error);
+  // Writes the index and closes the stream.
+  bool Finalize(std::wstring* error);
+
+ private:
+  struct Cluster {
+    uint64_t timecode = 0;
+    // Offset of the cluster from the segment data start.
+    uint64_t position = 0;
+  };
+
+  bool Fail(const wchar_t* message, std::wstring* error);
+
+  std::fstream file_;
+  std::wstring path_;
+  bool open_ = false;
+  uint32_t frame_ms_ = 0;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint64_t file_size_ = 0;
+  uint64_t truncated_bytes_ = 0;
+  std::vector<Cluster> clusters_;
+  std::vector<uint8_t> scratch_;
+};
@@ -119,7 +119,7 @@ bool EnsureDirectories(const OutputPaths& paths,
 std::wstring BuildFileName(const std::wstring& computer,
                            const std::wstring& user,
                            const DateTimeParts& dt, int display_index,
-                           int display_count) {
+                           int display_count, const wchar_t* extension) {
   std::wstring base = computer + L"_" + user + L"_" + FormatDate(dt) + L"_" +
                       FormatTime(dt);
   if (display_count > 1) {
@@ -127,6 +127,21 @@ std::wstring BuildFileName(const std::wstring& computer,
     swprintf_s(suffix, L"_Display%02d", display_index + 1);
     base += suffix;
   }
-  base += L".jpg";
+  base += extension;
+  return base;
+}
+
+std::wstring BuildArchiveFileName(const std::wstring& computer,
+                                  const std::wstring& user,
+                                  const DateTimeParts& dt, int display_index,
+                                  int display_count,
+                                  const wchar_t* extension) {
+  std::wstring base = computer + L"_" + user + L"_" + FormatDate(dt);
+  if (display_count > 1) {
+    wchar_t suffix[32] = {};
+    swprintf_s(suffix, L"_Display%02d", display_index + 1);
+    base += suffix;
+  }
+  base += extension;
   return base;
 }
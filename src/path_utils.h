@@ -31,8 +31,17 @@ bool EnsureDirectories(const OutputPaths& paths,
                        std::vector<std::wstring>* created,
                        std::wstring* error);
 
-// Generates file name for a display.
+// Generates file name for a display; extension includes the dot.
 std::wstring BuildFileName(const std::wstring& computer,
                            const std::wstring& user,
                            const DateTimeParts& dt, int display_index,
-                           int display_count);
+                           int display_count,
+                           const wchar_t* extension = L".jpg");
+
+// Generates daily archive file name of a display (no time of day):
+// PC_USER_YYYY-MM-DD[_DisplayNN] + extension (.p2pack / .p2idx).
+std::wstring BuildArchiveFileName(const std::wstring& computer,
+                                  const std::wstring& user,
+                                  const DateTimeParts& dt, int display_index,
+                                  int display_count,
+                                  const wchar_t* extension);
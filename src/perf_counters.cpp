@@ -0,0 +1,285 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <locale>
+#include <sstream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+thread_local PerfProfile* t_perf_profile = nullptr;
+
+const char* const kStageNames[kPerfStageCount] = {
+    "capture_copy", "convert", "encode", "hash", "write"};
+const char* const kCounterNames[kPerfCounterCount] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "task_clock_ns"};
+
+#if defined(__linux__)
+struct CounterConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+// PERF_COUNT_HW_CACHE_MISSES — промахи последнего уровня кэша (LLC) на
+// x86 и большинстве ARM.
+const CounterConfig kConfigs[kPerfCounterCount] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+int OpenCounter(const CounterConfig& config, bool exclude_kernel) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = config.type;
+  attr.config = config.config;
+  attr.exclude_kernel = exclude_kernel ? 1 : 0;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // pid 0, cpu -1: только вызывающий поток, на любом ядре.
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                                  PERF_FLAG_FD_CLOEXEC));
+}
+
+std::wstring ErrnoText(int code) {
+  const std::string text = std::strerror(code);
+  return std::wstring(text.begin(), text.end());
+}
+#endif
+
+}  // namespace
+
+const char* PerfStageName(PerfStage stage) {
+  return kStageNames[static_cast<size_t>(stage)];
+}
+
+const char* PerfCounterName(PerfCounter counter) {
+  return kCounterNames[static_cast<size_t>(counter)];
+}
+
+PerfProfile::~PerfProfile() { Detach(); }
+
+bool PerfProfile::Attach(std::wstring* error) {
+  Detach();
+#if defined(__linux__)
+  bool any = false;
+  int open_errno = 0;
+  for (size_t i = 0; i < kPerfCounterCount; ++i) {
+    // Обоснование: запись в файл идет в основном в ядре — сначала счетчик
+    // с ядром, при perf_event_paranoid >= 2 только пользовательский код.
+    int fd = OpenCounter(kConfigs[i], false);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+      fd = OpenCounter(kConfigs[i], true);
+    }
+    if (fd < 0) {
+      open_errno = errno;
+    }
+    fds_[i] = fd;
+    available_[i] = fd >= 0;
+    any = any || fd >= 0;
+  }
+  if (!any) {
+    if (error) {
+      *error = L"Счетчики производительности недоступны (perf_event_open: " +
+               ErrnoText(open_errno) + L").";
+    }
+    return false;
+  }
+#else
+  if (error) {
+    *error = L"Счетчики производительности есть только в сборке для Linux.";
+  }
+  return false;
+#endif
+  depth_ = 0;
+  overflow_ = 0;
+  Read(&last_);
+  t_perf_profile = this;
+  return true;
+}
+
+void PerfProfile::Detach() {
+  if (t_perf_profile == this) {
+    t_perf_profile = nullptr;
+  }
+  for (int& fd : fds_) {
+#if defined(__linux__)
+    if (fd >= 0) {
+      close(fd);
+    }
+#endif
+    fd = -1;
+  }
+}
+
+bool PerfProfile::Has(PerfCounter counter) const {
+  return available_[static_cast<size_t>(counter)];
+}
+
+const PerfValues& PerfProfile::Stage(PerfStage stage) const {
+  return stages_[static_cast<size_t>(stage)];
+}
+
+bool PerfProfile::Read(PerfValues* out) const {
+  out->fill(0);
+#if defined(__linux__)
+  for (size_t i = 0; i < kPerfCounterCount; ++i) {
+    if (fds_[i] < 0) {
+      continue;
+    }
+    // value, time_enabled, time_running.
+    uint64_t data[3] = {};
+    if (read(fds_[i], data, sizeof(data)) != sizeof(data)) {
+      return false;
+    }
+    // Счетчик, вытесненный мультиплексированием, масштабируется на долю
+    // времени, которую он работал.
+    (*out)[i] = data[2] == 0 || data[2] == data[1]
+                    ? data[0]
+                    : static_cast<uint64_t>(static_cast<double>(data[0]) *
+                                            data[1] / data[2]);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PerfProfile::Boundary() {
+  PerfValues now;
+  Read(&now);
+  if (depth_ > 0) {
+    PerfValues& stage = stages_[static_cast<size_t>(stack_[depth_ - 1])];
+    for (size_t i = 0; i < kPerfCounterCount; ++i) {
+      stage[i] += now[i] > last_[i] ? now[i] - last_[i] : 0;
+    }
+  }
+  last_ = now;
+}
+
+void PerfProfile::Enter(PerfStage stage) {
+  Boundary();
+  if (depth_ < kMaxDepth) {
+    stack_[depth_++] = stage;
+  } else {
+    ++overflow_;
+  }
+}
+
+void PerfProfile::Exit() {
+  Boundary();
+  if (overflow_ > 0) {
+    --overflow_;
+  } else if (depth_ > 0) {
+    --depth_;
+  }
+}
+
+std::string PerfProfile::Report() const {
+  std::ostringstream out;
+  out.imbue(std::locale::classic());
+  out.setf(std::ios::fixed);
+  out.precision(2);
+  const double megapixels = pixels_ / 1e6;
+  auto ratio = [&](PerfCounter counter, const PerfValues& values,
+                   double divisor) {
+    std::ostringstream value;
+    value.imbue(std::locale::classic());
+    value.setf(std::ios::fixed);
+    value.precision(2);
+    if (!Has(counter) || divisor <= 0) {
+      return std::string("-");
+    }
+    value << values[static_cast<size_t>(counter)] / divisor;
+    return value.str();
+  };
+  for (size_t i = 0; i < kPerfStageCount; ++i) {
+    const PerfValues& values = stages_[i];
+    const double cycles =
+        Has(PerfCounter::kCycles)
+            ? static_cast<double>(
+                  values[static_cast<size_t>(PerfCounter::kCycles)])
+            : 0;
+    out << kStageNames[i] << ": IPC "
+        << ratio(PerfCounter::kInstructions, values, cycles)
+        << ", LLC misses/MP "
+        << ratio(PerfCounter::kLlcMisses, values, megapixels)
+        << ", branch misses/MP "
+        << ratio(PerfCounter::kBranchMisses, values, megapixels)
+        << ", CPU ms " << ratio(PerfCounter::kTaskClock, values, 1e6)
+        << '\n';
+  }
+  return out.str();
+}
+
+std::string PerfProfile::ReportJson() const {
+  std::ostringstream out;
+  out.imbue(std::locale::classic());
+  out.precision(6);
+  const double megapixels = pixels_ / 1e6;
+  out << "{\"megapixels\": " << megapixels << ", \"counters\": [";
+  bool first = true;
+  for (size_t i = 0; i < kPerfCounterCount; ++i) {
+    if (available_[i]) {
+      out << (first ? "" : ", ") << '"' << kCounterNames[i] << '"';
+      first = false;
+    }
+  }
+  out << "], \"stages\": {";
+  for (size_t s = 0; s < kPerfStageCount; ++s) {
+    const PerfValues& values = stages_[s];
+    out << (s ? ", " : "") << '"' << kStageNames[s] << "\": {";
+    for (size_t i = 0; i < kPerfCounterCount; ++i) {
+      out << '"' << kCounterNames[i] << "\": ";
+      if (available_[i]) {
+        out << values[i];
+      } else {
+        out << "null";
+      }
+      out << ", ";
+    }
+    auto rate = [&](PerfCounter counter, double divisor) {
+      if (!Has(counter) || divisor <= 0) {
+        out << "null";
+      } else {
+        out << values[static_cast<size_t>(counter)] / divisor;
+      }
+    };
+    const double cycles =
+        Has(PerfCounter::kCycles)
+            ? static_cast<double>(
+                  values[static_cast<size_t>(PerfCounter::kCycles)])
+            : 0;
+    out << "\"ipc\": ";
+    rate(PerfCounter::kInstructions, cycles);
+    out << ", \"llc_misses_per_mpix\": ";
+    rate(PerfCounter::kLlcMisses, megapixels);
+    out << ", \"branch_misses_per_mpix\": ";
+    rate(PerfCounter::kBranchMisses, megapixels);
+    out << '}';
+  }
+  out << "}}";
+  return out.str();
+}
+
+PerfScope::PerfScope(PerfStage stage) : profile_(t_perf_profile) {
+  if (profile_) {
+    profile_->Enter(stage);
+  }
+}
+
+PerfScope::~PerfScope() {
+  if (profile_) {
+    profile_->Exit();
+  }
+}
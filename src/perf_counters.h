@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Opt-in hardware counters per pipeline stage (Linux perf_event_open).
+//
+// A PerfProfile attached to a thread opens per-thread counters for it;
+// PerfScope marks a stage. Conversion, encode, hash and file write are
+// marked inside p2_core; the capture copy is marked by the code that
+// copies the captured frame. Time is attributed exclusively:
+// entering a nested stage closes the interval of the outer one, so a hash
+// inside the encoder counts as hash only. Threads without a profile (and
+// builds without perf_event) pay one thread-local check per scope. Work
+// done on helper threads (parallel resampling) is not counted.
+
+enum class PerfStage : uint8_t {
+  kCaptureCopy,
+  kConvert,
+  kEncode,
+  kHash,
+  kWrite,
+};
+constexpr size_t kPerfStageCount = 5;
+
+enum class PerfCounter : uint8_t {
+  kCycles,
+  kInstructions,
+  kLlcMisses,
+  kBranchMisses,
+  // Thread CPU time, ns (software counter; also works in VMs without a
+  // PMU).
+  kTaskClock,
+};
+constexpr size_t kPerfCounterCount = 5;
+
+// "capture_copy", "convert", "encode", "hash", "write".
+const char* PerfStageName(PerfStage stage);
+// "cycles", "instructions", "llc_misses", "branch_misses", "task_clock_ns".
+const char* PerfCounterName(PerfCounter counter);
+
+using PerfValues = std::array<uint64_t, kPerfCounterCount>;
+
+class PerfProfile {
+ public:
+  PerfProfile() = default;
+  ~PerfProfile();
+  PerfProfile(const PerfProfile&) = delete;
+  PerfProfile& operator=(const PerfProfile&) = delete;
+
+  // Opens the counters for the calling thread and routes its PerfScopes
+  // here. Counters the kernel or hardware does not provide are left out.
+  // Output: false + error when no counter could be opened (not Linux,
+  // perf_event_paranoid, no PMU in a VM); scopes then stay no-ops.
+  bool Attach(std::wstring* error);
+  void Detach();
+
+  bool Has(PerfCounter counter) const;
+  // Pixels of the frames the stages worked on (for per-megapixel rates).
+  void AddPixels(uint64_t pixels) { pixels_ += pixels; }
+  uint64_t Pixels() const { return pixels_; }
+  // Counter totals of a stage; scaled when the kernel multiplexed them.
+  const PerfValues& Stage(PerfStage stage) const;
+
+  // One line per stage with IPC, LLC and branch misses per megapixel and
+  // CPU time; "-" for counters that are missing.
+  std::string Report() const;
+  // The same as a JSON object (null for missing counters).
+  std::string ReportJson() const;
+
+ private:
+  friend class PerfScope;
+  static constexpr size_t kMaxDepth = 8;
+
+  bool Read(PerfValues* out) const;
+  // Closes the interval of the current stage at the boundary.
+  void Boundary();
+  void Enter(PerfStage stage);
+  void Exit();
+
+  std::array<int, kPerfCounterCount> fds_ = {-1, -1, -1, -1, -1};
+  // Counters opened by the last Attach (kept after Detach for reports).
+  std::array<bool, kPerfCounterCount> available_ = {};
+  std::array<PerfValues, kPerfStageCount> stages_ = {};
+  PerfValues last_ = {};
+  std::array<PerfStage, kMaxDepth> stack_ = {};
+  size_t depth_ = 0;
+  // Scopes deeper than kMaxDepth are not tracked.
+  size_t overflow_ = 0;
+  uint64_t pixels_ = 0;
+};
+
+// Marks stage for the lifetime of the object on the current thread.
+class PerfScope {
+ public:
+  explicit PerfScope(PerfStage stage);
+  ~PerfScope();
+  PerfScope(const PerfScope&) = delete;
+  PerfScope& operator=(const PerfScope&) = delete;
+
+ private:
+  PerfProfile* profile_;
+};
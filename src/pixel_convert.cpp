@@ -0,0 +1,435 @@
+#include "pixel_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "perf_counters.h"
+#include "simd.h"
+
+namespace {
+
+uint32_t FloatBits(float value) {
+  uint32_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float BitsToFloat(uint32_t bits) {
+  float value = 0.0f;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+uint32_t LoadU32(const uint8_t* src) {
+  uint32_t value = 0;
+  std::memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+void StoreU32(uint8_t* dst, uint32_t value) {
+  std::memcpy(dst, &value, sizeof(value));
+}
+
+uint16_t LoadU16(const uint8_t* src) {
+  uint16_t value = 0;
+  std::memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+float ToneCurve(float x, const ToneMapParams& params) {
+  const float knee = std::clamp(params.knee, 0.0f, 0.99f);
+  if (x <= knee) {
+    return x;
+  }
+  // Обоснование: extended Reinhard только выше колена — SDR-контент на
+  // HDR рабочем столе почти не меняется, а блики плавно сходятся к белому.
+  const float range = 1.0f - knee;
+  const float white = std::max(params.white_point, 1.0f);
+  const float s = (x - knee) / range;
+  const float ws = (white - knee) / range;
+  const float y = s * (1.0f + s / (ws * ws)) / (1.0f + s);
+  return std::min(knee + range * y, 1.0f);
+}
+
+float SrgbEncode(float linear) {
+  if (linear <= 0.0031308f) {
+    return 12.92f * linear;
+  }
+  return 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+uint8_t To8Bit(float value) {
+  const float scaled = std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f;
+  return static_cast<uint8_t>(scaled);
+}
+
+// 10 бит -> 8 бит с округлением: (c * 255 + 511) / 1023 без деления.
+uint32_t Unorm10To8(uint32_t c) {
+  const uint32_t t = (c << 8) - c + 511;
+  return (t + (t >> 10) + 1) >> 10;
+}
+
+uint32_t R10G10B10A2ToBgra8(uint32_t v) {
+  const uint32_t r = Unorm10To8(v & 0x3FF);
+  const uint32_t g = Unorm10To8((v >> 10) & 0x3FF);
+  const uint32_t b = Unorm10To8((v >> 20) & 0x3FF);
+  return b | (g << 8) | (r << 16) | 0xFF000000u;
+}
+
+uint32_t Rgba8ToBgra8(uint32_t v) {
+  return (v & 0xFF00FF00u) | ((v >> 16) & 0xFFu) | ((v & 0xFFu) << 16);
+}
+
+uint32_t LutIndex(float linear) {
+  const float lo = BitsToFloat(ToneMapLut::kBaseBits);
+  const float hi = std::ldexp(1.0f, ToneMapLut::kMaxExponent);
+  // NaN и отрицательные значения сводятся к нижней границе.
+  float x = linear > lo ? linear : lo;
+  x = x < hi ? x : hi;
+  const uint32_t index =
+      (FloatBits(x) - ToneMapLut::kBaseBits) >> ToneMapLut::kIndexShift;
+  return std::min(index, ToneMapLut::kSize - 1);
+}
+
+void Rgba16FPixelToBgra8(const uint8_t* src, uint8_t* dst,
+                         const ToneMapLut& lut) {
+  dst[0] = lut.Map(HalfToFloat(LoadU16(src + 4)));
+  dst[1] = lut.Map(HalfToFloat(LoadU16(src + 2)));
+  dst[2] = lut.Map(HalfToFloat(LoadU16(src + 0)));
+  dst[3] = 255;
+}
+
+#if P2_HAVE_SSE2
+
+// Половинки (в младших 16 битах 32-битных дорожек) -> float.
+// Обоснование: F16C не гарантирован на целевых машинах, SSE2-вариант
+// корректно обрабатывает денормали, inf и NaN.
+__m128 HalfToFloat4(__m128i h) {
+  const __m128i mask_nosign = _mm_set1_epi32(0x7FFF);
+  const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+  const __m128i was_infnan = _mm_set1_epi32(0x7BFF);
+  const __m128i exp_infnan = _mm_set1_epi32(255 << 23);
+  const __m128i expmant = _mm_and_si128(mask_nosign, h);
+  const __m128i justsign = _mm_xor_si128(h, expmant);
+  const __m128i shifted = _mm_slli_epi32(expmant, 13);
+  const __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(shifted), magic);
+  const __m128i infnan = _mm_cmpgt_epi32(expmant, was_infnan);
+  const __m128i sign = _mm_slli_epi32(justsign, 16);
+  const __m128i infnan_exp = _mm_and_si128(infnan, exp_infnan);
+  const __m128i sign_inf = _mm_or_si128(sign, infnan_exp);
+  return _mm_or_ps(scaled, _mm_castsi128_ps(sign_inf));
+}
+
+__m128i LutIndex4(__m128 x) {
+  const __m128 lo = _mm_castsi128_ps(_mm_set1_epi32(ToneMapLut::kBaseBits));
+  const __m128 hi = _mm_castsi128_ps(_mm_set1_epi32(
+      static_cast<int>(((127u + ToneMapLut::kMaxExponent) << 23) - 1)));
+  // _mm_max_ps возвращает второй операнд для NaN, поэтому NaN -> lo.
+  x = _mm_min_ps(_mm_max_ps(x, lo), hi);
+  const __m128i bits = _mm_sub_epi32(
+      _mm_castps_si128(x),
+      _mm_set1_epi32(static_cast<int>(ToneMapLut::kBaseBits)));
+  return _mm_srli_epi32(bits, ToneMapLut::kIndexShift);
+}
+
+#endif
+
+}  // namespace
+
+ToneMapLut::ToneMapLut(const ToneMapParams& params) {
+  for (uint32_t i = 0; i < kSize; ++i) {
+    // Значение в середине корзины, чтобы ошибка была симметричной.
+    const uint32_t bits =
+        kBaseBits + (i << kIndexShift) + (1u << (kIndexShift - 1));
+    const float linear = BitsToFloat(bits) * params.exposure;
+    table_[i] = To8Bit(SrgbEncode(ToneCurve(linear, params)));
+  }
+}
+
+uint8_t ToneMapLut::Map(float linear) const {
+  return table_[LutIndex(linear)];
+}
+
+const ToneMapLut& DefaultToneMapLut() {
+  static const ToneMapLut lut{ToneMapParams{}};
+  return lut;
+}
+
+uint8_t ToneMapReference(float linear, const ToneMapParams& params) {
+  const float x = linear > 0.0f ? linear : 0.0f;
+  return To8Bit(SrgbEncode(ToneCurve(x, params)));
+}
+
+float HalfToFloat(uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1F;
+  const uint32_t mantissa = half & 0x3FF;
+  if (exponent == 0) {
+    const float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  }
+  if (exponent == 31) {
+    return BitsToFloat(sign | 0x7F800000u | (mantissa << 13));
+  }
+  return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+template <>
+void ConvertRowToBgra8<PixelFormat::kBgra8>(const uint8_t* src, uint8_t* dst,
+                                            uint32_t width,
+                                            const ToneMapLut&) {
+  std::memcpy(dst, src, static_cast<size_t>(width) * 4);
+}
+
+template <>
+void ConvertRowToBgra8<PixelFormat::kRgba8>(const uint8_t* src, uint8_t* dst,
+                                            uint32_t width,
+                                            const ToneMapLut&) {
+  uint32_t x = 0;
+#if P2_HAVE_SSE2
+  const __m128i keep = _mm_set1_epi32(static_cast<int>(0xFF00FF00u));
+  const __m128i low = _mm_set1_epi32(0xFF);
+  for (; x + 4 <= width; x += 4) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+    const __m128i r = _mm_and_si128(v, low);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+    const __m128i out = _mm_or_si128(_mm_and_si128(v, keep),
+                                     _mm_or_si128(b, _mm_slli_epi32(r, 16)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), out);
+  }
+#endif
+  for (; x < width; ++x) {
+    StoreU32(dst + x * 4, Rgba8ToBgra8(LoadU32(src + x * 4)));
+  }
+}
+
+template <>
+void ConvertRowToBgra8<PixelFormat::kR10G10B10A2>(const uint8_t* src,
+                                                  uint8_t* dst, uint32_t width,
+                                                  const ToneMapLut&) {
+  uint32_t x = 0;
+#if P2_HAVE_SSE2
+  const __m128i mask10 = _mm_set1_epi32(0x3FF);
+  const __m128i bias = _mm_set1_epi32(511);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+  auto to8 = [&](__m128i c) {
+    const __m128i t =
+        _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), bias);
+    return _mm_srli_epi32(
+        _mm_add_epi32(_mm_add_epi32(t, _mm_srli_epi32(t, 10)), one), 10);
+  };
+  for (; x + 4 <= width; x += 4) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+    const __m128i r = to8(_mm_and_si128(v, mask10));
+    const __m128i g = to8(_mm_and_si128(_mm_srli_epi32(v, 10), mask10));
+    const __m128i b = to8(_mm_and_si128(_mm_srli_epi32(v, 20), mask10));
+    const __m128i out = _mm_or_si128(
+        _mm_or_si128(b, _mm_slli_epi32(g, 8)),
+        _mm_or_si128(_mm_slli_epi32(r, 16), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), out);
+  }
+#endif
+  for (; x < width; ++x) {
+    StoreU32(dst + x * 4, R10G10B10A2ToBgra8(LoadU32(src + x * 4)));
+  }
+}
+
+template <>
+void ConvertRowToBgra8<PixelFormat::kRgba16F>(const uint8_t* src,
+                                              uint8_t* dst, uint32_t width,
+                                              const ToneMapLut& lut) {
+  uint32_t x = 0;
+  // Экспозиция учтена при построении LUT, индекс берется от исходного значения.
+#if P2_HAVE_SSE2
+  const uint8_t* table = lut.data();
+  alignas(16) uint32_t index[8];
+  for (; x + 2 <= width; x += 2) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 8));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 p0 = HalfToFloat4(_mm_unpacklo_epi16(v, zero));
+    const __m128 p1 = HalfToFloat4(_mm_unpackhi_epi16(v, zero));
+    _mm_store_si128(reinterpret_cast<__m128i*>(index), LutIndex4(p0));
+    _mm_store_si128(reinterpret_cast<__m128i*>(index + 4), LutIndex4(p1));
+    uint8_t* out = dst + x * 4;
+    out[0] = table[index[2]];
+    out[1] = table[index[1]];
+    out[2] = table[index[0]];
+    out[3] = 255;
+    out[4] = table[index[6]];
+    out[5] = table[index[5]];
+    out[6] = table[index[4]];
+    out[7] = 255;
+  }
+#endif
+  for (; x < width; ++x) {
+    Rgba16FPixelToBgra8(src + x * 8, dst + x * 4, lut);
+  }
+}
+
+void ConvertRowToBgra8Reference(PixelFormat format, const uint8_t* src,
+                                uint8_t* dst, uint32_t width,
+                                const ToneMapParams& params) {
+  for (uint32_t x = 0; x < width; ++x) {
+    uint8_t* out = dst + x * 4;
+    switch (format) {
+      case PixelFormat::kBgra8:
+        std::memcpy(out, src + x * 4, 4);
+        break;
+      case PixelFormat::kRgba8: {
+        const uint8_t* px = src + x * 4;
+        out[0] = px[2];
+        out[1] = px[1];
+        out[2] = px[0];
+        out[3] = px[3];
+        break;
+      }
+      case PixelFormat::kR10G10B10A2: {
+        const uint32_t v = LoadU32(src + x * 4);
+        auto scale = [](uint32_t c) {
+          return static_cast<uint8_t>(std::lround(c * 255.0 / 1023.0));
+        };
+        out[0] = scale((v >> 20) & 0x3FF);
+        out[1] = scale((v >> 10) & 0x3FF);
+        out[2] = scale(v & 0x3FF);
+        out[3] = 255;
+        break;
+      }
+      case PixelFormat::kRgba16F: {
+        const uint8_t* px = src + x * 8;
+        out[0] = ToneMapReference(HalfToFloat(LoadU16(px + 4)) * params.exposure,
+                                  params);
+        out[1] = ToneMapReference(HalfToFloat(LoadU16(px + 2)) * params.exposure,
+                                  params);
+        out[2] = ToneMapReference(HalfToFloat(LoadU16(px + 0)) * params.exposure,
+                                  params);
+        out[3] = 255;
+        break;
+      }
+    }
+  }
+}
+
+bool ConvertToBgra8(const ImageBuffer& src, ImageBuffer* dst,
+                    const ToneMapLut& lut, std::wstring* error) {
+  const PerfScope perf_scope(PerfStage::kConvert);
+  if (!dst) {
+    if (error) {
+      *error = L"Не передан буфер для конвертации.";
+    }
+    return false;
+  }
+  const uint32_t bpp = BytesPerPixel(src.pixel_format);
+  if (src.width == 0 || src.height == 0 || src.stride < src.width * bpp ||
+      src.pixels.size() < static_cast<size_t>(src.stride) * src.height) {
+    if (error) {
+      *error = L"Некорректные данные изображения для конвертации.";
+    }
+    return false;
+  }
+  dst->width = src.width;
+  dst->height = src.height;
+  dst->stride = src.width * 4;
+  dst->pixel_format = PixelFormat::kBgra8;
+  dst->pixels.resize(static_cast<size_t>(dst->stride) * dst->height);
+  DispatchPixelFormat(src.pixel_format, [&](auto tag) {
+    constexpr PixelFormat kFormat = decltype(tag)::value;
+    for (uint32_t y = 0; y < src.height; ++y) {
+      ConvertRowToBgra8<kFormat>(
+          src.pixels.data() + static_cast<size_t>(y) * src.stride,
+          dst->pixels.data() + static_cast<size_t>(y) * dst->stride, src.width,
+          lut);
+    }
+  });
+  return true;
+}
+
+void Bgra8RowToLuma(const uint8_t* bgra, uint8_t* luma, uint32_t width) {
+  // Y = 0.299 R + 0.587 G + 0.114 B, веса в 15-битной фиксированной точке
+  // (сумма ровно 32768), чтобы поместиться в int16 для _mm_madd_epi16.
+  constexpr int kWeightB = 3735;
+  constexpr int kWeightG = 19235;
+  constexpr int kWeightR = 9798;
+  uint32_t x = 0;
+#if P2_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights =
+      _mm_setr_epi16(kWeightB, kWeightG, kWeightR, 0, kWeightB, kWeightG,
+                     kWeightR, 0);
+  const __m128i round = _mm_set1_epi32(1 << 14);
+  for (; x + 4 <= width; x += 4) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgra + x * 4));
+    // madd дает [b*wb + g*wg, r*wr] на пиксель; складываем соседние дорожки.
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+    lo = _mm_add_epi32(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_add_epi32(hi, _mm_srli_si128(hi, 4));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+    __m128i sum = _mm_unpacklo_epi64(lo, hi);
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, round), 15);
+    const __m128i packed = _mm_packs_epi32(sum, sum);
+    const int value = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+    std::memcpy(luma + x, &value, 4);
+  }
+#endif
+  for (; x < width; ++x) {
+    const uint8_t* px = bgra + x * 4;
+    luma[x] = static_cast<uint8_t>(
+        (px[0] * kWeightB + px[1] * kWeightG + px[2] * kWeightR + (1 << 14)) >>
+        15);
+  }
+}
+
+bool ConvertToGray8(const ImageBuffer& src, std::vector<uint8_t>* out,
+                    std::wstring* error) {
+  const PerfScope perf_scope(PerfStage::kConvert);
+  if (!out) {
+    if (error) {
+      *error = L"Не передан буфер для конвертации.";
+    }
+    return false;
+  }
+  const uint32_t bpp = BytesPerPixel(src.pixel_format);
+  if (src.width == 0 || src.height == 0 || src.stride < src.width * bpp ||
+      src.pixels.size() < static_cast<size_t>(src.stride) * src.height) {
+    if (error) {
+      *error = L"Некорректные данные изображения для конвертации.";
+    }
+    return false;
+  }
+  out->resize(static_cast<size_t>(src.width) * src.height);
+  DispatchPixelFormat(src.pixel_format, [&](auto tag) {
+    constexpr PixelFormat kFormat = decltype(tag)::value;
+    std::vector<uint8_t> scratch;
+    if constexpr (kFormat != PixelFormat::kBgra8) {
+      scratch.resize(static_cast<size_t>(src.width) * 4);
+    }
+    for (uint32_t y = 0; y < src.height; ++y) {
+      const uint8_t* row =
+          src.pixels.data() + static_cast<size_t>(y) * src.stride;
+      if constexpr (kFormat != PixelFormat::kBgra8) {
+        ConvertRowToBgra8<kFormat>(row, scratch.data(), src.width,
+                                   DefaultToneMapLut());
+        row = scratch.data();
+      }
+      Bgra8RowToLuma(row, out->data() + static_cast<size_t>(y) * src.width,
+                     src.width);
+    }
+  });
+  return true;
+}
+
+void SamplePixelBgra8(const ImageBuffer& image, uint32_t x, uint32_t y,
+                      uint8_t out[4]) {
+  const uint8_t* px = image.pixels.data() + static_cast<size_t>(y) * image.stride +
+                      static_cast<size_t>(x) * BytesPerPixel(image.pixel_format);
+  DispatchPixelFormat(image.pixel_format, [&](auto tag) {
+    ConvertRowToBgra8<decltype(tag)::value>(px, out, 1, DefaultToneMapLut());
+  });
+}
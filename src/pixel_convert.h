@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "image_buffer.h"
+
+// HDR -> SDR tone-mapping parameters (scRGB linear: 1.0 = SDR white, 80 nit).
+struct ToneMapParams {
+  // Multiplier applied before the curve (1 / SDR white level).
+  float exposure = 1.0f;
+  // Linear level below which values pass through unchanged.
+  float knee = 0.8f;
+  // Linear level mapped to full white; brighter values clip.
+  float white_point = 4.0f;
+};
+
+// Precomputed tone curve + sRGB encode, indexed by the float bit pattern.
+// Input: linear value. Output: 8-bit sRGB code (max error 1 vs exact math).
+class ToneMapLut {
+ public:
+  // Index covers [2^-12, 2^6): 18 octaves with 8 mantissa bits each.
+  static constexpr int kMinExponent = -12;
+  static constexpr int kMaxExponent = 6;
+  static constexpr int kMantissaBits = 8;
+  static constexpr uint32_t kSize =
+      static_cast<uint32_t>(kMaxExponent - kMinExponent) << kMantissaBits;
+  static constexpr uint32_t kIndexShift = 23 - kMantissaBits;
+  static constexpr uint32_t kBaseBits =
+      static_cast<uint32_t>(127 + kMinExponent) << 23;
+
+  explicit ToneMapLut(const ToneMapParams& params);
+
+  // Maps linear value (after exposure) to 8-bit sRGB.
+  uint8_t Map(float linear) const;
+  const uint8_t* data() const { return table_.data(); }
+
+ private:
+  std::array<uint8_t, kSize> table_ = {};
+};
+
+// Returns LUT for default ToneMapParams, built once.
+const ToneMapLut& DefaultToneMapLut();
+
+// Exact tone curve + sRGB encode (scalar reference). Output: 0..255.
+uint8_t ToneMapReference(float linear, const ToneMapParams& params);
+
+// Converts IEEE half float bits to float (scalar, handles denormals/inf/nan).
+float HalfToFloat(uint16_t half);
+
+// Converts `width` pixels of Format into BGRA8 (alpha = 255 for 10-bit/FP16).
+// Specialized per format; vectorized with SSE2 where available.
+template <PixelFormat Format>
+void ConvertRowToBgra8(const uint8_t* src, uint8_t* dst, uint32_t width,
+                       const ToneMapLut& lut);
+template <>
+void ConvertRowToBgra8<PixelFormat::kBgra8>(const uint8_t*, uint8_t*, uint32_t,
+                                            const ToneMapLut&);
+template <>
+void ConvertRowToBgra8<PixelFormat::kRgba8>(const uint8_t*, uint8_t*, uint32_t,
+                                            const ToneMapLut&);
+template <>
+void ConvertRowToBgra8<PixelFormat::kR10G10B10A2>(const uint8_t*, uint8_t*,
+                                                  uint32_t, const ToneMapLut&);
+template <>
+void ConvertRowToBgra8<PixelFormat::kRgba16F>(const uint8_t*, uint8_t*,
+                                              uint32_t, const ToneMapLut&);
+
+// Scalar per-pixel reference used to validate the vectorized kernels.
+void ConvertRowToBgra8Reference(PixelFormat format, const uint8_t* src,
+                                uint8_t* dst, uint32_t width,
+                                const ToneMapParams& params);
+
+template <PixelFormat Format>
+using PixelFormatTag = std::integral_constant<PixelFormat, Format>;
+
+// Calls fn(PixelFormatTag<F>{}) for the runtime format.
+// Обоснование: ветвление по формату выполняется один раз на кадр/строку,
+// внутренние циклы инстанцируются отдельно для каждого формата.
+template <typename Fn>
+decltype(auto) DispatchPixelFormat(PixelFormat format, Fn&& fn) {
+  switch (format) {
+    case PixelFormat::kRgba8:
+      return fn(PixelFormatTag<PixelFormat::kRgba8>{});
+    case PixelFormat::kR10G10B10A2:
+      return fn(PixelFormatTag<PixelFormat::kR10G10B10A2>{});
+    case PixelFormat::kRgba16F:
+      return fn(PixelFormatTag<PixelFormat::kRgba16F>{});
+    case PixelFormat::kBgra8:
+    default:
+      return fn(PixelFormatTag<PixelFormat::kBgra8>{});
+  }
+}
+
+// Converts image of any supported format to tightly packed BGRA8.
+// Output: dst resized and filled; false + error on invalid input.
+bool ConvertToBgra8(const ImageBuffer& src, ImageBuffer* dst,
+                    const ToneMapLut& lut, std::wstring* error);
+
+// Converts BGRA8 row to 8-bit luma (BT.601 full range, as in JFIF).
+void Bgra8RowToLuma(const uint8_t* bgra, uint8_t* luma, uint32_t width);
+
+// Converts image of any format to a packed 8-bit luma plane (stride = width).
+bool ConvertToGray8(const ImageBuffer& src, std::vector<uint8_t>* out,
+                    std::wstring* error);
+
+// Reads one pixel as BGRA8 (for sparse probes like black-frame detection).
+void SamplePixelBgra8(const ImageBuffer& image, uint32_t x, uint32_t y,
+                      uint8_t out[4]);
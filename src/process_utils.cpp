@@ -3,6 +3,7 @@
 #include <TlHelp32.h>
 
 #include <sstream>
+#include <utility>
 
 namespace {
 
@@ -72,7 +73,7 @@ bool SnapshotProcesses(std::vector<ProcessInfo>* out, std::wstring* error) {
       info.start_time = start_time;
       info.start_time_valid = true;
     }
-    out->push_back(info);
+    out->push_back(std::move(info));
   } while (Process32NextW(snapshot, &entry));
 
   CloseHandle(snapshot);
@@ -0,0 +1,348 @@
+#include "qoi_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "perf_counters.h"
+#include "pixel_convert.h"
+#include "simd.h"
+
+namespace {
+
+constexpr uint8_t kOpIndex = 0x00;
+constexpr uint8_t kOpDiff = 0x40;
+constexpr uint8_t kOpLuma = 0x80;
+constexpr uint8_t kOpRun = 0xC0;
+constexpr uint8_t kOpRgb = 0xFE;
+constexpr uint8_t kOpRgba = 0xFF;
+constexpr uint8_t kMask2 = 0xC0;
+constexpr size_t kHeaderSize = 14;
+constexpr uint8_t kEndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+constexpr uint32_t kMaxRun = 62;
+// Пиксель как uint32 из байт BGRA8 (little-endian: B в младшем байте).
+constexpr uint32_t kOpaque = 0xFF000000u;
+constexpr uint32_t kBandRows = 16;
+
+inline uint32_t LoadPixel(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, 4);
+  return value | kOpaque;
+}
+
+inline uint32_t ColorHash(uint32_t px) {
+  const uint32_t r = (px >> 16) & 0xFF;
+  const uint32_t g = (px >> 8) & 0xFF;
+  const uint32_t b = px & 0xFF;
+  const uint32_t a = px >> 24;
+  return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+}
+
+// Число пикселей подряд, равных px, начиная с row (не больше count).
+uint32_t RunLength(const uint8_t* row, uint32_t count, uint32_t px) {
+  uint32_t n = 0;
+#if P2_HAVE_SSE2
+  // Обоснование: на экранном контенте большая часть пикселей — длинные
+  // серии (фон, заливки); сравнение 4 пикселей за инструкцию.
+  const __m128i target = _mm_set1_epi32(static_cast<int>(px));
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(kOpaque));
+  for (; n + 4 <= count; n += 4) {
+    const __m128i v = _mm_or_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + n * 4)),
+        opaque);
+    uint32_t mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi32(v, target)));
+    if (mask != 0xFFFF) {
+      while (mask & 1) {
+        mask >>= 4;
+        ++n;
+      }
+      return n;
+    }
+  }
+#endif
+  while (n < count && LoadPixel(row + n * 4) == px) {
+    ++n;
+  }
+  return n;
+}
+
+struct QoiState {
+  uint32_t prev = kOpaque;
+  uint32_t index[64] = {};
+  // Незаписанная серия повторов prev (может переходить через строки).
+  uint32_t run = 0;
+};
+
+// Запись в out: место резервируется построчно под худший случай.
+class QoiWriter {
+ public:
+  explicit QoiWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+  void Reserve(size_t bytes) {
+    const size_t pos = size();
+    if (pos + bytes > out_->size()) {
+      out_->resize(std::max(out_->size() * 2, pos + bytes));
+    }
+    dst_ = out_->data() + pos;
+  }
+  void Put(uint8_t value) { *dst_++ = value; }
+  size_t size() const { return dst_ ? dst_ - out_->data() : 0; }
+
+ private:
+  std::vector<uint8_t>* out_;
+  uint8_t* dst_ = nullptr;
+};
+
+class QoiCounter {
+ public:
+  void Reserve(size_t) {}
+  void Put(uint8_t) { ++bytes_; }
+  size_t size() const { return bytes_; }
+
+ private:
+  size_t bytes_ = 0;
+};
+
+template <typename Sink>
+void FlushRun(QoiState* state, Sink& sink) {
+  while (state->run > 0) {
+    const uint32_t n = std::min(state->run, kMaxRun);
+    sink.Put(static_cast<uint8_t>(kOpRun | (n - 1)));
+    state->run -= n;
+  }
+}
+
+template <typename Sink>
+void EncodeRow(const uint8_t* row, uint32_t width, QoiState* state,
+               Sink& sink) {
+  // Худший случай: OP_RGB (4 байта) на пиксель + серия прошлых строк.
+  sink.Reserve(static_cast<size_t>(width) * 4 + state->run / kMaxRun + 1);
+  uint32_t x = 0;
+  while (x < width) {
+    const uint32_t px = LoadPixel(row + static_cast<size_t>(x) * 4);
+    if (px == state->prev) {
+      const uint32_t n =
+          RunLength(row + static_cast<size_t>(x) * 4, width - x, px);
+      state->run += n;
+      x += n;
+      continue;
+    }
+    FlushRun(state, sink);
+    const uint32_t hash = ColorHash(px);
+    if (state->index[hash] == px) {
+      sink.Put(static_cast<uint8_t>(kOpIndex | hash));
+    } else {
+      state->index[hash] = px;
+      const uint32_t prev = state->prev;
+      const int dr = static_cast<int8_t>(((px >> 16) - (prev >> 16)) & 0xFF);
+      const int dg = static_cast<int8_t>(((px >> 8) - (prev >> 8)) & 0xFF);
+      const int db = static_cast<int8_t>((px - prev) & 0xFF);
+      const int dr_dg = dr - dg;
+      const int db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        sink.Put(static_cast<uint8_t>(kOpDiff | ((dr + 2) << 4) |
+                                      ((dg + 2) << 2) | (db + 2)));
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                 db_dg >= -8 && db_dg <= 7) {
+        sink.Put(static_cast<uint8_t>(kOpLuma | (dg + 32)));
+        sink.Put(static_cast<uint8_t>(((dr_dg + 8) << 4) | (db_dg + 8)));
+      } else {
+        sink.Put(kOpRgb);
+        sink.Put(static_cast<uint8_t>(px >> 16));
+        sink.Put(static_cast<uint8_t>(px >> 8));
+        sink.Put(static_cast<uint8_t>(px));
+      }
+    }
+    state->prev = px;
+    ++x;
+  }
+}
+
+// Кодирует строки [y0, y1) источника любого формата.
+template <typename Sink>
+void EncodeRows(const ImageBuffer& image, uint32_t y0, uint32_t y1,
+                QoiState* state, std::vector<uint8_t>* scratch, Sink& sink) {
+  DispatchPixelFormat(image.pixel_format, [&](auto tag) {
+    constexpr PixelFormat kFormat = decltype(tag)::value;
+    if constexpr (kFormat != PixelFormat::kBgra8) {
+      scratch->resize(static_cast<size_t>(image.width) * 4);
+    }
+    for (uint32_t y = y0; y < y1; ++y) {
+      const uint8_t* row =
+          image.pixels.data() + static_cast<size_t>(y) * image.stride;
+      if constexpr (kFormat != PixelFormat::kBgra8) {
+        ConvertRowToBgra8<kFormat>(row, scratch->data(), image.width,
+                                   DefaultToneMapLut());
+        row = scratch->data();
+      }
+      EncodeRow(row, image.width, state, sink);
+    }
+  });
+}
+
+bool ValidImage(const ImageBuffer& image) {
+  return image.width > 0 && image.height > 0 &&
+         image.stride >= image.width * BytesPerPixel(image.pixel_format) &&
+         image.pixels.size() >=
+             static_cast<size_t>(image.stride) * image.height;
+}
+
+void PutU32(uint8_t* dst, uint32_t value) {
+  dst[0] = static_cast<uint8_t>(value >> 24);
+  dst[1] = static_cast<uint8_t>(value >> 16);
+  dst[2] = static_cast<uint8_t>(value >> 8);
+  dst[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t GetU32(const uint8_t* src) {
+  return (static_cast<uint32_t>(src[0]) << 24) |
+         (static_cast<uint32_t>(src[1]) << 16) |
+         (static_cast<uint32_t>(src[2]) << 8) | src[3];
+}
+
+}  // namespace
+
+bool EncodeQoi(const ImageBuffer& image, std::vector<uint8_t>* out,
+               std::wstring* error) {
+  const PerfScope perf_scope(PerfStage::kEncode);
+  if (!out || !ValidImage(image)) {
+    if (error) {
+      *error = L"Некорректные данные изображения.";
+    }
+    return false;
+  }
+  uint8_t header[kHeaderSize] = {'q', 'o', 'i', 'f'};
+  PutU32(header + 4, image.width);
+  PutU32(header + 8, image.height);
+  header[12] = 3;  // RGB
+  header[13] = 0;  // sRGB
+
+  QoiWriter writer(out);
+  writer.Reserve(kHeaderSize);
+  for (uint8_t value : header) {
+    writer.Put(value);
+  }
+  QoiState state;
+  std::vector<uint8_t> scratch;
+  EncodeRows(image, 0, image.height, &state, &scratch, writer);
+  writer.Reserve(state.run / kMaxRun + 1 + sizeof(kEndMarker));
+  FlushRun(&state, writer);
+  for (uint8_t value : kEndMarker) {
+    writer.Put(value);
+  }
+  out->resize(writer.size());
+  return true;
+}
+
+size_t EstimateQoiSize(const ImageBuffer& image, uint32_t step) {
+  if (!ValidImage(image)) {
+    return 0;
+  }
+  step = std::max<uint32_t>(step, 1);
+  const uint32_t bands = (image.height + kBandRows - 1) / kBandRows;
+  QoiState state;
+  std::vector<uint8_t> scratch;
+  QoiCounter counter;
+  uint32_t sampled_rows = 0;
+  // Обоснование: полоса внутри группы из step полос сдвигается от группы к
+  // группе (все фазы за step групп) — шаг выборки не совпадает с периодом
+  // окон, строк текста и панелей рабочего стола.
+  for (uint32_t group = 0; group * step < bands; ++group) {
+    const uint32_t band = group * step + (group * 3 + step / 2) % step;
+    if (band >= bands) {
+      break;
+    }
+    const uint32_t y0 = band * kBandRows;
+    const uint32_t y1 = std::min(y0 + kBandRows, image.height);
+    EncodeRows(image, y0, y1, &state, &scratch, counter);
+    if (step > 1) {
+      FlushRun(&state, counter);
+      state = QoiState();
+    }
+    sampled_rows += y1 - y0;
+  }
+  FlushRun(&state, counter);
+  if (sampled_rows == 0) {
+    return kHeaderSize + sizeof(kEndMarker);
+  }
+  const double scale =
+      static_cast<double>(image.height) / static_cast<double>(sampled_rows);
+  return kHeaderSize + sizeof(kEndMarker) +
+         static_cast<size_t>(static_cast<double>(counter.size()) * scale);
+}
+
+bool DecodeQoi(const std::vector<uint8_t>& data, ImageBuffer* out,
+               std::wstring* error) {
+  auto fail = [&]() {
+    if (error) {
+      *error = L"Поврежденный поток QOI.";
+    }
+    return false;
+  };
+  if (!out || data.size() < kHeaderSize + sizeof(kEndMarker) ||
+      std::memcmp(data.data(), "qoif", 4) != 0) {
+    return fail();
+  }
+  const uint32_t width = GetU32(data.data() + 4);
+  const uint32_t height = GetU32(data.data() + 8);
+  const uint64_t pixels = static_cast<uint64_t>(width) * height;
+  if (width == 0 || height == 0 || pixels > (1ull << 30)) {
+    return fail();
+  }
+  out->width = width;
+  out->height = height;
+  out->stride = width * 4;
+  out->pixel_format = PixelFormat::kBgra8;
+  out->pixels.resize(static_cast<size_t>(pixels) * 4);
+
+  uint8_t px[4] = {0, 0, 0, 255};  // B, G, R, A
+  uint8_t index[64][4] = {};
+  const size_t end = data.size() - sizeof(kEndMarker);
+  size_t pos = kHeaderSize;
+  uint32_t run = 0;
+  for (uint64_t i = 0; i < pixels; ++i) {
+    if (run > 0) {
+      --run;
+    } else {
+      if (pos >= end) {
+        return fail();
+      }
+      const uint8_t op = data[pos++];
+      if (op == kOpRgb || op == kOpRgba) {
+        const size_t size = op == kOpRgb ? 3 : 4;
+        if (pos + size > end) {
+          return fail();
+        }
+        px[2] = data[pos];
+        px[1] = data[pos + 1];
+        px[0] = data[pos + 2];
+        if (op == kOpRgba) {
+          px[3] = data[pos + 3];
+        }
+        pos += size;
+      } else if ((op & kMask2) == kOpIndex) {
+        std::memcpy(px, index[op], 4);
+      } else if ((op & kMask2) == kOpDiff) {
+        px[2] = static_cast<uint8_t>(px[2] + ((op >> 4) & 3) - 2);
+        px[1] = static_cast<uint8_t>(px[1] + ((op >> 2) & 3) - 2);
+        px[0] = static_cast<uint8_t>(px[0] + (op & 3) - 2);
+      } else if ((op & kMask2) == kOpLuma) {
+        if (pos >= end) {
+          return fail();
+        }
+        const int dg = (op & 0x3F) - 32;
+        const uint8_t next = data[pos++];
+        px[2] = static_cast<uint8_t>(px[2] + dg - 8 + ((next >> 4) & 0x0F));
+        px[1] = static_cast<uint8_t>(px[1] + dg);
+        px[0] = static_cast<uint8_t>(px[0] + dg - 8 + (next & 0x0F));
+      } else {
+        run = op & 0x3F;
+      }
+      const uint32_t hash =
+          (px[2] * 3u + px[1] * 5u + px[0] * 7u + px[3] * 11u) & 63;
+      std::memcpy(index[hash], px, 4);
+    }
+    std::memcpy(out->pixels.data() + i * 4, px, 4);
+  }
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image_buffer.h"
+
+// Lossless screen-content codec in the QOI format (qoiformat.org): pixel
+// runs, a 64-entry hashed color index and small deltas from the previous
+// pixel. Encoded as 3 channels (alpha is ignored), sRGB colorspace.
+
+// Encodes image (any PixelFormat; 10-bit/FP16 are tone-mapped to 8-bit
+// first). Output: out replaced with file bytes; false + error on invalid
+// input.
+bool EncodeQoi(const ImageBuffer& image, std::vector<uint8_t>* out,
+               std::wstring* error);
+
+// Returns encoded size estimated from every step-th band of 16 rows (step 1
+// = exact size). Each band starts from a fresh encoder state.
+size_t EstimateQoiSize(const ImageBuffer& image, uint32_t step);
+
+// Decodes a QOI stream into BGRA8 (tests and tools).
+// Output: false + error on a malformed stream.
+bool DecodeQoi(const std::vector<uint8_t>& data, ImageBuffer* out,
+               std::wstring* error);
@@ -0,0 +1,264 @@
+#include <Windows.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cwchar>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "codec_select.h"
+#include "frame_archive.h"
+#include "path_utils.h"
+#include "time_utils.h"
+
+// p2_query: lists frames of the capture catalog (PC_USER/catalog, written
+// with --catalog) by time range, display and activity, with the location
+// of each frame; the image folders are not read.
+
+namespace {
+
+// Порог --active: изменилась хотя бы одна полоса из 100.
+constexpr uint16_t kActiveChange = 10;
+
+struct QueryOptions {
+  std::wstring catalog_dir;
+  CatalogQuery query;
+  bool at = false;
+};
+
+void PrintUsage() {
+  std::wcerr << L"Использование: p2_query --catalog <папка PC_USER\\catalog>\n"
+             << L"                [--from YYYY-MM-DD_HH-MM-SS] "
+                L"[--to YYYY-MM-DD_HH-MM-SS]\n"
+             << L"                [--at YYYY-MM-DD_HH-MM-SS] [--display N]\n"
+             << L"                [--active] [--min-change PERMILLE] "
+                L"[--limit N]\n";
+  std::wcerr << L"Границы --from/--to включительно; --at печатает последний "
+                L"кадр каждого дисплея не позже момента.\n";
+  std::wcerr << L"--active оставляет кадры с изменениями (от 1% строк) без "
+                L"черных; --min-change задает порог в промилле.\n";
+}
+
+// Разбирает время в формате имен файлов: YYYY-MM-DD_HH-MM-SS.
+bool ParseTimestampArg(const std::wstring& value, int64_t* out) {
+  DateTimeParts dt;
+  wchar_t tail = 0;
+  if (swscanf_s(value.c_str(), L"%4d-%2d-%2d_%2d-%2d-%2d%c", &dt.year,
+                &dt.month, &dt.day, &dt.hour, &dt.minute, &dt.second, &tail,
+                1u) != 6 ||
+      dt.month < 1 || dt.month > 12 || dt.day < 1 || dt.day > 31 ||
+      dt.hour > 23 || dt.minute > 59 || dt.second > 59) {
+    return false;
+  }
+  *out = ArchiveTimestamp(dt);
+  return true;
+}
+
+bool ParseCountArg(const std::wstring& value, int min_value, int max_value,
+                   int* out) {
+  wchar_t* end = nullptr;
+  const long parsed = std::wcstol(value.c_str(), &end, 10);
+  if (value.empty() || *end != L'\0' || parsed < min_value ||
+      parsed > max_value) {
+    return false;
+  }
+  *out = static_cast<int>(parsed);
+  return true;
+}
+
+bool ParseArgs(int argc, wchar_t* argv[], QueryOptions* options,
+               std::wstring* error) {
+  CatalogQuery& query = options->query;
+  bool from_set = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::wstring arg = argv[i];
+    if (arg == L"--help" || arg == L"-h" || arg == L"/?") {
+      return false;
+    }
+    if (arg == L"--active") {
+      query.min_change = kActiveChange;
+      query.skip_black = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      *error = L"Не указан аргумент после " + arg + L".";
+      return false;
+    }
+    const std::wstring value = argv[++i];
+    int number = 0;
+    if (arg == L"--catalog") {
+      options->catalog_dir = value;
+    } else if (arg == L"--from") {
+      if (!ParseTimestampArg(value, &query.from)) {
+        *error = L"Некорректное значение --from.";
+        return false;
+      }
+      from_set = true;
+    } else if (arg == L"--to" || arg == L"--at") {
+      if (!ParseTimestampArg(value, &query.to)) {
+        *error = L"Некорректное значение " + arg + L".";
+        return false;
+      }
+      options->at = options->at || arg == L"--at";
+    } else if (arg == L"--display") {
+      if (!ParseCountArg(value, 1, 255, &number)) {
+        *error = L"Некорректное значение --display.";
+        return false;
+      }
+      query.display_index = number - 1;
+    } else if (arg == L"--min-change") {
+      if (!ParseCountArg(value, 0, 1000, &number)) {
+        *error = L"Некорректное значение --min-change.";
+        return false;
+      }
+      query.min_change = static_cast<uint16_t>(number);
+    } else if (arg == L"--limit") {
+      if (!ParseCountArg(value, 1, INT32_MAX, &number)) {
+        *error = L"Некорректное значение --limit.";
+        return false;
+      }
+      query.limit = static_cast<size_t>(number);
+    } else {
+      *error = L"Неизвестный аргумент: " + arg;
+      return false;
+    }
+  }
+  if (options->catalog_dir.empty()) {
+    *error = L"Нужен --catalog.";
+    return false;
+  }
+  // Обоснование: кадр на момент --at снят не раньше чем за сутки (начало
+  // дня и папка дня) — так запрос читает не больше двух файлов месяца.
+  if (options->at) {
+    if (query.limit > 0) {
+      *error = L"--at несовместим с --limit.";
+      return false;
+    }
+    if (!from_set) {
+      query.from = query.to - 86400;
+    }
+  }
+  if (query.from > query.to) {
+    *error = L"--from позже --to.";
+    return false;
+  }
+  return true;
+}
+
+// Имя части суточного потока, как при записи (--video).
+std::wstring VideoPartPath(const std::wstring& base, int part) {
+  return part == 0 ? base + L".mkv"
+                   : base + L"_part" + std::to_wstring(part + 1) + L".mkv";
+}
+
+// Где лежит кадр: файл, архив или поток дня, журнал ссылок хранилища.
+std::wstring FrameLocation(const std::wstring& pc_user_dir,
+                           const ArchiveIdentity& identity,
+                           const CatalogEntry& entry) {
+  const DateTimeParts dt = ArchiveDateTime(entry.timestamp);
+  const std::wstring day_dir =
+      JoinPath(JoinPath(pc_user_dir, FormatYearMonth(dt)), FormatDate(dt));
+  switch (entry.storage) {
+    case CatalogStorage::kArchive:
+      return JoinPath(day_dir, BuildArchiveFileName(
+                                   identity.computer, identity.user, dt,
+                                   entry.display_index, entry.display_count,
+                                   L".p2pack"));
+    case CatalogStorage::kVideo:
+      return VideoPartPath(
+          JoinPath(day_dir, BuildArchiveFileName(
+                                identity.computer, identity.user, dt,
+                                entry.display_index, entry.display_count,
+                                L"")),
+          entry.video_part);
+    case CatalogStorage::kStore:
+      return JoinPath(JoinPath(pc_user_dir, L"store\\refs"),
+                      FormatDate(dt) + L".p2refs");
+    case CatalogStorage::kFile:
+      break;
+  }
+  return JoinPath(day_dir,
+                  BuildFileName(identity.computer, identity.user, dt,
+                                entry.display_index, entry.display_count,
+                                OutputCodecExtension(entry.codec)));
+}
+
+void PrintEntry(const std::wstring& pc_user_dir,
+                const ArchiveIdentity& identity, const CatalogEntry& entry) {
+  const DateTimeParts dt = ArchiveDateTime(entry.timestamp);
+  wchar_t change[32] = {};
+  if (entry.change == kCatalogChangeUnknown) {
+    swprintf_s(change, L"-");
+  } else {
+    swprintf_s(change, L"%.1f%%", entry.change / 10.0);
+  }
+  std::wcout << FormatDate(dt) << L" " << FormatTime(dt) << L"  дисплей "
+             << entry.display_index + 1 << L"/" << entry.display_count
+             << L"  " << OutputCodecName(entry.codec) << L"  байт: "
+             << entry.size << L"  изменения: " << change
+             << (entry.black ? L"  черный" : L"") << L"  "
+             << FrameLocation(pc_user_dir, identity, entry) << L"\n";
+}
+
+}  // namespace
+
+int wmain(int argc, wchar_t* argv[]) {
+  QueryOptions options;
+  std::wstring error;
+  if (!ParseArgs(argc, argv, &options, &error)) {
+    if (!error.empty()) {
+      std::wcerr << error << L"\n";
+    }
+    PrintUsage();
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<CatalogEntry> entries;
+  ArchiveIdentity identity;
+  CatalogQueryStats stats;
+  if (!QueryCatalog(options.catalog_dir, options.query, &entries, &identity,
+                    &stats, &error)) {
+    std::wcerr << error << L"\n";
+    return 2;
+  }
+  const auto ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count() /
+                  1000.0;
+  if (options.at) {
+    // Последняя запись каждого дисплея не позже момента --at.
+    std::map<int, CatalogEntry> latest;
+    for (const CatalogEntry& entry : entries) {
+      auto found = latest.find(entry.display_index);
+      if (found == latest.end() || entry.timestamp >= found->second.timestamp) {
+        latest[entry.display_index] = entry;
+      }
+    }
+    entries.clear();
+    for (const auto& [display, entry] : latest) {
+      entries.push_back(entry);
+    }
+  }
+
+  // Каталог лежит в PC_USER/catalog: папка PC_USER — над ним.
+  std::wstring catalog_dir = options.catalog_dir;
+  while (catalog_dir.size() > 1 &&
+         (catalog_dir.back() == L'\\' || catalog_dir.back() == L'/')) {
+    catalog_dir.pop_back();
+  }
+  const size_t slash = catalog_dir.find_last_of(L"\\/");
+  const std::wstring pc_user_dir =
+      slash == std::wstring::npos ? L"." : catalog_dir.substr(0, slash);
+  for (const CatalogEntry& entry : entries) {
+    PrintEntry(pc_user_dir, identity, entry);
+  }
+  std::wcout << L"Найдено кадров: " << entries.size()
+             << L", файлов каталога: " << stats.files
+             << L", записей просмотрено: " << stats.scanned << L", мс: " << ms
+             << L"\n";
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "rate_control.h"
+
+#include <algorithm>
+
+namespace {
+
+// Размер в пределах [target * (1 - tolerance), target] принимается сразу.
+constexpr double kSizeTolerance = 0.03;
+// Шаг первой пробы от прошлой оценки, удваивается до нахождения границы.
+constexpr int kInitialStep = 4;
+
+}  // namespace
+
+bool RateControlEnabled(const RateControlOptions& options) {
+  return options.target_bytes > 0 || options.daily_budget_bytes > 0;
+}
+
+uint64_t FrameByteTarget(const RateControlOptions& options,
+                         const RateControlState& state,
+                         int seconds_left_in_day, int interval_seconds) {
+  uint64_t target = options.target_bytes;
+  if (options.daily_budget_bytes > 0) {
+    const uint64_t left = options.daily_budget_bytes > state.used_today
+                              ? options.daily_budget_bytes - state.used_today
+                              : 0;
+    const int interval = std::max(1, interval_seconds);
+    const uint64_t frames_left = static_cast<uint64_t>(
+        std::max(1, (std::max(0, seconds_left_in_day) + interval - 1) /
+                        interval));
+    // Обоснование: делим остаток, а не суточную норму — перерасход утром
+    // компенсируется меньшими кадрами вечером, недорасход отдается дальше.
+    const uint64_t daily_target = std::max<uint64_t>(1, left / frames_left);
+    target = target > 0 ? std::min(target, daily_target) : daily_target;
+  }
+  return target;
+}
+
+void EncodeJpegToTarget(const JpegCoefficients& coefficients,
+                        uint64_t target_bytes, RateControlState* state,
+                        HuffmanReuseState* huffman, std::vector<uint8_t>* out,
+                        RateControlResult* result, JpegWorkspace* workspace) {
+  RateControlState local;
+  if (!state) {
+    state = &local;
+  }
+  // Оценки по качеству 1..100, 0 = не измерено.
+  size_t sizes[102] = {};
+  int passes = 0;
+  auto estimate = [&](int quality) {
+    if (sizes[quality] == 0) {
+      sizes[quality] = EstimateJpegSize(coefficients, quality);
+      ++passes;
+    }
+    return sizes[quality];
+  };
+
+  const double low_band =
+      static_cast<double>(target_bytes) * (1.0 - kSizeTolerance);
+  int lo = 1;
+  int hi = 100;
+  int best = 0;
+  int quality = std::clamp(state->quality, lo, hi);
+  int step = kInitialStep;
+  bool seen_fit = false;
+  bool seen_over = false;
+  while (lo <= hi) {
+    const size_t size = estimate(quality);
+    if (size <= target_bytes) {
+      best = quality;
+      lo = quality + 1;
+      seen_fit = true;
+      // Принимаем без дальнейшего поиска: попали в полосу допуска или,
+      // по прошлому кадру, следующее качество все равно не поместится.
+      if (size >= low_band ||
+          (state->next_growth > 0.0f &&
+           static_cast<double>(size) * state->next_growth > target_bytes)) {
+        break;
+      }
+    } else {
+      hi = quality - 1;
+      seen_over = true;
+    }
+    if (lo > hi) {
+      break;
+    }
+    if (seen_fit && seen_over) {
+      quality = lo + (hi - lo) / 2;
+    } else {
+      quality = seen_fit ? std::min(quality + step, hi)
+                         : std::max(quality - step, lo);
+      step *= 2;
+    }
+  }
+  if (best == 0) {
+    best = 1;
+  }
+
+  if (huffman) {
+    EncodeJpegOptimized(coefficients, best, huffman, out, workspace);
+  } else {
+    EncodeJpegCoefficients(coefficients, best, out);
+  }
+  ++passes;
+
+  if (best < 100 && sizes[best] > 0 && sizes[best + 1] > 0) {
+    state->next_growth = static_cast<float>(sizes[best + 1]) /
+                         static_cast<float>(sizes[best]);
+  }
+  state->quality = best;
+  if (result) {
+    result->quality = best;
+    result->passes = passes;
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+// Byte budget for JPEG output (0 = not limited).
+struct RateControlOptions {
+  // Target size of one frame in bytes.
+  uint64_t target_bytes = 0;
+  // Storage budget of one display per day in bytes.
+  uint64_t daily_budget_bytes = 0;
+};
+
+// Returns true if any budget is set.
+bool RateControlEnabled(const RateControlOptions& options);
+
+// Estimate carried between frames of one display.
+struct RateControlState {
+  // IJG quality (1..100) chosen for the previous frame; first probe.
+  int quality = 50;
+  // Observed size(quality + 1) / size(quality), 0 = unknown.
+  float next_growth = 0.0f;
+  // Bytes written today (for the daily budget).
+  uint64_t used_today = 0;
+};
+
+struct RateControlResult {
+  int quality = 0;
+  // Number of quantization passes (estimates + final encodes).
+  int passes = 0;
+};
+
+// Returns byte target for the next frame: the per-frame target and/or the
+// remaining daily budget spread over frames left until midnight.
+// Output: 0 if no budget is set.
+uint64_t FrameByteTarget(const RateControlOptions& options,
+                         const RateControlState& state,
+                         int seconds_left_in_day, int interval_seconds);
+
+// Encodes cached coefficients with the highest quality whose size fits
+// target_bytes (quality 1 if nothing fits). Starts from state->quality and
+// updates it. Sizes are probed with the Annex K tables; huffman != nullptr
+// writes the final stream with optimized tables (only smaller).
+// Output: out replaced with the JPEG stream.
+void EncodeJpegToTarget(const JpegCoefficients& coefficients,
+                        uint64_t target_bytes, RateControlState* state,
+                        HuffmanReuseState* huffman, std::vector<uint8_t>* out,
+                        RateControlResult* result,
+                        JpegWorkspace* workspace = nullptr);
@@ -0,0 +1,387 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "pixel_convert.h"
+#include "simd.h"
+
+namespace {
+
+// Веса фильтра в фиксированной точке: сумма весов = 1 << kWeightBits.
+constexpr int kWeightBits = 14;
+// Промежуточный (после горизонтального прохода) результат хранится как
+// значение * 64 в int16: запас на отрицательные лепестки Lanczos.
+constexpr int kMidShift = kWeightBits - 6;
+constexpr int kOutShift = kWeightBits + 6;
+// Полосы меньше этого числа строк не стоит отдавать отдельному потоку.
+constexpr uint32_t kMinRowsPerBand = 32;
+
+struct FilterTaps {
+  int taps = 0;
+  std::vector<int32_t> index;   // [out * taps + k], индекс источника.
+  std::vector<int16_t> weight;  // [out * taps + k].
+};
+
+double Lanczos3(double x) {
+  constexpr double kPi = 3.14159265358979323846;
+  x = std::fabs(x);
+  if (x < 1e-9) {
+    return 1.0;
+  }
+  if (x >= 3.0) {
+    return 0.0;
+  }
+  const double pix = kPi * x;
+  return 3.0 * std::sin(pix) * std::sin(pix / 3.0) / (pix * pix);
+}
+
+FilterTaps BuildLanczosTaps(uint32_t src_size, uint32_t dst_size) {
+  const double ratio = static_cast<double>(src_size) / dst_size;
+  // При уменьшении ядро растягивается, чтобы работать как antialias-фильтр.
+  const double filter_scale = std::max(ratio, 1.0);
+  const double support = 3.0 * filter_scale;
+  FilterTaps taps;
+  taps.taps = static_cast<int>(std::ceil(support * 2.0)) + 1;
+  // Четное число отводов: SIMD-путь обрабатывает их парами (_mm_madd_epi16).
+  taps.taps += taps.taps & 1;
+  taps.index.resize(static_cast<size_t>(dst_size) * taps.taps);
+  taps.weight.resize(static_cast<size_t>(dst_size) * taps.taps);
+
+  std::vector<double> weights(static_cast<size_t>(taps.taps));
+  for (uint32_t i = 0; i < dst_size; ++i) {
+    const double center = (i + 0.5) * ratio - 0.5;
+    const int first = static_cast<int>(std::floor(center - support)) + 1;
+    double sum = 0.0;
+    for (int k = 0; k < taps.taps; ++k) {
+      weights[k] = Lanczos3((first + k - center) / filter_scale);
+      sum += weights[k];
+    }
+    int32_t* index = &taps.index[static_cast<size_t>(i) * taps.taps];
+    int16_t* weight = &taps.weight[static_cast<size_t>(i) * taps.taps];
+    int total = 0;
+    int largest = 0;
+    for (int k = 0; k < taps.taps; ++k) {
+      index[k] = std::clamp(first + k, 0, static_cast<int>(src_size) - 1);
+      weight[k] = static_cast<int16_t>(
+          std::lround(weights[k] / sum * (1 << kWeightBits)));
+      total += weight[k];
+      if (weight[k] > weight[largest]) {
+        largest = k;
+      }
+    }
+    // Остаток округления отдаем центральному весу: сумма строго 1.0.
+    weight[largest] =
+        static_cast<int16_t>(weight[largest] + (1 << kWeightBits) - total);
+  }
+  return taps;
+}
+
+// Строка источника в BGRA8: для BGRA8 без копии, иначе конвертация на лету.
+template <PixelFormat Format>
+const uint8_t* FetchRow(const ImageBuffer& src, uint32_t y,
+                        std::vector<uint8_t>* scratch) {
+  const uint8_t* row = src.pixels.data() + static_cast<size_t>(y) * src.stride;
+  if constexpr (Format == PixelFormat::kBgra8) {
+    return row;
+  } else {
+    ConvertRowToBgra8<Format>(row, scratch->data(), src.width,
+                              DefaultToneMapLut());
+    return scratch->data();
+  }
+}
+
+uint32_t LoadU32(const uint8_t* src) {
+  uint32_t value = 0;
+  std::memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+void HorizontalPass(const uint8_t* src, const FilterTaps& h,
+                    uint32_t dst_width, int16_t* out) {
+  const int taps = h.taps;
+  for (uint32_t x = 0; x < dst_width; ++x) {
+    const int32_t* index = &h.index[static_cast<size_t>(x) * taps];
+    const int16_t* weight = &h.weight[static_cast<size_t>(x) * taps];
+#if P2_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (int k = 0; k < taps; k += 2) {
+      const __m128i p0 = _mm_unpacklo_epi8(
+          _mm_cvtsi32_si128(static_cast<int>(LoadU32(src + index[k] * 4))),
+          zero);
+      const __m128i p1 = _mm_unpacklo_epi8(
+          _mm_cvtsi32_si128(static_cast<int>(LoadU32(src + index[k + 1] * 4))),
+          zero);
+      const __m128i w = _mm_set1_epi32(
+          static_cast<int>((static_cast<uint32_t>(weight[k + 1]) << 16) |
+                           static_cast<uint16_t>(weight[k])));
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi16(p0, p1), w));
+    }
+    acc = _mm_srai_epi32(
+        _mm_add_epi32(acc, _mm_set1_epi32(1 << (kMidShift - 1))), kMidShift);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4),
+                     _mm_packs_epi32(acc, acc));
+#else
+    for (int c = 0; c < 4; ++c) {
+      int32_t acc = 0;
+      for (int k = 0; k < taps; ++k) {
+        acc += src[index[k] * 4 + c] * weight[k];
+      }
+      acc = (acc + (1 << (kMidShift - 1))) >> kMidShift;
+      out[x * 4 + c] = static_cast<int16_t>(std::clamp(acc, -32768, 32767));
+    }
+#endif
+  }
+}
+
+void VerticalPass(const int16_t* const* rows, const int16_t* weight, int taps,
+                  uint32_t values, uint8_t* out) {
+  uint32_t i = 0;
+#if P2_HAVE_SSE2
+  const __m128i round = _mm_set1_epi32(1 << (kOutShift - 1));
+  for (; i + 8 <= values; i += 8) {
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+    for (int k = 0; k < taps; k += 2) {
+      const __m128i r0 =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+      const __m128i r1 =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i));
+      const __m128i w = _mm_set1_epi32(
+          static_cast<int>((static_cast<uint32_t>(weight[k + 1]) << 16) |
+                           static_cast<uint16_t>(weight[k])));
+      acc_lo = _mm_add_epi32(acc_lo,
+                             _mm_madd_epi16(_mm_unpacklo_epi16(r0, r1), w));
+      acc_hi = _mm_add_epi32(acc_hi,
+                             _mm_madd_epi16(_mm_unpackhi_epi16(r0, r1), w));
+    }
+    acc_lo = _mm_srai_epi32(_mm_add_epi32(acc_lo, round), kOutShift);
+    acc_hi = _mm_srai_epi32(_mm_add_epi32(acc_hi, round), kOutShift);
+    const __m128i packed = _mm_packs_epi32(acc_lo, acc_hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(packed, packed));
+  }
+#endif
+  for (; i < values; ++i) {
+    int32_t acc = 0;
+    for (int k = 0; k < taps; ++k) {
+      acc += rows[k][i] * weight[k];
+    }
+    acc = (acc + (1 << (kOutShift - 1))) >> kOutShift;
+    out[i] = static_cast<uint8_t>(std::clamp(acc, 0, 255));
+  }
+}
+
+template <PixelFormat Format>
+void LanczosBand(const ImageBuffer& src, const FilterTaps& h,
+                 const FilterTaps& v, ImageBuffer* dst, uint32_t y_begin,
+                 uint32_t y_end) {
+  const size_t mid_size = static_cast<size_t>(dst->width) * 4;
+  // Обоснование: кольцо из taps горизонтально отфильтрованных строк вместо
+  // промежуточного кадра целиком — память O(ширина * taps) на поток.
+  std::vector<int16_t> ring(mid_size * v.taps);
+  std::vector<int32_t> ring_row(static_cast<size_t>(v.taps), -1);
+  std::vector<uint8_t> scratch(static_cast<size_t>(src.width) * 4);
+  std::vector<const int16_t*> rows(static_cast<size_t>(v.taps));
+  for (uint32_t y = y_begin; y < y_end; ++y) {
+    const int32_t* index = &v.index[static_cast<size_t>(y) * v.taps];
+    for (int k = 0; k < v.taps; ++k) {
+      const int32_t sy = index[k];
+      const size_t slot = static_cast<size_t>(sy) % v.taps;
+      int16_t* mid = ring.data() + slot * mid_size;
+      if (ring_row[slot] != sy) {
+        HorizontalPass(FetchRow<Format>(src, static_cast<uint32_t>(sy),
+                                        &scratch),
+                       h, dst->width, mid);
+        ring_row[slot] = sy;
+      }
+      rows[k] = mid;
+    }
+    VerticalPass(rows.data(), &v.weight[static_cast<size_t>(y) * v.taps],
+                 v.taps, static_cast<uint32_t>(mid_size),
+                 dst->pixels.data() + static_cast<size_t>(y) * dst->stride);
+  }
+}
+
+template <PixelFormat Format, int Factor>
+void BoxBand(const ImageBuffer& src, ImageBuffer* dst, uint32_t y_begin,
+             uint32_t y_end) {
+  constexpr int kArea = Factor * Factor;
+  constexpr int kShift = Factor == 2 ? 2 : 4;
+  std::vector<uint8_t> scratch(static_cast<size_t>(src.width) * 4 * Factor);
+  for (uint32_t y = y_begin; y < y_end; ++y) {
+    const uint8_t* rows[Factor];
+    for (int r = 0; r < Factor; ++r) {
+      const uint8_t* row = src.pixels.data() +
+                           static_cast<size_t>(y * Factor + r) * src.stride;
+      if constexpr (Format == PixelFormat::kBgra8) {
+        rows[r] = row;
+      } else {
+        uint8_t* slot =
+            scratch.data() + static_cast<size_t>(r) * src.width * 4;
+        ConvertRowToBgra8<Format>(row, slot, src.width, DefaultToneMapLut());
+        rows[r] = slot;
+      }
+    }
+    uint8_t* out = dst->pixels.data() + static_cast<size_t>(y) * dst->stride;
+    uint32_t x = 0;
+#if P2_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(kArea / 2);
+    if constexpr (Factor == 2) {
+      for (; x + 2 <= dst->width; x += 2) {
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + x * 8));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + x * 8));
+        const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                         _mm_unpacklo_epi8(b, zero));
+        const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                         _mm_unpackhi_epi8(b, zero));
+        const __m128i s0 = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        const __m128i s1 = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i s = _mm_unpacklo_epi64(s0, s1);
+        s = _mm_srli_epi16(_mm_add_epi16(s, round), kShift);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4),
+                         _mm_packus_epi16(s, s));
+      }
+    } else {
+      for (; x < dst->width; ++x) {
+        __m128i t = _mm_setzero_si128();
+        for (int r = 0; r < Factor; ++r) {
+          const __m128i v = _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(rows[r] + x * 16));
+          t = _mm_add_epi16(t, _mm_add_epi16(_mm_unpacklo_epi8(v, zero),
+                                             _mm_unpackhi_epi8(v, zero)));
+        }
+        t = _mm_add_epi16(t, _mm_srli_si128(t, 8));
+        t = _mm_srli_epi16(_mm_add_epi16(t, round), kShift);
+        const __m128i packed = _mm_packus_epi16(t, t);
+        const int value = _mm_cvtsi128_si32(packed);
+        std::memcpy(out + x * 4, &value, 4);
+      }
+    }
+#endif
+    for (; x < dst->width; ++x) {
+      for (int c = 0; c < 4; ++c) {
+        int sum = 0;
+        for (int r = 0; r < Factor; ++r) {
+          for (int i = 0; i < Factor; ++i) {
+            sum += rows[r][(x * Factor + i) * 4 + c];
+          }
+        }
+        out[x * 4 + c] = static_cast<uint8_t>((sum + kArea / 2) >> kShift);
+      }
+    }
+  }
+}
+
+// Делит строки результата на полосы и обрабатывает их параллельно.
+template <typename Fn>
+void RunBands(uint32_t rows, int threads, Fn&& fn) {
+  uint32_t count = threads > 0 ? static_cast<uint32_t>(threads)
+                               : std::thread::hardware_concurrency();
+  count = std::max(1u, std::min(count, rows / kMinRowsPerBand));
+  if (count == 1) {
+    fn(0u, rows);
+    return;
+  }
+  std::vector<std::thread> workers;
+  workers.reserve(count - 1);
+  const uint32_t band = (rows + count - 1) / count;
+  for (uint32_t i = 1; i < count; ++i) {
+    const uint32_t begin = std::min(rows, i * band);
+    const uint32_t end = std::min(rows, begin + band);
+    workers.emplace_back([&fn, begin, end] { fn(begin, end); });
+  }
+  fn(0u, std::min(rows, band));
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+int BoxFactor(const ImageBuffer& src, uint32_t dst_width,
+              uint32_t dst_height) {
+  for (int factor : {2, 4}) {
+    // Обоснование: только точная кратность — при нечетной стороне
+    // целое деление отбросило бы последний столбец или строку.
+    if (src.width == dst_width * factor && src.height == dst_height * factor) {
+      return factor;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+bool ComputeScaledSize(uint32_t width, uint32_t height,
+                       const ScaleOptions& options, uint32_t* out_width,
+                       uint32_t* out_height) {
+  if (!out_width || !out_height || width == 0 || height == 0) {
+    return false;
+  }
+  const double scale =
+      options.scale > 0.0f && options.scale < 1.0f ? options.scale : 1.0;
+  uint32_t target = static_cast<uint32_t>(
+      std::max(1L, std::lround(static_cast<double>(width) * scale)));
+  if (options.max_width > 0 && target > options.max_width) {
+    target = options.max_width;
+  }
+  target = std::min(target, width);
+  *out_width = target;
+  *out_height = static_cast<uint32_t>(std::max(
+      1L, std::lround(static_cast<double>(height) * target / width)));
+  return *out_width != width || *out_height != height;
+}
+
+bool ResampleImage(const ImageBuffer& src, uint32_t dst_width,
+                   uint32_t dst_height, ResampleFilter filter, int threads,
+                   ImageBuffer* dst, std::wstring* error) {
+  if (!dst) {
+    if (error) {
+      *error = L"Не передан буфер для масштабирования.";
+    }
+    return false;
+  }
+  if (src.width == 0 || src.height == 0 || dst_width == 0 ||
+      dst_height == 0 ||
+      src.stride < src.width * BytesPerPixel(src.pixel_format) ||
+      src.pixels.size() < static_cast<size_t>(src.stride) * src.height) {
+    if (error) {
+      *error = L"Некорректные данные изображения для масштабирования.";
+    }
+    return false;
+  }
+  dst->width = dst_width;
+  dst->height = dst_height;
+  dst->stride = dst_width * 4;
+  dst->pixel_format = PixelFormat::kBgra8;
+  dst->pixels.resize(static_cast<size_t>(dst->stride) * dst_height);
+
+  const int box = filter == ResampleFilter::kLanczos3
+                      ? 0
+                      : BoxFactor(src, dst_width, dst_height);
+  DispatchPixelFormat(src.pixel_format, [&](auto tag) {
+    constexpr PixelFormat kFormat = decltype(tag)::value;
+    if (box == 2) {
+      RunBands(dst_height, threads, [&](uint32_t begin, uint32_t end) {
+        BoxBand<kFormat, 2>(src, dst, begin, end);
+      });
+    } else if (box == 4) {
+      RunBands(dst_height, threads, [&](uint32_t begin, uint32_t end) {
+        BoxBand<kFormat, 4>(src, dst, begin, end);
+      });
+    } else {
+      const FilterTaps h = BuildLanczosTaps(src.width, dst_width);
+      const FilterTaps v = BuildLanczosTaps(src.height, dst_height);
+      RunBands(dst_height, threads, [&](uint32_t begin, uint32_t end) {
+        LanczosBand<kFormat>(src, h, v, dst, begin, end);
+      });
+    }
+  });
+  return true;
+}
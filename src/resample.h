@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "image_buffer.h"
+
+// Output size policy (from --scale / --max-width).
+struct ScaleOptions {
+  // Linear scale factor, 0 < scale <= 1 (1 = без масштабирования).
+  float scale = 1.0f;
+  // Upper bound on output width in pixels (0 = no limit).
+  uint32_t max_width = 0;
+};
+
+enum class ResampleFilter {
+  kAuto,      // Box for exact 2x/4x reduction, Lanczos3 otherwise.
+  kBox,       // Exact 2x/4x area average (falls back to Lanczos3 otherwise).
+  kLanczos3,  // Separable Lanczos3, fixed-point.
+};
+
+// Computes target size for a frame. Aspect ratio is preserved.
+// Output: true when the frame must be resized (size differs from source).
+bool ComputeScaledSize(uint32_t width, uint32_t height,
+                       const ScaleOptions& options, uint32_t* out_width,
+                       uint32_t* out_height);
+
+// Resamples src (any PixelFormat) into packed BGRA8 dst of the given size.
+// Color conversion is fused into the source row fetch (no extra pass).
+// Input: threads = 0 uses hardware concurrency; rows are split into bands.
+// Output: false + error on invalid input.
+bool ResampleImage(const ImageBuffer& src, uint32_t dst_width,
+                   uint32_t dst_height, ResampleFilter filter, int threads,
+                   ImageBuffer* dst, std::wstring* error);
@@ -0,0 +1,625 @@
+#include "retention.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "file_io.h"
+#include "frame_archive.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "qoi_codec.h"
+#include "resample.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Обоснование: прогресс дня пишется не после каждого файла — метки в
+// файлах и так защищают от повторного уменьшения, журнал лишь избавляет
+// от повторного чтения уже обработанных файлов.
+constexpr size_t kCheckpointFiles = 32;
+constexpr char kTagPrefix[] = "p2-retention";
+
+int ScalePermille(float scale) {
+  return std::clamp(static_cast<int>(std::lround(scale * 1000.0f)), 1, 1000);
+}
+
+// Метка примененного уровня в COM: "p2-retention scale=500 gray=1".
+std::string FormatTag(int scale_permille, bool grayscale) {
+  char text[64] = {};
+  std::snprintf(text, sizeof(text), "%s scale=%d gray=%d", kTagPrefix,
+                scale_permille, grayscale ? 1 : 0);
+  return text;
+}
+
+bool ParseTag(const std::string& comment, int* scale_permille,
+              bool* grayscale) {
+  int scale = 0;
+  int gray = 0;
+  const std::string format = std::string(kTagPrefix) + " scale=%d gray=%d";
+  if (std::sscanf(comment.c_str(), format.c_str(), &scale, &gray) != 2 ||
+      scale < 1 || scale > 1000) {
+    return false;
+  }
+  *scale_permille = scale;
+  *grayscale = gray != 0;
+  return true;
+}
+
+// Разбирает "YYYY-MM" (with_day = false) или "YYYY-MM-DD".
+bool ParseFolderDate(const std::wstring& name, DateTimeParts* out,
+                     bool with_day) {
+  const size_t expected = with_day ? 10 : 7;
+  if (name.size() != expected) {
+    return false;
+  }
+  for (size_t i = 0; i < expected; ++i) {
+    const bool dash = i == 4 || i == 7;
+    if (dash ? name[i] != L'-' : (name[i] < L'0' || name[i] > L'9')) {
+      return false;
+    }
+  }
+  DateTimeParts dt;
+  dt.year = std::stoi(name.substr(0, 4));
+  dt.month = std::stoi(name.substr(5, 2));
+  dt.day = with_day ? std::stoi(name.substr(8, 2)) : 1;
+  if (dt.month < 1 || dt.month > 12 || dt.day < 1 || dt.day > 31) {
+    return false;
+  }
+  *out = dt;
+  return true;
+}
+
+int64_t DayNumber(const DateTimeParts& dt) {
+  DateTimeParts day = dt;
+  day.hour = 0;
+  day.minute = 0;
+  day.second = 0;
+  return ArchiveTimestamp(day) / 86400;
+}
+
+struct DayFolder {
+  std::wstring name;
+  fs::path path;
+  DateTimeParts date;
+};
+
+// Папки дней всех месяцев, по возрастанию даты.
+std::vector<DayFolder> ListDays(const fs::path& pc_user_dir,
+                                std::error_code* ec) {
+  std::vector<DayFolder> days;
+  for (const fs::directory_entry& month :
+       fs::directory_iterator(pc_user_dir, *ec)) {
+    DateTimeParts month_date;
+    if (!month.is_directory() ||
+        !ParseFolderDate(month.path().filename().wstring(), &month_date,
+                         false)) {
+      continue;
+    }
+    std::error_code month_ec;
+    for (const fs::directory_entry& day :
+         fs::directory_iterator(month.path(), month_ec)) {
+      DayFolder folder;
+      folder.name = day.path().filename().wstring();
+      if (day.is_directory() &&
+          ParseFolderDate(folder.name, &folder.date, true)) {
+        folder.path = day.path();
+        days.push_back(folder);
+      }
+    }
+  }
+  std::sort(days.begin(), days.end(),
+            [](const DayFolder& a, const DayFolder& b) {
+              return a.name < b.name;
+            });
+  return days;
+}
+
+bool IsFrameFile(const fs::path& path) {
+  const std::wstring extension = path.extension().wstring();
+  return extension == L".jpg" || extension == L".qoi";
+}
+
+std::string Narrow(const std::wstring& ascii) {
+  return std::string(ascii.begin(), ascii.end());
+}
+
+// Перекодирует файл кадра до уровня tier. Output: bytes — прочитано и
+// записано; false + error при сбое (файл остается прежним).
+bool RecompressFile(const fs::path& path, const RetentionTier& tier,
+                    float jpeg_quality, RetentionStats* stats,
+                    uint64_t* bytes, std::wstring* error) {
+  std::vector<uint8_t> data;
+  if (!ReadFileBytes(path.wstring(), &data, error)) {
+    return false;
+  }
+  *bytes = data.size();
+  const bool jpeg = path.extension() == L".jpg";
+  int current_scale = 1000;
+  bool current_gray = false;
+  JpegInfo info;
+  if (jpeg && ReadJpegInfo(data, &info, nullptr)) {
+    ParseTag(info.comment, &current_scale, &current_gray);
+  }
+  const int target_scale = ScalePermille(tier.scale);
+  const bool target_gray = tier.grayscale || current_gray;
+  if (current_scale <= target_scale && current_gray == target_gray) {
+    return true;
+  }
+  ImageBuffer frame;
+  if (!(jpeg ? DecodeJpeg(data, &frame, error)
+             : DecodeQoi(data, &frame, error))) {
+    return false;
+  }
+  const int applied_scale = std::min(current_scale, target_scale);
+  const double factor = static_cast<double>(applied_scale) / current_scale;
+  const uint32_t width = std::max<uint32_t>(
+      1, static_cast<uint32_t>(std::lround(frame.width * factor)));
+  const uint32_t height = std::max<uint32_t>(
+      1, static_cast<uint32_t>(std::lround(frame.height * factor)));
+  ImageBuffer scaled;
+  if (width != frame.width || height != frame.height) {
+    // Один поток: фоновая работа не должна занимать все ядра.
+    if (!ResampleImage(frame, width, height, ResampleFilter::kAuto, 1,
+                       &scaled, error)) {
+      return false;
+    }
+    frame = std::move(scaled);
+  }
+  JpegEncodeOptions options;
+  options.quality = jpeg_quality;
+  options.color_mode = target_gray ? ColorMode::kGray : ColorMode::k420;
+  std::vector<uint8_t> encoded;
+  if (!EncodeJpeg(frame, options, &encoded, error)) {
+    return false;
+  }
+  InsertJpegComment(FormatTag(applied_scale, target_gray), &encoded);
+
+  // Новый файл появляется под именем .jpg только целиком; исходный .qoi
+  // удаляется после.
+  fs::path target = path;
+  target.replace_extension(L".jpg");
+  fs::path temp = target;
+  temp += L".tmp";
+  std::error_code ec;
+  if (!WriteFileBytes(temp.wstring(), encoded, error)) {
+    return false;
+  }
+  fs::rename(temp, target, ec);
+  if (ec) {
+    fs::remove(temp, ec);
+    if (error) {
+      *error = L"Не удалось заменить файл: " + target.wstring();
+    }
+    return false;
+  }
+  if (!jpeg) {
+    fs::remove(path, ec);
+  }
+  *bytes += encoded.size();
+  ++stats->files_recompressed;
+  stats->bytes_before += data.size();
+  stats->bytes_after += encoded.size();
+  return true;
+}
+
+}  // namespace
+
+bool ParseRetentionPolicy(const std::wstring& text, RetentionPolicy* out,
+                          std::wstring* error) {
+  auto fail = [&](const std::wstring& tier) {
+    if (error) {
+      *error = L"Некорректный уровень хранения: " + tier;
+    }
+    return false;
+  };
+  RetentionPolicy policy;
+  if (out) {
+    policy.jpeg_quality = out->jpeg_quality;
+  }
+  std::wstringstream tiers(text);
+  std::wstring item;
+  while (std::getline(tiers, item, L',')) {
+    std::wstringstream parts(item);
+    std::wstring part;
+    RetentionTier tier;
+    bool first = true;
+    bool scaled = false;
+    while (std::getline(parts, part, L':')) {
+      wchar_t* end = nullptr;
+      if (first) {
+        const long days = std::wcstol(part.c_str(), &end, 10);
+        if (part.empty() || *end != L'\0' || days < 1 || days > 36500) {
+          return fail(item);
+        }
+        tier.min_age_days = static_cast<int>(days);
+        first = false;
+      } else if (part == L"delete" && !tier.remove && !scaled &&
+                 !tier.grayscale) {
+        tier.remove = true;
+      } else if (part == L"gray" && !tier.remove && !tier.grayscale) {
+        tier.grayscale = true;
+      } else {
+        const float scale = std::wcstof(part.c_str(), &end);
+        if (part.empty() || *end != L'\0' || !(scale > 0.0f) ||
+            scale > 1.0f || scaled || tier.remove) {
+          return fail(item);
+        }
+        tier.scale = scale;
+        scaled = true;
+      }
+    }
+    if (first || (!tier.remove && !scaled && !tier.grayscale)) {
+      return fail(item);
+    }
+    // Обоснование: уровни только ужесточаются — старший день не может
+    // вернуть размер или цвет, уже отнятые младшим уровнем; масштаб и
+    // серый без явного значения наследуются.
+    if (!policy.tiers.empty()) {
+      const RetentionTier& previous = policy.tiers.back();
+      if (!scaled && !tier.remove) {
+        tier.scale = previous.scale;
+      }
+      if (previous.remove || tier.min_age_days <= previous.min_age_days ||
+          (!tier.remove && tier.scale > previous.scale)) {
+        return fail(item);
+      }
+      tier.grayscale = tier.grayscale || (previous.grayscale && !tier.remove);
+    }
+    policy.tiers.push_back(tier);
+  }
+  if (policy.tiers.empty()) {
+    return fail(text);
+  }
+  if (out) {
+    *out = policy;
+  }
+  return true;
+}
+
+int RetentionTierForAge(const RetentionPolicy& policy, int age_days) {
+  int index = -1;
+  for (size_t i = 0; i < policy.tiers.size(); ++i) {
+    if (age_days >= policy.tiers[i].min_age_days) {
+      index = static_cast<int>(i);
+    }
+  }
+  return index;
+}
+
+bool RetentionDeleteCutoff(const RetentionPolicy& policy,
+                           const DateTimeParts& today,
+                           DateTimeParts* first_kept) {
+  if (policy.tiers.empty() || !policy.tiers.back().remove) {
+    return false;
+  }
+  const int64_t day =
+      DayNumber(today) - (policy.tiers.back().min_age_days - 1);
+  *first_kept = ArchiveDateTime(day * 86400);
+  return true;
+}
+
+int64_t RetentionThrottleDelayUs(const RetentionBudget& budget,
+                                 int64_t work_us, uint64_t io_bytes) {
+  int64_t delay = 0;
+  if (budget.cpu_fraction > 0.0 && budget.cpu_fraction < 1.0) {
+    delay = static_cast<int64_t>(static_cast<double>(work_us) *
+                                 (1.0 / budget.cpu_fraction - 1.0));
+  }
+  if (budget.io_bytes_per_second > 0) {
+    const int64_t io_us = static_cast<int64_t>(
+        static_cast<double>(io_bytes) * 1e6 /
+        static_cast<double>(budget.io_bytes_per_second));
+    delay = std::max(delay, io_us - work_us);
+  }
+  return std::max<int64_t>(delay, 0);
+}
+
+std::wstring FormatRetentionStats(const RetentionStats& stats) {
+  return L"перекодировано файлов: " +
+         std::to_wstring(stats.files_recompressed) + L" (байт " +
+         std::to_wstring(stats.bytes_before) + L" -> " +
+         std::to_wstring(stats.bytes_after) + L"), удалено дней: " +
+         std::to_wstring(stats.days_removed) + L", файлов: " +
+         std::to_wstring(stats.files_removed) + L", байт: " +
+         std::to_wstring(stats.bytes_removed) + L", ошибок: " +
+         std::to_wstring(stats.files_failed) +
+         (stats.complete ? L"" : L", проход не завершен");
+}
+
+RetentionEngine::~RetentionEngine() { Stop(); }
+
+bool RetentionEngine::Open(const std::wstring& pc_user_dir,
+                           const RetentionPolicy& policy,
+                           const RetentionBudget& budget,
+                           std::wstring* error) {
+  pc_user_dir_ = pc_user_dir;
+  policy_ = policy;
+  budget_ = budget;
+  journal_.clear();
+  const fs::path root(pc_user_dir);
+  journal_path_ = (root / "retention.journal").wstring();
+
+  // Строка журнала: "YYYY-MM-DD scale gray files_done complete";
+  // действует последняя строка дня.
+  std::ifstream in(root / "retention.journal");
+  std::string line;
+  while (std::getline(in, line)) {
+    char day[16] = {};
+    JournalEntry entry;
+    int gray = 0;
+    unsigned long long done = 0;
+    int complete = 0;
+    if (std::sscanf(line.c_str(), "%10s %d %d %llu %d", day,
+                    &entry.scale_permille, &gray, &done, &complete) != 5) {
+      continue;
+    }
+    entry.grayscale = gray != 0;
+    entry.files_done = static_cast<size_t>(done);
+    entry.complete = complete != 0;
+    journal_[std::wstring(day, day + std::strlen(day))] = entry;
+  }
+  in.close();
+
+  // Сжатие журнала: по строке на существующий день, запись через
+  // временный файл и переименование.
+  std::error_code ec;
+  fs::create_directories(root, ec);
+  const std::vector<DayFolder> days = ListDays(root, &ec);
+  std::string compact;
+  for (auto it = journal_.begin(); it != journal_.end();) {
+    const bool exists = std::any_of(
+        days.begin(), days.end(),
+        [&](const DayFolder& day) { return day.name == it->first; });
+    if (!exists) {
+      it = journal_.erase(it);
+      continue;
+    }
+    char text[96] = {};
+    std::snprintf(text, sizeof(text), "%s %d %d %llu %d\n",
+                  Narrow(it->first).c_str(), it->second.scale_permille,
+                  it->second.grayscale ? 1 : 0,
+                  static_cast<unsigned long long>(it->second.files_done),
+                  it->second.complete ? 1 : 0);
+    compact += text;
+    ++it;
+  }
+  const std::wstring temp = journal_path_ + L".tmp";
+  if (!WriteFileBytes(temp,
+                      std::vector<uint8_t>(compact.begin(), compact.end()),
+                      error)) {
+    return false;
+  }
+  fs::rename(fs::path(temp), fs::path(journal_path_), ec);
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось записать журнал хранения: " + journal_path_;
+    }
+    return false;
+  }
+  return true;
+}
+
+void RetentionEngine::Checkpoint(const std::wstring& day,
+                                 const JournalEntry& entry) {
+  journal_[day] = entry;
+  std::ofstream out(fs::path(journal_path_), std::ios::app);
+  out << Narrow(day) << ' ' << entry.scale_permille << ' '
+      << (entry.grayscale ? 1 : 0) << ' ' << entry.files_done << ' '
+      << (entry.complete ? 1 : 0) << '\n';
+}
+
+bool RetentionEngine::Stopping() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stop_;
+}
+
+bool RetentionEngine::Throttle(int64_t work_us, uint64_t io_bytes) {
+  const int64_t delay = RetentionThrottleDelayUs(budget_, work_us, io_bytes);
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (delay > 0) {
+    wake_.wait_for(lock, std::chrono::microseconds(delay),
+                   [this]() { return stop_; });
+  }
+  return !stop_;
+}
+
+bool RetentionEngine::RemoveDay(const std::wstring& day_dir,
+                                RetentionStats* stats) {
+  std::error_code ec;
+  std::vector<fs::path> files;
+  for (const fs::directory_entry& entry :
+       fs::recursive_directory_iterator(fs::path(day_dir), ec)) {
+    if (entry.is_regular_file(ec)) {
+      files.push_back(entry.path());
+    }
+  }
+  // Обоснование: удаление по файлу с паузами бюджета — тысячи удалений
+  // подряд тоже нагружают диск.
+  for (const fs::path& file : files) {
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t size = fs::file_size(file, ec);
+    if (!fs::remove(file, ec)) {
+      ++stats->files_failed;
+      continue;
+    }
+    ++stats->files_removed;
+    stats->bytes_removed += ec ? 0 : size;
+    const int64_t work_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    if (!Throttle(work_us, 0)) {
+      return false;
+    }
+  }
+  const fs::path day(day_dir);
+  fs::remove_all(day, ec);
+  if (fs::is_empty(day.parent_path(), ec) && !ec) {
+    fs::remove(day.parent_path(), ec);
+  }
+  ++stats->days_removed;
+  return true;
+}
+
+bool RetentionEngine::RunPass(const DateTimeParts& today, size_t max_files,
+                              RetentionStats* stats, std::wstring* error) {
+  *stats = RetentionStats{};
+  std::error_code ec;
+  const std::vector<DayFolder> days = ListDays(fs::path(pc_user_dir_), &ec);
+  if (ec) {
+    if (error) {
+      *error = L"Не удалось прочитать папку: " + pc_user_dir_;
+    }
+    return false;
+  }
+  const int64_t today_number = DayNumber(today);
+  size_t processed = 0;
+  for (const DayFolder& day : days) {
+    const int tier_index = RetentionTierForAge(
+        policy_, static_cast<int>(today_number - DayNumber(day.date)));
+    if (tier_index < 0) {
+      continue;
+    }
+    const RetentionTier& tier = policy_.tiers[tier_index];
+    if (tier.remove) {
+      if (!RemoveDay(day.path.wstring(), stats)) {
+        stats->complete = false;
+        return true;
+      }
+      journal_.erase(day.name);
+      continue;
+    }
+    JournalEntry entry;
+    entry.scale_permille = ScalePermille(tier.scale);
+    entry.grayscale = tier.grayscale;
+    const auto known = journal_.find(day.name);
+    if (known != journal_.end() &&
+        known->second.scale_permille == entry.scale_permille &&
+        known->second.grayscale == entry.grayscale) {
+      if (known->second.complete) {
+        continue;
+      }
+      entry.files_done = known->second.files_done;
+    }
+    std::vector<fs::path> files;
+    for (const fs::directory_entry& file :
+         fs::directory_iterator(day.path, ec)) {
+      if (file.is_regular_file() && IsFrameFile(file.path())) {
+        files.push_back(file.path());
+      }
+    }
+    // Обоснование: порядок по имени (времени кадра) делает счетчик
+    // files_done позицией возобновления; .qoi, ставший .jpg, сохраняет
+    // место в порядке, так как имена различаются только расширением.
+    std::sort(files.begin(), files.end());
+    for (size_t i = std::min(entry.files_done, files.size());
+         i < files.size(); ++i) {
+      if (processed >= max_files || Stopping()) {
+        entry.files_done = i;
+        Checkpoint(day.name, entry);
+        stats->complete = false;
+        return true;
+      }
+      const auto start = std::chrono::steady_clock::now();
+      uint64_t bytes = 0;
+      std::wstring file_error;
+      if (!RecompressFile(files[i], tier, policy_.jpeg_quality, stats,
+                          &bytes, &file_error)) {
+        ++stats->files_failed;
+        if (error) {
+          *error = file_error;
+        }
+      }
+      ++processed;
+      if ((i + 1) % kCheckpointFiles == 0) {
+        entry.files_done = i + 1;
+        Checkpoint(day.name, entry);
+      }
+      const int64_t work_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      Throttle(work_us, bytes);
+    }
+    entry.files_done = files.size();
+    entry.complete = true;
+    Checkpoint(day.name, entry);
+  }
+  return true;
+}
+
+void RetentionEngine::Start(std::function<void()> on_start) {
+  if (thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+  thread_ = std::thread(&RetentionEngine::ThreadMain, this,
+                        std::move(on_start));
+}
+
+void RetentionEngine::Schedule(const DateTimeParts& today) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_ = true;
+  pending_day_ = today;
+  wake_.notify_all();
+}
+
+bool RetentionEngine::TakeResult(RetentionStats* stats, std::wstring* error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!has_result_) {
+    return false;
+  }
+  has_result_ = false;
+  *stats = result_;
+  if (error) {
+    *error = result_error_;
+  }
+  return true;
+}
+
+void RetentionEngine::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    wake_.notify_all();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void RetentionEngine::ThreadMain(std::function<void()> on_start) {
+  if (on_start) {
+    on_start();
+  }
+  while (true) {
+    DateTimeParts today;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return stop_ || pending_; });
+      if (stop_) {
+        return;
+      }
+      pending_ = false;
+      today = pending_day_;
+    }
+    RetentionStats stats;
+    std::wstring error;
+    const bool ok = RunPass(today, SIZE_MAX, &stats, &error);
+    std::lock_guard<std::mutex> lock(mutex_);
+    has_result_ = true;
+    result_ = stats;
+    result_error_ = ok ? error : L"Ошибка прохода хранения: " + error;
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "time_utils.h"
+
+// Retention of aging day folders <PC_USER>/<YYYY-MM>/<YYYY-MM-DD>: policy
+// tiers by age recompress the frame files of a day (downscale, grayscale)
+// or delete the day. Scales are relative to the captured frame, and every
+// recompressed JPEG carries a COM tag with the applied tier, so processing
+// a file twice never shrinks it twice. Progress is kept in
+// <PC_USER>/retention.journal (day, tier, files done), so an interrupted
+// pass resumes where it stopped. Folders younger than the first tier and
+// non-frame files (archives, video, process logs) are only removed by a
+// delete tier.
+
+struct RetentionTier {
+  // Applies to days at least this old (today = 0).
+  int min_age_days = 0;
+  bool remove = false;
+  // Linear scale against the captured frame, 0 < scale <= 1.
+  float scale = 1.0f;
+  bool grayscale = false;
+};
+
+struct RetentionPolicy {
+  // Ascending by age; a later tier never restores size and inherits the
+  // scale (when it gives none) and grayscale.
+  std::vector<RetentionTier> tiers;
+  // JPEG quality of recompressed frames (same scale as WIC).
+  float jpeg_quality = 0.01f;
+};
+
+// Parses "DAYS:ACTION[,...]", ACTION = delete | SCALE | gray | SCALE:gray,
+// e.g. "7:0.5:gray,90:0.25,365:delete". Output: false + error on invalid
+// text or a tier that enlarges frames.
+bool ParseRetentionPolicy(const std::wstring& text, RetentionPolicy* out,
+                          std::wstring* error);
+// Index of the tier applied at age_days (-1: the day is kept as captured).
+int RetentionTierForAge(const RetentionPolicy& policy, int age_days);
+// Oldest day kept on date today (days before it fall into the delete
+// tier). Output: false when the policy never deletes.
+bool RetentionDeleteCutoff(const RetentionPolicy& policy,
+                           const DateTimeParts& today,
+                           DateTimeParts* first_kept);
+
+struct RetentionBudget {
+  // Share of one core: work time against wall time (>= 1: unlimited).
+  double cpu_fraction = 0.1;
+  // Bytes read plus written per second (0: unlimited).
+  uint64_t io_bytes_per_second = 4ull << 20;
+};
+
+// Pause after a unit of work (work_us, io_bytes) that keeps the averages
+// of the budget.
+int64_t RetentionThrottleDelayUs(const RetentionBudget& budget,
+                                 int64_t work_us, uint64_t io_bytes);
+
+struct RetentionStats {
+  uint64_t days_removed = 0;
+  uint64_t files_recompressed = 0;
+  uint64_t files_removed = 0;
+  uint64_t files_failed = 0;
+  // Sizes of recompressed files before and after.
+  uint64_t bytes_before = 0;
+  uint64_t bytes_after = 0;
+  uint64_t bytes_removed = 0;
+  // False when the pass stopped early (file limit, Stop).
+  bool complete = true;
+};
+
+std::wstring FormatRetentionStats(const RetentionStats& stats);
+
+class RetentionEngine {
+ public:
+  RetentionEngine() = default;
+  ~RetentionEngine();
+  RetentionEngine(const RetentionEngine&) = delete;
+  RetentionEngine& operator=(const RetentionEngine&) = delete;
+
+  // Loads and compacts the journal of pc_user_dir.
+  bool Open(const std::wstring& pc_user_dir, const RetentionPolicy& policy,
+            const RetentionBudget& budget, std::wstring* error);
+
+  // One pass over the day folders for the date today on the calling
+  // thread, throttled by the budget. Stops after max_files frame files
+  // (the next pass resumes). Output: false + error when the folders cannot
+  // be listed; failures of single files are counted in stats.
+  bool RunPass(const DateTimeParts& today, size_t max_files,
+               RetentionStats* stats, std::wstring* error);
+
+  // Background thread; on_start runs first on it (thread priority).
+  void Start(std::function<void()> on_start);
+  // Requests a background pass for today (merged with a pending one).
+  void Schedule(const DateTimeParts& today);
+  // Result of a finished background pass; false when none since the last
+  // call.
+  bool TakeResult(RetentionStats* stats, std::wstring* error);
+  // Interrupts a running pass between files and joins the thread.
+  void Stop();
+
+ private:
+  struct JournalEntry {
+    int scale_permille = 1000;
+    bool grayscale = false;
+    size_t files_done = 0;
+    bool complete = false;
+  };
+
+  void ThreadMain(std::function<void()> on_start);
+  bool Stopping();
+  // Sleeps for the budget pause; false when Stop interrupted it.
+  bool Throttle(int64_t work_us, uint64_t io_bytes);
+  void Checkpoint(const std::wstring& day, const JournalEntry& entry);
+  bool RemoveDay(const std::wstring& day_dir, RetentionStats* stats);
+
+  std::wstring pc_user_dir_;
+  std::wstring journal_path_;
+  RetentionPolicy policy_;
+  RetentionBudget budget_;
+  std::map<std::wstring, JournalEntry> journal_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  bool pending_ = false;
+  DateTimeParts pending_day_;
+  bool has_result_ = false;
+  RetentionStats result_;
+  std::wstring result_error_;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+// Compile-time SIMD capability detection shared by the vectorized kernels.
+// P2_HAVE_SSE2 is defined when SSE2 intrinsics are available (always on x64).
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define P2_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,16 @@
+#include "strip_source.h"
+
+bool ImageStripSource::ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                                std::wstring* error) {
+  const size_t frame_bytes = static_cast<size_t>(image_.stride) * image_.height;
+  if (!rows || count == 0 || count > kMaxStripRows || y >= image_.height ||
+      count > image_.height - y || image_.pixels.size() < frame_bytes) {
+    if (error) {
+      *error = L"Запрошены строки за пределами кадра.";
+    }
+    return false;
+  }
+  rows->data = image_.pixels.data() + static_cast<size_t>(y) * image_.stride;
+  rows->stride = image_.stride;
+  return true;
+}
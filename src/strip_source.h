@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image_buffer.h"
+
+// Rows handed out by a StripSource; valid until the next ReadRows call.
+struct PixelRows {
+  const uint8_t* data = nullptr;
+  size_t stride = 0;
+};
+
+// Largest strip a consumer requests (one 4:2:0 MCU row).
+constexpr uint32_t kMaxStripRows = 16;
+
+// Frame produced top to bottom in horizontal strips, so a consumer can
+// encode it without a full-frame copy. Sources recycle one strip buffer.
+class StripSource {
+ public:
+  virtual ~StripSource() = default;
+
+  virtual uint32_t Width() const = 0;
+  virtual uint32_t Height() const = 0;
+  virtual PixelFormat Format() const = 0;
+
+  // Provides rows [y, y + count), count <= kMaxStripRows, in Format().
+  // Output: false + error on failure or an out-of-frame range.
+  virtual bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                        std::wstring* error) = 0;
+};
+
+// Strips of a frame already in memory (no copy); image must outlive it.
+class ImageStripSource : public StripSource {
+ public:
+  explicit ImageStripSource(const ImageBuffer& image) : image_(image) {}
+
+  uint32_t Width() const override { return image_.width; }
+  uint32_t Height() const override { return image_.height; }
+  PixelFormat Format() const override { return image_.pixel_format; }
+  bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                std::wstring* error) override;
+
+ private:
+  const ImageBuffer& image_;
+};
@@ -0,0 +1,202 @@
+#include "synthetic_frames.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// xorshift32: воспроизводимо на всех платформах, в отличие от std::rand.
+class SceneRandom {
+ public:
+  explicit SceneRandom(uint32_t seed) : state_(seed ? seed : 0x9E3779B9u) {}
+
+  uint32_t Next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+
+  uint32_t Range(uint32_t n) { return Next() % n; }
+
+ private:
+  uint32_t state_;
+};
+
+void FillRect(ImageBuffer& image, uint32_t x, uint32_t y, uint32_t w,
+              uint32_t h, uint8_t b, uint8_t g, uint8_t r) {
+  const uint32_t x1 = std::min(image.width, x + w);
+  const uint32_t y1 = std::min(image.height, y + h);
+  for (uint32_t yy = y; yy < y1; ++yy) {
+    uint8_t* row = image.pixels.data() + static_cast<size_t>(yy) * image.stride;
+    for (uint32_t xx = x; xx < x1; ++xx) {
+      row[xx * 4 + 0] = b;
+      row[xx * 4 + 1] = g;
+      row[xx * 4 + 2] = r;
+      row[xx * 4 + 3] = 255;
+    }
+  }
+}
+
+void DrawText(ImageBuffer& image, SceneRandom& rng) {
+  FillRect(image, 0, 0, image.width, image.height, 255, 255, 255);
+  const uint32_t line_height = 18;
+  if (image.width < 64) {
+    return;
+  }
+  for (uint32_t y = 8; y + 12 < image.height; y += line_height) {
+    uint32_t x = 12 + rng.Range(24);
+    const uint32_t line_end = image.width - 12 - rng.Range(image.width / 3 + 1);
+    while (x + 8 < line_end) {
+      const uint32_t word = 2 + rng.Range(8);
+      for (uint32_t c = 0; c < word && x + 8 < line_end; ++c, x += 8) {
+        // Глиф 6x10: случайные вертикальные и горизонтальные штрихи.
+        const uint32_t shape = rng.Next();
+        if (shape & 1) FillRect(image, x, y, 1, 10, 30, 30, 30);
+        if (shape & 2) FillRect(image, x + 5, y + 2, 1, 8, 30, 30, 30);
+        if (shape & 4) FillRect(image, x, y + 9, 6, 1, 30, 30, 30);
+        if (shape & 8) FillRect(image, x, y + 4, 6, 1, 30, 30, 30);
+        if (shape & 16) FillRect(image, x + 2, y + 2, 1, 8, 30, 30, 30);
+      }
+      x += 6;
+    }
+  }
+}
+
+void DrawUi(ImageBuffer& image, SceneRandom& rng) {
+  FillRect(image, 0, 0, image.width, image.height, 240, 240, 240);
+  FillRect(image, 0, 0, image.width, 32, 120, 80, 40);
+  FillRect(image, 0, 32, 220, image.height, 60, 56, 52);
+  for (int i = 0; i < 40; ++i) {
+    const uint32_t w = 40 + rng.Range(320);
+    const uint32_t h = 20 + rng.Range(200);
+    const uint32_t x = rng.Range(image.width > 20 ? image.width - 20 : 1);
+    const uint32_t y = rng.Range(image.height > 40 ? image.height - 40 : 1) + 40;
+    const uint8_t shade = static_cast<uint8_t>(200 + rng.Range(56));
+    FillRect(image, x, y, w, h, 90, 90, 90);
+    FillRect(image, x + 1, y + 1, w - 2, h - 2, shade, shade,
+             static_cast<uint8_t>(shade - rng.Range(40)));
+  }
+}
+
+void DrawPhoto(ImageBuffer& image, SceneRandom& rng) {
+  const float fx = 6.2831853f / static_cast<float>(image.width);
+  const float fy = 6.2831853f / static_cast<float>(image.height);
+  const float phase = static_cast<float>(rng.Range(628)) / 100.0f;
+  for (uint32_t y = 0; y < image.height; ++y) {
+    uint8_t* row = image.pixels.data() + static_cast<size_t>(y) * image.stride;
+    for (uint32_t x = 0; x < image.width; ++x) {
+      const float base = 0.5f + 0.25f * std::sin(x * fx * 1.5f + phase) +
+                         0.2f * std::cos(y * fy * 2.0f - phase);
+      const int noise = static_cast<int>(rng.Range(9)) - 4;
+      const int v = static_cast<int>(base * 200.0f) + noise;
+      row[x * 4 + 0] = static_cast<uint8_t>(std::clamp(v - 20, 0, 255));
+      row[x * 4 + 1] = static_cast<uint8_t>(std::clamp(v, 0, 255));
+      row[x * 4 + 2] =
+          static_cast<uint8_t>(std::clamp(v + 30 - static_cast<int>(y % 64), 0, 255));
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+void DrawNoise(ImageBuffer& image, SceneRandom& rng) {
+  for (uint32_t y = 0; y < image.height; ++y) {
+    uint8_t* row = image.pixels.data() + static_cast<size_t>(y) * image.stride;
+    for (uint32_t x = 0; x < image.width; ++x) {
+      const uint32_t v = rng.Next();
+      row[x * 4 + 0] = static_cast<uint8_t>(v);
+      row[x * 4 + 1] = static_cast<uint8_t>(v >> 8);
+      row[x * 4 + 2] = static_cast<uint8_t>(v >> 16);
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+}  // namespace
+
+const char* SyntheticSceneName(SyntheticScene scene) {
+  switch (scene) {
+    case SyntheticScene::kText:
+      return "text";
+    case SyntheticScene::kUi:
+      return "ui";
+    case SyntheticScene::kPhoto:
+      return "photo";
+    case SyntheticScene::kNoise:
+    default:
+      return "noise";
+  }
+}
+
+ImageBuffer MakeSyntheticFrame(SyntheticScene scene, uint32_t width,
+                               uint32_t height, uint32_t seed) {
+  ImageBuffer image;
+  image.width = width;
+  image.height = height;
+  image.stride = width * 4;
+  image.pixel_format = PixelFormat::kBgra8;
+  image.pixels.assign(static_cast<size_t>(image.stride) * height, 0);
+  if (width == 0 || height == 0) {
+    return image;
+  }
+  SceneRandom rng(seed);
+  switch (scene) {
+    case SyntheticScene::kText:
+      DrawText(image, rng);
+      break;
+    case SyntheticScene::kUi:
+      DrawUi(image, rng);
+      break;
+    case SyntheticScene::kPhoto:
+      DrawPhoto(image, rng);
+      break;
+    case SyntheticScene::kNoise:
+    default:
+      DrawNoise(image, rng);
+      break;
+  }
+  return image;
+}
+
+SyntheticStripSource::SyntheticStripSource(SyntheticScene scene,
+                                           uint32_t width, uint32_t height,
+                                           uint32_t tile_width,
+                                           uint32_t tile_height, uint32_t seed)
+    : tile_(MakeSyntheticFrame(scene, std::max<uint32_t>(tile_width, 1),
+                               std::max<uint32_t>(tile_height, 1), seed)),
+      width_(width),
+      height_(height),
+      strip_(static_cast<size_t>(width) * 4 * kMaxStripRows) {}
+
+bool SyntheticStripSource::ReadRows(uint32_t y, uint32_t count,
+                                    PixelRows* rows, std::wstring* error) {
+  if (!rows || count == 0 || count > kMaxStripRows || y >= height_ ||
+      count > height_ - y) {
+    if (error) {
+      *error = L"Запрошены строки за пределами кадра.";
+    }
+    return false;
+  }
+  const size_t stride = static_cast<size_t>(width_) * 4;
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t sy = y + i;
+    const uint8_t* src =
+        tile_.pixels.data() +
+        static_cast<size_t>(sy % tile_.height) * tile_.stride;
+    uint8_t* dst = strip_.data() + i * stride;
+    // Копируем строку плитки кусками до края плитки.
+    uint32_t tx = (sy / tile_.height) * 97 % tile_.width;
+    for (uint32_t x = 0; x < width_;) {
+      const uint32_t run = std::min(tile_.width - tx, width_ - x);
+      std::memcpy(dst + static_cast<size_t>(x) * 4,
+                  src + static_cast<size_t>(tx) * 4,
+                  static_cast<size_t>(run) * 4);
+      x += run;
+      tx = 0;
+    }
+  }
+  rows->data = strip_.data();
+  rows->stride = stride;
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image_buffer.h"
+#include "strip_source.h"
+
+// Synthetic desktop-like content for benchmarks and tests.
+enum class SyntheticScene {
+  kText,   // Dark glyph strokes on white (editor/document).
+  kUi,     // Flat panels, toolbars, buttons, thin borders.
+  kPhoto,  // Smooth gradients with low-amplitude noise.
+  kNoise,  // Per-pixel random (worst case for any codec).
+};
+
+// Returns scene name for reports ("text", "ui", ...).
+const char* SyntheticSceneName(SyntheticScene scene);
+
+// Generates deterministic BGRA8 frame for scene and seed.
+ImageBuffer MakeSyntheticFrame(SyntheticScene scene, uint32_t width,
+                               uint32_t height, uint32_t seed);
+
+// Large span (8K, multi-monitor) tiled from one scene frame and produced
+// strip by strip: only the tile and one strip are ever in memory. Tile rows
+// are shifted per tile row so neighbouring tiles do not repeat exactly.
+class SyntheticStripSource : public StripSource {
+ public:
+  SyntheticStripSource(SyntheticScene scene, uint32_t width, uint32_t height,
+                       uint32_t tile_width, uint32_t tile_height,
+                       uint32_t seed);
+
+  uint32_t Width() const override { return width_; }
+  uint32_t Height() const override { return height_; }
+  PixelFormat Format() const override { return PixelFormat::kBgra8; }
+  bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                std::wstring* error) override;
+
+ private:
+  ImageBuffer tile_;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  std::vector<uint8_t> strip_;
+};
@@ -0,0 +1,1128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "codec_select.h"
+#include "contact_sheet.h"
+#include "file_io.h"
+#include "frame_archive.h"
+#include "frame_ring.h"
+#include "frame_store.h"
+#include "hash.h"
+#include "jpeg_dct.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "jpeg_entropy.h"
+#include "jpeg_tables.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "mjpeg_stream.h"
+#include "perf_counters.h"
+#include "pixel_convert.h"
+#include "qoi_codec.h"
+#include "rate_control.h"
+#include "resample.h"
+#include "strip_source.h"
+#include "synthetic_frames.h"
+
+namespace {
+
+// Параметры прогона: --quick для ctest (малый кадр, 1 итерация).
+struct BenchConfig {
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  int iterations = 5;
+  // --json: stage counters written as JSON (empty: not written).
+  std::string json_path;
+};
+
+double MedianMs(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+bool BenchColorModes(const BenchConfig& config) {
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto,
+                                   SyntheticScene::kNoise};
+  const ColorMode modes[] = {ColorMode::k420, ColorMode::k422,
+                             ColorMode::k444, ColorMode::kGray};
+  std::cout << "== color modes (" << config.width << "x" << config.height
+            << ", quality 0.75) ==\n";
+  std::cout << std::left << std::setw(8) << "scene" << std::setw(8) << "mode"
+            << std::right << std::setw(12) << "bytes" << std::setw(12)
+            << "encode_ms" << "\n";
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame =
+        MakeSyntheticFrame(scene, config.width, config.height, 1);
+    for (ColorMode mode : modes) {
+      JpegEncodeOptions options;
+      options.quality = 0.75f;
+      options.color_mode = mode;
+      std::vector<uint8_t> jpeg;
+      std::vector<double> samples;
+      for (int i = 0; i < config.iterations; ++i) {
+        std::wstring error;
+        const auto start = std::chrono::steady_clock::now();
+        if (!EncodeJpeg(frame, options, &jpeg, &error)) {
+          std::cerr << "encode failed\n";
+          return false;
+        }
+        const auto end = std::chrono::steady_clock::now();
+        samples.push_back(
+            std::chrono::duration<double, std::milli>(end - start).count());
+      }
+      const std::wstring mode_name = ColorModeName(mode);
+      std::cout << std::left << std::setw(8) << SyntheticSceneName(scene)
+                << std::setw(8) << std::string(mode_name.begin(), mode_name.end())
+                << std::right << std::setw(12) << jpeg.size() << std::setw(12)
+                << std::fixed << std::setprecision(2) << MedianMs(samples)
+                << "\n";
+    }
+  }
+  return true;
+}
+
+double ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Rate control: DCT один раз, затем проходы квантования; холодный старт
+// против переноса оценки с прошлого кадра.
+bool BenchRateControl(const BenchConfig& config) {
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto};
+  std::cout << "== rate control (" << config.width << "x" << config.height
+            << ", 420, target = q20 size + 2%) ==\n";
+  std::cout << std::left << std::setw(8) << "scene" << std::right
+            << std::setw(10) << "target" << std::setw(10) << "bytes"
+            << std::setw(6) << "q" << std::setw(12) << "cold_pass"
+            << std::setw(12) << "warm_pass" << std::setw(10) << "dct_ms"
+            << std::setw(10) << "cold_ms" << std::setw(10) << "warm_ms"
+            << "\n";
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame =
+        MakeSyntheticFrame(scene, config.width, config.height, 1);
+    JpegCoefficients coefficients;
+    std::wstring error;
+    auto start = std::chrono::steady_clock::now();
+    if (!ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients,
+                                 &error)) {
+      std::cerr << "coefficients failed\n";
+      return false;
+    }
+    const double dct_ms = ElapsedMs(start);
+    const uint64_t target = EstimateJpegSize(coefficients, 20) * 102 / 100;
+
+    RateControlState state;
+    RateControlResult cold;
+    std::vector<uint8_t> jpeg;
+    start = std::chrono::steady_clock::now();
+    EncodeJpegToTarget(coefficients, target, &state, nullptr, &jpeg, &cold);
+    const double cold_ms = ElapsedMs(start);
+
+    RateControlResult warm;
+    std::vector<double> samples;
+    for (int i = 0; i < config.iterations; ++i) {
+      start = std::chrono::steady_clock::now();
+      EncodeJpegToTarget(coefficients, target, &state, nullptr, &jpeg, &warm);
+      samples.push_back(ElapsedMs(start));
+    }
+    std::cout << std::left << std::setw(8) << SyntheticSceneName(scene)
+              << std::right << std::setw(10) << target << std::setw(10)
+              << jpeg.size() << std::setw(6) << warm.quality << std::setw(12)
+              << cold.passes << std::setw(12) << warm.passes << std::fixed
+              << std::setprecision(2) << std::setw(10) << dct_ms
+              << std::setw(10) << cold_ms << std::setw(10) << MedianMs(samples)
+              << "\n";
+    if (jpeg.size() > target && warm.quality > 1) {
+      std::cerr << "rate control exceeded target\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Оптимизированные таблицы Huffman: выигрыш в размере против затрат CPU
+// (время от кэшированных коэффициентов, DCT не входит).
+bool BenchHuffman(const BenchConfig& config) {
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto,
+                                   SyntheticScene::kNoise};
+  const int quality = QualityToIjg(0.01f);
+  std::cout << "== optimized huffman (" << config.width << "x"
+            << config.height << ", 420, ijg quality " << quality << ") ==\n";
+  std::cout << std::left << std::setw(8) << "scene" << std::right
+            << std::setw(10) << "std_bytes" << std::setw(10) << "opt_bytes"
+            << std::setw(9) << "saved%" << std::setw(10) << "std_ms"
+            << std::setw(10) << "frame_ms" << std::setw(10) << "reuse_ms"
+            << "\n";
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame =
+        MakeSyntheticFrame(scene, config.width, config.height, 1);
+    JpegCoefficients coefficients;
+    std::wstring error;
+    if (!ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients,
+                                 &error)) {
+      std::cerr << "coefficients failed\n";
+      return false;
+    }
+    std::vector<uint8_t> standard;
+    std::vector<uint8_t> optimized;
+    std::vector<uint8_t> reused;
+    std::vector<double> std_ms;
+    std::vector<double> frame_ms;
+    std::vector<double> reuse_ms;
+    HuffmanReuseState reuse;
+    EncodeJpegOptimized(coefficients, quality, &reuse, &reused);
+    for (int i = 0; i < config.iterations; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      EncodeJpegCoefficients(coefficients, quality, &standard);
+      std_ms.push_back(ElapsedMs(start));
+      start = std::chrono::steady_clock::now();
+      EncodeJpegOptimized(coefficients, quality, nullptr, &optimized);
+      frame_ms.push_back(ElapsedMs(start));
+      start = std::chrono::steady_clock::now();
+      EncodeJpegOptimized(coefficients, quality, &reuse, &reused);
+      reuse_ms.push_back(ElapsedMs(start));
+    }
+    const double saved = 100.0 * (1.0 - static_cast<double>(optimized.size()) /
+                                            static_cast<double>(standard.size()));
+    std::cout << std::left << std::setw(8) << SyntheticSceneName(scene)
+              << std::right << std::setw(10) << standard.size()
+              << std::setw(10) << optimized.size() << std::fixed
+              << std::setprecision(1) << std::setw(9) << saved
+              << std::setprecision(2) << std::setw(10) << MedianMs(std_ms)
+              << std::setw(10) << MedianMs(frame_ms) << std::setw(10)
+              << MedianMs(reuse_ms) << "\n";
+    if (optimized.size() > standard.size()) {
+      std::cerr << "optimized tables larger than standard\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Инкрементальное кодирование: стоимость против доли измененных полос MCU.
+bool BenchIncremental(const BenchConfig& config) {
+  const double fractions[] = {0.0, 0.05, 0.25, 1.0};
+  JpegEncodeOptions options;
+  options.quality = 0.3f;
+  const ImageBuffer base =
+      MakeSyntheticFrame(SyntheticScene::kText, config.width, config.height, 1);
+  const uint32_t strip_rows = 16;
+  const uint32_t strips = (config.height + strip_rows - 1) / strip_rows;
+  std::vector<uint8_t> jpeg;
+  std::wstring error;
+  std::vector<double> full_ms;
+  for (int i = 0; i < config.iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    EncodeJpeg(base, options, &jpeg, &error);
+    full_ms.push_back(ElapsedMs(start));
+  }
+  std::cout << "== incremental (" << config.width << "x" << config.height
+            << ", text, 420, full encode " << std::fixed
+            << std::setprecision(2) << MedianMs(full_ms) << " ms) ==\n";
+  std::cout << std::left << std::setw(10) << "changed%" << std::right
+            << std::setw(8) << "rows" << std::setw(10) << "bytes"
+            << std::setw(10) << "inc_ms" << std::setw(10) << "speedup"
+            << "\n";
+  for (double fraction : fractions) {
+    IncrementalJpegCache cache;
+    IncrementalEncodeStats stats;
+    EncodeJpegIncremental(base, options, &cache, &jpeg, &stats, &error);
+    const uint32_t changed = static_cast<uint32_t>(fraction * strips + 0.5);
+    std::vector<double> samples;
+    size_t bytes = 0;
+    for (int i = 0; i < config.iterations; ++i) {
+      // Каждую итерацию меняем выбранные полосы заново (инверсия пикселя).
+      ImageBuffer frame = base;
+      for (uint32_t k = 0; k < changed; ++k) {
+        const uint32_t strip = static_cast<uint32_t>(
+            (static_cast<uint64_t>(k) * strips) / std::max<uint32_t>(changed, 1));
+        const uint32_t y = std::min(strip * strip_rows, frame.height - 1);
+        frame.pixels[static_cast<size_t>(y) * frame.stride +
+                     static_cast<size_t>(i % frame.width) * 4] ^= 0xFF;
+      }
+      const auto start = std::chrono::steady_clock::now();
+      EncodeJpegIncremental(frame, options, &cache, &jpeg, &stats, &error);
+      samples.push_back(ElapsedMs(start));
+      bytes = jpeg.size();
+      EncodeJpegIncremental(base, options, &cache, &jpeg, nullptr, &error);
+    }
+    const double inc_ms = MedianMs(samples);
+    std::cout << std::left << std::setw(10) << std::setprecision(0)
+              << fraction * 100.0 << std::right << std::setw(8)
+              << stats.rows_encoded << std::setw(10) << bytes
+              << std::setprecision(2) << std::setw(10) << inc_ms
+              << std::setw(10) << MedianMs(full_ms) / std::max(inc_ms, 0.001)
+              << "\n";
+  }
+  return true;
+}
+
+// Энтропийное кодирование отдельно от DCT: побайтовый писатель с обходом
+// всех 63 коэффициентов против 64-битного аккумулятора с маской ненулевых.
+// Все блоки кодируются таблицами яркости: поток не декодируется, важна
+// скорость; выходы обоих вариантов должны совпадать байт в байт.
+template <typename Writer, typename Coder>
+double EntropyPassMs(const std::vector<int16_t>& blocks, Coder coder,
+                     std::vector<uint8_t>* out) {
+  static const HuffmanLut dc = BuildHuffmanLut(kStdDcLuma);
+  static const HuffmanLut ac = BuildHuffmanLut(kStdAcLuma);
+  out->clear();
+  const auto start = std::chrono::steady_clock::now();
+  Writer writer(out);
+  int last_dc = 0;
+  for (size_t i = 0; i < blocks.size(); i += 64) {
+    coder(writer, blocks.data() + i, &last_dc, dc, ac);
+  }
+  writer.Flush();
+  return ElapsedMs(start);
+}
+
+bool BenchEntropy(const BenchConfig& config) {
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto,
+                                   SyntheticScene::kNoise};
+  const int qualities[] = {QualityToIjg(0.01f), 50};
+  std::cout << "== entropy coding (" << config.width << "x" << config.height
+            << ", 420, MB/s of output) ==\n";
+  std::cout << std::left << std::setw(8) << "scene" << std::right
+            << std::setw(5) << "q" << std::setw(10) << "bytes"
+            << std::setw(10) << "byte_ms" << std::setw(10) << "word_ms"
+            << std::setw(10) << "byte_MBs" << std::setw(10) << "word_MBs"
+            << std::setw(9) << "speedup" << "\n";
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame =
+        MakeSyntheticFrame(scene, config.width, config.height, 1);
+    JpegCoefficients coefficients;
+    std::wstring error;
+    if (!ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients,
+                                 &error)) {
+      std::cerr << "coefficients failed\n";
+      return false;
+    }
+    for (int quality : qualities) {
+      std::vector<int16_t> blocks;
+      QuantizeJpegCoefficients(coefficients, quality, &blocks);
+      std::vector<uint8_t> reference;
+      std::vector<uint8_t> fast;
+      std::vector<double> byte_ms;
+      std::vector<double> word_ms;
+      for (int i = 0; i < config.iterations; ++i) {
+        byte_ms.push_back(EntropyPassMs<ByteBitWriter>(
+            blocks, EncodeBlockReference<ByteBitWriter>, &reference));
+        word_ms.push_back(EntropyPassMs<JpegBitWriter>(
+            blocks, EncodeBlockFast<JpegBitWriter>, &fast));
+      }
+      if (fast != reference) {
+        std::cerr << "entropy writers disagree\n";
+        return false;
+      }
+      const double mb = static_cast<double>(fast.size()) / (1024.0 * 1024.0);
+      const double slow = std::max(MedianMs(byte_ms), 0.001);
+      const double quick = std::max(MedianMs(word_ms), 0.001);
+      std::cout << std::left << std::setw(8) << SyntheticSceneName(scene)
+                << std::right << std::setw(5) << quality << std::setw(10)
+                << fast.size() << std::fixed << std::setprecision(2)
+                << std::setw(10) << slow << std::setw(10) << quick
+                << std::setprecision(1) << std::setw(10)
+                << mb * 1000.0 / slow << std::setw(10) << mb * 1000.0 / quick
+                << std::setprecision(2) << std::setw(9) << slow / quick
+                << "\n";
+    }
+  }
+  return true;
+}
+
+// DCT и квантование: скалярный эталон против SSE2 (нс на блок 8x8) и
+// полное кодирование кадра с пересчетом на 8K (7680x4320, один поток).
+bool BenchDct(const BenchConfig& config) {
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kPhoto, config.width, config.height, 1);
+  std::vector<uint8_t> luma;
+  std::wstring error;
+  if (!ConvertToGray8(frame, &luma, &error)) {
+    std::cerr << "luma failed\n";
+    return false;
+  }
+  const uint32_t blocks_x = config.width / 8;
+  const uint32_t blocks_y = config.height / 8;
+  const size_t blocks = static_cast<size_t>(blocks_x) * blocks_y;
+  std::vector<int16_t> coef(blocks * 64);
+  std::vector<int16_t> zz(blocks * 64);
+  const QuantDivisors divisors = BuildQuantDivisors(kStdLumaQuant);
+
+  auto run_dct = [&](auto dct) {
+    std::vector<double> samples;
+    for (int i = 0; i < config.iterations; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t b = 0; b < blocks; ++b) {
+        const size_t x = (b % blocks_x) * 8;
+        const size_t y = (b / blocks_x) * 8;
+        dct(luma.data() + y * config.width + x, config.width,
+            coef.data() + b * 64);
+      }
+      samples.push_back(ElapsedMs(start));
+    }
+    return MedianMs(samples) * 1e6 / static_cast<double>(blocks);
+  };
+  auto run_quant = [&](auto quantize) {
+    std::vector<double> samples;
+    for (int i = 0; i < config.iterations; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t b = 0; b < blocks; ++b) {
+        quantize(coef.data() + b * 64, zz.data() + b * 64);
+      }
+      samples.push_back(ElapsedMs(start));
+    }
+    return MedianMs(samples) * 1e6 / static_cast<double>(blocks);
+  };
+  const double dct_ref = run_dct(ForwardDct8x8Reference);
+  const double dct_simd = run_dct(ForwardDct8x8);
+  const double quant_ref = run_quant([](const int16_t* c, int16_t* z) {
+    QuantizeBlockReference(c, kStdLumaQuant, z);
+  });
+  const double quant_simd = run_quant([&](const int16_t* c, int16_t* z) {
+    QuantizeBlock(c, divisors, z);
+  });
+
+  JpegCoefficients coefficients;
+  std::vector<uint8_t> jpeg;
+  std::vector<double> coef_ms;
+  std::vector<double> entropy_ms;
+  for (int i = 0; i < config.iterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients, &error);
+    coef_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    EncodeJpegCoefficients(coefficients, QualityToIjg(0.01f), &jpeg);
+    entropy_ms.push_back(ElapsedMs(start));
+  }
+  const double frame_ms = MedianMs(coef_ms) + MedianMs(entropy_ms);
+  const double scale_8k = (7680.0 * 4320.0) /
+                          (static_cast<double>(config.width) * config.height);
+  std::cout << "== dct + quantization (" << config.width << "x"
+            << config.height << ", ns per 8x8 block) ==\n";
+  std::cout << std::right << std::setw(10) << "dct_ref" << std::setw(10)
+            << "dct_simd" << std::setw(10) << "q_ref" << std::setw(10)
+            << "q_simd" << std::setw(10) << "coef_ms" << std::setw(12)
+            << "quant+huff" << std::setw(10) << "8K_ms" << "\n";
+  std::cout << std::fixed << std::setprecision(1) << std::setw(10) << dct_ref
+            << std::setw(10) << dct_simd << std::setw(10) << quant_ref
+            << std::setw(10) << quant_simd << std::setprecision(2)
+            << std::setw(10) << MedianMs(coef_ms) << std::setw(12)
+            << MedianMs(entropy_ms) << std::setw(10) << frame_ms * scale_8k
+            << "\n";
+  return true;
+}
+
+// Кодирование кадра без контекста (буферы и таблицы на каждый вызов)
+// против долгоживущего контекста дисплея (качество продакшена).
+bool BenchEncoderContext(const BenchConfig& config) {
+  const ImageBuffer frame =
+      MakeSyntheticFrame(SyntheticScene::kUi, config.width, config.height, 1);
+  std::cout << "== encoder context (" << config.width << "x" << config.height
+            << ", ui, 420, quality 0.01) ==\n";
+  std::cout << std::left << std::setw(10) << "huffman" << std::right
+            << std::setw(12) << "plain_ms" << std::setw(12) << "context_ms"
+            << std::setw(10) << "speedup" << "\n";
+  for (const bool optimize : {false, true}) {
+    JpegEncodeOptions options;
+    options.optimize_huffman = optimize;
+    JpegEncoderContext context;
+    std::wstring error;
+    if (!EncodeJpeg(frame, options, &context, &error)) {
+      std::cerr << "encode failed\n";
+      return false;
+    }
+    std::vector<double> plain_ms;
+    std::vector<double> context_ms;
+    for (int i = 0; i < config.iterations; ++i) {
+      std::vector<uint8_t> jpeg;
+      auto start = std::chrono::steady_clock::now();
+      EncodeJpeg(frame, options, &jpeg, &error);
+      plain_ms.push_back(ElapsedMs(start));
+      start = std::chrono::steady_clock::now();
+      EncodeJpeg(frame, options, &context, &error);
+      context_ms.push_back(ElapsedMs(start));
+      if (jpeg != context.output) {
+        std::cerr << "context output mismatch\n";
+        return false;
+      }
+    }
+    const double plain = MedianMs(plain_ms);
+    const double reused = MedianMs(context_ms);
+    std::cout << std::left << std::setw(10)
+              << (optimize ? "optimized" : "standard") << std::right
+              << std::fixed << std::setprecision(2) << std::setw(12) << plain
+              << std::setw(12) << reused << std::setw(10)
+              << plain / std::max(reused, 0.001) << "\n";
+  }
+  return true;
+}
+
+// JPEG (встроенный кодер) против QOI без потерь по сценам: размер, время
+// кодирования, время и решение выборочной оценки auto.
+bool BenchCodecs(const BenchConfig& config) {
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto,
+                                   SyntheticScene::kNoise};
+  std::cout << "== jpeg vs lossless (" << config.width << "x"
+            << config.height << ", 420) ==\n";
+  std::cout << std::left << std::setw(8) << "scene" << std::setw(8)
+            << "quality" << std::right << std::setw(10) << "jpeg_B"
+            << std::setw(10) << "jpeg_ms" << std::setw(10) << "qoi_B"
+            << std::setw(10) << "qoi_ms" << std::setw(10) << "pick_ms"
+            << std::setw(10) << "auto" << "\n";
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame =
+        MakeSyntheticFrame(scene, config.width, config.height, 1);
+    for (const float quality : {0.01f, 0.75f}) {
+      JpegEncodeOptions options;
+      options.quality = quality;
+      JpegEncoderContext context;
+      std::vector<uint8_t> qoi;
+      std::wstring error;
+      std::vector<double> jpeg_ms;
+      std::vector<double> qoi_ms;
+      std::vector<double> pick_ms;
+      CodecChoice choice;
+      for (int i = 0; i < config.iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (!EncodeJpeg(frame, options, &context, &error)) {
+          std::cerr << "encode failed\n";
+          return false;
+        }
+        jpeg_ms.push_back(ElapsedMs(start));
+        start = std::chrono::steady_clock::now();
+        if (!EncodeQoi(frame, &qoi, &error)) {
+          std::cerr << "lossless encode failed\n";
+          return false;
+        }
+        qoi_ms.push_back(ElapsedMs(start));
+        start = std::chrono::steady_clock::now();
+        choice = ChooseCodec(frame, options.color_mode, quality,
+                             context.workspace.get());
+        pick_ms.push_back(ElapsedMs(start));
+      }
+      const std::wstring pick = OutputCodecName(choice.codec);
+      std::cout << std::left << std::setw(8) << SyntheticSceneName(scene)
+                << std::fixed << std::setprecision(2) << std::setw(8)
+                << quality << std::right << std::setw(10)
+                << context.output.size() << std::setw(10)
+                << MedianMs(jpeg_ms) << std::setw(10) << qoi.size()
+                << std::setw(10) << MedianMs(qoi_ms) << std::setw(10)
+                << MedianMs(pick_ms) << std::setw(10)
+                << std::string(pick.begin(), pick.end()) << "\n";
+    }
+  }
+  return true;
+}
+
+// Прирост пикового RSS за вызов fn, КБ; -1, если сброс пика недоступен.
+template <typename Fn>
+long long PeakGrowthKb(Fn&& fn) {
+  ProcessMemory before;
+  ProcessMemory after;
+  const bool tracked = ResetPeakRss() && QueryProcessMemory(&before);
+  fn();
+  if (!tracked || !QueryProcessMemory(&after)) {
+    return -1;
+  }
+  return static_cast<long long>(after.peak_rss_bytes - before.rss_bytes) /
+         1024;
+}
+
+bool BenchStreaming(const BenchConfig& config) {
+  // Пролет 4x4 дисплеев конфигурации (1080p -> 8K), сцена text.
+  const uint32_t width = config.width * 4;
+  const uint32_t height = config.height * 4;
+  SyntheticStripSource span(SyntheticScene::kText, width, height,
+                            config.width, config.height, 1);
+  std::cout << "== streaming strips vs full frame (" << width << "x"
+            << height << ", 420) ==\n";
+  std::cout << std::left << std::setw(8) << "path" << std::right
+            << std::setw(10) << "ms" << std::setw(14) << "peak_rss_KB"
+            << std::setw(10) << "bytes" << "\n";
+  std::wstring error;
+  bool ok = true;
+  std::vector<double> stream_ms;
+  std::vector<uint8_t> stream_out;
+  const long long stream_kb = PeakGrowthKb([&] {
+    for (int i = 0; i < config.iterations; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      ok &= EncodeJpegStreaming(&span, JpegEncodeOptions{}, &stream_out,
+                                &error);
+      stream_ms.push_back(ElapsedMs(start));
+    }
+  });
+  std::vector<double> frame_ms;
+  std::vector<uint8_t> frame_out;
+  const long long frame_kb = PeakGrowthKb([&] {
+    for (int i = 0; i < config.iterations; ++i) {
+      // Прежний путь: кадр целиком, затем коэффициенты всего кадра.
+      const auto start = std::chrono::steady_clock::now();
+      ImageBuffer frame;
+      frame.width = width;
+      frame.height = height;
+      frame.stride = width * 4;
+      frame.pixels.resize(static_cast<size_t>(frame.stride) * height);
+      for (uint32_t y = 0; y < height; y += kMaxStripRows) {
+        const uint32_t count = std::min(kMaxStripRows, height - y);
+        PixelRows rows;
+        ok &= span.ReadRows(y, count, &rows, &error);
+        std::memcpy(frame.pixels.data() + static_cast<size_t>(y) * frame.stride,
+                    rows.data, static_cast<size_t>(count) * frame.stride);
+      }
+      JpegCoefficients coefficients;
+      ok &= ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients,
+                                    &error);
+      EncodeJpegCoefficients(coefficients, 1, &frame_out);
+      frame_ms.push_back(ElapsedMs(start));
+    }
+  });
+  if (!ok || stream_out != frame_out) {
+    std::cerr << "streaming encode failed or differs\n";
+    return false;
+  }
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << std::left << std::setw(8) << "stream" << std::right
+            << std::setw(10) << MedianMs(stream_ms) << std::setw(14)
+            << stream_kb << std::setw(10) << stream_out.size() << "\n";
+  std::cout << std::left << std::setw(8) << "frame" << std::right
+            << std::setw(10) << MedianMs(frame_ms) << std::setw(14)
+            << frame_kb << std::setw(10) << frame_out.size() << "\n";
+  return true;
+}
+
+bool BenchArchive(const BenchConfig& config) {
+  namespace fs = std::filesystem;
+  // Сутки одного дисплея при интервале 10 с (--quick: 200 кадров).
+  const int frames = config.iterations == 1 ? 200 : 8640;
+  const fs::path dir = fs::temp_directory_path() / "p2_bench_archive";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir / "files", ec);
+  std::vector<uint8_t> data(16 * 1024);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 131);
+  }
+  std::cout << "== archive and mjpeg stream vs per-file output (" << frames
+            << " frames x 16 KB) ==\n";
+  std::wstring error;
+  bool ok = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; ++i) {
+    const fs::path path = dir / "files" / (std::to_string(i) + ".jpg");
+    ok &= WriteFileBytes(path.wstring(), data, &error);
+  }
+  const double files_ms = ElapsedMs(start);
+
+  const std::wstring pack = (dir / "day.p2pack").wstring();
+  const std::wstring index = (dir / "day.p2idx").wstring();
+  start = std::chrono::steady_clock::now();
+  {
+    FrameArchiveWriter writer;
+    ok &= writer.Open(pack, index, ArchiveIdentity{}, &error);
+    for (int i = 0; i < frames; ++i) {
+      ok &= writer.Append(i * 10, OutputCodec::kJpeg, 1, data, &error);
+    }
+  }
+  const double archive_ms = ElapsedMs(start);
+
+  start = std::chrono::steady_clock::now();
+  {
+    MjpegStreamWriter video;
+    ok &= video.Open((dir / "day.mkv").wstring(), 100, &error);
+    for (int i = 0; i < frames; ++i) {
+      ok &= video.Append(data, 1920, 1080, &error);
+    }
+    ok &= video.Finalize(&error);
+  }
+  const double video_ms = ElapsedMs(start);
+
+  ArchiveIndexView view;
+  ok &= view.Open(index, &error);
+  const int lookups = 100000;
+  size_t found = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < lookups; ++i) {
+    found += view.LowerBound((i * 7919LL) % (frames * 10LL));
+  }
+  const double lookup_ns = ElapsedMs(start) * 1e6 / lookups;
+  fs::remove_all(dir, ec);
+  if (!ok || view.Size() != static_cast<size_t>(frames) || found == 0) {
+    std::cerr << "archive bench failed\n";
+    return false;
+  }
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "per-file write, ms: " << files_ms
+            << "\narchive append, ms: " << archive_ms
+            << "\nmjpeg stream append + index, ms: " << video_ms
+            << "\nindex lookup, ns: " << lookup_ns << "\n";
+  return true;
+}
+
+bool BenchDedup(const BenchConfig& config) {
+  namespace fs = std::filesystem;
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kUi, config.width, config.height, 1);
+  const double megabytes = frame.pixels.size() / (1024.0 * 1024.0);
+  const int rounds = config.iterations * 4;
+  std::vector<double> hash64_ms;
+  std::vector<double> key_ms;
+  uint64_t sink = 0;
+  for (int i = 0; i < rounds; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    sink += Hash64(frame.pixels.data(), frame.pixels.size());
+    hash64_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    sink += FrameContentKey(frame).high;
+    key_ms.push_back(ElapsedMs(start));
+  }
+
+  // Повтор кадра: ключ + ссылка против полного кодирования.
+  const fs::path dir = fs::temp_directory_path() / "p2_bench_store";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  std::wstring error;
+  FrameStore store;
+  bool ok = store.Open(dir.wstring(), ArchiveIdentity{}, &error) &&
+            store.SetDay(DateTimeParts{2026, 1, 1, 0, 0, 0}, &error);
+  JpegEncodeOptions options;
+  options.quality = 0.01f;
+  std::vector<uint8_t> jpeg;
+  StoreReference reference;
+  reference.key = FrameContentKey(frame);
+  ok = ok && EncodeJpeg(frame, options, &jpeg, &error) &&
+       store.AddFrame(reference, jpeg, &error);
+  std::vector<double> encode_ms;
+  std::vector<double> hit_ms;
+  for (int i = 0; i < rounds; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    ok = ok && EncodeJpeg(frame, options, &jpeg, &error);
+    encode_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    reference.key = FrameContentKey(frame);
+    ok = ok && store.Contains(reference.key) &&
+         store.AddReference(&reference, &error);
+    hit_ms.push_back(ElapsedMs(start));
+  }
+  const DedupStats stats = store.DayStats();
+  // Журнал дня закрывается до удаления папки.
+  store = FrameStore();
+  fs::remove_all(dir, ec);
+  if (!ok || stats.unique_frames != 1 || sink == 0) {
+    std::cerr << "dedup bench failed\n";
+    return false;
+  }
+  std::cout << "== frame store dedup (" << config.width << "x"
+            << config.height << ", " << rounds << " repeats) ==\n";
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "hash64, MB/s: " << megabytes * 1000.0 / MedianMs(hash64_ms)
+            << "\nframe key (hash128), MB/s: "
+            << megabytes * 1000.0 / MedianMs(key_ms)
+            << "\nencode repeated frame, ms: " << MedianMs(encode_ms)
+            << "\nstore hit (key + reference), ms: " << MedianMs(hit_ms)
+            << "\ndedup ratio: "
+            << static_cast<double>(stats.references) / stats.unique_frames
+            << "\n";
+  return true;
+}
+
+// Хранение по сроку: декодирование сохраненного кадра и полный пережим
+// уровня "0.5:gray" (декодирование + уменьшение + серый JPEG).
+bool BenchRetention(const BenchConfig& config) {
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kText, config.width, config.height, 1);
+  JpegEncodeOptions options;
+  options.quality = 0.01f;
+  std::vector<uint8_t> jpeg;
+  std::wstring error;
+  bool ok = EncodeJpeg(frame, options, &jpeg, &error);
+  JpegEncodeOptions gray_options = options;
+  gray_options.color_mode = ColorMode::kGray;
+  std::vector<double> decode_ms;
+  std::vector<double> recompress_ms;
+  std::vector<uint8_t> recompressed;
+  ImageBuffer decoded;
+  ImageBuffer half;
+  for (int i = 0; i < config.iterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    ok = ok && DecodeJpeg(jpeg, &decoded, &error);
+    decode_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    ok = ok && DecodeJpeg(jpeg, &decoded, &error) &&
+         ResampleImage(decoded, decoded.width / 2, decoded.height / 2,
+                       ResampleFilter::kAuto, 1, &half, &error) &&
+         EncodeJpeg(half, gray_options, &recompressed, &error);
+    recompress_ms.push_back(ElapsedMs(start));
+  }
+  if (!ok) {
+    std::cerr << "retention bench failed\n";
+    return false;
+  }
+  std::cout << "== retention recompression (" << config.width << "x"
+            << config.height << ") ==\n";
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "jpeg decode, ms: " << MedianMs(decode_ms)
+            << "\nrecompress 0.5:gray, ms: " << MedianMs(recompress_ms)
+            << "\nbytes before: " << jpeg.size()
+            << "\nbytes after: " << recompressed.size() << "\n";
+  return true;
+}
+
+// Листы дня: эскиз полным декодированием против декодирования DC, эскиз
+// при кодировании и построение листов часа на всех ядрах.
+bool BenchContactSheets(const BenchConfig& config) {
+  namespace fs = std::filesystem;
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kText, config.width, config.height, 1);
+  JpegEncodeOptions options;
+  options.quality = 0.01f;
+  std::vector<uint8_t> jpeg;
+  std::wstring error;
+  bool ok = EncodeJpeg(frame, options, &jpeg, &error);
+  ImageBuffer decoded;
+  ImageBuffer thumbnail;
+  std::vector<double> full_ms;
+  std::vector<double> dc_ms;
+  std::vector<double> encode_ms;
+  std::vector<double> encode_thumbnail_ms;
+  for (int i = 0; i < config.iterations * 2; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    ok = ok && DecodeJpeg(jpeg, &decoded, &error) &&
+         ResampleImage(decoded, (decoded.width + 7) / 8,
+                       (decoded.height + 7) / 8, ResampleFilter::kAuto, 1,
+                       &thumbnail, &error);
+    full_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    ok = ok && DecodeJpegDc(jpeg, &thumbnail, &error);
+    dc_ms.push_back(ElapsedMs(start));
+    options.thumbnail = nullptr;
+    start = std::chrono::steady_clock::now();
+    ok = ok && EncodeJpeg(frame, options, &jpeg, &error);
+    encode_ms.push_back(ElapsedMs(start));
+    options.thumbnail = &thumbnail;
+    start = std::chrono::steady_clock::now();
+    ok = ok && EncodeJpeg(frame, options, &jpeg, &error);
+    encode_thumbnail_ms.push_back(ElapsedMs(start));
+  }
+
+  // Час съемки раз в 10 с (--quick: несколько кадров).
+  const int frames = config.iterations == 1 ? 6 : 360;
+  const fs::path dir = fs::temp_directory_path() / "p2_bench_sheets";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir, ec);
+  for (int i = 0; i < frames && ok; ++i) {
+    wchar_t name[64] = {};
+    std::swprintf(name, 64, L"PC_USER_2026-01-01_09-%02d-%02d.jpg", i / 6,
+                  i % 6 * 10);
+    ok = WriteFileBytes((dir / name).wstring(), jpeg, &error);
+  }
+  ContactSheetStats stats;
+  const auto start = std::chrono::steady_clock::now();
+  ok = ok && BuildDayContactSheets(dir.wstring(), (dir / "sheets").wstring(),
+                                   ContactSheetOptions{}, &stats, &error);
+  const double sheets_ms = ElapsedMs(start);
+  fs::remove_all(dir, ec);
+  if (!ok || stats.sheets != 1) {
+    std::cerr << "contact sheet bench failed\n";
+    return false;
+  }
+  std::cout << "== contact sheets (" << config.width << "x" << config.height
+            << ") ==\n";
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "thumbnail by full decode + resample, ms: " << MedianMs(full_ms)
+            << "\nthumbnail by DC decode, ms: " << MedianMs(dc_ms)
+            << "\nencode, ms: " << MedianMs(encode_ms)
+            << "\nencode + DC thumbnail, ms: "
+            << MedianMs(encode_thumbnail_ms) << "\nsheet of " << frames
+            << " frames, ms: " << sheets_ms << "\n";
+  return true;
+}
+
+bool BenchCatalog(const BenchConfig& config) {
+  namespace fs = std::filesystem;
+  // Год съемки раз в 30 с (--quick: три дня); каждый десятый цикл активен.
+  const int64_t interval = 30;
+  const int64_t cycles = (config.iterations == 1 ? 3 : 365) * 86400 / interval;
+  const int64_t base = ArchiveTimestamp(DateTimeParts{2026, 1, 1, 0, 0, 0});
+  const fs::path dir = fs::temp_directory_path() / "p2_bench_catalog";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  std::wstring error;
+  ArchiveIdentity identity;
+  identity.computer = L"PC";
+  identity.user = L"USER";
+  auto start = std::chrono::steady_clock::now();
+  bool ok = true;
+  {
+    CatalogWriter writer;
+    ok = writer.Open(dir.wstring(), identity, &error);
+    CatalogEntry entry;
+    for (int64_t i = 0; i < cycles && ok; ++i) {
+      entry.timestamp = base + i * interval;
+      entry.size = 200000;
+      entry.change = static_cast<uint16_t>(i % 10 == 0 ? 300 : 0);
+      ok = writer.Append(entry, &error);
+    }
+  }
+  const double append_us = ElapsedMs(start) * 1000.0 / cycles;
+
+  // Минута в середине диапазона, активные кадры одного дня, весь год.
+  const int64_t middle = base + cycles * interval / 2;
+  CatalogQuery minute;
+  minute.from = middle;
+  minute.to = middle + 59;
+  CatalogQuery active_day;
+  active_day.from = middle - 43200;
+  active_day.to = middle + 43199;
+  active_day.min_change = 100;
+  CatalogQuery active_all;
+  active_all.min_change = 100;
+  std::vector<CatalogEntry> found;
+  CatalogQueryStats stats;
+  std::vector<double> minute_ms;
+  std::vector<double> day_ms;
+  std::vector<double> all_ms;
+  size_t minute_found = 0;
+  size_t day_found = 0;
+  size_t all_found = 0;
+  for (int i = 0; i < config.iterations && ok; ++i) {
+    start = std::chrono::steady_clock::now();
+    ok = QueryCatalog(dir.wstring(), minute, &found, nullptr, &stats, &error);
+    minute_ms.push_back(ElapsedMs(start));
+    minute_found = found.size();
+    start = std::chrono::steady_clock::now();
+    ok = ok && QueryCatalog(dir.wstring(), active_day, &found, nullptr,
+                            &stats, &error);
+    day_ms.push_back(ElapsedMs(start));
+    day_found = found.size();
+    start = std::chrono::steady_clock::now();
+    ok = ok && QueryCatalog(dir.wstring(), active_all, &found, nullptr,
+                            &stats, &error);
+    all_ms.push_back(ElapsedMs(start));
+    all_found = found.size();
+  }
+  fs::remove_all(dir, ec);
+  if (!ok || minute_found != 2 || day_found != 288 ||
+      all_found != static_cast<size_t>((cycles + 9) / 10)) {
+    std::cerr << "catalog bench failed\n";
+    return false;
+  }
+  std::cout << "== capture catalog (" << cycles << " entries, month files: "
+            << stats.files << ") ==\n";
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "append, us/entry: " << append_us
+            << "\nquery one minute, ms: " << MedianMs(minute_ms)
+            << "\nquery active frames of a day, ms: " << MedianMs(day_ms)
+            << "\nquery active frames of all, ms: " << MedianMs(all_ms)
+            << "\n";
+  return true;
+}
+
+bool BenchMetrics(const BenchConfig& config) {
+  // Набор как у захвата: 4 дисплея по три гистограммы и два счетчика.
+  MetricsRegistry registry;
+  std::vector<MetricId> histograms;
+  std::vector<MetricId> counters;
+  for (int display = 1; display <= 4; ++display) {
+    const std::vector<MetricLabel> labels = {
+        {"display", std::to_string(display)}};
+    for (const char* name : {"p2_capture_seconds", "p2_encode_seconds",
+                             "p2_write_seconds"}) {
+      histograms.push_back(
+          registry.Histogram(name, "Latency.", labels, LatencyBuckets()));
+    }
+    counters.push_back(registry.Counter("p2_frames_total", "Frames.", labels));
+    counters.push_back(
+        registry.Counter("p2_written_bytes_total", "Bytes.", labels));
+  }
+  const int updates = config.iterations == 1 ? 100000 : 10000000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; ++i) {
+    registry.Add(counters[i % counters.size()], 1);
+  }
+  const double add_ns = ElapsedMs(start) * 1e6 / updates;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < updates; ++i) {
+    registry.Observe(histograms[i % histograms.size()], (i % 1000) * 1e-4);
+  }
+  const double observe_ns = ElapsedMs(start) * 1e6 / updates;
+  std::vector<double> render_ms;
+  std::string text;
+  for (int i = 0; i < config.iterations * 20; ++i) {
+    start = std::chrono::steady_clock::now();
+    text = registry.Render();
+    render_ms.push_back(ElapsedMs(start));
+  }
+  if (text.find("p2_write_seconds_count{display=\"4\"}") ==
+      std::string::npos) {
+    std::cerr << "metrics bench failed\n";
+    return false;
+  }
+  std::cout << "== metrics (" << histograms.size() << " histograms, "
+            << counters.size() << " counters) ==\n";
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "counter add, ns: " << add_ns
+            << "\nhistogram observe, ns: " << observe_ns
+            << "\nrender, ms: " << MedianMs(render_ms) << ", bytes: "
+            << text.size() << "\n";
+  return true;
+}
+
+bool BenchFrameRing(const BenchConfig& config) {
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kUi, config.width, config.height, 1);
+  const std::wstring name =
+      L"p2_bench_ring_" +
+      std::to_wstring(
+          std::chrono::steady_clock::now().time_since_epoch().count());
+  FrameRingWriter writer;
+  FrameRingReader reader;
+  std::wstring error;
+  bool ok = writer.Create(name, 1, frame.pixels.size(), &error) &&
+            reader.Open(name, &error);
+  std::vector<double> publish_ms;
+  std::vector<double> view_ms;
+  std::vector<double> copy_ms;
+  ImageBuffer copy;
+  // Чтение на месте: проход по пикселям вида и проверка последовательности
+  // против копии кадра из кольца.
+  uint64_t checksum = 0;
+  for (int i = 0; i < config.iterations * 10 && ok; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    ok = writer.Publish(0, frame, i, &error);
+    publish_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    FrameRingView view;
+    ok = ok && reader.Latest(0, &view);
+    for (size_t offset = 0; ok && offset < frame.pixels.size();
+         offset += 64) {
+      checksum += view.pixels[offset];
+    }
+    ok = ok && reader.Validate(view);
+    view_ms.push_back(ElapsedMs(start));
+    start = std::chrono::steady_clock::now();
+    ok = ok && reader.CopyLatest(0, &copy, nullptr);
+    copy_ms.push_back(ElapsedMs(start));
+  }
+  if (!ok || copy.pixels != frame.pixels || checksum == 0) {
+    std::cerr << "frame ring bench failed\n";
+    return false;
+  }
+  std::cout << "== shared-memory frame ring (" << config.width << "x"
+            << config.height << ") ==\n";
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "publish, ms: " << MedianMs(publish_ms)
+            << "\nread in place + validate, ms: " << MedianMs(view_ms)
+            << "\ncopy latest, ms: " << MedianMs(copy_ms) << "\n";
+  return true;
+}
+
+// Конвейер кадра с разметкой стадий: копия захвата, кодирование (с
+// конвертацией внутри), хеш ключа хранилища, запись файла.
+bool BenchPerfStages(const BenchConfig& config) {
+  namespace fs = std::filesystem;
+  const ImageBuffer frame = MakeSyntheticFrame(
+      SyntheticScene::kUi, config.width, config.height, 1);
+  const fs::path path = fs::temp_directory_path() / "p2_bench_perf.jpg";
+  const int frames = config.iterations * 4;
+  PerfProfile profile;
+  std::wstring error;
+  const bool attached = profile.Attach(&error);
+  ImageBuffer captured = frame;
+  JpegEncodeOptions options;
+  JpegEncoderContext context;
+  bool ok = true;
+  uint64_t hashes = 0;
+  for (int i = 0; i < frames && ok; ++i) {
+    {
+      const PerfScope scope(PerfStage::kCaptureCopy);
+      std::memcpy(captured.pixels.data(), frame.pixels.data(),
+                  frame.pixels.size());
+    }
+    ok = EncodeJpeg(captured, options, &context, &error);
+    hashes += Hash128(captured.pixels.data(), captured.pixels.size()).low;
+    ok = ok && WriteFileBytes(path.wstring(), context.output, &error);
+    profile.AddPixels(static_cast<uint64_t>(frame.width) * frame.height);
+  }
+  profile.Detach();
+  std::error_code ec;
+  fs::remove(path, ec);
+  if (!ok || hashes == 0) {
+    std::cerr << "perf stages bench failed\n";
+    return false;
+  }
+  std::cout << "== perf counters per stage (" << config.width << "x"
+            << config.height << ", " << frames << " frames) ==\n";
+  if (attached) {
+    std::cout << profile.Report();
+  } else {
+    std::cout << "counters unavailable (not Linux, perf_event_paranoid or "
+                 "no PMU)\n";
+  }
+  if (!config.json_path.empty()) {
+    std::ofstream json(config.json_path, std::ios::trunc);
+    json << "{\"width\": " << config.width << ", \"height\": "
+         << config.height << ", \"frames\": " << frames
+         << ", \"perf_stages\": "
+         << (attached ? profile.ReportJson() : std::string("null")) << "}\n";
+    if (!json) {
+      std::cerr << "perf stages JSON write failed\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchConfig config;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--quick") == 0) {
+      config.width = 320;
+      config.height = 200;
+      config.iterations = 1;
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      config.json_path = argv[++i];
+    } else {
+      std::cerr << "Usage: p2_bench [--quick] [--json PATH]\n";
+      return 2;
+    }
+  }
+  bool ok = BenchColorModes(config);
+  ok = BenchRateControl(config) && ok;
+  ok = BenchHuffman(config) && ok;
+  ok = BenchIncremental(config) && ok;
+  ok = BenchEntropy(config) && ok;
+  ok = BenchDct(config) && ok;
+  ok = BenchEncoderContext(config) && ok;
+  ok = BenchCodecs(config) && ok;
+  ok = BenchStreaming(config) && ok;
+  ok = BenchArchive(config) && ok;
+  ok = BenchDedup(config) && ok;
+  ok = BenchRetention(config) && ok;
+  ok = BenchContactSheets(config) && ok;
+  ok = BenchCatalog(config) && ok;
+  ok = BenchMetrics(config) && ok;
+  ok = BenchFrameRing(config) && ok;
+  ok = BenchPerfStages(config) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,3023 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "activity_scheduler.h"
+#include "alloc_tracking.h"
+#include "catalog.h"
+#include "codec_select.h"
+#include "contact_sheet.h"
+#include "cpu_governor.h"
+#include "cycle_scheduler.h"
+#include "file_io.h"
+#include "frame_archive.h"
+#include "frame_ring.h"
+#include "frame_store.h"
+#include "hash.h"
+#include "jpeg_dct.h"
+#include "jpeg_decoder.h"
+#include "image_buffer.h"
+#include "jpeg_encoder.h"
+#include "jpeg_entropy.h"
+#include "jpeg_tables.h"
+#include "memory_budget.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "mjpeg_stream.h"
+#include "perf_counters.h"
+#include "pixel_convert.h"
+#include "qoi_codec.h"
+#include "rate_control.h"
+#include "retention.h"
+#include "resample.h"
+#include "strip_source.h"
+#include "synthetic_frames.h"
+
+#if defined(P2_ALLOC_TRACKING)
+namespace {
+
+// Число выделений через operator new p2_core (alloc_tracking.h).
+size_t Allocations() {
+  return static_cast<size_t>(ProcessAllocCounts().allocations);
+}
+
+}  // namespace
+#else
+namespace {
+
+// Число выделений через operator new (см. TestEncoderContext).
+std::atomic<size_t> g_allocations{0};
+
+size_t Allocations() {
+  return g_allocations.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+#endif
+
+namespace {
+
+struct TestContext {
+  int passed = 0;
+  int failed = 0;
+};
+
+void Assert(bool condition, const char* message, TestContext& ctx) {
+  if (!condition) {
+    std::cerr << "FAIL: " << message << "\n";
+    ++ctx.failed;
+  } else {
+    ++ctx.passed;
+  }
+}
+
+// Детерминированный генератор, чтобы тесты воспроизводились на любой ОС.
+struct TestRandom {
+  uint32_t state = 12345;
+  uint32_t Next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+};
+
+ImageBuffer MakeRandomImage(uint32_t width, uint32_t height,
+                            PixelFormat format, uint32_t padding,
+                            TestRandom& rng) {
+  ImageBuffer image;
+  image.width = width;
+  image.height = height;
+  image.pixel_format = format;
+  image.stride = width * BytesPerPixel(format) + padding;
+  image.pixels.resize(static_cast<size_t>(image.stride) * height);
+  for (auto& byte : image.pixels) {
+    byte = static_cast<uint8_t>(rng.Next() >> 24);
+  }
+  return image;
+}
+
+int MaxChannelDiff(const uint8_t* a, const uint8_t* b, size_t size) {
+  int worst = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const int diff = std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i]));
+    if (diff > worst) {
+      worst = diff;
+    }
+  }
+  return worst;
+}
+
+void TestHalfToFloat(TestContext& ctx) {
+  Assert(HalfToFloat(0x3C00) == 1.0f, "half 1.0", ctx);
+  Assert(HalfToFloat(0xC000) == -2.0f, "half -2.0", ctx);
+  Assert(HalfToFloat(0x0001) == 1.0f / 16777216.0f, "half denormal", ctx);
+  Assert(HalfToFloat(0x7C00) > 1e30f, "half inf", ctx);
+}
+
+void TestToneMapLut(TestContext& ctx) {
+  ToneMapParams params;
+  ToneMapLut lut(params);
+  int worst = 0;
+  for (float x = 0.0f; x < 8.0f; x += 0.0007f) {
+    const int diff = std::abs(static_cast<int>(lut.Map(x)) -
+                              static_cast<int>(ToneMapReference(x, params)));
+    if (diff > worst) {
+      worst = diff;
+    }
+  }
+  Assert(worst <= 1, "tone map lut within 1 code of reference", ctx);
+  Assert(lut.Map(0.0f) <= 1 && lut.Map(-1.0f) <= 1, "tone map black", ctx);
+  Assert(lut.Map(params.white_point) == 255 && lut.Map(100.0f) == 255,
+         "tone map white clips", ctx);
+  Assert(ToneMapReference(0.5f, params) == 188,
+         "tone map below knee is plain srgb", ctx);
+}
+
+void TestConvertRowsMatchReference(TestContext& ctx) {
+  TestRandom rng;
+  const ToneMapParams params;
+  const PixelFormat formats[] = {PixelFormat::kBgra8, PixelFormat::kRgba8,
+                                 PixelFormat::kR10G10B10A2,
+                                 PixelFormat::kRgba16F};
+  // Ширина 37 проверяет и векторную часть, и скалярный хвост.
+  for (PixelFormat format : formats) {
+    ImageBuffer src = MakeRandomImage(37, 9, format, 12, rng);
+    ImageBuffer fast;
+    std::wstring error;
+    bool ok = ConvertToBgra8(src, &fast, DefaultToneMapLut(), &error);
+    Assert(ok, "convert to bgra8", ctx);
+    if (!ok) {
+      continue;
+    }
+    std::vector<uint8_t> reference(static_cast<size_t>(src.width) * 4);
+    int worst = 0;
+    for (uint32_t y = 0; y < src.height; ++y) {
+      ConvertRowToBgra8Reference(
+          format, src.pixels.data() + static_cast<size_t>(y) * src.stride,
+          reference.data(), src.width, params);
+      const int diff = MaxChannelDiff(
+          reference.data(),
+          fast.pixels.data() + static_cast<size_t>(y) * fast.stride,
+          reference.size());
+      if (diff > worst) {
+        worst = diff;
+      }
+    }
+    const int tolerance = format == PixelFormat::kRgba16F ? 1 : 0;
+    Assert(worst <= tolerance, "vectorized kernel matches scalar reference",
+           ctx);
+    Assert(fast.stride == src.width * 4, "converted stride is packed", ctx);
+  }
+}
+
+void TestSamplePixel(TestContext& ctx) {
+  ImageBuffer image;
+  image.width = 2;
+  image.height = 1;
+  image.pixel_format = PixelFormat::kR10G10B10A2;
+  image.stride = 8;
+  image.pixels.assign(8, 0);
+  const uint32_t white_red = 0x3FFu;
+  image.pixels[4] = static_cast<uint8_t>(white_red & 0xFF);
+  image.pixels[5] = static_cast<uint8_t>(white_red >> 8);
+  uint8_t px[4] = {};
+  SamplePixelBgra8(image, 1, 0, px);
+  Assert(px[0] == 0 && px[1] == 0 && px[2] == 255 && px[3] == 255,
+         "sample 10-bit red pixel", ctx);
+  const uint32_t bpp = DispatchPixelFormat(
+      PixelFormat::kRgba16F,
+      [](auto tag) { return BytesPerPixel(decltype(tag)::value); });
+  Assert(bpp == 8, "dispatch selects fp16 specialization", ctx);
+}
+
+ImageBuffer MakeGradient(uint32_t width, uint32_t height) {
+  ImageBuffer image;
+  image.width = width;
+  image.height = height;
+  image.stride = width * 4;
+  image.pixels.resize(static_cast<size_t>(image.stride) * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      uint8_t* px = image.pixels.data() + static_cast<size_t>(y) * image.stride +
+                    x * 4;
+      px[0] = static_cast<uint8_t>(x * 255 / (width - 1));
+      px[1] = static_cast<uint8_t>(y * 255 / (height - 1));
+      px[2] = 128;
+      px[3] = 255;
+    }
+  }
+  return image;
+}
+
+void TestScaledSize(TestContext& ctx) {
+  uint32_t w = 0;
+  uint32_t h = 0;
+  ScaleOptions none;
+  Assert(!ComputeScaledSize(3840, 2160, none, &w, &h) && w == 3840 &&
+             h == 2160,
+         "scale 1.0 keeps size", ctx);
+  ScaleOptions half;
+  half.scale = 0.5f;
+  Assert(ComputeScaledSize(3840, 2160, half, &w, &h) && w == 1920 && h == 1080,
+         "scale 0.5", ctx);
+  ScaleOptions limit;
+  limit.max_width = 1280;
+  Assert(ComputeScaledSize(5120, 2880, limit, &w, &h) && w == 1280 && h == 720,
+         "max width keeps aspect", ctx);
+  limit.max_width = 8000;
+  Assert(!ComputeScaledSize(1920, 1080, limit, &w, &h), "no upscale", ctx);
+}
+
+void TestBoxResample(TestContext& ctx) {
+  TestRandom rng;
+  for (int factor : {2, 4}) {
+    ImageBuffer src = MakeRandomImage(68, 36, PixelFormat::kBgra8, 8, rng);
+    ImageBuffer dst;
+    const uint32_t dw = src.width / factor;
+    const uint32_t dh = src.height / factor;
+    Assert(ResampleImage(src, dw, dh, ResampleFilter::kBox, 1, &dst, nullptr),
+           "box resample", ctx);
+    bool exact = dst.width == dw && dst.height == dh;
+    for (uint32_t y = 0; exact && y < dh; ++y) {
+      for (uint32_t x = 0; exact && x < dw; ++x) {
+        for (int c = 0; c < 4; ++c) {
+          int sum = 0;
+          for (int j = 0; j < factor; ++j) {
+            for (int i = 0; i < factor; ++i) {
+              sum += src.pixels[static_cast<size_t>(y * factor + j) *
+                                    src.stride +
+                                (x * factor + i) * 4 + c];
+            }
+          }
+          const int area = factor * factor;
+          const int expected = (sum + area / 2) / area;
+          if (dst.pixels[static_cast<size_t>(y) * dst.stride + x * 4 + c] !=
+              expected) {
+            exact = false;
+          }
+        }
+      }
+    }
+    Assert(exact, "box resample equals exact area average", ctx);
+  }
+  // Нечетные стороны не кратны 2: box уступает Lanczos3, а не теряет
+  // последний столбец и строку.
+  ImageBuffer odd = MakeRandomImage(69, 37, PixelFormat::kBgra8, 8, rng);
+  ImageBuffer box;
+  ImageBuffer lanczos;
+  Assert(ResampleImage(odd, 34, 18, ResampleFilter::kBox, 1, &box, nullptr) &&
+             ResampleImage(odd, 34, 18, ResampleFilter::kLanczos3, 1,
+                           &lanczos, nullptr) &&
+             box.pixels == lanczos.pixels,
+         "box resample falls back on odd sizes", ctx);
+}
+
+void TestLanczosResample(TestContext& ctx) {
+  ImageBuffer flat;
+  flat.width = 101;
+  flat.height = 77;
+  flat.stride = flat.width * 4;
+  flat.pixels.assign(static_cast<size_t>(flat.stride) * flat.height, 0);
+  for (size_t i = 0; i < flat.pixels.size(); i += 4) {
+    flat.pixels[i + 0] = 10;
+    flat.pixels[i + 1] = 200;
+    flat.pixels[i + 2] = 255;
+    flat.pixels[i + 3] = 255;
+  }
+  ImageBuffer out;
+  Assert(ResampleImage(flat, 37, 29, ResampleFilter::kLanczos3, 1, &out,
+                       nullptr),
+         "lanczos resample", ctx);
+  bool flat_ok = true;
+  for (size_t i = 0; i < out.pixels.size(); i += 4) {
+    flat_ok = flat_ok && out.pixels[i] == 10 && out.pixels[i + 1] == 200 &&
+              out.pixels[i + 2] == 255;
+  }
+  Assert(flat_ok, "lanczos preserves flat color", ctx);
+
+  ImageBuffer gradient = MakeGradient(640, 360);
+  ImageBuffer single;
+  ImageBuffer multi;
+  ResampleImage(gradient, 213, 120, ResampleFilter::kLanczos3, 1, &single,
+                nullptr);
+  ResampleImage(gradient, 213, 120, ResampleFilter::kLanczos3, 4, &multi,
+                nullptr);
+  Assert(single.pixels == multi.pixels, "lanczos threads are deterministic",
+         ctx);
+  int worst = 0;
+  for (uint32_t y = 4; y + 4 < single.height; ++y) {
+    for (uint32_t x = 4; x + 4 < single.width; ++x) {
+      const double sx = (x + 0.5) * 640.0 / 213.0 - 0.5;
+      const int expected = static_cast<int>(sx * 255.0 / 639.0 + 0.5);
+      const int got = single.pixels[static_cast<size_t>(y) * single.stride +
+                                    x * 4];
+      worst = std::max(worst, std::abs(got - expected));
+    }
+  }
+  Assert(worst <= 1, "lanczos reproduces linear gradient", ctx);
+}
+
+void TestResampleFusedConversion(TestContext& ctx) {
+  TestRandom rng;
+  ImageBuffer src = MakeRandomImage(64, 48, PixelFormat::kR10G10B10A2, 0, rng);
+  ImageBuffer converted;
+  ConvertToBgra8(src, &converted, DefaultToneMapLut(), nullptr);
+  ImageBuffer fused;
+  ImageBuffer two_pass;
+  ResampleImage(src, 40, 30, ResampleFilter::kLanczos3, 2, &fused, nullptr);
+  ResampleImage(converted, 40, 30, ResampleFilter::kLanczos3, 2, &two_pass,
+                nullptr);
+  Assert(fused.pixels == two_pass.pixels && fused.width == 40,
+         "fused conversion matches convert-then-resample", ctx);
+  ImageBuffer box_fused;
+  ImageBuffer box_two_pass;
+  ResampleImage(src, 16, 12, ResampleFilter::kAuto, 0, &box_fused, nullptr);
+  ResampleImage(converted, 16, 12, ResampleFilter::kAuto, 0, &box_two_pass,
+                nullptr);
+  Assert(box_fused.pixels == box_two_pass.pixels, "fused box 4x", ctx);
+}
+
+void TestLumaRow(TestContext& ctx) {
+  TestRandom rng;
+  const uint32_t width = 37;
+  std::vector<uint8_t> bgra(width * 4);
+  for (auto& byte : bgra) {
+    byte = static_cast<uint8_t>(rng.Next() >> 24);
+  }
+  bgra[0] = bgra[1] = bgra[2] = 128;
+  std::vector<uint8_t> luma(width);
+  Bgra8RowToLuma(bgra.data(), luma.data(), width);
+  bool match = true;
+  for (uint32_t x = 0; x < width; ++x) {
+    const uint8_t* px = bgra.data() + x * 4;
+    const int expected = static_cast<int>(
+        0.299 * px[2] + 0.587 * px[1] + 0.114 * px[0] + 0.5);
+    if (std::abs(expected - luma[x]) > 1) {
+      match = false;
+    }
+  }
+  Assert(match, "luma row within 1 of BT.601", ctx);
+  Assert(luma[0] == 128, "luma keeps neutral gray", ctx);
+}
+
+// Параметры SOF0 и DQT из потока JPEG (по маркерам до SOS).
+struct JpegFrameInfo {
+  bool valid = false;
+  int width = 0;
+  int height = 0;
+  int components = 0;
+  int sampling[3] = {};
+  // Таблицы квантования в естественном порядке.
+  int quant[2][64] = {};
+};
+
+JpegFrameInfo ParseJpegFrame(const std::vector<uint8_t>& data) {
+  JpegFrameInfo info;
+  if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8 ||
+      data[data.size() - 2] != 0xFF || data[data.size() - 1] != 0xD9) {
+    return info;
+  }
+  size_t pos = 2;
+  while (pos + 4 <= data.size() && data[pos] == 0xFF) {
+    const uint8_t marker = data[pos + 1];
+    const size_t length = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+    if (marker == 0xC0 && pos + 2 + length <= data.size()) {
+      const uint8_t* sof = data.data() + pos + 4;
+      info.height = (sof[1] << 8) | sof[2];
+      info.width = (sof[3] << 8) | sof[4];
+      info.components = sof[5];
+      for (int c = 0; c < info.components && c < 3; ++c) {
+        info.sampling[c] = sof[6 + c * 3 + 1];
+      }
+      info.valid = true;
+    }
+    if (marker == 0xDB && length == 67 && pos + 2 + length <= data.size()) {
+      const uint8_t* dqt = data.data() + pos + 4;
+      for (int k = 0; k < 64; ++k) {
+        info.quant[dqt[0] & 1][kZigzagToNatural[k]] = dqt[1 + k];
+      }
+    }
+    if (marker == 0xDA) {
+      break;
+    }
+    pos += 2 + length;
+  }
+  return info;
+}
+
+void TestJpegColorModes(TestContext& ctx) {
+  const ImageBuffer frame =
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 70, 45, 7);
+  struct Case {
+    ColorMode mode;
+    int components;
+    int luma_sampling;
+  };
+  const Case cases[] = {{ColorMode::kGray, 1, 0x11},
+                        {ColorMode::k420, 3, 0x22},
+                        {ColorMode::k422, 3, 0x21},
+                        {ColorMode::k444, 3, 0x11}};
+  size_t sizes[4] = {};
+  for (int i = 0; i < 4; ++i) {
+    JpegEncodeOptions options;
+    options.quality = 0.75f;
+    options.color_mode = cases[i].mode;
+    std::vector<uint8_t> jpeg;
+    std::wstring error;
+    Assert(EncodeJpeg(frame, options, &jpeg, &error), "encode jpeg", ctx);
+    const JpegFrameInfo info = ParseJpegFrame(jpeg);
+    Assert(info.valid, "jpeg has SOI/SOF0/EOI", ctx);
+    Assert(info.width == 70 && info.height == 45, "jpeg frame size", ctx);
+    Assert(info.components == cases[i].components, "jpeg component count",
+           ctx);
+    Assert(info.sampling[0] == cases[i].luma_sampling, "jpeg luma sampling",
+           ctx);
+    if (info.components == 3) {
+      Assert(info.sampling[1] == 0x11 && info.sampling[2] == 0x11,
+             "jpeg chroma sampling", ctx);
+    }
+    sizes[i] = jpeg.size();
+  }
+  Assert(sizes[0] < sizes[1], "gray smaller than 420", ctx);
+  Assert(sizes[1] < sizes[3], "420 smaller than 444", ctx);
+
+  ColorMode parsed = ColorMode::k420;
+  Assert(ParseColorMode(L"gray", &parsed) && parsed == ColorMode::kGray,
+         "parse color mode", ctx);
+  Assert(!ParseColorMode(L"411", &parsed), "reject unknown color mode", ctx);
+}
+
+void TestJpegHdrInput(TestContext& ctx) {
+  TestRandom rng;
+  const ImageBuffer image =
+      MakeRandomImage(19, 9, PixelFormat::kR10G10B10A2, 12, rng);
+  std::vector<uint8_t> jpeg;
+  std::wstring error;
+  Assert(EncodeJpeg(image, JpegEncodeOptions{}, &jpeg, &error),
+         "encode 10-bit input", ctx);
+  Assert(ParseJpegFrame(jpeg).valid, "10-bit input jpeg valid", ctx);
+  ImageBuffer empty;
+  Assert(!EncodeJpeg(empty, JpegEncodeOptions{}, &jpeg, &error),
+         "reject empty image", ctx);
+}
+
+void TestRateControl(TestContext& ctx) {
+  const ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 320, 200, 3);
+  JpegCoefficients coefficients;
+  std::wstring error;
+  Assert(ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients, &error),
+         "compute coefficients", ctx);
+
+  std::vector<uint8_t> jpeg;
+  EncodeJpegCoefficients(coefficients, 40, &jpeg);
+  const size_t estimate = EstimateJpegSize(coefficients, 40);
+  Assert(estimate == jpeg.size(), "size estimate matches encoded size", ctx);
+
+  const uint64_t target = 6000;
+  RateControlState state;
+  RateControlResult result;
+  EncodeJpegToTarget(coefficients, target, &state, nullptr, &jpeg, &result);
+  Assert(jpeg.size() <= target, "rate control fits target", ctx);
+  Assert(ParseJpegFrame(jpeg).valid, "rate control output valid", ctx);
+  Assert(result.quality == 100 ||
+             EstimateJpegSize(coefficients, result.quality + 1) > target ||
+             jpeg.size() >= target * 97 / 100,
+         "rate control picks highest fitting quality", ctx);
+
+  // Та же сцена в следующем цикле: оценка переносится, 1-2 прохода.
+  RateControlResult next;
+  EncodeJpegToTarget(coefficients, target, &state, nullptr, &jpeg, &next);
+  Assert(next.quality == result.quality, "carried estimate keeps quality",
+         ctx);
+  Assert(next.passes <= 2, "carried estimate converges in <= 2 passes", ctx);
+
+  RateControlResult tiny;
+  EncodeJpegToTarget(coefficients, 10, &state, nullptr, &jpeg, &tiny);
+  Assert(tiny.quality == 1 && ParseJpegFrame(jpeg).valid,
+         "unreachable target falls back to quality 1", ctx);
+}
+
+void TestDailyBudget(TestContext& ctx) {
+  RateControlOptions options;
+  RateControlState state;
+  Assert(FrameByteTarget(options, state, 3600, 10) == 0, "no budget no target",
+         ctx);
+  options.daily_budget_bytes = 360000;
+  Assert(FrameByteTarget(options, state, 3600, 10) == 1000,
+         "daily budget spread over frames left", ctx);
+  state.used_today = 180000;
+  Assert(FrameByteTarget(options, state, 3600, 10) == 500,
+         "daily budget uses remaining bytes", ctx);
+  options.target_bytes = 200;
+  Assert(FrameByteTarget(options, state, 3600, 10) == 200,
+         "per-frame target caps daily share", ctx);
+  state.used_today = 500000;
+  options.target_bytes = 0;
+  Assert(FrameByteTarget(options, state, 3600, 10) == 1,
+         "exhausted budget gives minimal target", ctx);
+}
+
+// Сумма Крафта в единицах 2^-16 и число кодов таблицы.
+uint32_t KraftSum(const HuffmanSpec& spec, int* codes, int* longest) {
+  uint32_t sum = 0;
+  *codes = 0;
+  *longest = 0;
+  for (int length = 1; length <= 16; ++length) {
+    sum += static_cast<uint32_t>(spec.bits[length - 1]) << (16 - length);
+    *codes += spec.bits[length - 1];
+    if (spec.bits[length - 1]) {
+      *longest = length;
+    }
+  }
+  return sum;
+}
+
+void TestOptimalHuffman(TestContext& ctx) {
+  uint32_t freq[256] = {};
+  freq[0] = 1000;
+  freq[1] = 10;
+  freq[7] = 3;
+  HuffmanSpec spec = BuildOptimalHuffman(freq);
+  int codes = 0;
+  int longest = 0;
+  uint32_t kraft = KraftSum(spec, &codes, &longest);
+  Assert(codes == 3 && spec.count == 3, "code per used symbol", ctx);
+  Assert(kraft < 65536, "no all-ones code", ctx);
+  Assert(spec.values[0] == 0, "most frequent symbol first", ctx);
+
+  // Частоты Фибоначчи дают дерево глубже 16 — проверяем ограничение длины.
+  uint32_t fib[256] = {};
+  uint32_t a = 1;
+  uint32_t b = 1;
+  for (int i = 0; i < 40; ++i) {
+    fib[i] = a;
+    const uint32_t next = a + b;
+    a = b;
+    b = next;
+  }
+  spec = BuildOptimalHuffman(fib);
+  kraft = KraftSum(spec, &codes, &longest);
+  Assert(codes == 40 && longest <= 16, "length limited to 16", ctx);
+  Assert(kraft < 65536, "length-limited code is prefix-free", ctx);
+
+  const uint32_t empty[256] = {};
+  spec = BuildOptimalHuffman(empty);
+  Assert(spec.count == 0, "empty statistics give empty table", ctx);
+}
+
+void TestOptimizedJpeg(TestContext& ctx) {
+  const ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 320, 200, 5);
+  JpegCoefficients coefficients;
+  std::wstring error;
+  ComputeJpegCoefficients(frame, ColorMode::k420, &coefficients, &error);
+  std::vector<uint8_t> standard;
+  std::vector<uint8_t> optimized;
+  EncodeJpegCoefficients(coefficients, 10, &standard);
+  EncodeJpegOptimized(coefficients, 10, nullptr, &optimized);
+  Assert(ParseJpegFrame(optimized).valid, "optimized jpeg valid", ctx);
+  Assert(optimized.size() < standard.size(), "optimized tables are smaller",
+         ctx);
+
+  HuffmanReuseState reuse;
+  std::vector<uint8_t> first;
+  std::vector<uint8_t> second;
+  EncodeJpegOptimized(coefficients, 10, &reuse, &first);
+  EncodeJpegOptimized(coefficients, 10, &reuse, &second);
+  Assert(reuse.valid && reuse.rebuilds == 1 && reuse.reused_frames == 1,
+         "stable statistics reuse display tables", ctx);
+  Assert(first == second, "reused tables give same stream", ctx);
+  Assert(second.size() < standard.size(), "reused tables beat Annex K", ctx);
+
+  const ImageBuffer noise =
+      MakeSyntheticFrame(SyntheticScene::kNoise, 320, 200, 5);
+  JpegCoefficients noise_coefficients;
+  ComputeJpegCoefficients(noise, ColorMode::k420, &noise_coefficients, &error);
+  std::vector<uint8_t> changed;
+  EncodeJpegOptimized(noise_coefficients, 10, &reuse, &changed);
+  Assert(ParseJpegFrame(changed).valid, "reused tables encode new content",
+         ctx);
+  Assert(reuse.rebuilds == 2, "changed statistics rebuild tables", ctx);
+}
+
+int CountRestartMarkers(const std::vector<uint8_t>& jpeg) {
+  int count = 0;
+  for (size_t i = 0; i + 1 < jpeg.size(); ++i) {
+    if (jpeg[i] == 0xFF && jpeg[i + 1] >= 0xD0 && jpeg[i + 1] <= 0xD7) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void TestHash64(TestContext& ctx) {
+  std::vector<uint8_t> data(100);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i);
+  }
+  const uint64_t base = Hash64(data.data(), data.size());
+  Assert(base == Hash64(data.data(), data.size()), "hash is deterministic",
+         ctx);
+  data[77] ^= 1;
+  Assert(base != Hash64(data.data(), data.size()), "hash sees one bit", ctx);
+  Assert(Hash64(data.data(), 10, 1) != Hash64(data.data(), 10, 2),
+         "hash depends on seed", ctx);
+  const Hash128Value wide = Hash128(data.data(), data.size());
+  data[3] ^= 0x80;
+  const Hash128Value flipped = Hash128(data.data(), data.size());
+  Assert(wide.low != wide.high && flipped.low != wide.low &&
+             flipped.high != wide.high,
+         "hash128 halves differ and see one bit", ctx);
+  data[3] ^= 0x80;
+  Assert(Hash128(data.data(), data.size()).low == wide.low &&
+             Hash128(data.data(), 20).high != Hash128(data.data(), 21).high,
+         "hash128 is deterministic and sees the tail", ctx);
+}
+
+void TestIncrementalJpeg(TestContext& ctx) {
+  ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kText, 200, 120, 9);
+  JpegEncodeOptions options;
+  options.quality = 0.3f;
+  IncrementalJpegCache cache;
+  IncrementalEncodeStats stats;
+  std::vector<uint8_t> first;
+  std::wstring error;
+  Assert(EncodeJpegIncremental(frame, options, &cache, &first, &stats, &error),
+         "incremental encode", ctx);
+  Assert(stats.rows_total == 8 && stats.rows_encoded == 8,
+         "first frame encodes all rows", ctx);
+  Assert(ParseJpegFrame(first).valid, "incremental jpeg valid", ctx);
+  Assert(CountRestartMarkers(first) == 7, "restart marker per MCU row", ctx);
+
+  std::vector<uint8_t> same;
+  EncodeJpegIncremental(frame, options, &cache, &same, &stats, &error);
+  Assert(stats.rows_encoded == 0 && same == first,
+         "unchanged frame reuses all segments", ctx);
+
+  // Меняем пиксели в одной полосе MCU (строки 40..47 -> полоса 2).
+  for (uint32_t y = 40; y < 48; ++y) {
+    for (uint32_t x = 20; x < 90; ++x) {
+      frame.pixels[y * frame.stride + x * 4 + 1] ^= 0x3C;
+    }
+  }
+  std::vector<uint8_t> changed;
+  EncodeJpegIncremental(frame, options, &cache, &changed, &stats, &error);
+  Assert(stats.rows_encoded == 1, "only changed row re-encoded", ctx);
+  IncrementalJpegCache fresh_cache;
+  std::vector<uint8_t> fresh;
+  EncodeJpegIncremental(frame, options, &fresh_cache, &fresh, nullptr, &error);
+  Assert(changed == fresh, "incremental equals from-scratch encode", ctx);
+
+  options.quality = 0.5f;
+  EncodeJpegIncremental(frame, options, &cache, &changed, &stats, &error);
+  Assert(stats.rows_encoded == 8, "quality change invalidates cache", ctx);
+}
+
+void TestEncoderContext(TestContext& ctx) {
+  std::wstring error;
+  // Таблицы пресетов (constexpr) и кэша процесса совпадают с формулой IJG.
+  const ImageBuffer small =
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 40, 24, 3);
+  bool tables_match = true;
+  for (const int quality : {1, 50, 51, 90, 97}) {
+    JpegEncodeOptions options;
+    options.quality = static_cast<float>(quality) / 100.0f;
+    std::vector<uint8_t> jpeg;
+    EncodeJpeg(small, options, &jpeg, &error);
+    const JpegFrameInfo info = ParseJpegFrame(jpeg);
+    const int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; ++i) {
+      const int luma = std::clamp((kStdLumaQuant[i] * scale + 50) / 100, 1,
+                                  255);
+      const int chroma =
+          std::clamp((kStdChromaQuant[i] * scale + 50) / 100, 1, 255);
+      tables_match &= info.quant[0][i] == luma && info.quant[1][i] == chroma;
+    }
+  }
+  Assert(tables_match, "preset and cached quant tables match IJG", ctx);
+
+  const ImageBuffer frame_a =
+      MakeSyntheticFrame(SyntheticScene::kUi, 320, 200, 11);
+  ImageBuffer frame_b = frame_a;
+  for (uint32_t y = 50; y < 70; ++y) {
+    for (uint32_t x = 0; x < 200; ++x) {
+      frame_b.pixels[y * frame_b.stride + x * 4 + 2] ^= 0x5A;
+    }
+  }
+  const JpegEncodeOptions options;
+  JpegEncoderContext context;
+  JpegWorkspace* workspace = context.workspace.get();
+
+  // Первый кадр выделяет буферы, второй того же размера — ничего.
+  EncodeJpeg(frame_a, options, &context, &error);
+  size_t before = Allocations();
+  const bool encoded = EncodeJpeg(frame_a, options, &context, &error);
+  Assert(encoded && Allocations() == before,
+         "context encode allocates nothing", ctx);
+  std::vector<uint8_t> plain;
+  before = Allocations();
+  EncodeJpeg(frame_a, options, &plain, &error);
+  Assert(Allocations() > before, "allocation counter sees plain encode", ctx);
+  Assert(context.output == plain, "context output equals plain encode", ctx);
+
+  HuffmanReuseState reuse;
+  auto encode_optimized = [&](const ImageBuffer& frame) {
+    ComputeJpegCoefficients(frame, options.color_mode, &context.coefficients,
+                            &error, workspace);
+    EncodeJpegOptimized(context.coefficients, QualityToIjg(options.quality),
+                        &reuse, &context.output, workspace);
+  };
+  encode_optimized(frame_a);
+  encode_optimized(frame_b);
+  before = Allocations();
+  encode_optimized(frame_a);
+  Assert(Allocations() == before, "optimized reuse allocates nothing", ctx);
+
+  RateControlState rate;
+  for (int i = 0; i < 2; ++i) {
+    EncodeJpegToTarget(context.coefficients, 6000, &rate, nullptr,
+                       &context.output, nullptr, workspace);
+  }
+  before = Allocations();
+  EncodeJpegToTarget(context.coefficients, 6000, &rate, nullptr,
+                     &context.output, nullptr, workspace);
+  Assert(Allocations() == before, "rate control allocates nothing", ctx);
+
+  IncrementalJpegCache cache;
+  IncrementalEncodeStats stats;
+  EncodeJpegIncremental(frame_a, options, &cache, &context.output, &stats,
+                        &error, workspace);
+  EncodeJpegIncremental(frame_b, options, &cache, &context.output, &stats,
+                        &error, workspace);
+  EncodeJpegIncremental(frame_a, options, &cache, &context.output, &stats,
+                        &error, workspace);
+  before = Allocations();
+  EncodeJpegIncremental(frame_b, options, &cache, &context.output, &stats,
+                        &error, workspace);
+  Assert(Allocations() == before && stats.rows_encoded > 0,
+         "incremental encode allocates nothing", ctx);
+  IncrementalJpegCache fresh_cache;
+  std::vector<uint8_t> fresh;
+  EncodeJpegIncremental(frame_b, options, &fresh_cache, &fresh, nullptr,
+                        &error);
+  Assert(context.output == fresh, "incremental with workspace matches", ctx);
+}
+
+// Кадр "пустого рабочего стола": заливка и несколько плоских окон.
+ImageBuffer MakeFlatDesktop(uint32_t width, uint32_t height) {
+  ImageBuffer frame;
+  frame.width = width;
+  frame.height = height;
+  frame.stride = width * 4;
+  frame.pixels.resize(static_cast<size_t>(frame.stride) * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      uint8_t* px = frame.pixels.data() + y * frame.stride + x * 4;
+      const bool window = x % 400 > 40 && x % 400 < 360 && y % 300 > 30 &&
+                          y % 300 < 270;
+      const bool title = window && y % 300 < 50;
+      px[0] = title ? 120 : window ? 240 : 90;
+      px[1] = title ? 80 : window ? 240 : 60;
+      px[2] = title ? 30 : window ? 240 : 20;
+      px[3] = 255;
+    }
+  }
+  return frame;
+}
+
+void TestQoiCodec(TestContext& ctx) {
+  std::wstring error;
+  const SyntheticScene scenes[] = {SyntheticScene::kText, SyntheticScene::kUi,
+                                   SyntheticScene::kPhoto,
+                                   SyntheticScene::kNoise};
+  bool lossless = true;
+  bool exact_estimate = true;
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame = MakeSyntheticFrame(scene, 203, 77, 5);
+    std::vector<uint8_t> qoi;
+    ImageBuffer decoded;
+    if (!EncodeQoi(frame, &qoi, &error) || !DecodeQoi(qoi, &decoded, &error)) {
+      lossless = false;
+      continue;
+    }
+    exact_estimate &= EstimateQoiSize(frame, 1) == qoi.size();
+    for (uint32_t y = 0; y < frame.height; ++y) {
+      for (uint32_t x = 0; x < frame.width; ++x) {
+        const uint8_t* a = frame.pixels.data() + y * frame.stride + x * 4;
+        const uint8_t* b = decoded.pixels.data() + y * decoded.stride + x * 4;
+        lossless &= a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && b[3] == 255;
+      }
+    }
+  }
+  Assert(lossless, "qoi round trip is lossless", ctx);
+  Assert(exact_estimate, "qoi estimate with step 1 is exact", ctx);
+
+  // Сплошной кадр: одна серия через все строки (длиннее 62 и ширины).
+  ImageBuffer solid;
+  solid.width = 97;
+  solid.height = 300;
+  solid.stride = solid.width * 4 + 12;
+  solid.pixels.assign(static_cast<size_t>(solid.stride) * solid.height, 0x7F);
+  std::vector<uint8_t> qoi;
+  ImageBuffer decoded;
+  Assert(EncodeQoi(solid, &qoi, &error) && DecodeQoi(qoi, &decoded, &error) &&
+             decoded.pixels[decoded.pixels.size() - 2] == 0x7F,
+         "qoi solid frame round trip", ctx);
+  Assert(qoi.size() < 14 + 8 + 4 + 97 * 300 / 62 + 2,
+         "qoi solid frame is runs only", ctx);
+  Assert(std::string(qoi.begin(), qoi.begin() + 4) == "qoif" && qoi[12] == 3,
+         "qoi header", ctx);
+  qoi.resize(qoi.size() - 9);
+  Assert(!DecodeQoi(qoi, &decoded, &error), "qoi rejects truncated stream",
+         ctx);
+
+  // HDR-вход кодируется после тонмаппинга так же, как его BGRA8-версия.
+  const ImageBuffer photo =
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 64, 40, 2);
+  ImageBuffer hdr;
+  hdr.width = photo.width;
+  hdr.height = photo.height;
+  hdr.stride = photo.width * 4;
+  hdr.pixel_format = PixelFormat::kR10G10B10A2;
+  hdr.pixels.resize(static_cast<size_t>(hdr.stride) * hdr.height);
+  for (size_t i = 0; i < static_cast<size_t>(photo.width) * photo.height;
+       ++i) {
+    const uint8_t* px = photo.pixels.data() + i * 4;
+    const uint32_t value = (static_cast<uint32_t>(px[2]) << 2) |
+                           (static_cast<uint32_t>(px[1]) << 12) |
+                           (static_cast<uint32_t>(px[0]) << 22) | (3u << 30);
+    std::memcpy(hdr.pixels.data() + i * 4, &value, 4);
+  }
+  ImageBuffer hdr_bgra;
+  ConvertToBgra8(hdr, &hdr_bgra, DefaultToneMapLut(), &error);
+  std::vector<uint8_t> from_hdr;
+  std::vector<uint8_t> from_bgra;
+  EncodeQoi(hdr, &from_hdr, &error);
+  EncodeQoi(hdr_bgra, &from_bgra, &error);
+  Assert(from_hdr == from_bgra, "qoi converts 10-bit input", ctx);
+}
+
+void TestCodecChoice(TestContext& ctx) {
+  std::wstring error;
+  OutputCodec codec = OutputCodec::kJpeg;
+  Assert(ParseOutputCodec(L"auto", &codec) && codec == OutputCodec::kAuto,
+         "parse codec", ctx);
+  Assert(!ParseOutputCodec(L"png", &codec), "reject unknown codec", ctx);
+  Assert(std::wstring(OutputCodecExtension(OutputCodec::kLossless)) ==
+                 L".qoi" &&
+             std::wstring(OutputCodecExtension(OutputCodec::kJpeg)) == L".jpg",
+         "codec extensions", ctx);
+
+  const ImageBuffer frames[] = {
+      MakeFlatDesktop(1280, 720),
+      MakeSyntheticFrame(SyntheticScene::kText, 1280, 720, 4),
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 1280, 720, 4)};
+  bool estimates_close = true;
+  bool picks_smaller = true;
+  for (const ImageBuffer& frame : frames) {
+    for (const float quality : {0.01f, 0.75f}) {
+      const CodecChoice choice =
+          ChooseCodec(frame, ColorMode::k420, quality);
+      JpegEncodeOptions options;
+      options.quality = quality;
+      std::vector<uint8_t> jpeg;
+      std::vector<uint8_t> qoi;
+      EncodeJpeg(frame, options, &jpeg, &error);
+      EncodeQoi(frame, &qoi, &error);
+      const double jpeg_ratio =
+          static_cast<double>(choice.jpeg_bytes) / jpeg.size();
+      const double qoi_ratio =
+          static_cast<double>(choice.lossless_bytes) / qoi.size();
+      estimates_close &= jpeg_ratio > 0.75 && jpeg_ratio < 1.25 &&
+                         qoi_ratio > 0.85 && qoi_ratio < 1.15;
+      // Почти равные размеры (< 10%) допускают любой выбор.
+      const double gap = static_cast<double>(qoi.size()) / jpeg.size();
+      if (gap < 0.9) {
+        picks_smaller &= choice.codec == OutputCodec::kLossless;
+      } else if (gap > 1.1) {
+        picks_smaller &= choice.codec == OutputCodec::kJpeg;
+      }
+    }
+  }
+  Assert(estimates_close, "sampled size estimates close to actual", ctx);
+  Assert(picks_smaller, "auto picks the smaller file", ctx);
+  Assert(ChooseCodec(frames[0], ColorMode::k420, 0.75f).codec ==
+             OutputCodec::kLossless,
+         "flat desktop at 0.75 goes lossless", ctx);
+  Assert(ChooseCodec(frames[2], ColorMode::k420, 0.01f).codec ==
+             OutputCodec::kJpeg,
+         "photo at 0.01 goes jpeg", ctx);
+}
+
+// Источник, у которого чтение полосы с строки fail_row завершается ошибкой
+// (сбой захвата посреди кадра).
+class FailingStripSource : public StripSource {
+ public:
+  FailingStripSource(const ImageBuffer& image, uint32_t fail_row)
+      : inner_(image), fail_row_(fail_row) {}
+
+  uint32_t Width() const override { return inner_.Width(); }
+  uint32_t Height() const override { return inner_.Height(); }
+  PixelFormat Format() const override { return inner_.Format(); }
+  bool ReadRows(uint32_t y, uint32_t count, PixelRows* rows,
+                std::wstring* error) override {
+    if (y >= fail_row_) {
+      *error = L"read failed";
+      return false;
+    }
+    return inner_.ReadRows(y, count, rows, error);
+  }
+
+ private:
+  ImageStripSource inner_;
+  uint32_t fail_row_;
+};
+
+void TestStreamingJpeg(TestContext& ctx) {
+  std::wstring error;
+  const ColorMode modes[] = {ColorMode::kGray, ColorMode::k420,
+                             ColorMode::k422, ColorMode::k444};
+  const SyntheticScene scenes[] = {SyntheticScene::kText,
+                                   SyntheticScene::kPhoto};
+  bool identical = true;
+  for (SyntheticScene scene : scenes) {
+    const ImageBuffer frame = MakeSyntheticFrame(scene, 203, 77, 3);
+    for (ColorMode mode : modes) {
+      JpegEncodeOptions options;
+      options.quality = 0.75f;
+      options.color_mode = mode;
+      JpegCoefficients coefficients;
+      std::vector<uint8_t> reference;
+      ComputeJpegCoefficients(frame, mode, &coefficients, &error);
+      EncodeJpegCoefficients(coefficients, 75, &reference);
+      ImageStripSource source(frame);
+      std::vector<uint8_t> streamed;
+      identical &= EncodeJpegStreaming(&source, options, &streamed, &error) &&
+                   streamed == reference;
+    }
+  }
+  Assert(identical, "streaming encode equals coefficient encode", ctx);
+
+  // Синтетический источник полос: тот же поток, что и у собранного кадра.
+  SyntheticStripSource tiled(SyntheticScene::kUi, 300, 100, 64, 48, 9);
+  ImageBuffer assembled;
+  assembled.width = 300;
+  assembled.height = 100;
+  assembled.stride = 300 * 4;
+  assembled.pixels.resize(static_cast<size_t>(assembled.stride) * 100);
+  for (uint32_t y = 0; y < 100; y += 7) {
+    const uint32_t count = std::min(7u, 100 - y);
+    PixelRows rows;
+    tiled.ReadRows(y, count, &rows, &error);
+    for (uint32_t i = 0; i < count; ++i) {
+      std::memcpy(assembled.pixels.data() + (y + i) * assembled.stride,
+                  rows.data + i * rows.stride, assembled.stride);
+    }
+  }
+  std::vector<uint8_t> streamed;
+  std::vector<uint8_t> whole;
+  JpegCoefficients coefficients;
+  ComputeJpegCoefficients(assembled, ColorMode::k420, &coefficients, &error);
+  EncodeJpegCoefficients(coefficients, 1, &whole);
+  Assert(EncodeJpegStreaming(&tiled, JpegEncodeOptions{}, &streamed, &error) &&
+             streamed == whole,
+         "synthetic strip source encodes like assembled frame", ctx);
+  PixelRows rows;
+  Assert(!tiled.ReadRows(95, 6, &rows, &error) &&
+             !tiled.ReadRows(0, kMaxStripRows + 1, &rows, &error),
+         "strip source rejects out-of-frame rows", ctx);
+
+  FailingStripSource failing(assembled, 48);
+  error.clear();
+  Assert(!EncodeJpegStreaming(&failing, JpegEncodeOptions{}, &streamed,
+                              &error) &&
+             error == L"read failed",
+         "streaming encode reports read failure", ctx);
+  JpegEncodeOptions optimized;
+  optimized.optimize_huffman = true;
+  ImageStripSource source(assembled);
+  Assert(!EncodeJpegStreaming(&source, optimized, &streamed, &error),
+         "streaming encode rejects optimized tables", ctx);
+
+  // 8K: полный BGRA-кадр занял бы 132 МБ, потоковый путь держит плитку,
+  // одну полосу и поток.
+  JpegEncoderContext context;
+  SyntheticStripSource span(SyntheticScene::kText, 7680, 4320, 960, 540, 1);
+  ProcessMemory before;
+  const bool reset = ResetPeakRss();
+  const bool queried = QueryProcessMemory(&before);
+  const bool encoded = EncodeJpegStreaming(&span, JpegEncodeOptions{},
+                                           &context.output, &error,
+                                           context.workspace.get());
+  const JpegFrameInfo info = ParseJpegFrame(context.output);
+  Assert(encoded && info.width == 7680 && info.height == 4320,
+         "streaming 8k encode", ctx);
+  ProcessMemory after;
+  if (reset && queried && QueryProcessMemory(&after)) {
+    const size_t growth = after.peak_rss_bytes - before.rss_bytes;
+    std::cout << "8k streaming peak RSS growth, KB: " << growth / 1024
+              << "\n";
+    Assert(growth < (24u << 20), "streaming 8k peak RSS under 24 MB", ctx);
+  } else {
+    std::cout << "peak RSS reset unsupported, 8k memory check skipped\n";
+  }
+}
+
+void TestFrameArchive(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  const fs::path dir = fs::temp_directory_path() / "p2_archive_test";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir, ec);
+  const std::wstring pack = (dir / "day.p2pack").wstring();
+  const std::wstring index = (dir / "day.p2idx").wstring();
+
+  DateTimeParts leap;
+  leap.year = 2024;
+  leap.month = 2;
+  leap.day = 29;
+  leap.hour = 23;
+  leap.minute = 59;
+  leap.second = 58;
+  const DateTimeParts back = ArchiveDateTime(ArchiveTimestamp(leap));
+  Assert(ArchiveTimestamp(DateTimeParts{1970, 1, 1, 0, 0, 0}) == 0 &&
+             ArchiveTimestamp(DateTimeParts{2000, 3, 1, 0, 0, 0}) ==
+                 951868800 &&
+             back.year == 2024 && back.month == 2 && back.day == 29 &&
+             back.hour == 23 && back.minute == 59 && back.second == 58,
+         "archive civil timestamps", ctx);
+
+  ArchiveIdentity identity;
+  identity.computer = L"PC";
+  identity.user = L"Пользователь";
+  identity.display_index = 1;
+  const int64_t base = ArchiveTimestamp(DateTimeParts{2026, 10, 19, 9, 0, 0});
+  std::vector<std::vector<uint8_t>> frames;
+  std::wstring error;
+  {
+    FrameArchiveWriter writer;
+    bool appended = writer.Open(pack, index, identity, &error);
+    for (int i = 0; i < 20; ++i) {
+      std::vector<uint8_t> data(100 + i * 37);
+      for (size_t k = 0; k < data.size(); ++k) {
+        data[k] = static_cast<uint8_t>(k * 7 + i);
+      }
+      appended &= writer.Append(base + i * 10,
+                                i % 3 == 0 ? OutputCodec::kLossless
+                                           : OutputCodec::kJpeg,
+                                2, data, &error);
+      frames.push_back(std::move(data));
+    }
+    Assert(appended && writer.Frames() == 20, "archive appends frames", ctx);
+  }
+
+  auto verify = [&](const char* message) {
+    ArchiveIndexView view;
+    FrameArchiveReader reader;
+    bool ok = view.Open(index, &error) && reader.Open(pack, &error) &&
+              view.Size() == frames.size() &&
+              reader.Identity().user == identity.user &&
+              reader.Identity().display_index == 1;
+    std::vector<uint8_t> data;
+    for (size_t i = 0; ok && i < view.Size(); ++i) {
+      const ArchiveEntry entry = view.Entry(i);
+      ok = reader.Read(entry, &data, &error) && data == frames[i] &&
+           entry.display_count == 2 && entry.display_index == 1 &&
+           (entry.codec == OutputCodec::kLossless) == (i % 3 == 0);
+    }
+    Assert(ok, message, ctx);
+  };
+  verify("archive frames read back by index");
+  {
+    ArchiveIndexView view;
+    view.Open(index, &error);
+    Assert(view.Sorted() && view.LowerBound(base + 35) == 4 &&
+               view.LowerBound(base - 1) == 0 &&
+               view.LowerBound(base + 190) == 19 &&
+               view.LowerBound(base + 191) == 20,
+           "archive index lookup by time", ctx);
+  }
+
+  FrameArchiveWriter writer;
+  ArchiveIdentity other = identity;
+  other.display_index = 0;
+  Assert(!writer.Open(pack, index, other, &error),
+         "archive rejects another display", ctx);
+
+  // Сбой посреди записи кадра: недописанный хвост пакета отрезается.
+  const uintmax_t pack_size = fs::file_size(pack, ec);
+  {
+    std::ofstream tail(dir / "day.p2pack", std::ios::binary | std::ios::app);
+    tail.write("P2FR partial record", 19);
+  }
+  Assert(writer.Open(pack, index, identity, &error) &&
+             writer.TruncatedBytes() == 19 && writer.Frames() == 20 &&
+             fs::file_size(pack, ec) == pack_size,
+         "archive truncates torn record", ctx);
+  writer.Close();
+
+  // Сбой между записью кадров и индекса: последние записи индексируются
+  // заново, оборванная запись индекса отбрасывается.
+  fs::resize_file(index, kArchiveIndexHeaderSize +
+                             18 * kArchiveIndexEntrySize + 7, ec);
+  Assert(writer.Open(pack, index, identity, &error) &&
+             writer.RecoveredFrames() == 2 && writer.Frames() == 20,
+         "archive re-indexes unindexed records", ctx);
+  writer.Close();
+  verify("archive frames intact after recovery");
+
+  // Часы перевели назад: индекс помечается, поиск становится линейным.
+  writer.Open(pack, index, identity, &error);
+  frames.push_back(std::vector<uint8_t>(50, 1));
+  writer.Append(base + 5, OutputCodec::kLossless, 2, frames.back(), &error);
+  writer.Close();
+  {
+    ArchiveIndexView view;
+    view.Open(index, &error);
+    Assert(!view.Sorted() && view.Size() == 21 &&
+               view.LowerBound(base + 5) == 1,
+           "archive index with clock going back", ctx);
+  }
+
+  // Поврежденный кадр не проходит проверку хеша.
+  {
+    std::fstream file(dir / "day.p2pack",
+                      std::ios::in | std::ios::out | std::ios::binary);
+    ArchiveIndexView view;
+    view.Open(index, &error);
+    file.seekp(static_cast<std::streamoff>(view.Entry(3).offset +
+                                           kArchiveRecordHeaderSize + 5));
+    file.put('\x7F');
+  }
+  {
+    ArchiveIndexView view;
+    FrameArchiveReader reader;
+    std::vector<uint8_t> data;
+    Assert(view.Open(index, &error) && reader.Open(pack, &error) &&
+               reader.Read(view.Entry(2), &data, &error) &&
+               !reader.Read(view.Entry(3), &data, &error),
+           "archive detects corrupted frame", ctx);
+  }
+  fs::remove_all(dir, ec);
+}
+
+// Элемент EBML, разобранный общими правилами vint (независимо от писателя).
+struct EbmlElement {
+  uint32_t id = 0;
+  uint64_t size = 0;
+  size_t data = 0;
+  bool unknown_size = false;
+};
+
+bool ReadEbmlElement(const std::vector<uint8_t>& bytes, size_t pos,
+                     EbmlElement* out) {
+  auto vint_length = [&](size_t at) {
+    int length = 1;
+    while (at < bytes.size() && length <= 8 &&
+           (bytes[at] & (0x80 >> (length - 1))) == 0) {
+      ++length;
+    }
+    return at < bytes.size() && length <= 8 ? length : 0;
+  };
+  const int id_length = vint_length(pos);
+  if (id_length == 0 || id_length > 4 || pos + id_length > bytes.size()) {
+    return false;
+  }
+  out->id = 0;
+  for (int i = 0; i < id_length; ++i) {
+    out->id = (out->id << 8) | bytes[pos + i];
+  }
+  pos += id_length;
+  const int size_length = vint_length(pos);
+  if (size_length == 0 || pos + size_length > bytes.size()) {
+    return false;
+  }
+  uint64_t size = bytes[pos] & (0xFF >> size_length);
+  bool all_ones = size == (0xFFu >> size_length);
+  for (int i = 1; i < size_length; ++i) {
+    size = (size << 8) | bytes[pos + i];
+    all_ones = all_ones && bytes[pos + i] == 0xFF;
+  }
+  out->unknown_size = all_ones;
+  out->data = pos + size_length;
+  out->size = all_ones ? bytes.size() - out->data : size;
+  return out->data + out->size <= bytes.size();
+}
+
+uint64_t EbmlUint(const std::vector<uint8_t>& bytes, const EbmlElement& e) {
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < e.size; ++i) {
+    value = (value << 8) | bytes[e.data + i];
+  }
+  return value;
+}
+
+// Разбор файла потока MJPEG: кадры, время кластеров и индекс.
+struct MkvSummary {
+  bool valid = false;
+  bool unknown_size = false;
+  std::vector<std::vector<uint8_t>> frames;
+  std::vector<uint64_t> timecodes;
+  size_t cue_points = 0;
+  bool seek_to_cues = false;
+  double duration = 0.0;
+  uint64_t width = 0;
+};
+
+MkvSummary ParseMkv(const std::vector<uint8_t>& bytes) {
+  MkvSummary summary;
+  EbmlElement ebml;
+  EbmlElement segment;
+  if (!ReadEbmlElement(bytes, 0, &ebml) || ebml.id != 0x1A45DFA3 ||
+      !ReadEbmlElement(bytes, ebml.data + ebml.size, &segment) ||
+      segment.id != 0x18538067) {
+    return summary;
+  }
+  summary.unknown_size = segment.unknown_size;
+  const size_t end = segment.data + segment.size;
+  uint64_t cues_position = 0;
+  size_t pos = segment.data;
+  while (pos < end) {
+    EbmlElement e;
+    if (!ReadEbmlElement(bytes, pos, &e)) {
+      return summary;
+    }
+    std::vector<EbmlElement> children;
+    for (size_t c = e.data; e.id != 0xEC && c < e.data + e.size;) {
+      EbmlElement child;
+      if (!ReadEbmlElement(bytes, c, &child)) {
+        return summary;
+      }
+      children.push_back(child);
+      c = child.data + child.size;
+    }
+    for (const EbmlElement& child : children) {
+      if (e.id == 0x1F43B675 && child.id == 0xE7) {
+        summary.timecodes.push_back(EbmlUint(bytes, child));
+      } else if (e.id == 0x1F43B675 && child.id == 0xA3) {
+        summary.frames.emplace_back(bytes.begin() + child.data + 4,
+                                    bytes.begin() + child.data + child.size);
+      } else if (e.id == 0x1C53BB6B && child.id == 0xBB) {
+        ++summary.cue_points;
+      } else if (e.id == 0x1549A966 && child.id == 0x4489) {
+        uint64_t bits = EbmlUint(bytes, child);
+        std::memcpy(&summary.duration, &bits, sizeof(bits));
+      } else if (e.id == 0x114D9B74 && child.id == 0x4DBB) {
+        EbmlElement seek_id;
+        EbmlElement seek_position;
+        ReadEbmlElement(bytes, child.data, &seek_id);
+        ReadEbmlElement(bytes, seek_id.data + seek_id.size, &seek_position);
+        if (EbmlUint(bytes, seek_id) == 0x1C53BB6B) {
+          cues_position = EbmlUint(bytes, seek_position);
+        }
+      } else if (e.id == 0x1654AE6B && child.id == 0xAE) {
+        for (size_t c = child.data; c < child.data + child.size;) {
+          EbmlElement track;
+          ReadEbmlElement(bytes, c, &track);
+          if (track.id == 0xE0) {
+            EbmlElement pixel_width;
+            ReadEbmlElement(bytes, track.data, &pixel_width);
+            summary.width = EbmlUint(bytes, pixel_width);
+          }
+          c = track.data + track.size;
+        }
+      }
+    }
+    if (e.id == 0x1C53BB6B) {
+      summary.seek_to_cues = cues_position == pos - segment.data;
+    }
+    pos = e.data + e.size;
+  }
+  summary.valid = pos == bytes.size();
+  return summary;
+}
+
+void TestMjpegStream(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  const fs::path dir = fs::temp_directory_path() / "p2_mjpeg_test";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir, ec);
+  const std::wstring path = (dir / "day.mkv").wstring();
+
+  std::vector<std::vector<uint8_t>> jpegs;
+  std::wstring error;
+  for (uint32_t i = 0; i < 6; ++i) {
+    std::vector<uint8_t> jpeg;
+    EncodeJpeg(MakeSyntheticFrame(SyntheticScene::kUi, 64, 40, i),
+               JpegEncodeOptions{}, &jpeg, &error);
+    jpegs.push_back(std::move(jpeg));
+  }
+  auto read_file = [&] {
+    std::vector<uint8_t> bytes;
+    ReadFileBytes(path, &bytes, &error);
+    return bytes;
+  };
+
+  {
+    MjpegStreamWriter writer;
+    bool ok = writer.Open(path, 100, &error);
+    for (int i = 0; i < 3; ++i) {
+      ok &= writer.Append(jpegs[i], 64, 40, &error);
+    }
+    Assert(ok && writer.Frames() == 3, "mjpeg stream appends frames", ctx);
+    // Процесс убит: Finalize не вызывается.
+  }
+  MkvSummary live = ParseMkv(read_file());
+  Assert(live.valid && live.unknown_size && live.frames.size() == 3 &&
+             live.frames[2] == jpegs[2] && live.timecodes[1] == 100 &&
+             live.cue_points == 0 && live.width == 64,
+         "mjpeg stream playable without finalize", ctx);
+
+  // Кадр оборван посреди записи.
+  const uintmax_t live_size = fs::file_size(dir / "day.mkv", ec);
+  {
+    std::vector<uint8_t> bytes = read_file();
+    bytes.insert(bytes.end(), bytes.end() - 200, bytes.end() - 100);
+    WriteFileBytes(path, bytes, &error);
+  }
+  MjpegStreamWriter writer;
+  Assert(writer.Open(path, 250, &error) && writer.Frames() == 3 &&
+             writer.TruncatedBytes() == 100 &&
+             fs::file_size(dir / "day.mkv", ec) == live_size,
+         "mjpeg stream truncates torn frame", ctx);
+  Assert(!writer.Accepts(65, 40) &&
+             !writer.Append(jpegs[3], 65, 40, &error) && writer.IsOpen(),
+         "mjpeg stream rejects another frame size", ctx);
+  bool ok = writer.Append(jpegs[3], 64, 40, &error) &&
+            writer.Finalize(&error);
+  MkvSummary closed = ParseMkv(read_file());
+  Assert(ok && closed.valid && !closed.unknown_size &&
+             closed.frames.size() == 4 && closed.timecodes[3] == 300 &&
+             closed.cue_points == 4 && closed.seek_to_cues &&
+             closed.duration == 400.0,
+         "mjpeg stream finalize writes index", ctx);
+
+  // Перезапуск в тот же день: индекс снимается, поток продолжается.
+  ok = writer.Open(path, 100, &error) && writer.Frames() == 4 &&
+       writer.TruncatedBytes() == 0 &&
+       writer.Append(jpegs[4], 64, 40, &error);
+  MkvSummary resumed = ParseMkv(read_file());
+  ok = ok && resumed.valid && resumed.unknown_size &&
+       resumed.cue_points == 0 && resumed.frames.size() == 5 &&
+       writer.Append(jpegs[5], 64, 40, &error) && writer.Finalize(&error);
+  MkvSummary reclosed = ParseMkv(read_file());
+  Assert(ok && reclosed.valid && reclosed.cue_points == 6 &&
+             reclosed.seek_to_cues && reclosed.frames[5] == jpegs[5] &&
+             reclosed.timecodes[5] == 500,
+         "mjpeg stream resumes after finalize", ctx);
+
+  WriteFileBytes(path, std::vector<uint8_t>(400, 7), &error);
+  Assert(!writer.Open(path, 100, &error), "mjpeg stream rejects other file",
+         ctx);
+  fs::remove_all(dir, ec);
+}
+
+void TestFrameStore(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  const fs::path dir = fs::temp_directory_path() / "p2_store_test";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  const std::wstring store_dir = dir.wstring();
+
+  const ImageBuffer a = MakeSyntheticFrame(SyntheticScene::kUi, 64, 40, 1);
+  const ImageBuffer b = MakeSyntheticFrame(SyntheticScene::kPhoto, 64, 40, 2);
+  const ImageBuffer c = MakeSyntheticFrame(SyntheticScene::kText, 64, 40, 3);
+  ImageBuffer reshaped = a;
+  reshaped.width = 32;
+  reshaped.height = 80;
+  reshaped.stride = 32 * 4;
+  Assert(FrameContentKey(a) == FrameContentKey(ImageBuffer(a)) &&
+             !(FrameContentKey(a) == FrameContentKey(b)) &&
+             !(FrameContentKey(a) == FrameContentKey(reshaped)) &&
+             FrameKeyHex(FrameContentKey(a)).size() == 32,
+         "frame content keys", ctx);
+
+  ArchiveIdentity identity;
+  identity.computer = L"PC";
+  identity.user = L"Пользователь";
+  const DateTimeParts day1{2026, 10, 19, 9, 0, 0};
+  const DateTimeParts day2{2026, 10, 20, 9, 0, 0};
+  const std::vector<uint8_t> data_a(300, 1);
+  const std::vector<uint8_t> data_b(200, 2);
+  const std::vector<uint8_t> data_c(100, 3);
+  std::wstring error;
+  auto reference = [](const ImageBuffer& frame, int display, int64_t time) {
+    StoreReference ref;
+    ref.key = FrameContentKey(frame);
+    ref.timestamp = time;
+    ref.display_index = display;
+    ref.display_count = 2;
+    return ref;
+  };
+  // Повторные ссылки в тесте — только на кадр a (300 байт).
+  auto add_reference = [&](FrameStore* store, StoreReference ref) {
+    return store->AddReference(&ref, &error) && ref.length == 300;
+  };
+  {
+    FrameStore store;
+    bool ok = store.Open(store_dir, identity, &error) &&
+              store.SetDay(day1, &error) &&
+              store.AddFrame(reference(a, 0, 10), data_a, &error) &&
+              store.Contains(FrameContentKey(a)) &&
+              !store.Contains(FrameContentKey(b)) &&
+              add_reference(&store, reference(a, 1, 10)) &&
+              add_reference(&store, reference(a, 0, 20)) &&
+              store.AddFrame(reference(b, 1, 20), data_b, &error);
+    const DedupStats& stats = store.DayStats();
+    Assert(ok && stats.references == 4 && stats.unique_frames == 2 &&
+               stats.new_objects == 2 && stats.logical_bytes == 1100 &&
+               stats.stored_bytes == 500 && store.Objects() == 2 &&
+               FormatDedupStats(stats).find(L"2.00") != std::wstring::npos &&
+               fs::exists(store.ObjectPath(FrameContentKey(a),
+                                           OutputCodec::kJpeg)),
+           "store writes each image once", ctx);
+    ok = store.SetDay(day2, &error) &&
+         add_reference(&store, reference(a, 0, 30)) &&
+         store.AddFrame(reference(c, 0, 40), data_c, &error);
+    Assert(ok && store.DayStats().references == 2 &&
+               store.DayStats().stored_bytes == 100 &&
+               store.ObjectBytes() == 600,
+           "store references across days", ctx);
+    // Сбой: объект без ссылки, временный файл и оборванная ссылка.
+    WriteFileBytes(store.ObjectPath(FrameKey{5, 6}, OutputCodec::kJpeg),
+                   data_c, &error);
+    WriteFileBytes(store.ObjectPath(FrameKey{5, 6}, OutputCodec::kJpeg) +
+                       L".tmp", data_c, &error);
+    std::ofstream torn(fs::path(store.ReferencePath(day2)),
+                       std::ios::binary | std::ios::app);
+    torn.write("partial", 7);
+  }
+
+  FrameStore store;
+  ArchiveIdentity stored;
+  std::vector<StoreReference> refs;
+  bool ok = store.Open(store_dir, identity, &error) &&
+            store.Objects() == 3 && store.SetDay(day2, &error) &&
+            store.DayStats().references == 2 &&
+            ReadStoreReferences(store.ReferencePath(day2), &stored, &refs,
+                                &error) &&
+            refs.size() == 2 && refs[1].new_object &&
+            refs[0].codec == OutputCodec::kJpeg && refs[0].length == 300 &&
+            stored.user == identity.user;
+  Assert(ok &&
+             !fs::exists(store.ObjectPath(FrameKey{5, 6},
+                                          OutputCodec::kJpeg)) &&
+             !fs::exists(store.ObjectPath(FrameKey{5, 6},
+                                          OutputCodec::kJpeg) +
+                         L".tmp"),
+         "store recovers references and removes orphans", ctx);
+
+  uint64_t removed = 0;
+  uint64_t removed_bytes = 0;
+  ok = store.ReleaseDaysBefore(day2, &removed, &removed_bytes, &error);
+  Assert(ok && removed == 1 && removed_bytes == 200 &&
+             fs::exists(store.ObjectPath(FrameContentKey(a),
+                                         OutputCodec::kJpeg)) &&
+             !fs::exists(store.ObjectPath(FrameContentKey(b),
+                                          OutputCodec::kJpeg)) &&
+             !fs::exists(store.ReferencePath(day1)),
+         "store release keeps shared objects", ctx);
+  ok = store.ReleaseDay(day2, &removed, &removed_bytes, &error);
+  Assert(ok && removed == 2 && store.Objects() == 0 &&
+             store.ObjectBytes() == 0,
+         "store release removes last references", ctx);
+  fs::remove_all(dir, ec);
+}
+
+// Средняя абсолютная ошибка по каналам B, G, R.
+double MeanAbsError(const ImageBuffer& a, const ImageBuffer& b) {
+  double sum = 0.0;
+  for (uint32_t y = 0; y < a.height; ++y) {
+    for (uint32_t x = 0; x < a.width * 4; ++x) {
+      if (x % 4 != 3) {
+        sum += std::abs(a.pixels[y * a.stride + x] -
+                        b.pixels[y * b.stride + x]);
+      }
+    }
+  }
+  return sum / (3.0 * a.width * a.height);
+}
+
+void TestJpegDecoder(TestContext& ctx) {
+  const ImageBuffer frame =
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 203, 117, 3);
+  std::wstring error;
+  bool all_close = true;
+  for (ColorMode mode : {ColorMode::k420, ColorMode::k422, ColorMode::k444}) {
+    JpegEncodeOptions options;
+    options.quality = 0.9f;
+    options.color_mode = mode;
+    std::vector<uint8_t> jpeg;
+    ImageBuffer decoded;
+    all_close = all_close && EncodeJpeg(frame, options, &jpeg, &error) &&
+                DecodeJpeg(jpeg, &decoded, &error) &&
+                decoded.width == 203 && decoded.height == 117 &&
+                MeanAbsError(frame, decoded) < 3.0;
+  }
+  Assert(all_close, "jpeg decoder restores color frames", ctx);
+
+  // Перезапуски после каждой строки MCU и одна компонента.
+  JpegEncodeOptions options;
+  options.quality = 0.9f;
+  options.color_mode = ColorMode::kGray;
+  IncrementalJpegCache cache;
+  IncrementalEncodeStats stats;
+  std::vector<uint8_t> jpeg;
+  ImageBuffer decoded;
+  const ImageBuffer text =
+      MakeSyntheticFrame(SyntheticScene::kText, 203, 117, 3);
+  Assert(EncodeJpegIncremental(text, options, &cache, &jpeg, &stats,
+                               &error) &&
+             DecodeJpeg(jpeg, &decoded, &error) &&
+             MeanAbsError(text, decoded) < 3.0 &&
+             decoded.pixels[0] == decoded.pixels[1],
+         "jpeg decoder handles restarts and gray", ctx);
+
+  InsertJpegComment("p2 comment", &jpeg);
+  JpegInfo info;
+  Assert(ReadJpegInfo(jpeg, &info, &error) && info.width == 203 &&
+             info.height == 117 && info.components == 1 &&
+             info.comment == "p2 comment" &&
+             DecodeJpeg(jpeg, &decoded, &error),
+         "jpeg comment round trip", ctx);
+
+  std::vector<uint8_t> truncated(jpeg.begin(), jpeg.end() - 200);
+  std::vector<uint8_t> progressive = jpeg;
+  for (size_t i = 0; i + 1 < progressive.size(); ++i) {
+    if (progressive[i] == 0xFF && progressive[i + 1] == 0xC0) {
+      progressive[i + 1] = 0xC2;
+      break;
+    }
+  }
+  Assert(!DecodeJpeg(truncated, &decoded, &error) &&
+             !DecodeJpeg(progressive, &decoded, &error) &&
+             !ReadJpegInfo(progressive, &info, &error),
+         "jpeg decoder rejects truncated and progressive", ctx);
+
+  // Все коды первой таблицы DHT объявлены длиной 1: больше кодов, чем
+  // допускает длина, — таблица отклоняется до заполнения.
+  std::vector<uint8_t> oversubscribed = jpeg;
+  bool patched = false;
+  for (size_t i = 0; i + 21 < oversubscribed.size() && !patched; ++i) {
+    if (oversubscribed[i] == 0xFF && oversubscribed[i + 1] == 0xC4) {
+      uint8_t* counts = &oversubscribed[i + 5];
+      int total = 0;
+      for (int length = 0; length < 16; ++length) {
+        total += counts[length];
+        counts[length] = 0;
+      }
+      counts[0] = static_cast<uint8_t>(total);
+      patched = total > 2;
+    }
+  }
+  Assert(patched && !DecodeJpeg(oversubscribed, &decoded, &error) &&
+             !ReadJpegInfo(oversubscribed, &info, &error),
+         "jpeg decoder rejects oversubscribed huffman table", ctx);
+}
+
+void TestRetention(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  RetentionPolicy policy;
+  std::wstring error;
+  Assert(ParseRetentionPolicy(L"7:0.5:gray,90:0.25,365:delete", &policy,
+                              &error) &&
+             policy.tiers.size() == 3 && policy.tiers[0].scale == 0.5f &&
+             policy.tiers[0].grayscale && policy.tiers[1].grayscale &&
+             policy.tiers[2].remove &&
+             RetentionTierForAge(policy, 6) == -1 &&
+             RetentionTierForAge(policy, 7) == 0 &&
+             RetentionTierForAge(policy, 364) == 1 &&
+             RetentionTierForAge(policy, 400) == 2,
+         "retention policy parse", ctx);
+  RetentionPolicy gray_later;
+  Assert(ParseRetentionPolicy(L"7:0.5,30:gray", &gray_later, &error) &&
+             gray_later.tiers.size() == 2 &&
+             gray_later.tiers[1].scale == 0.5f &&
+             gray_later.tiers[1].grayscale,
+         "retention policy parse: gray tier inherits scale", ctx);
+  DateTimeParts first_kept;
+  Assert(RetentionDeleteCutoff(policy, DateTimeParts{2026, 3, 1, 9, 0, 0},
+                               &first_kept) &&
+             first_kept.year == 2025 && first_kept.month == 3 &&
+             first_kept.day == 2 &&
+             !RetentionDeleteCutoff(RetentionPolicy{}, first_kept,
+                                    &first_kept),
+         "retention delete cutoff", ctx);
+  RetentionPolicy rejected;
+  Assert(!ParseRetentionPolicy(L"90:0.5,7:0.25", &rejected, &error) &&
+             !ParseRetentionPolicy(L"7:0.5,30:1", &rejected, &error) &&
+             !ParseRetentionPolicy(L"7:delete,30:0.5", &rejected, &error) &&
+             !ParseRetentionPolicy(L"7", &rejected, &error) &&
+             !ParseRetentionPolicy(L"0:delete", &rejected, &error),
+         "retention policy rejects loosening tiers", ctx);
+
+  RetentionBudget budget;
+  budget.cpu_fraction = 0.1;
+  budget.io_bytes_per_second = 1 << 20;
+  Assert(RetentionThrottleDelayUs(budget, 1000, 0) == 9000 &&
+             RetentionThrottleDelayUs(budget, 0, 2 << 20) == 2000000 &&
+             RetentionThrottleDelayUs(RetentionBudget{1.0, 0}, 5000,
+                                      1 << 30) == 0,
+         "retention throttle delay", ctx);
+
+  const fs::path root = fs::temp_directory_path() / "p2_retention_test";
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  const fs::path pc_user = root / "PC_USER";
+  const ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 64, 40, 1);
+  JpegEncodeOptions options;
+  options.quality = 0.75f;
+  std::vector<uint8_t> jpeg;
+  std::vector<uint8_t> qoi;
+  EncodeJpeg(frame, options, &jpeg, &error);
+  EncodeQoi(frame, &qoi, &error);
+  auto day_dir = [&](const char* month, const char* day) {
+    const fs::path dir = pc_user / month / day;
+    fs::create_directories(dir / "p", ec);
+    return dir;
+  };
+  const fs::path recent = day_dir("2026-10", "2026-10-17");
+  const fs::path reduced = day_dir("2026-09", "2026-09-01");
+  const fs::path small = day_dir("2026-03", "2026-03-01");
+  const fs::path expired = day_dir("2025-09", "2025-09-01");
+  WriteFileBytes((recent / "a.jpg").wstring(), jpeg, &error);
+  WriteFileBytes((reduced / "a.jpg").wstring(), jpeg, &error);
+  WriteFileBytes((reduced / "b.qoi").wstring(), qoi, &error);
+  WriteFileBytes((reduced / "c.jpg").wstring(), jpeg, &error);
+  WriteFileBytes((reduced / "p" / "log.txt").wstring(), qoi, &error);
+  WriteFileBytes((small / "a.jpg").wstring(), jpeg, &error);
+  WriteFileBytes((expired / "a.jpg").wstring(), jpeg, &error);
+  WriteFileBytes((expired / "p" / "log.txt").wstring(), qoi, &error);
+
+  auto info_of = [&](const fs::path& path) {
+    std::vector<uint8_t> data;
+    JpegInfo info;
+    ReadFileBytes(path.wstring(), &data, &error);
+    ReadJpegInfo(data, &info, &error);
+    return info;
+  };
+  const RetentionBudget unlimited{1.0, 0};
+  const DateTimeParts today{2026, 10, 19, 12, 0, 0};
+  RetentionStats stats;
+  {
+    RetentionEngine engine;
+    Assert(engine.Open(pc_user.wstring(), policy, unlimited, &error) &&
+               engine.RunPass(today, 2, &stats, &error) && !stats.complete &&
+               stats.days_removed == 1 && stats.files_recompressed == 2 &&
+               fs::exists(pc_user / "retention.journal"),
+           "retention pass stops at file limit", ctx);
+  }
+  // Новый процесс продолжает проход по журналу.
+  RetentionEngine engine;
+  bool ok = engine.Open(pc_user.wstring(), policy, unlimited, &error) &&
+            engine.RunPass(today, SIZE_MAX, &stats, &error);
+  const JpegInfo half = info_of(reduced / "a.jpg");
+  const JpegInfo converted = info_of(reduced / "b.jpg");
+  const JpegInfo quarter = info_of(small / "a.jpg");
+  Assert(ok && stats.complete && stats.files_recompressed == 2 &&
+             half.width == 32 && half.height == 20 && half.components == 1 &&
+             info_of(reduced / "c.jpg").width == 32 &&
+             converted.width == 32 && !fs::exists(reduced / "b.qoi") &&
+             fs::exists(reduced / "p" / "log.txt") && quarter.width == 16 &&
+             quarter.components == 1 &&
+             info_of(recent / "a.jpg").width == 64 &&
+             !fs::exists(expired) && !fs::exists(pc_user / "2025-09"),
+         "retention applies tiers once across restarts", ctx);
+
+  fs::remove(pc_user / "retention.journal", ec);
+  RetentionEngine fresh;
+  ok = fresh.Open(pc_user.wstring(), policy, unlimited, &error) &&
+       fresh.RunPass(today, SIZE_MAX, &stats, &error);
+  Assert(ok && stats.files_recompressed == 0 &&
+             info_of(reduced / "a.jpg").width == 32,
+         "retention tags make passes idempotent", ctx);
+
+  // Фоновый проход через 74 дня: сентябрьский день переходит на уровень
+  // 0.25, октябрьский — на 0.5.
+  fresh.Start(nullptr);
+  fresh.Schedule(DateTimeParts{2027, 1, 1, 0, 0, 0});
+  bool finished = false;
+  for (int i = 0; i < 500 && !finished; ++i) {
+    finished = fresh.TakeResult(&stats, &error);
+    if (!finished) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  fresh.Stop();
+  Assert(finished && stats.files_recompressed == 4 &&
+             info_of(reduced / "a.jpg").width == 16 &&
+             info_of(reduced / "a.jpg").components == 1 &&
+             info_of(recent / "a.jpg").width == 32,
+         "retention background pass", ctx);
+  fs::remove_all(root, ec);
+}
+
+void TestEntropyWriters(TestContext& ctx) {
+  Assert(FFByteMask(0x00FF7FFEFF0180FFULL) == 0x0080000080000080ULL,
+         "FFByteMask marks exactly 0xFF bytes", ctx);
+  Assert(FFByteMask(0xFFFFFFFFFFFFFFFFULL) == 0x8080808080808080ULL,
+         "FFByteMask all bytes", ctx);
+
+  const HuffmanLut dc = BuildHuffmanLut(kStdDcLuma);
+  const HuffmanLut ac = BuildHuffmanLut(kStdAcLuma);
+  TestRandom rng;
+  std::vector<int16_t> blocks(64 * 400, 0);
+  for (size_t b = 0; b < 400; ++b) {
+    int16_t* zz = blocks.data() + b * 64;
+    zz[0] = static_cast<int16_t>(static_cast<int>(rng.Next() % 2047) - 1023);
+    // Плотность от "только DC" до полностью заполненных блоков, включая
+    // серии нулей > 16 (ZRL) и ненулевой последний коэффициент.
+    const uint32_t density = b % 5 == 0 ? 0 : rng.Next() % 64;
+    for (int k = 1; k < 64; ++k) {
+      if (rng.Next() % 64 < density) {
+        zz[k] = static_cast<int16_t>(static_cast<int>(rng.Next() % 2047) -
+                                     1023);
+      }
+    }
+  }
+  std::vector<uint8_t> reference;
+  std::vector<uint8_t> fast = {0xAB};
+  ByteBitWriter byte_writer(&reference);
+  JpegBitWriter word_writer(&fast);
+  JpegBitCounter counter;
+  int dc_ref = 0;
+  int dc_fast = 0;
+  int dc_count = 0;
+  for (size_t b = 0; b < 400; ++b) {
+    const int16_t* zz = blocks.data() + b * 64;
+    EncodeBlockReference(byte_writer, zz, &dc_ref, dc, ac);
+    EncodeBlockFast(word_writer, zz, &dc_fast, dc, ac);
+    EncodeBlockFast(counter, zz, &dc_count, dc, ac);
+  }
+  byte_writer.Flush();
+  word_writer.Flush();
+  Assert(fast.size() == reference.size() + 1 && fast[0] == 0xAB &&
+             std::equal(reference.begin(), reference.end(), fast.begin() + 1),
+         "word writer appends the reference stream", ctx);
+  Assert(counter.Finish() == reference.size(), "counter matches stream", ctx);
+  bool stuffed = false;
+  for (size_t i = 0; i + 1 < reference.size(); ++i) {
+    stuffed = stuffed || (reference[i] == 0xFF && reference[i + 1] == 0x00);
+  }
+  Assert(stuffed, "test stream exercises 0xFF stuffing", ctx);
+
+  // Все варианты дополнения последнего байта: потоки длиной n бит.
+  bool padding_ok = true;
+  for (int total = 1; total <= 80; ++total) {
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    ByteBitWriter expected_writer(&expected);
+    JpegBitWriter actual_writer(&actual);
+    JpegBitCounter bit_counter;
+    for (int left = total; left > 0;) {
+      const int size = std::min(left, static_cast<int>(rng.Next() % 16) + 1);
+      const uint32_t bits = rng.Next() & ((1u << size) - 1);
+      expected_writer.Put(bits, size);
+      actual_writer.Put(bits, size);
+      bit_counter.Put(bits, size);
+      left -= size;
+    }
+    expected_writer.Flush();
+    actual_writer.Flush();
+    padding_ok = padding_ok && actual == expected &&
+                 bit_counter.Finish() == expected.size();
+  }
+  Assert(padding_ok, "writers pad the last byte identically", ctx);
+}
+
+// Точное DCT в double: 8 * F(u,v) (масштаб коэффициентов кодера).
+void DoubleDct8x8(const uint8_t* samples, size_t stride, double* out) {
+  const double pi = 3.14159265358979323846;
+  for (int v = 0; v < 8; ++v) {
+    for (int u = 0; u < 8; ++u) {
+      double sum = 0.0;
+      for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+          sum += (samples[y * stride + x] - 128.0) *
+                 std::cos((2 * x + 1) * u * pi / 16) *
+                 std::cos((2 * y + 1) * v * pi / 16);
+        }
+      }
+      const double cu = u == 0 ? std::sqrt(0.5) : 1.0;
+      const double cv = v == 0 ? std::sqrt(0.5) : 1.0;
+      out[v * 8 + u] = 8.0 * 0.25 * cu * cv * sum;
+    }
+  }
+}
+
+void TestForwardDct(TestContext& ctx) {
+  TestRandom rng;
+  bool exact = true;
+  double max_error = 0.0;
+  double sum_error = 0.0;
+  const int kBlocks = 2000;
+  for (int b = 0; b < kBlocks; ++b) {
+    uint8_t samples[8 * 10];
+    const int pattern = b % 4;
+    for (int i = 0; i < 8 * 10; ++i) {
+      const int x = i % 10;
+      const int y = i / 10;
+      uint8_t value = static_cast<uint8_t>(rng.Next());
+      if (pattern == 1) {
+        value = ((x + y) & 1) ? 255 : 0;  // шахматка: максимум AC
+      } else if (pattern == 2) {
+        value = static_cast<uint8_t>(b & 1 ? 255 : 0);  // предельный DC
+      } else if (pattern == 3) {
+        value = static_cast<uint8_t>(std::clamp(x * 30 + y * 7, 0, 255));
+      }
+      samples[i] = value;
+    }
+    int16_t simd[64];
+    int16_t reference[64];
+    double expected[64];
+    ForwardDct8x8(samples, 10, simd);
+    ForwardDct8x8Reference(samples, 10, reference);
+    DoubleDct8x8(samples, 10, expected);
+    for (int i = 0; i < 64; ++i) {
+      exact = exact && simd[i] == reference[i];
+      const double error = std::abs(simd[i] - expected[i]);
+      max_error = std::max(max_error, error);
+      sum_error += error;
+    }
+  }
+  Assert(exact, "vectorized DCT bit-exact with scalar reference", ctx);
+  // Единица коэффициента = F/8; у jfdctint максимум ~1.3, среднее ~0.3.
+  Assert(max_error <= 2.0, "integer DCT max error vs double", ctx);
+  Assert(sum_error / (kBlocks * 64) <= 0.5, "integer DCT mean error", ctx);
+}
+
+void TestQuantizeBlock(TestContext& ctx) {
+  bool exact = true;
+  bool has_ac_ok = true;
+  for (int q = 1; q <= 255; ++q) {
+    uint8_t quant[64];
+    std::fill(quant, quant + 64, static_cast<uint8_t>(q));
+    const QuantDivisors divisors = BuildQuantDivisors(quant);
+    // Все модули 0..32767 обоих знаков по 64 в блоке.
+    for (int base = 0; base < 32768; base += 64) {
+      int16_t coef[64];
+      for (int i = 0; i < 64; ++i) {
+        const int magnitude = base + i;
+        coef[i] = static_cast<int16_t>(i & 1 ? -magnitude : magnitude);
+      }
+      int16_t fast[64];
+      int16_t reference[64];
+      const bool fast_ac = QuantizeBlock(coef, divisors, fast);
+      const bool reference_ac = QuantizeBlockReference(coef, quant, reference);
+      exact = exact && std::equal(fast, fast + 64, reference);
+      has_ac_ok = has_ac_ok && fast_ac == reference_ac;
+    }
+  }
+  Assert(exact, "reciprocal quantization equals rounded division", ctx);
+  Assert(has_ac_ok, "quantization reports nonzero AC", ctx);
+
+  uint8_t quant[64];
+  std::fill(quant, quant + 64, static_cast<uint8_t>(16));
+  const QuantDivisors divisors = BuildQuantDivisors(quant);
+  int16_t coef[64] = {};
+  int16_t zz[64];
+  coef[0] = 900;
+  coef[63] = 63;  // 63 / 128 -> 0
+  Assert(!QuantizeBlock(coef, divisors, zz) && zz[0] == 7,
+         "DC-only block flagged empty", ctx);
+  coef[63] = 64;  // 64 / 128 -> 1 (округление от нуля)
+  Assert(QuantizeBlock(coef, divisors, zz) && zz[63] == 1,
+         "last AC coefficient detected", ctx);
+}
+
+// Средние блоков 8x8 кадра (края дополнены повтором, как в кодере).
+ImageBuffer BlockAverages(const ImageBuffer& frame) {
+  ImageBuffer out;
+  out.width = (frame.width + 7) / 8;
+  out.height = (frame.height + 7) / 8;
+  out.stride = out.width * 4;
+  out.pixels.assign(static_cast<size_t>(out.stride) * out.height, 255);
+  for (uint32_t by = 0; by < out.height; ++by) {
+    for (uint32_t bx = 0; bx < out.width; ++bx) {
+      for (int c = 0; c < 3; ++c) {
+        int sum = 0;
+        for (uint32_t y = 0; y < 8; ++y) {
+          for (uint32_t x = 0; x < 8; ++x) {
+            const uint32_t sy = std::min(by * 8 + y, frame.height - 1);
+            const uint32_t sx = std::min(bx * 8 + x, frame.width - 1);
+            sum += frame.pixels[sy * frame.stride + sx * 4 + c];
+          }
+        }
+        out.pixels[by * out.stride + bx * 4 + c] =
+            static_cast<uint8_t>((sum + 32) / 64);
+      }
+    }
+  }
+  return out;
+}
+
+void TestContactSheets(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  const ImageBuffer frame =
+      MakeSyntheticFrame(SyntheticScene::kPhoto, 203, 117, 5);
+  const ImageBuffer averages = BlockAverages(frame);
+  std::wstring error;
+  JpegEncodeOptions options;
+  options.quality = 0.9f;
+  options.color_mode = ColorMode::k444;
+  ImageBuffer thumbnail;
+  options.thumbnail = &thumbnail;
+  std::vector<uint8_t> jpeg;
+  ImageBuffer dc;
+  Assert(EncodeJpeg(frame, options, &jpeg, &error) &&
+             thumbnail.width == 26 && thumbnail.height == 15 &&
+             MeanAbsError(averages, thumbnail) < 1.0 &&
+             DecodeJpegDc(jpeg, &dc, &error) && dc.width == 26 &&
+             dc.height == 15 && MeanAbsError(averages, dc) < 2.0,
+         "DC thumbnails of encoder and decoder match block averages", ctx);
+
+  // Все пути кодера дают один эскиз; инкрементальный обновляет только
+  // перекодированные полосы.
+  bool same = true;
+  for (ColorMode mode : {ColorMode::kGray, ColorMode::k420, ColorMode::k422}) {
+    options.color_mode = mode;
+    JpegCoefficients coefficients;
+    ImageBuffer from_coefficients;
+    ImageBuffer incremental_thumbnail;
+    IncrementalJpegCache cache;
+    IncrementalEncodeStats stats;
+    JpegEncodeOptions incremental = options;
+    incremental.thumbnail = &incremental_thumbnail;
+    same = same && EncodeJpeg(frame, options, &jpeg, &error) &&
+           ComputeJpegCoefficients(frame, mode, &coefficients, &error) &&
+           EncodeJpegIncremental(frame, incremental, &cache, &jpeg, &stats,
+                                 &error) &&
+           DecodeJpegDc(jpeg, &dc, &error) &&
+           MeanAbsError(thumbnail, dc) < 2.0;
+    JpegCoefficientsThumbnail(coefficients, &from_coefficients);
+    same = same && from_coefficients.pixels == thumbnail.pixels &&
+           incremental_thumbnail.pixels == thumbnail.pixels;
+    ImageBuffer changed = frame;
+    std::fill(changed.pixels.begin(), changed.pixels.begin() + 4 * 203 * 4,
+              static_cast<uint8_t>(200));
+    same = same &&
+           EncodeJpegIncremental(changed, incremental, &cache, &jpeg, &stats,
+                                 &error) &&
+           stats.rows_encoded == 1 && EncodeJpeg(changed, options, &jpeg,
+                                                 &error) &&
+           incremental_thumbnail.pixels == thumbnail.pixels;
+  }
+  Assert(same, "thumbnail equal on streaming, coefficient and incremental",
+         ctx);
+
+  int hour = -1;
+  int display = -1;
+  Assert(ParseFrameFileName(L"PC_A_B_2026-10-19_09-15-00.jpg", &hour,
+                            &display) &&
+             hour == 9 && display == 0 &&
+             ParseFrameFileName(L"PC_USER_2026-10-19_23-59-59_Display02.qoi",
+                                &hour, &display) &&
+             hour == 23 && display == 1 &&
+             !ParseFrameFileName(L"PC_USER_2026-10-19.p2pack", &hour,
+                                 &display) &&
+             !ParseFrameFileName(L"PC_USER_2026-10-19_24-00-00.jpg", &hour,
+                                 &display),
+         "frame file name parse", ctx);
+
+  // День: два часа, два дисплея, QOI, готовый эскиз и испорченный файл.
+  const fs::path dir = fs::temp_directory_path() / "p2_sheet_test";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir / "t", ec);
+  options.color_mode = ColorMode::k420;
+  options.thumbnail = nullptr;
+  std::vector<uint8_t> qoi;
+  bool written = EncodeJpeg(frame, options, &jpeg, &error) &&
+                 EncodeQoi(frame, &qoi, &error);
+  const std::wstring prefix = (dir / L"PC_USER_2026-10-19_").wstring();
+  for (const wchar_t* name :
+       {L"09-00-00_Display01.jpg", L"09-00-10_Display01.jpg",
+        L"10-00-00_Display01.jpg"}) {
+    written = written && WriteFileBytes(prefix + name, jpeg, &error);
+  }
+  written = written &&
+            WriteFileBytes(prefix + L"09-00-00_Display02.qoi", qoi, &error) &&
+            WriteFileBytes(prefix + L"10-00-10_Display01.jpg",
+                           std::vector<uint8_t>(jpeg.begin(),
+                                                jpeg.begin() + 300),
+                           &error) &&
+            WriteFileBytes(
+                ThumbnailPathForFrame(prefix + L"09-00-10_Display01.jpg"),
+                jpeg, &error);
+  ContactSheetOptions sheet_options;
+  sheet_options.tile_width = 16;
+  sheet_options.columns = 2;
+  sheet_options.threads = 3;
+  ContactSheetStats sheet_stats;
+  ImageBuffer sheet;
+  std::vector<uint8_t> sheet_jpeg;
+  const bool built =
+      written &&
+      BuildDayContactSheets(dir.wstring(), (dir / "sheets").wstring(),
+                            sheet_options, &sheet_stats, &error) &&
+      ReadFileBytes((dir / "sheets" / "sheet_09_Display01.jpg").wstring(),
+                    &sheet_jpeg, &error) &&
+      DecodeJpeg(sheet_jpeg, &sheet, &error);
+  Assert(built && sheet_stats.frames == 5 && sheet_stats.failed == 1 &&
+             sheet_stats.encoder_thumbnails == 1 && sheet_stats.sheets == 3 &&
+             sheet.width == 2 * (16 + 2) + 2 && sheet.height == 9 + 4 &&
+             fs::exists(dir / "sheets" / "sheet_09_Display02.jpg") &&
+             fs::exists(dir / "sheets" / "sheet_10_Display01.jpg"),
+         "day contact sheets per hour and display", ctx);
+  fs::remove_all(dir, ec);
+}
+
+void TestCatalog(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 64, 64, 1);
+  ChangeTracker tracker;
+  const uint16_t first = tracker.Update(frame);
+  const uint16_t same = tracker.Update(frame);
+  frame.pixels[static_cast<size_t>(20) * frame.stride] ^= 0xFF;
+  const uint16_t one_band = tracker.Update(frame);
+  frame.width = 32;
+  const uint16_t resized = tracker.Update(frame);
+  Assert(first == kCatalogChangeUnknown && same == 0 && one_band == 250 &&
+             resized == kCatalogChangeUnknown,
+         "change score by row bands", ctx);
+
+  const fs::path dir = fs::temp_directory_path() / "p2_catalog_test";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  ArchiveIdentity identity;
+  identity.computer = L"PC";
+  identity.user = L"Пользователь";
+  // Два месяца по два дисплея; в марте часы переведены назад.
+  const int64_t feb = ArchiveTimestamp(DateTimeParts{2026, 2, 28, 23, 0, 0});
+  const int64_t mar = ArchiveTimestamp(DateTimeParts{2026, 3, 3, 14, 0, 0});
+  std::wstring error;
+  bool appended = false;
+  {
+    CatalogWriter writer;
+    appended = writer.Open(dir.wstring(), identity, &error);
+    for (int i = 0; i < 100; ++i) {
+      for (int display = 0; display < 2; ++display) {
+        CatalogEntry entry;
+        entry.timestamp = (i < 50 ? feb : mar) + (i % 50) * 10;
+        entry.size = 1000 + static_cast<uint32_t>(i);
+        entry.change = static_cast<uint16_t>(i % 5 == 0 ? 400 : 0);
+        entry.display_index = display;
+        entry.display_count = 2;
+        entry.black = i == 7;
+        entry.storage = CatalogStorage::kVideo;
+        entry.video_part = display;
+        appended = appended && writer.Append(entry, &error);
+      }
+    }
+    CatalogEntry back;
+    back.timestamp = mar - 3600;
+    appended = appended && writer.Append(back, &error) &&
+               writer.Entries() == 101;
+  }
+  Assert(appended && fs::exists(dir / "2026-02.p2cat") &&
+             fs::exists(dir / "2026-03.p2cat") &&
+             CatalogFileName(mar) == L"2026-03.p2cat",
+         "catalog appends into month files", ctx);
+
+  CatalogView view;
+  const bool opened = view.Open((dir / "2026-02.p2cat").wstring(), &error);
+  Assert(opened && view.Sorted() && view.Size() == 100 &&
+             view.Identity().user == identity.user &&
+             view.LowerBound(feb + 100) == 20 &&
+             view.Entry(20).timestamp == feb + 100 &&
+             view.Entry(21).display_index == 1 &&
+             view.Entry(21).video_part == 1 &&
+             view.Entry(21).storage == CatalogStorage::kVideo &&
+             view.Entry(14).black,
+         "catalog view binary search", ctx);
+
+  CatalogQuery query;
+  query.from = mar + 60;
+  query.to = mar + 120;
+  query.display_index = 1;
+  std::vector<CatalogEntry> found;
+  ArchiveIdentity source;
+  CatalogQueryStats stats;
+  bool ok = QueryCatalog(dir.wstring(), query, &found, &source, &stats,
+                         &error);
+  Assert(ok && found.size() == 7 && stats.files == 1 &&
+             found.front().timestamp == mar + 60 &&
+             source.computer == L"PC",
+         "catalog query range and display", ctx);
+
+  query = CatalogQuery{};
+  query.min_change = 100;
+  query.skip_black = true;
+  ok = QueryCatalog(dir.wstring(), query, &found, nullptr, &stats, &error);
+  // 20 активных циклов на двух дисплеях и запись с неизвестной оценкой.
+  Assert(ok && found.size() == 41 && stats.files == 2,
+         "catalog query active frames", ctx);
+
+  // Недописанная запись отрезается, мартовский файл помечен неупорядоченным.
+  {
+    std::ofstream tail(dir / "2026-03.p2cat",
+                       std::ios::binary | std::ios::app);
+    tail.write("torn", 4);
+  }
+  CatalogWriter reopened;
+  CatalogEntry next;
+  next.timestamp = mar + 1000;
+  ok = reopened.Open(dir.wstring(), identity, &error) &&
+       reopened.Append(next, &error) && reopened.Entries() == 102 &&
+       view.Open((dir / "2026-03.p2cat").wstring(), &error) &&
+       !view.Sorted() && view.Size() == 102 && view.LowerBound(mar) == 0;
+  Assert(ok, "catalog torn tail and unsorted month", ctx);
+
+  CatalogWriter other;
+  identity.computer = L"OTHER";
+  Assert(other.Open(dir.wstring(), identity, &error) &&
+             !other.Append(next, &error),
+         "catalog of another source rejected", ctx);
+  fs::remove_all(dir, ec);
+}
+
+// HTTP-запрос к 127.0.0.1:port; ответ целиком (пусто при ошибке).
+std::string HttpGet(uint16_t port, const std::string& path) {
+#if defined(_WIN32)
+  WSADATA wsa = {};
+  WSAStartup(MAKEWORD(2, 2), &wsa);
+  using Socket = SOCKET;
+#else
+  using Socket = int;
+#endif
+  const Socket client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::string response;
+  if (connect(client, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == 0) {
+    const std::string request =
+        "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(client, request.data(), static_cast<int>(request.size()), 0);
+    char buffer[4096];
+    for (;;) {
+      const auto received = recv(client, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        break;
+      }
+      response.append(buffer, static_cast<size_t>(received));
+    }
+  }
+#if defined(_WIN32)
+  closesocket(client);
+  WSACleanup();
+#else
+  close(client);
+#endif
+  return response;
+}
+
+void TestMetrics(TestContext& ctx) {
+  MetricsRegistry registry;
+  const MetricId frames =
+      registry.Counter("p2_frames_total", "Frames.", {{"display", "1"}});
+  const MetricId frames2 =
+      registry.Counter("p2_frames_total", "Frames.", {{"display", "2"}});
+  const MetricId latency = registry.Histogram(
+      "p2_latency_seconds", "Latency.", {}, {0.01, 0.1});
+  const MetricId pending = registry.Gauge("p2_pending", "Pending.");
+  registry.GaugeCallback("p2_answer", "Answer.", []() { return 42.0; });
+
+  // Запись из двух потоков: у каждого свой шард, сумма — при выводе.
+  std::thread writer([&]() {
+    for (int i = 0; i < 1000; ++i) {
+      registry.Add(frames);
+    }
+  });
+  for (int i = 0; i < 500; ++i) {
+    registry.Add(frames);
+  }
+  writer.join();
+  registry.Add(frames2, 7);
+  registry.Observe(latency, 0.005);
+  const size_t allocations = Allocations();
+  registry.Observe(latency, 0.05);
+  registry.Observe(latency, 3.0);
+  registry.Add(kNoMetric);
+  registry.Set(pending, 2.5);
+  Assert(Allocations() == allocations, "metric updates do not allocate",
+         ctx);
+
+  const std::string text = registry.Render();
+  auto has = [&](const char* line) {
+    return text.find(std::string(line) + "\n") != std::string::npos;
+  };
+  Assert(has("# TYPE p2_frames_total counter") &&
+             has("p2_frames_total{display=\"1\"} 1500") &&
+             has("p2_frames_total{display=\"2\"} 7") &&
+             text.find("# HELP p2_frames_total") ==
+                 text.rfind("# HELP p2_frames_total") &&
+             has("# TYPE p2_latency_seconds histogram") &&
+             has("p2_latency_seconds_bucket{le=\"0.01\"} 1") &&
+             has("p2_latency_seconds_bucket{le=\"0.1\"} 2") &&
+             has("p2_latency_seconds_bucket{le=\"+Inf\"} 3") &&
+             has("p2_latency_seconds_sum 3.055") &&
+             has("p2_latency_seconds_count 3") && has("p2_pending 2.5") &&
+             has("p2_answer 42"),
+         "metrics text exposition", ctx);
+
+  MetricsServer server;
+  std::wstring error;
+  const bool started = server.Start(&registry, 0, &error);
+  const std::string ok = started ? HttpGet(server.Port(), "/metrics") : "";
+  const std::string missing = started ? HttpGet(server.Port(), "/") : "";
+  server.Stop();
+  Assert(started && server.Port() != 0 &&
+             ok.rfind("HTTP/1.0 200 OK\r\n", 0) == 0 &&
+             ok.find("Content-Type: text/plain; version=0.0.4") !=
+                 std::string::npos &&
+             ok.find("p2_frames_total{display=\"1\"} 1500\n") !=
+                 std::string::npos &&
+             missing.rfind("HTTP/1.0 404", 0) == 0 &&
+             server.Requests() == 2,
+         "metrics endpoint on localhost", ctx);
+}
+
+void TestFrameRing(TestContext& ctx) {
+  const std::wstring name =
+      L"p2_test_ring_" +
+      std::to_wstring(
+          std::chrono::steady_clock::now().time_since_epoch().count());
+  ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 64, 32, 1);
+  FrameRingWriter writer;
+  std::wstring error;
+  Assert(writer.Create(name, 2, 64 * 32 * 4, &error),
+         "frame ring created", ctx);
+  FrameRingReader reader;
+  FrameRingView view;
+  Assert(reader.Open(name, &error) && reader.Displays() == 2 &&
+             !reader.Closed() && !reader.Latest(0, &view),
+         "frame ring empty before publish", ctx);
+
+  // Кадр с запасом в строке: в кольцо строки ложатся вплотную.
+  ImageBuffer padded = frame;
+  padded.stride = frame.stride + 16;
+  padded.pixels.assign(static_cast<size_t>(padded.stride) * frame.height, 0);
+  for (uint32_t y = 0; y < frame.height; ++y) {
+    std::memcpy(padded.pixels.data() + y * padded.stride,
+                frame.pixels.data() + y * frame.stride, frame.stride);
+  }
+  const size_t allocations = Allocations();
+  const bool published = writer.Publish(1, padded, 1234, &error);
+  const bool latest = reader.Latest(1, &view);
+  Assert(published && latest && Allocations() == allocations &&
+             view.width == 64 && view.height == 32 &&
+             view.stride == frame.stride && view.timestamp == 1234 &&
+             view.frame_number == 1 &&
+             std::memcmp(view.pixels, frame.pixels.data(),
+                         frame.pixels.size()) == 0 &&
+             reader.Validate(view) && !reader.Latest(0, &view),
+         "frame ring publishes without allocations, reads in place", ctx);
+
+  // Слот переписывается через kFrameRingDepth кадров: старый вид
+  // становится недействительным, новый — целым.
+  reader.Latest(1, &view);
+  for (uint32_t i = 0; i < kFrameRingDepth; ++i) {
+    writer.Publish(1, frame, 1235 + i, &error);
+  }
+  FrameRingView fresh;
+  ImageBuffer copy;
+  Assert(!reader.Validate(view) && reader.Latest(1, &fresh) &&
+             fresh.frame_number == 1 + kFrameRingDepth &&
+             reader.Validate(fresh) &&
+             reader.CopyLatest(1, &copy, nullptr) &&
+             copy.pixels == frame.pixels,
+         "frame ring view invalidated when its slot is reused", ctx);
+
+  ImageBuffer large = MakeSyntheticFrame(SyntheticScene::kUi, 128, 32, 1);
+  Assert(!writer.Publish(0, large, 0, &error) &&
+             !writer.Publish(2, frame, 0, &error) &&
+             !writer.Create(L"bad/name", 1, 16, &error),
+         "frame ring rejects oversized frame, display and name", ctx);
+
+  writer.Close();
+  FrameRingReader missing;
+  Assert(reader.Closed() && !missing.Open(name, &error),
+         "frame ring closed for readers", ctx);
+}
+
+void TestPerfCounters(TestContext& ctx) {
+  const size_t task_clock = static_cast<size_t>(PerfCounter::kTaskClock);
+  std::vector<uint8_t> data(4 << 20, 1);
+  // Без профиля стадии ничего не стоят и никуда не пишутся.
+  PerfProfile idle;
+  {
+    const PerfScope scope(PerfStage::kHash);
+    Hash64(data.data(), data.size());
+  }
+  Assert(idle.Stage(PerfStage::kHash)[task_clock] == 0,
+         "perf scope without profile is a no-op", ctx);
+
+  PerfProfile profile;
+  std::wstring error;
+  if (!profile.Attach(&error)) {
+    // Счетчики недоступны (не Linux, perf_event_paranoid, нет PMU):
+    // отчет без значений, ошибка с причиной.
+    Assert(!error.empty() &&
+               profile.Report().find("encode: IPC -") != std::string::npos &&
+               profile.ReportJson().find("\"ipc\": null") !=
+                   std::string::npos,
+           "perf counters unavailable degrade to empty report", ctx);
+    return;
+  }
+  uint64_t sink = 0;
+  {
+    const PerfScope encode(PerfStage::kEncode);
+    for (int i = 0; i < 4; ++i) {
+      sink += Hash64(data.data(), data.size(), i);
+    }
+    // Хеш внутри кодирования учитывается как хеш.
+    std::vector<uint8_t> jpeg;
+    ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 256, 256, 1);
+    EncodeJpeg(frame, JpegEncodeOptions(), &jpeg, &error);
+    sink += jpeg.size();
+  }
+  profile.AddPixels(256 * 256);
+  profile.Detach();
+  {
+    const PerfScope scope(PerfStage::kWrite);
+    sink += Hash64(data.data(), data.size());
+  }
+  const PerfValues& hash = profile.Stage(PerfStage::kHash);
+  const PerfValues& encode = profile.Stage(PerfStage::kEncode);
+  const PerfValues& convert = profile.Stage(PerfStage::kConvert);
+  const PerfValues& write = profile.Stage(PerfStage::kWrite);
+  bool counted = sink != 0;
+  for (size_t i = 0; i < kPerfCounterCount; ++i) {
+    if (profile.Has(static_cast<PerfCounter>(i)) &&
+        static_cast<PerfCounter>(i) != PerfCounter::kLlcMisses &&
+        static_cast<PerfCounter>(i) != PerfCounter::kBranchMisses) {
+      counted = counted && hash[i] > 0 && encode[i] > 0 && convert[i] > 0 &&
+                write[i] == 0;
+    }
+  }
+  Assert(counted, "perf counters attributed to nested stages", ctx);
+  const std::string json = profile.ReportJson();
+  Assert(profile.Report().find("hash: IPC ") != std::string::npos &&
+             json.find("\"megapixels\": 0.065536") != std::string::npos &&
+             json.find("\"stages\": {\"capture_copy\": {") !=
+                 std::string::npos,
+         "perf counters report and JSON", ctx);
+}
+
+// Синтетический цикл захвата переносимой части конвейера: кадр меняется на
+// месте, публикуется в кольцо, оценивается изменение, кодируется,
+// хешируется, пишется в файл и в каталог, обновляются метрики.
+void TestSteadyStateAllocations(TestContext& ctx) {
+  namespace fs = std::filesystem;
+  // Обоснование: бюджет записан по текущему состоянию — на Linux перевод
+  // пути в байты в WriteFileBytes (2 выделения на кадр), на Windows 0;
+  // рост выше означает новое выделение в горячем цикле.
+  constexpr size_t kCycleAllocationBudget = 4;
+  constexpr uint32_t kDisplays = 2;
+  constexpr int kWarmupCycles = 10;
+  constexpr int kCycles = 1000;
+  const fs::path dir = fs::temp_directory_path() / "p2_alloc_test";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  std::wstring error;
+
+  struct Display {
+    ImageBuffer frame;
+    JpegEncoderContext encoder;
+    ChangeTracker change;
+    std::wstring path;
+  };
+  std::vector<Display> displays(kDisplays);
+  for (uint32_t i = 0; i < kDisplays; ++i) {
+    displays[i].frame = MakeSyntheticFrame(SyntheticScene::kUi, 320, 200, i);
+    displays[i].path =
+        (dir / ("display" + std::to_string(i + 1) + ".jpg")).wstring();
+  }
+  const std::wstring ring_name =
+      L"p2_alloc_ring_" +
+      std::to_wstring(
+          std::chrono::steady_clock::now().time_since_epoch().count());
+  FrameRingWriter ring;
+  MetricsRegistry metrics;
+  const MetricId frames = metrics.Counter("p2_frames_total", "Frames.");
+  const MetricId latency = metrics.Histogram(
+      "p2_encode_seconds", "Encode.", {}, LatencyBuckets());
+  CatalogWriter catalog;
+  ArchiveIdentity identity;
+  identity.computer = L"pc";
+  identity.user = L"user";
+  const bool opened =
+      ring.Create(ring_name, kDisplays, 320 * 200 * 4, &error) &&
+      catalog.Open(dir.wstring(), identity, &error);
+  const AllocRegion region = RegisterAllocRegion("test_cycle");
+
+  bool ok = opened;
+  uint64_t sink = 0;
+  auto run_cycle = [&](int cycle) {
+    const AllocScope scope(region);
+    const int64_t timestamp = 1767225600 + cycle;
+    for (uint32_t i = 0; i < kDisplays; ++i) {
+      Display& display = displays[i];
+      // «Захват»: часть строк меняется от цикла к циклу.
+      const size_t row = static_cast<size_t>(cycle % 200) *
+                         display.frame.stride;
+      std::memset(display.frame.pixels.data() + row, cycle & 0xFF,
+                  display.frame.stride);
+      ok = ring.Publish(i, display.frame, timestamp, &error) && ok;
+      CatalogEntry entry;
+      entry.timestamp = timestamp;
+      entry.change = display.change.Update(display.frame);
+      entry.display_index = static_cast<int>(i);
+      entry.display_count = kDisplays;
+      ok = EncodeJpeg(display.frame, JpegEncodeOptions(), &display.encoder,
+                      &error) &&
+           ok;
+      const std::vector<uint8_t>& jpeg = display.encoder.output;
+      sink += Hash128(jpeg.data(), jpeg.size()).low;
+      ok = WriteFileBytes(display.path, jpeg, &error) && ok;
+      entry.size = static_cast<uint32_t>(jpeg.size());
+      ok = catalog.Append(entry, &error) && ok;
+      metrics.Add(frames);
+      metrics.Observe(latency, 0.01);
+    }
+  };
+
+  for (int cycle = 0; cycle < kWarmupCycles; ++cycle) {
+    run_cycle(cycle);
+  }
+  const size_t allocations = Allocations();
+  const AllocCounts region_start = AllocRegionCounts(region);
+  for (int cycle = kWarmupCycles; cycle < kWarmupCycles + kCycles; ++cycle) {
+    run_cycle(cycle);
+  }
+  const size_t cycle_allocations = Allocations() - allocations;
+  const AllocCounts region_counts = AllocRegionCounts(region) - region_start;
+  std::cout << "Steady-state allocations per cycle: "
+            << static_cast<double>(cycle_allocations) / kCycles
+            << " (budget " << kCycleAllocationBudget << ")\n";
+  // Обоснование: сравниваются суммы — целое деление на kCycles пропустило
+  // бы до kCycles - 1 лишних выделений.
+  Assert(ok && sink != 0 &&
+             cycle_allocations <= kCycleAllocationBudget * kCycles,
+         "steady-state capture cycle within allocation budget", ctx);
+  // Со счетчиком p2_core все выделения цикла приписаны его области; без
+  // него области пусты.
+  Assert(kAllocTrackingEnabled
+             ? region_counts.allocations == cycle_allocations &&
+                   region_counts.bytes > 0
+             : region_counts.allocations == 0 &&
+                   ProcessAllocCounts().allocations == 0,
+         "allocations attributed to the scoped region", ctx);
+
+  ring.Close();
+  catalog.Close();
+  fs::remove_all(dir);
+}
+
+// Синтетические часы и счетчик CPU: каждый цикл длится wall_step секунд и
+// тратит cpu_step секунд процессора.
+class FakeCpuMeter : public CpuMeter {
+ public:
+  bool Sample(CpuSample* out) override {
+    if (fail) {
+      return false;
+    }
+    *out = now;
+    return true;
+  }
+  void Advance(double wall_step, double cpu_step) {
+    now.wall_seconds += wall_step;
+    now.cpu_seconds += cpu_step;
+  }
+
+  CpuSample now;
+  bool fail = false;
+};
+
+void TestCpuGovernor(TestContext& ctx) {
+  std::vector<GovernorLevel> levels;
+  std::wstring error;
+  const bool parsed =
+      ParseGovernorLevels(kDefaultGovernorLevels, &levels, &error);
+  Assert(parsed && levels.size() == 5 && levels[0].fixed_quality &&
+             !levels[0].grayscale && levels[1].grayscale &&
+             levels[2].scale == 0.5f && !levels[2].skip_unchanged &&
+             levels[3].skip_unchanged && levels[3].interval_factor == 1 &&
+             levels[4].interval_factor == 2 && levels[4].fixed_quality &&
+             FormatGovernorLevel(levels[4]) ==
+                 L"quality + gray + scale 0.50 + skip + interval x2" &&
+             FormatGovernorLevel(GovernorLevel()) == L"full",
+         "governor default levels are cumulative", ctx);
+  std::vector<GovernorLevel> compound;
+  Assert(ParseGovernorLevels(L"scale:0.5,scale:0.5,interval:3", &compound,
+                             &error) &&
+             compound[1].scale == 0.25f && compound[2].interval_factor == 3 &&
+             !ParseGovernorLevels(L"scale:1", &levels, &error) &&
+             !ParseGovernorLevels(L"interval:1", &levels, &error) &&
+             !ParseGovernorLevels(L"gray:2", &levels, &error) &&
+             !ParseGovernorLevels(L"quality,,gray", &levels, &error) &&
+             !ParseGovernorLevels(L"", &levels, &error) &&
+             levels.size() == 5,
+         "governor levels reject invalid steps", ctx);
+
+  // Бюджет 10% двух ядер: цикл 10 с, 2 с CPU = 10%.
+  FakeCpuMeter meter;
+  CpuGovernorConfig config;
+  config.budget_percent = 10;
+  config.processors = 2;
+  config.levels = levels;
+  config.down_cycles = 2;
+  config.up_cycles = 3;
+  config.up_share = 0.5;
+  CpuGovernor governor(config, &meter);
+  governor.Start();
+  GovernorTransition transition;
+  auto cycle = [&](double cpu_seconds) {
+    meter.Advance(10.0, cpu_seconds);
+    return governor.EndCycle(&transition);
+  };
+  const bool first = cycle(5.0);
+  const bool second = cycle(5.0);
+  Assert(!first && second && governor.Level() == 1 &&
+             transition.from_level == 0 && transition.to_level == 1 &&
+             std::abs(transition.usage_percent - 25.0) < 1e-9 &&
+             governor.Current().fixed_quality,
+         "governor steps down after cycles over budget", ctx);
+  int transitions = 0;
+  for (int i = 0; i < 20; ++i) {
+    transitions += cycle(5.0) ? 1 : 0;
+  }
+  Assert(governor.Level() == 5 && transitions == 4 &&
+             governor.Current().interval_factor == 2,
+         "governor steps one level at a time down to the last", ctx);
+
+  // Между up_share и бюджетом уровень держится.
+  transitions = 0;
+  for (int i = 0; i < 20; ++i) {
+    transitions += cycle(1.5) ? 1 : 0;
+  }
+  Assert(transitions == 0 && governor.Level() == 5 &&
+             std::abs(governor.UsagePercent() - 7.5) < 1e-9,
+         "governor holds its level inside the hysteresis band", ctx);
+
+  const bool up1 = cycle(0.4);
+  const bool up2 = cycle(0.4);
+  const bool up3 = cycle(0.4);
+  Assert(!up1 && !up2 && up3 && governor.Level() == 4 &&
+             transition.from_level == 5 && transition.to_level == 4,
+         "governor steps up after cycles with headroom", ctx);
+
+  // Повышение сразу вернуло перегрузку: следующее ждет вдвое дольше.
+  cycle(5.0);
+  const bool down = cycle(5.0);
+  int waited = 0;
+  while (governor.Level() == 5 && waited < 20) {
+    cycle(0.4);
+    ++waited;
+  }
+  Assert(down && waited == 6, "governor backs off a failed step up", ctx);
+
+  // Удержавшееся повышение возвращает обычное ожидание.
+  for (int i = 0; i < 3; ++i) {
+    cycle(1.5);
+  }
+  waited = 0;
+  while (governor.Level() == 4 && waited < 20) {
+    cycle(0.4);
+    ++waited;
+  }
+  Assert(governor.Level() == 3 && waited == 3,
+         "governor resets the wait after a step up holds", ctx);
+
+  meter.fail = true;
+  meter.Advance(10.0, 5.0);
+  Assert(!governor.EndCycle(&transition) && governor.Level() == 3,
+         "governor keeps its level without CPU samples", ctx);
+  ProcessCpuMeter process;
+  CpuSample sample;
+  Assert(process.Sample(&sample) && sample.wall_seconds > 0 &&
+             sample.cpu_seconds > 0,
+         "process CPU meter", ctx);
+}
+
+void TestMemoryBudget(TestContext& ctx) {
+  MemoryBudget small(100);
+  MemoryReservation first;
+  MemoryReservation second;
+  Assert(first.TryAcquire(&small, 60) && !second.TryAcquire(&small, 50) &&
+             second.Bytes() == 0 && !second.Acquire(&small, 101) &&
+             small.Used() == 60,
+         "memory budget rejects what does not fit", ctx);
+  MemoryReservation moved = std::move(first);
+  second.ForceAcquire(&small, 50);
+  Assert(first.Bytes() == 0 && moved.Bytes() == 60 && small.Used() == 110 &&
+             small.Peak() == 110,
+         "memory budget forced reservation goes over the limit", ctx);
+  moved.Reset();
+  second.Reset();
+  MemoryBudget unlimited(0);
+  Assert(small.Used() == 0 && first.TryAcquire(&unlimited, SIZE_MAX / 2),
+         "memory budget release and unlimited", ctx);
+  first.Reset();
+
+  // Обоснование: блокирующий Acquire ждет освобождения другим потоком.
+  MemoryReservation held;
+  held.TryAcquire(&small, 80);
+  std::atomic<bool> acquired{false};
+  std::thread waiter([&]() {
+    MemoryReservation wanted;
+    acquired = wanted.Acquire(&small, 40);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const bool waited = !acquired;
+  held.Reset();
+  waiter.join();
+  Assert(waited && acquired && small.Used() == 0,
+         "memory budget Acquire waits for a release", ctx);
+
+  JpegEncoderContext context;
+  const ImageBuffer frame =
+      MakeSyntheticFrame(SyntheticScene::kUi, 320, 200, 1);
+  std::wstring error;
+  Assert(EncodeJpeg(frame, JpegEncodeOptions{}, &context, &error) &&
+             JpegEncoderContextBytes(context) >= context.output.size() &&
+             JpegEncoderContextBytes(JpegEncoderContext()) == 0 &&
+             FullFrameBytes(3840, 2160, 3840, 2160, ColorMode::k420) >
+                 FullFrameBytes(3840, 2160, 1920, 1080, ColorMode::k420) &&
+             FullFrameBytes(3840, 2160, 3840, 2160, ColorMode::kGray) <
+                 FullFrameBytes(3840, 2160, 3840, 2160, ColorMode::k444) &&
+             StripFrameBytes(3840, 2160) * 8 <
+                 FullFrameBytes(3840, 2160, 3840, 2160, ColorMode::k420),
+         "memory budget estimates", ctx);
+
+  // 16 дисплеев 4K, два рабочих потока и общий бюджет 128 МБ: полный кадр
+  // (~87 МБ) помещается один, остальные уходят в кодирование полосами;
+  // контекст кодера сохраняется, только пока помещается в бюджет.
+  constexpr uint32_t kDisplays = 16;
+  constexpr uint32_t kWidth = 3840;
+  constexpr uint32_t kHeight = 2160;
+  constexpr size_t kLimit = size_t{128} << 20;
+  MemoryBudget budget(kLimit);
+  std::vector<JpegEncoderContext> contexts(kDisplays);
+  std::vector<MemoryReservation> retained(kDisplays);
+  std::vector<JpegFrameInfo> infos(kDisplays);
+  std::atomic<uint32_t> next{0};
+  std::atomic<uint32_t> full_frames{0};
+  std::atomic<uint32_t> spilled{0};
+  std::atomic<uint32_t> released{0};
+  std::mutex retained_mutex;
+  // Освобождает сохраненные контексты других дисплеев (как main перед
+  // переходом на полосы).
+  auto release_others = [&](uint32_t display) {
+    std::lock_guard<std::mutex> lock(retained_mutex);
+    for (uint32_t other = 0; other < kDisplays; ++other) {
+      if (other != display && retained[other].Bytes() != 0) {
+        retained[other].Reset();
+        contexts[other] = JpegEncoderContext();
+        ++released;
+      }
+    }
+  };
+  const size_t full_bytes =
+      FullFrameBytes(kWidth, kHeight, kWidth, kHeight, ColorMode::k420);
+  const size_t strip_bytes = StripFrameBytes(kWidth, kHeight);
+  auto worker = [&]() {
+    for (uint32_t d = next++; d < kDisplays; d = next++) {
+      JpegEncoderContext& encoder = contexts[d];
+      std::wstring worker_error;
+      MemoryReservation frame_memory;
+      bool full = frame_memory.TryAcquire(&budget, full_bytes);
+      if (!full) {
+        release_others(d);
+        full = frame_memory.TryAcquire(&budget, full_bytes);
+      }
+      if (full) {
+        ++full_frames;
+        const ImageBuffer image =
+            MakeSyntheticFrame(SyntheticScene::kUi, kWidth, kHeight, d);
+        ComputeJpegCoefficients(image, ColorMode::k420, &encoder.coefficients,
+                                &worker_error, encoder.workspace.get());
+        EncodeJpegCoefficients(encoder.coefficients,
+                               QualityToIjg(JpegEncodeOptions{}.quality),
+                               &encoder.output);
+      } else {
+        ++spilled;
+        frame_memory.Acquire(&budget, strip_bytes);
+        SyntheticStripSource source(SyntheticScene::kUi, kWidth, kHeight,
+                                    256, 256, d);
+        EncodeJpegStreaming(&source, JpegEncodeOptions{}, &encoder.output,
+                            &worker_error, encoder.workspace.get());
+      }
+      infos[d] = ParseJpegFrame(encoder.output);
+      frame_memory.Reset();
+      std::lock_guard<std::mutex> lock(retained_mutex);
+      if (!retained[d].TryAcquire(&budget,
+                                  JpegEncoderContextBytes(encoder))) {
+        encoder = JpegEncoderContext();
+      }
+    }
+  };
+  ProcessMemory before;
+  const bool reset = ResetPeakRss();
+  const bool queried = QueryProcessMemory(&before);
+  std::thread helper(worker);
+  worker();
+  helper.join();
+  ProcessMemory after;
+  const bool measured = reset && queried && QueryProcessMemory(&after);
+  bool all_encoded = true;
+  for (const JpegFrameInfo& info : infos) {
+    all_encoded = all_encoded && info.width == kWidth &&
+                  info.height == kHeight;
+  }
+  Assert(all_encoded && full_frames > 0 && spilled > 0 && released > 0 &&
+             budget.Peak() <= kLimit,
+         "memory budget 16x4k: full frames, spills and releases", ctx);
+  if (measured) {
+    const size_t growth = after.peak_rss_bytes - before.rss_bytes;
+    std::cout << "16x4k budget peak RSS growth, MB: " << (growth >> 20)
+              << ", full frames: " << full_frames << ", spilled: " << spilled
+              << ", released: " << released
+              << "\n";
+    Assert(growth < kLimit + (size_t{24} << 20),
+           "memory budget 16x4k peak RSS within budget + 24 MB", ctx);
+  } else {
+    std::cout << "peak RSS reset unsupported, 16x4k memory check skipped\n";
+  }
+}
+
+void TestActivityScheduler(TestContext& ctx) {
+  ImageBuffer frame = MakeSyntheticFrame(SyntheticScene::kUi, 256, 144, 1);
+  // Квадрат 4x4 в углу ячейки сетки 16x9 — мимо точек пробы.
+  auto paint = [&](uint32_t x0, uint32_t y0, uint8_t value) {
+    for (uint32_t y = y0; y < y0 + 4; ++y) {
+      std::memset(frame.pixels.data() + y * frame.stride + x0 * 4, value,
+                  16);
+    }
+  };
+  const uint64_t before = SparseProbeHash(frame, 16, 9);
+  paint(0, 0, 0x11);
+  const uint64_t off_grid = SparseProbeHash(frame, 16, 9);
+  paint(6, 6, 0x22);
+  Assert(off_grid == before && SparseProbeHash(frame, 16, 9) != before,
+         "probe hash sees grid pixels only", ctx);
+
+  ActivitySchedulerConfig config;
+  config.min_interval = 1;
+  config.max_interval = 60;
+  ActivityScheduler scheduler(config);
+  scheduler.Resize(1, 0);
+  ChangeTracker change;
+  double last_capture = -1;
+  bool min_respected = true;
+  bool probe_missed = true;
+  // Один такт синтетических часов (1 с): проба, затем захват, если пора.
+  auto tick = [&](double now) {
+    const bool probe_changed =
+        scheduler.Probe(0, SparseProbeHash(frame, 16, 9));
+    probe_missed = probe_missed && !probe_changed;
+    if (!scheduler.CaptureDue(0, now)) {
+      return 0;
+    }
+    min_respected = min_respected &&
+                    (last_capture < 0 || now - last_capture >= 1.0);
+    last_capture = now;
+    scheduler.Captured(0, now, change.Update(frame) != 0);
+    return 1;
+  };
+
+  // Полчаса простоя: интервал растет до максимума.
+  int idle_captures = 0;
+  for (int t = 0; t < 1800; ++t) {
+    idle_captures += tick(t);
+  }
+  Assert(idle_captures < 50 && scheduler.Interval(0) == 60.0 &&
+             scheduler.NextDue(1800) == scheduler.NextCapture(0),
+         "activity scheduler: idle display backs off to the maximum", ctx);
+
+  // Активность (новый кадр каждую секунду): захват через несколько проб,
+  // затем каждый такт.
+  int first_active = -1;
+  int active_captures = 0;
+  for (int t = 1800; t < 1860; ++t) {
+    frame = MakeSyntheticFrame(SyntheticScene::kUi, 256, 144,
+                               static_cast<uint32_t>(t));
+    const int captured = tick(t);
+    if (captured && first_active < 0) {
+      first_active = t;
+    }
+    active_captures += captured;
+  }
+  Assert(first_active >= 1800 && first_active <= 1806 &&
+             active_captures >= 50 && scheduler.Interval(0) == 1.0,
+         "activity scheduler: activity shortens the interval", ctx);
+
+  // Мелкие изменения мимо точек пробы: их ловит сравнение кадров.
+  probe_missed = true;
+  int subtle_captures = 0;
+  for (int t = 1860; t < 1920; ++t) {
+    paint(0, 0, static_cast<uint8_t>(t));
+    subtle_captures += tick(t);
+  }
+  Assert(probe_missed && subtle_captures >= 50 &&
+             scheduler.Interval(0) == 1.0 && min_respected,
+         "activity scheduler: frame changes keep the interval short", ctx);
+
+  // Второй дисплей добавляется с минимальным интервалом и сразу к захвату.
+  scheduler.Resize(2, 1920.5);
+  Assert(scheduler.Displays() == 2 && scheduler.CaptureDue(1, 1920.5) &&
+             scheduler.Interval(1) == 1.0 && !scheduler.CaptureDue(2, 1e9),
+         "activity scheduler: new display is due at once", ctx);
+}
+
+// Синтетические часы цикла: сон до срока и еще wake_jitter, работа цикла
+// двигает время явно.
+class FakeCycleClock : public CycleClock {
+ public:
+  int64_t Now() override { return now_; }
+  void SleepUntil(int64_t deadline) override {
+    if (deadline > now_) {
+      now_ = deadline + wake_jitter;
+    }
+  }
+  void Advance(int64_t ns) { now_ += ns; }
+
+  int64_t wake_jitter = 0;
+
+ private:
+  int64_t now_ = 1000;
+};
+
+void TestCycleScheduler(TestContext& ctx) {
+  constexpr int64_t kMs = 1000000;
+  OverrunPolicy policy = OverrunPolicy::kSkip;
+  Assert(ParseOverrunPolicy(L"catch-up", &policy) &&
+             policy == OverrunPolicy::kCatchUp &&
+             std::wstring(OverrunPolicyName(OverrunPolicy::kCoalesce)) ==
+                 L"coalesce" &&
+             !ParseOverrunPolicy(L"later", &policy),
+         "overrun policy names", ctx);
+
+  // Дрожание пробуждения и длина цикла не сдвигают сетку сроков.
+  FakeCycleClock clock;
+  clock.wake_jitter = 300000;
+  CycleScheduler steady(&clock, 10 * kMs, OverrunPolicy::kCoalesce);
+  CycleTick tick;
+  bool on_grid = true;
+  for (int i = 0; i < 1000; ++i) {
+    tick = steady.Wait();
+    on_grid = on_grid && tick.deadline == 1000 + i * 10 * kMs &&
+              !tick.overrun && (i == 0 || tick.lateness == 300000);
+    clock.Advance(3 * kMs + (i % 7) * kMs);
+  }
+  Assert(on_grid && steady.Stats().cycles == 1000 &&
+             steady.Stats().overruns == 0 &&
+             steady.Stats().max_lateness == 300000,
+         "cycle scheduler keeps absolute deadlines without drift", ctx);
+
+  // Цикл 25 мс при периоде 10 мс: сроки 10 и 20 прошли.
+  auto overrun = [&](OverrunPolicy overrun_policy, CycleTick* after,
+                     CycleTick* next) {
+    FakeCycleClock fake;
+    CycleScheduler scheduler(&fake, 10 * kMs, overrun_policy);
+    scheduler.Wait();
+    fake.Advance(25 * kMs);
+    *after = scheduler.Wait();
+    fake.Advance(1 * kMs);
+    *next = scheduler.Wait();
+    return scheduler.Stats();
+  };
+  CycleTick after;
+  CycleTick next;
+  CycleStats stats = overrun(OverrunPolicy::kSkip, &after, &next);
+  Assert(after.overrun && after.missed == 2 &&
+             after.deadline == 1000 + 30 * kMs && after.lateness == 0 &&
+             next.deadline == 1000 + 40 * kMs && !next.overrun &&
+             stats.overruns == 1 && stats.missed == 2,
+         "overrun skip waits for the next deadline on the grid", ctx);
+  stats = overrun(OverrunPolicy::kCoalesce, &after, &next);
+  Assert(after.overrun && after.missed == 1 &&
+             after.deadline == 1000 + 20 * kMs && after.lateness == 5 * kMs &&
+             next.deadline == 1000 + 30 * kMs && !next.overrun &&
+             stats.max_lateness == 5 * kMs,
+         "overrun coalesce runs once at once and returns to the grid", ctx);
+  stats = overrun(OverrunPolicy::kCatchUp, &after, &next);
+  Assert(after.overrun && after.missed == 0 &&
+             after.deadline == 1000 + 10 * kMs &&
+             after.lateness == 15 * kMs &&
+             next.deadline == 1000 + 20 * kMs && next.overrun &&
+             next.lateness == 6 * kMs && stats.overruns == 2 &&
+             stats.total_lateness == 21 * kMs,
+         "overrun catch-up runs every missed deadline back to back", ctx);
+
+  // Новый период отсчитывается от срока текущего цикла.
+  FakeCycleClock periodic;
+  CycleScheduler changing(&periodic, 10 * kMs, OverrunPolicy::kSkip);
+  changing.Wait();
+  changing.Wait();
+  changing.SetPeriod(30 * kMs);
+  tick = changing.Wait();
+  Assert(tick.deadline == 1000 + 40 * kMs && changing.Period() == 30 * kMs,
+         "cycle scheduler period change re-anchors the grid", ctx);
+
+  // Системные часы: сон по абсолютному сроку (timerfd на Linux).
+  SystemCycleClock system;
+  CycleScheduler real(&system, 2 * kMs, OverrunPolicy::kSkip);
+  const int64_t start = system.Now();
+  for (int i = 0; i < 10; ++i) {
+    tick = real.Wait();
+  }
+  const int64_t elapsed = system.Now() - start;
+  std::cout << "system cycle clock lateness, us: mean "
+            << real.Stats().total_lateness / 10 / 1000 << ", max "
+            << real.Stats().max_lateness / 1000 << "\n";
+  Assert(elapsed >= 18 * kMs && tick.deadline >= start + 18 * kMs &&
+             system.Now() >= tick.deadline,
+         "system cycle clock sleeps until absolute deadlines", ctx);
+}
+
+}  // namespace
+
+int main() {
+  TestContext ctx;
+  TestHalfToFloat(ctx);
+  TestToneMapLut(ctx);
+  TestConvertRowsMatchReference(ctx);
+  TestSamplePixel(ctx);
+  TestScaledSize(ctx);
+  TestBoxResample(ctx);
+  TestLanczosResample(ctx);
+  TestResampleFusedConversion(ctx);
+  TestLumaRow(ctx);
+  TestJpegColorModes(ctx);
+  TestJpegHdrInput(ctx);
+  TestRateControl(ctx);
+  TestDailyBudget(ctx);
+  TestOptimalHuffman(ctx);
+  TestOptimizedJpeg(ctx);
+  TestHash64(ctx);
+  TestIncrementalJpeg(ctx);
+  TestEncoderContext(ctx);
+  TestEntropyWriters(ctx);
+  TestForwardDct(ctx);
+  TestQuantizeBlock(ctx);
+  TestQoiCodec(ctx);
+  TestCodecChoice(ctx);
+  TestStreamingJpeg(ctx);
+  TestFrameArchive(ctx);
+  TestMjpegStream(ctx);
+  TestFrameStore(ctx);
+  TestJpegDecoder(ctx);
+  TestRetention(ctx);
+  TestContactSheets(ctx);
+  TestCatalog(ctx);
+  TestMetrics(ctx);
+  TestFrameRing(ctx);
+  TestPerfCounters(ctx);
+  TestSteadyStateAllocations(ctx);
+  TestCpuGovernor(ctx);
+  TestMemoryBudget(ctx);
+  TestActivityScheduler(ctx);
+  TestCycleScheduler(ctx);
+
+  std::cout << "Passed: " << ctx.passed << ", Failed: " << ctx.failed << "\n";
+  return ctx.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.h"
+
+// Runs the frame ring across processes: one writer publishes frames as
+// fast as it can while several readers map the ring and check every frame
+// they accept. Each 32-bit word of a frame is derived from its number, so
+// a torn frame that passes Validate is detected.
+//
+//   p2_ring_harness                     starts writer and readers, waits
+//   p2_ring_harness --writer NAME MS    publishes for MS milliseconds
+//   p2_ring_harness --reader NAME SLOW  reads until the writer closes
+
+namespace {
+
+constexpr uint32_t kDisplays = 2;
+constexpr uint32_t kWidth = 320;
+constexpr uint32_t kHeight = 200;
+constexpr int kReaders = 3;
+constexpr int kWriterMs = 1500;
+constexpr int kOpenTimeoutMs = 3000;
+
+uint32_t Word(uint64_t frame_number, uint32_t display, size_t index) {
+  return static_cast<uint32_t>(frame_number * 0x9E3779B1u) ^
+         (display << 24) ^ static_cast<uint32_t>(index);
+}
+
+int RunWriter(const std::wstring& name, int ms) {
+  FrameRingWriter writer;
+  std::wstring error;
+  if (!writer.Create(name, kDisplays, kWidth * kHeight * 4, &error)) {
+    std::cerr << "writer: create failed\n";
+    return 1;
+  }
+  ImageBuffer frame;
+  frame.width = kWidth;
+  frame.height = kHeight;
+  frame.stride = kWidth * 4;
+  frame.pixels.resize(static_cast<size_t>(frame.stride) * kHeight);
+  const auto stop =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+  uint64_t published = 0;
+  for (uint64_t number = 1; std::chrono::steady_clock::now() < stop;
+       ++number) {
+    for (uint32_t display = 0; display < kDisplays; ++display) {
+      uint32_t* words = reinterpret_cast<uint32_t*>(frame.pixels.data());
+      for (size_t i = 0; i < frame.pixels.size() / 4; ++i) {
+        words[i] = Word(number, display, i);
+      }
+      if (!writer.Publish(display, frame, static_cast<int64_t>(number),
+                          &error)) {
+        std::cerr << "writer: publish failed\n";
+        return 1;
+      }
+      ++published;
+    }
+  }
+  writer.Close();
+  std::cout << "writer: frames " << published << "\n";
+  return 0;
+}
+
+// slow: держит кадр дольше, чем писатель переписывает слот, — Validate
+// обязан это заметить.
+int RunReader(const std::wstring& name, bool slow) {
+  FrameRingReader reader;
+  std::wstring error;
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(kOpenTimeoutMs);
+  while (!reader.Open(name, &error)) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      std::cerr << "reader: ring not found\n";
+      return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  uint64_t accepted = 0;
+  uint64_t rejected = 0;
+  uint64_t torn = 0;
+  uint64_t last[kDisplays] = {};
+  bool ordered = reader.Displays() == kDisplays;
+  for (uint64_t pass = 0; ordered && !reader.Closed(); ++pass) {
+    for (uint32_t display = 0; display < kDisplays; ++display) {
+      FrameRingView view;
+      if (!reader.Latest(display, &view)) {
+        continue;
+      }
+      // Чтение на месте, без копии: сверка слов с номером кадра.
+      const uint32_t* words = reinterpret_cast<const uint32_t*>(view.pixels);
+      bool intact = view.width == kWidth && view.height == kHeight &&
+                    view.timestamp == static_cast<int64_t>(view.frame_number);
+      for (size_t i = 0; intact && i < kWidth * kHeight; ++i) {
+        intact = words[i] == Word(view.frame_number, display, i);
+      }
+      if (slow && pass % 8 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+      if (!reader.Validate(view)) {
+        ++rejected;
+        continue;
+      }
+      torn += intact ? 0 : 1;
+      ordered = view.frame_number >= last[display];
+      last[display] = view.frame_number;
+      ++accepted;
+    }
+  }
+  std::cout << "reader" << (slow ? " (slow)" : "") << ": accepted "
+            << accepted << ", rejected " << rejected << ", torn " << torn
+            << "\n";
+  const bool ok = ordered && accepted > 0 && torn == 0 && (!slow || rejected);
+  return ok ? 0 : 1;
+}
+
+pid_t Spawn(const std::vector<std::string>& args) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (const std::string& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv("/proc/self/exe", argv.data());
+    _exit(127);
+  }
+  return pid;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc == 4 && std::strcmp(argv[1], "--writer") == 0) {
+    const std::string name = argv[2];
+    return RunWriter(std::wstring(name.begin(), name.end()),
+                     std::atoi(argv[3]));
+  }
+  if (argc == 4 && std::strcmp(argv[1], "--reader") == 0) {
+    const std::string name = argv[2];
+    return RunReader(std::wstring(name.begin(), name.end()),
+                     std::strcmp(argv[3], "1") == 0);
+  }
+
+  const std::string name = "p2_ring_harness_" + std::to_string(getpid());
+  std::vector<pid_t> children;
+  children.push_back(
+      Spawn({argv[0], "--writer", name, std::to_string(kWriterMs)}));
+  for (int i = 0; i < kReaders; ++i) {
+    children.push_back(
+        Spawn({argv[0], "--reader", name, i == 0 ? "1" : "0"}));
+  }
+  int failed = 0;
+  for (pid_t child : children) {
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ++failed;
+    }
+  }
+  std::cout << "Processes: " << children.size() << ", Failed: " << failed
+            << "\n";
+  return failed == 0 ? 0 : 1;
+}
@@ -29,7 +29,7 @@ ImageBuffer MakeTestPattern(uint32_t width, uint32_t height) {
   buffer.width = width;
   buffer.height = height;
   buffer.stride = width * 4;
-  buffer.pixel_format = GUID_WICPixelFormat32bppBGRA;
+  buffer.pixel_format = PixelFormat::kBgra8;
   buffer.pixels.resize(static_cast<size_t>(buffer.stride) * height);
   for (uint32_t y = 0; y < height; ++y) {
     for (uint32_t x = 0; x < width; ++x) {
@@ -92,6 +92,12 @@ void TestBuildFileName(TestContext& ctx) {
       BuildFileName(L"PC", L"User", dt, 0, 2);
   Assert(name2 == L"PC_User_2026-01-09_05-07-03_Display01.jpg",
          "filename multi display", ctx);
+  std::wstring name3 = BuildFileName(L"PC", L"User", dt, 1, 2, L".qoi");
+  Assert(name3 == L"PC_User_2026-01-09_05-07-03_Display02.qoi",
+         "filename lossless extension", ctx);
+  Assert(BuildArchiveFileName(L"PC", L"User", dt, 1, 2, L".p2pack") ==
+             L"PC_User_2026-01-09_Display02.p2pack",
+         "archive filename", ctx);
 }
 
 void TestDirectories(TestContext& ctx) {
@@ -119,12 +125,15 @@ void TestEncode(TestContext& ctx) {
   ImageBuffer buffer = MakeTestPattern(32, 32);
   std::wstring error;
   HRESULT hr = S_OK;
-  bool ok = SaveJpeg(buffer, file, 0.05f, &error, &hr);
-  Assert(ok, "save jpeg", ctx);
-  if (ok) {
-    std::error_code ec;
-    auto size = std::filesystem::file_size(file, ec);
-    Assert(!ec && size > 0, "jpeg size > 0", ctx);
+  for (ColorMode mode : {ColorMode::k420, ColorMode::k422, ColorMode::k444,
+                         ColorMode::kGray}) {
+    bool ok = SaveJpeg(buffer, file, 0.05f, mode, &error, &hr);
+    Assert(ok, "save jpeg", ctx);
+    if (ok) {
+      std::error_code ec;
+      auto size = std::filesystem::file_size(file, ec);
+      Assert(!ec && size > 0, "jpeg size > 0", ctx);
+    }
   }
   std::error_code ec;
   std::filesystem::remove_all(std::filesystem::path(root), ec);